@@ -0,0 +1,202 @@
+#include "cfg.h"
+#include "cpu_internal.h"
+#include "log.h"
+#include "rom.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * chip8-analyze: report the reachable code, call graph and memory writes of a
+ * ROM, and optionally write its disassembly listing. Analyses are cached under
+ * the ROM hash, chip8-aot reuses them.
+ */
+
+/* Typedefs */
+
+typedef struct options_s
+{
+	const char *cache_dir;
+	const char *listing_path;
+	const char *rom_path;
+} options_t;
+
+/* Private function declarations */
+
+static int parse_options(options_t *p_options, int argc, char *argv[]);
+static void print_report(const cfg_t *p_cfg, const options_t *p_options, size_t size, int hit);
+
+/* Public function definitions */
+
+int main(int argc, char *argv[])
+{
+	options_t options;
+	if (parse_options(&options, argc, argv) != 0)
+	{
+		return -1;
+	}
+
+	rom_t rom;
+	if (rom_load(&rom, options.rom_path) != 0)
+	{
+		ERROR_PRINT("rom_load failed.\n");
+		return -1;
+	}
+
+	/* Would be rejected by cpu_load, and analyzed as a truncated ROM otherwise. */
+	if (rom.size > CPU_PROGRAM_SIZE_MAX)
+	{
+		ERROR_PRINT_ARGS("ROM too large (%s, %zu bytes).\n", options.rom_path, rom.size);
+		rom_free(&rom);
+		return -1;
+	}
+
+	int hit = 0;
+	cfg_t *p_cfg = cfg_cached(options.cache_dir, rom.data, rom.size, &hit);
+	if (!p_cfg)
+	{
+		ERROR_PRINT("cfg_cached failed, ROM too large or out of memory.\n");
+		rom_free(&rom);
+		return -1;
+	}
+
+	print_report(p_cfg, &options, rom.size, hit);
+
+	int result = 0;
+	if (options.listing_path)
+	{
+		FILE *out = (strcmp(options.listing_path, "-") == 0) ? stdout : fopen(options.listing_path, "w");
+		if (out)
+		{
+			cfg_listing(p_cfg, rom.data, rom.size, out);
+			if (out != stdout)
+			{
+				(void)fclose(out);
+			}
+		}
+		else
+		{
+			ERROR_PRINT_ARGS("fopen failed (%s).\n", options.listing_path);
+			result = -1;
+		}
+	}
+
+	cfg_free(p_cfg);
+	rom_free(&rom);
+
+	return result;
+}
+
+/* Private function definitions */
+
+static int parse_options(options_t *p_options, int argc, char *argv[])
+{
+	(void)memset(p_options, 0, sizeof(options_t));
+	p_options->cache_dir = cfg_cache_directory();
+
+	int opt;
+	while ((opt = getopt(argc, argv, "C:l:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'C':
+			/* An empty directory disables the cache. */
+			p_options->cache_dir = optarg[0] ? optarg : NULL;
+			break;
+		case 'l':
+			p_options->listing_path = optarg;
+			break;
+		default:
+			ERROR_PRINT("Invalid argument.\n");
+			return -1;
+		}
+	}
+
+	if (optind >= argc)
+	{
+		ERROR_PRINT("Missing argument.\n");
+		return -1;
+	}
+
+	p_options->rom_path = argv[optind];
+
+	return 0;
+}
+
+static void print_report(const cfg_t *p_cfg, const options_t *p_options, size_t size, int hit)
+{
+	/* The report goes to stderr when the listing takes stdout. */
+	FILE *out = (p_options->listing_path && (strcmp(p_options->listing_path, "-") == 0)) ? stderr : stdout;
+
+	uint32_t block_count;
+	const cfg_block_t *blocks = cfg_blocks(p_cfg, &block_count);
+	uint32_t call_count;
+	const cfg_call_t *calls = cfg_calls(p_cfg, &call_count);
+
+	uint32_t code = 0;
+	uint32_t subroutines = 0;
+	for (uint32_t index = 0; index < block_count; index++)
+	{
+		code += blocks[index].length * 2u;
+		subroutines += !!(cfg_flags(p_cfg, blocks[index].start) & CFG_SUBROUTINE);
+	}
+
+	fprintf(out, "%s: ROM 0x%016llx, %zu bytes, %s\n", p_options->rom_path, (unsigned long long)cfg_rom_hash(p_cfg),
+			size, hit ? "cached" : "analyzed");
+	fprintf(out, "  code: %u bytes in %u blocks, %u subroutines\n", code, block_count, subroutines);
+
+	/* Call graph, one line per caller. */
+	for (uint32_t index = 0; index < call_count; index++)
+	{
+		if (!index || (calls[index].caller != calls[index - 1].caller))
+		{
+			fprintf(out, "%s  calls: 0x%03X ->", index ? "\n" : "", calls[index].caller);
+		}
+
+		/* A callee called from several sites is listed once. */
+		int listed = 0;
+		for (uint32_t other = index; (other > 0) && (calls[other - 1].caller == calls[index].caller); other--)
+		{
+			listed |= (calls[other - 1].target == calls[index].target);
+		}
+		if (!listed)
+		{
+			fprintf(out, " 0x%03X", calls[index].target);
+		}
+	}
+	if (call_count)
+	{
+		fprintf(out, "\n");
+	}
+
+	/* Written ranges. */
+	uint32_t start = 0;
+	int in_range = 0;
+	for (uint32_t address = 0; address <= MEM_SIZE; address++)
+	{
+		int written = (address < MEM_SIZE) && (cfg_flags(p_cfg, (uint16_t)address) & CFG_WRITTEN);
+		if (written && !in_range)
+		{
+			start = address;
+		}
+		else if (!written && in_range)
+		{
+			fprintf(out, "  writes: 0x%03X-0x%03X\n", start, address - 1);
+		}
+		in_range = written;
+	}
+
+	uint32_t summary = cfg_summary(p_cfg);
+	fprintf(out, "  self-modifying: %s\n", (summary & CFG_SELF_MODIFYING) ? "yes" : "no");
+	if (summary & CFG_UNKNOWN_WRITES)
+	{
+		fprintf(out, "  writes through an unknown I: code may be modified\n");
+	}
+	if (summary & CFG_COMPUTED_JUMPS)
+	{
+		fprintf(out, "  computed jumps (BNNN): code they reach is not included\n");
+	}
+}
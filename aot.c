@@ -0,0 +1,436 @@
+#include "cfg.h"
+#include "cpu_internal.h"
+#include "hash.h"
+#include "log.h"
+#include "native.h"
+#include "rom.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * chip8-aot: translate a ROM into C, one function per reachable basic block,
+ * and compile it into a shared object loaded with native_load.
+ *
+ * Blocks come from the ROM analysis (cfg.h), cached across runs. A function
+ * starts at a block and runs on through the following ones until an instruction
+ * leaves the straight-line code.
+ */
+
+/* Defines */
+
+#ifndef CHIP8_INCLUDE_DIR
+#define CHIP8_INCLUDE_DIR "."
+#endif
+
+/* Typedefs */
+
+typedef struct options_s
+{
+	const char *output_path;
+	const char *source_path;
+	const char *include_dir;
+	const char *cache_dir;
+	const char *rom_path;
+} options_t;
+
+typedef struct program_s
+{
+	uint8_t memory[MEM_SIZE];
+	uint16_t end; /* First address past the ROM. */
+
+	const cfg_t *p_cfg;
+} program_t;
+
+/* Private function declarations */
+
+static int parse_options(options_t *p_options, int argc, char *argv[]);
+static uint16_t opcode_at(const program_t *p_program, uint16_t address);
+static int block_start(const program_t *p_program, uint32_t address);
+static uint16_t block_length(const program_t *p_program, uint16_t start);
+static void emit_block(FILE *out, const program_t *p_program, uint16_t start);
+static void emit_instruction(FILE *out, uint16_t address, uint16_t opcode);
+static int emit_module(FILE *out, const program_t *p_program, uint64_t rom_hash);
+
+/* Public function definitions */
+
+int main(int argc, char *argv[])
+{
+	options_t options;
+	if (parse_options(&options, argc, argv) != 0)
+	{
+		return -1;
+	}
+
+	rom_t rom;
+	if (rom_load(&rom, options.rom_path) != 0)
+	{
+		ERROR_PRINT("rom_load failed.\n");
+		return -1;
+	}
+
+	if (rom.size > (MEM_SIZE - ROM_ADDRESS))
+	{
+		ERROR_PRINT("ROM too large.\n");
+		return -1;
+	}
+
+	program_t *p_program = calloc(1, sizeof(program_t));
+	if (!p_program)
+	{
+		ERROR_PRINT("calloc failed.\n");
+		return -1;
+	}
+
+	(void)memcpy(p_program->memory + ROM_ADDRESS, rom.data, rom.size);
+	p_program->end = (uint16_t)(ROM_ADDRESS + rom.size);
+
+	cfg_t *p_cfg = cfg_cached(options.cache_dir, rom.data, rom.size, NULL);
+	if (!p_cfg)
+	{
+		ERROR_PRINT("cfg_cached failed.\n");
+		return -1;
+	}
+	p_program->p_cfg = p_cfg;
+
+	char source_path[4096 + sizeof(".c")];
+	if (options.source_path)
+	{
+		(void)snprintf(source_path, sizeof(source_path), "%s", options.source_path);
+	}
+	else
+	{
+		(void)snprintf(source_path, sizeof(source_path), "%s.c", options.output_path);
+	}
+
+	FILE *out = fopen(source_path, "w");
+	if (!out)
+	{
+		ERROR_PRINT_ARGS("fopen failed (%s).\n", source_path);
+		return -1;
+	}
+
+	int blocks = emit_module(out, p_program, hash_fnv1a(rom.data, rom.size, HASH_SEED));
+	fclose(out);
+
+	const char *cc = getenv("CC");
+	char command[4 * 4096];
+	(void)snprintf(command, sizeof(command), "%s -O2 -fPIC -shared -I\"%s\" -o \"%s\" \"%s\"",
+				   cc ? cc : "cc", options.include_dir, options.output_path, source_path);
+
+	int result = system(command);
+
+	if (!options.source_path)
+	{
+		unlink(source_path);
+	}
+
+	if (result != 0)
+	{
+		ERROR_PRINT_ARGS("Compilation failed (%s).\n", command);
+		return -1;
+	}
+
+	printf("%s: %d blocks compiled to %s\n", options.rom_path, blocks, options.output_path);
+
+	cfg_free(p_cfg);
+	free(p_program);
+	rom_free(&rom);
+
+	return 0;
+}
+
+/* Private function definitions */
+
+static int parse_options(options_t *p_options, int argc, char *argv[])
+{
+	(void)memset(p_options, 0, sizeof(options_t));
+	p_options->include_dir = CHIP8_INCLUDE_DIR;
+	p_options->cache_dir = cfg_cache_directory();
+
+	int opt;
+	while ((opt = getopt(argc, argv, "o:c:I:C:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'o':
+			p_options->output_path = optarg;
+			break;
+		case 'c':
+			p_options->source_path = optarg;
+			break;
+		case 'I':
+			p_options->include_dir = optarg;
+			break;
+		case 'C':
+			/* An empty directory disables the cache. */
+			p_options->cache_dir = optarg[0] ? optarg : NULL;
+			break;
+		default:
+			ERROR_PRINT("Invalid argument.\n");
+			return -1;
+		}
+	}
+
+	if (optind >= argc)
+	{
+		ERROR_PRINT("Missing argument.\n");
+		return -1;
+	}
+
+	p_options->rom_path = argv[optind];
+
+	if (!p_options->output_path)
+	{
+		static char output_path[4096];
+		(void)snprintf(output_path, sizeof(output_path), "%s.so", p_options->rom_path);
+		p_options->output_path = output_path;
+	}
+
+	return 0;
+}
+
+static uint16_t opcode_at(const program_t *p_program, uint16_t address)
+{
+	return (uint16_t)((p_program->memory[address] << 8) | p_program->memory[address + 1]);
+}
+
+static int block_start(const program_t *p_program, uint32_t address)
+{
+	return (cfg_flags(p_program->p_cfg, (uint16_t)address) & CFG_BLOCK_START) != 0;
+}
+
+static uint16_t block_length(const program_t *p_program, uint16_t start)
+{
+	uint16_t address = start;
+	uint16_t count = 0;
+
+	while (((address + 2) <= p_program->end) && (count < CFG_BLOCK_INSTRUCTIONS_MAX))
+	{
+		count++;
+		if (cfg_ends_block(opcode_at(p_program, address)))
+		{
+			break;
+		}
+		address += 2;
+	}
+
+	return count;
+}
+
+static void emit_instruction(FILE *out, uint16_t address, uint16_t opcode)
+{
+	uint16_t nnn = opcode & 0x0FFF;
+	uint8_t nn = opcode & 0x00FF;
+	uint8_t n = opcode & 0x000F;
+	uint8_t x = (opcode >> 8) & 0x0F;
+	uint8_t y = (opcode >> 4) & 0x0F;
+
+	fprintf(out, "\t/* %04x: %04x */\n", address, opcode);
+
+	switch (opcode >> 12)
+	{
+	case 0x0:
+		if (opcode == 0x00E0)
+		{
+			/* Swaps graphics pages, interpreted in place. */
+			fprintf(out, "\tp->pc = 0x%04x;\n\tif ((status = step(p)) != CPU_OK) return (int)status;\n", address);
+			return;
+		}
+		fprintf(out, "\tp->pc = 0x%04x;\n\treturn (int)step(p);\n", address);
+		return;
+	case 0x1:
+		fprintf(out, "\tp->cycles++;\n\tp->pc = 0x%04x;\n\treturn CPU_OK;\n", nnn);
+		return;
+	case 0x3:
+		fprintf(out, "\tif (v[%u] == 0x%02x) { p->cycles++; p->pc = 0x%04x; return CPU_OK; }\n", x, nn, address + 4);
+		break;
+	case 0x4:
+		fprintf(out, "\tif (v[%u] != 0x%02x) { p->cycles++; p->pc = 0x%04x; return CPU_OK; }\n", x, nn, address + 4);
+		break;
+	case 0x5:
+		fprintf(out, "\tif (v[%u] == v[%u]) { p->cycles++; p->pc = 0x%04x; return CPU_OK; }\n", x, y, address + 4);
+		break;
+	case 0x6:
+		fprintf(out, "\tv[%u] = 0x%02x;\n", x, nn);
+		break;
+	case 0x7:
+		fprintf(out, "\tv[%u] += 0x%02x;\n", x, nn);
+		break;
+	case 0x8:
+		switch (n)
+		{
+		case 0x0:
+			fprintf(out, "\tv[%u] = v[%u];\n", x, y);
+			break;
+		case 0x1:
+			fprintf(out, "\tv[%u] |= v[%u];\n", x, y);
+			break;
+		case 0x2:
+			fprintf(out, "\tv[%u] &= v[%u];\n", x, y);
+			break;
+		case 0x3:
+			fprintf(out, "\tv[%u] ^= v[%u];\n", x, y);
+			break;
+		case 0x4:
+			fprintf(out, "\t{ uint16_t sum = v[%u] + v[%u]; v[15] = (sum & 0xFF00) ? 1 : 0; v[%u] = (uint8_t)sum; }\n", x, y, x);
+			break;
+		case 0x5:
+			fprintf(out, "\tv[15] = (v[%u] > v[%u]) ? 0 : 1;\n\tv[%u] -= v[%u];\n", y, x, x, y);
+			break;
+		case 0x6:
+			fprintf(out, "\tv[15] = v[%u] & 0x01;\n\tv[%u] >>= 1;\n", x, x);
+			break;
+		case 0x7:
+			fprintf(out, "\tv[15] = (v[%u] > v[%u]) ? 0 : 1;\n\tv[%u] = v[%u] - v[%u];\n", x, y, x, y, x);
+			break;
+		case 0xE:
+			fprintf(out, "\tv[15] = (v[%u] >> 7) & 0x01;\n\tv[%u] <<= 1;\n", x, x);
+			break;
+		default:
+			fprintf(out, "\tp->pc = 0x%04x;\n\treturn (int)step(p);\n", address);
+			return;
+		}
+		break;
+	case 0x9:
+		fprintf(out, "\tif (v[%u] != v[%u]) { p->cycles++; p->pc = 0x%04x; return CPU_OK; }\n", x, y, address + 4);
+		break;
+	case 0xA:
+		fprintf(out, "\tp->i = 0x%04x;\n", nnn);
+		break;
+	case 0xE:
+		if (nn == 0x9E)
+		{
+			fprintf(out, "\tp->keys_read_flag = 1;\n");
+			fprintf(out, "\tif ((v[%u] < KEY_COUNT) && ((p->keys >> v[%u]) & 1)) { p->cycles++; p->pc = 0x%04x; return CPU_OK; }\n", x, x, address + 4);
+			break;
+		}
+		if (nn == 0xA1)
+		{
+			fprintf(out, "\tp->keys_read_flag = 1;\n");
+			fprintf(out, "\tif ((v[%u] < KEY_COUNT) && !((p->keys >> v[%u]) & 1)) { p->cycles++; p->pc = 0x%04x; return CPU_OK; }\n", x, x, address + 4);
+			break;
+		}
+		fprintf(out, "\tp->pc = 0x%04x;\n\treturn (int)step(p);\n", address);
+		return;
+	case 0xF:
+		switch (nn)
+		{
+		case 0x07:
+			fprintf(out, "\tv[%u] = cpu_timer_value(p, p->timer_delay, p->timer_delay_cycle);\n", x);
+			break;
+		case 0x15:
+			fprintf(out, "\tp->timer_delay = v[%u];\n\tp->timer_delay_cycle = p->cycles;\n", x);
+			break;
+		case 0x18:
+			fprintf(out, "\tp->timer_sound = v[%u];\n\tp->timer_sound_cycle = p->cycles;\n", x);
+			break;
+		case 0x1E:
+			fprintf(out, "\tp->i += v[%u];\n", x);
+			break;
+		case 0x29:
+			fprintf(out, "\tp->i = FONT_ADDRESS + (v[%u] * FONT_CHAR_SIZE);\n", x);
+			break;
+		case 0x65:
+			/* Reads memory, the interpreter checks the bounds. */
+			fprintf(out, "\tp->pc = 0x%04x;\n\tif ((status = step(p)) != CPU_OK) return (int)status;\n", address);
+			return;
+		default:
+			fprintf(out, "\tp->pc = 0x%04x;\n\treturn (int)step(p);\n", address);
+			return;
+		}
+		break;
+	default:
+		/* 2NNN, BNNN: leave the block. CXNN, DXYN: interpreted in place. */
+		if (((opcode >> 12) == 0xC) || ((opcode >> 12) == 0xD))
+		{
+			fprintf(out, "\tp->pc = 0x%04x;\n\tif ((status = step(p)) != CPU_OK) return (int)status;\n", address);
+			return;
+		}
+		fprintf(out, "\tp->pc = 0x%04x;\n\treturn (int)step(p);\n", address);
+		return;
+	}
+
+	fprintf(out, "\tp->cycles++;\n");
+}
+
+static void emit_block(FILE *out, const program_t *p_program, uint16_t start)
+{
+	uint16_t length = block_length(p_program, start);
+
+	fprintf(out, "static int block_%04x(cpu_t *p, native_step_t step)\n{\n", start);
+
+	/* Self-modified code no longer matches what was compiled. */
+	fprintf(out, "\tstatic const uint8_t code[] = {");
+	for (uint16_t n = 0; n < (length * 2); n++)
+	{
+		fprintf(out, "%s0x%02x", n ? ", " : "", p_program->memory[start + n]);
+	}
+	fprintf(out, "};\n");
+	fprintf(out, "\tif (!cpu_memory_equal(p, 0x%04x, code, sizeof(code))) return NATIVE_BLOCK_MISS;\n\n", start);
+
+	fprintf(out, "\tuint8_t *v = p->reg_v;\n\tcpu_status_t status;\n\t(void)v;\n\t(void)status;\n\t(void)step;\n\n");
+
+	uint16_t address = start;
+	for (uint16_t count = 0; count < length; count++)
+	{
+		uint16_t opcode = opcode_at(p_program, address);
+		emit_instruction(out, address, opcode);
+
+		if (cfg_ends_block(opcode))
+		{
+			fprintf(out, "}\n\n");
+			return;
+		}
+
+		address += 2;
+	}
+
+	fprintf(out, "\tp->pc = 0x%04x;\n\treturn CPU_OK;\n}\n\n", address);
+}
+
+static int emit_module(FILE *out, const program_t *p_program, uint64_t rom_hash)
+{
+	int blocks = 0;
+
+	fprintf(out, "/* Generated by chip8-aot, do not edit. */\n\n");
+	fprintf(out, "#include \"cpu_internal.h\"\n#include \"native.h\"\n\n#include <stdint.h>\n#include <string.h>\n\n");
+
+	for (uint32_t address = ROM_ADDRESS; address < MEM_SIZE; address++)
+	{
+		if (block_start(p_program, address))
+		{
+			emit_block(out, p_program, (uint16_t)address);
+			blocks++;
+		}
+	}
+
+	fprintf(out, "const uint32_t chip8_native_abi = NATIVE_ABI_VERSION;\n");
+	fprintf(out, "const uint32_t chip8_native_cpu_size = sizeof(struct cpu_s);\n");
+	fprintf(out, "const uint64_t chip8_native_rom_hash = 0x%016llxull;\n\n", (unsigned long long)rom_hash);
+
+	fprintf(out, "const native_block_t chip8_native_blocks[MEM_SIZE] = {\n");
+	for (uint32_t address = ROM_ADDRESS; address < MEM_SIZE; address++)
+	{
+		if (block_start(p_program, address))
+		{
+			fprintf(out, "\t[0x%04x] = block_%04x,\n", address, address);
+		}
+	}
+	fprintf(out, "};\n\n");
+
+	fprintf(out, "const uint16_t chip8_native_block_cycles[MEM_SIZE] = {\n");
+	for (uint32_t address = ROM_ADDRESS; address < MEM_SIZE; address++)
+	{
+		if (block_start(p_program, address))
+		{
+			fprintf(out, "\t[0x%04x] = %u,\n", address, block_length(p_program, (uint16_t)address));
+		}
+	}
+	fprintf(out, "};\n");
+
+	return blocks;
+}
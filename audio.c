@@ -0,0 +1,290 @@
+#include "audio.h"
+
+#include "log.h"
+
+#include "SDL2/SDL.h"
+
+#include <math.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Defines */
+
+#define SAMPLE_RATE (44100)	 /* Hz */
+#define TONE_FREQUENCY (440) /* Hz */
+#define TONE_AMPLITUDE (3000)
+
+#define PATTERN_SIZE (16)		    /* Bytes. */
+#define PATTERN_BITS_SHIFT (32 - 7) /* 128 samples, the phase top bits index them. */
+#define PATTERN_RATE (4000.0)	    /* Hz, at pitch 64. */
+
+/* SDL device buffer (2.9 ms) plus ring buffer (5.8 ms) stay below 10 ms of latency. */
+#define DEVICE_SAMPLES (128)
+#define RING_SIZE (256) /* Must be a power of two. */
+#define RING_MASK (RING_SIZE - 1)
+
+#define WAV_HEADER_SIZE (44)
+
+/* Typedefs */
+
+struct audio_s
+{
+	audio_sink_t sink;
+
+	atomic_int tone;
+	uint32_t phase;
+	uint32_t phase_step;
+	uint64_t pending_us; /* Emulated time not yet converted to samples, scaled by SAMPLE_RATE. */
+
+	/* XO-CHIP pattern, owned by the audio_update thread. */
+	uint8_t pattern[PATTERN_SIZE];
+	uint32_t pattern_step; /* 0 to sound the beep. */
+
+	/* Single producer (audio_update), single consumer (SDL callback). */
+	int16_t ring[RING_SIZE];
+	atomic_uint ring_head;
+	atomic_uint ring_tail;
+
+	SDL_AudioDeviceID device;
+
+	FILE *wav;
+	uint32_t wav_samples;
+};
+
+/* Private function declarations */
+
+static int16_t generate_sample(audio_t *p_audio, int tone);
+static void audio_callback(void *userdata, Uint8 *stream, int len);
+static void wav_write_header(FILE *file, uint32_t samples);
+static void write_le16(FILE *file, uint16_t value);
+static void write_le32(FILE *file, uint32_t value);
+
+/* Public function definitions */
+
+audio_t *audio_allocate(audio_sink_t sink, const char *path)
+{
+	audio_t *p_audio = calloc(1, sizeof(struct audio_s));
+
+	if (!p_audio)
+	{
+		return NULL;
+	}
+
+	p_audio->sink = sink;
+	p_audio->phase_step = (uint32_t)(((uint64_t)TONE_FREQUENCY << 32) / SAMPLE_RATE);
+	atomic_init(&(p_audio->tone), 0);
+	atomic_init(&(p_audio->ring_head), 0);
+	atomic_init(&(p_audio->ring_tail), 0);
+
+	switch (sink)
+	{
+	case AUDIO_SINK_SDL:
+	{
+		SDL_AudioSpec want = {0};
+		want.freq = SAMPLE_RATE;
+		want.format = AUDIO_S16SYS;
+		want.channels = 1;
+		want.samples = DEVICE_SAMPLES;
+		want.callback = audio_callback;
+		want.userdata = p_audio;
+
+		p_audio->device = SDL_OpenAudioDevice(NULL, 0, &want, NULL, 0);
+		if (!p_audio->device)
+		{
+			ERROR_PRINT_ARGS("SDL_OpenAudioDevice failed (%s).\n", SDL_GetError());
+			free(p_audio);
+			return NULL;
+		}
+
+		SDL_PauseAudioDevice(p_audio->device, 0);
+	}
+	break;
+	case AUDIO_SINK_WAV:
+		p_audio->wav = path ? fopen(path, "wb") : NULL;
+		if (!p_audio->wav)
+		{
+			ERROR_PRINT_ARGS("fopen failed (%s).\n", path ? path : "(null)");
+			free(p_audio);
+			return NULL;
+		}
+
+		/* Sizes are patched once the sample count is known. */
+		wav_write_header(p_audio->wav, 0);
+		break;
+	case AUDIO_SINK_NULL:
+	default:
+		break;
+	}
+
+	return p_audio;
+}
+
+void audio_free(audio_t *p_audio)
+{
+	if (p_audio)
+	{
+		if (p_audio->device)
+		{
+			SDL_CloseAudioDevice(p_audio->device);
+		}
+
+		if (p_audio->wav)
+		{
+			(void)fseek(p_audio->wav, 0, SEEK_SET);
+			wav_write_header(p_audio->wav, p_audio->wav_samples);
+			fclose(p_audio->wav);
+		}
+
+		free(p_audio);
+	}
+}
+
+void audio_set_tone(audio_t *p_audio, int enabled)
+{
+	if (p_audio)
+	{
+		atomic_store_explicit(&(p_audio->tone), enabled ? 1 : 0, memory_order_relaxed);
+	}
+}
+
+void audio_set_pattern(audio_t *p_audio, const uint8_t *pattern, uint8_t pitch)
+{
+	if (!p_audio)
+	{
+		return;
+	}
+
+	if (!pattern)
+	{
+		p_audio->pattern_step = 0;
+		return;
+	}
+
+	(void)memcpy(p_audio->pattern, pattern, PATTERN_SIZE);
+
+	double rate = PATTERN_RATE * exp2((pitch - 64) / 48.0);
+	p_audio->pattern_step = (uint32_t)((rate * (double)(1u << PATTERN_BITS_SHIFT)) / SAMPLE_RATE);
+}
+
+void audio_update(audio_t *p_audio, uint32_t elapsed_us)
+{
+	if (!p_audio)
+	{
+		return;
+	}
+
+	int tone = atomic_load_explicit(&(p_audio->tone), memory_order_relaxed);
+
+	if (p_audio->sink == AUDIO_SINK_SDL)
+	{
+		/* Top up the ring, the callback drains it at the device rate. */
+		unsigned int head = atomic_load_explicit(&(p_audio->ring_head), memory_order_relaxed);
+		unsigned int tail = atomic_load_explicit(&(p_audio->ring_tail), memory_order_acquire);
+
+		while ((head - tail) < RING_SIZE)
+		{
+			p_audio->ring[head & RING_MASK] = generate_sample(p_audio, tone);
+			head++;
+		}
+
+		atomic_store_explicit(&(p_audio->ring_head), head, memory_order_release);
+		return;
+	}
+
+	p_audio->pending_us += (uint64_t)elapsed_us * SAMPLE_RATE;
+	uint64_t count = p_audio->pending_us / 1000000;
+	p_audio->pending_us %= 1000000;
+
+	for (uint64_t n = 0; n < count; n++)
+	{
+		int16_t sample = generate_sample(p_audio, tone);
+
+		if (p_audio->wav)
+		{
+			write_le16(p_audio->wav, (uint16_t)sample);
+			p_audio->wav_samples++;
+		}
+	}
+}
+
+/* Private function definitions */
+
+static int16_t generate_sample(audio_t *p_audio, int tone)
+{
+	if (!tone)
+	{
+		/* Restart the square wave on a clean edge at the next beep. */
+		p_audio->phase = 0;
+		return 0;
+	}
+
+	if (p_audio->pattern_step)
+	{
+		uint32_t bit = p_audio->phase >> PATTERN_BITS_SHIFT;
+		p_audio->phase += p_audio->pattern_step;
+		return ((p_audio->pattern[bit / 8] >> (7 - (bit % 8))) & 1) ? TONE_AMPLITUDE : -TONE_AMPLITUDE;
+	}
+
+	p_audio->phase += p_audio->phase_step;
+	return (p_audio->phase & 0x80000000u) ? -TONE_AMPLITUDE : TONE_AMPLITUDE;
+}
+
+static void audio_callback(void *userdata, Uint8 *stream, int len)
+{
+	audio_t *p_audio = (audio_t *)userdata;
+	int16_t *samples = (int16_t *)stream;
+	unsigned int count = (unsigned int)len / sizeof(int16_t);
+
+	unsigned int tail = atomic_load_explicit(&(p_audio->ring_tail), memory_order_relaxed);
+	unsigned int head = atomic_load_explicit(&(p_audio->ring_head), memory_order_acquire);
+
+	unsigned int n;
+	for (n = 0; (n < count) && (tail != head); n++, tail++)
+	{
+		samples[n] = p_audio->ring[tail & RING_MASK];
+	}
+
+	/* Underrun, pad with silence. */
+	for (; n < count; n++)
+	{
+		samples[n] = 0;
+	}
+
+	atomic_store_explicit(&(p_audio->ring_tail), tail, memory_order_release);
+}
+
+static void wav_write_header(FILE *file, uint32_t samples)
+{
+	uint32_t data_size = samples * sizeof(int16_t);
+
+	(void)fwrite("RIFF", 4, 1, file);
+	write_le32(file, WAV_HEADER_SIZE - 8 + data_size);
+	(void)fwrite("WAVE", 4, 1, file);
+
+	(void)fwrite("fmt ", 4, 1, file);
+	write_le32(file, 16);							   /* Chunk size. */
+	write_le16(file, 1);							   /* PCM. */
+	write_le16(file, 1);							   /* Mono. */
+	write_le32(file, SAMPLE_RATE);					   /* Sample rate. */
+	write_le32(file, SAMPLE_RATE * sizeof(int16_t)); /* Byte rate. */
+	write_le16(file, sizeof(int16_t));				   /* Block align. */
+	write_le16(file, 16);							   /* Bits per sample. */
+
+	(void)fwrite("data", 4, 1, file);
+	write_le32(file, data_size);
+}
+
+static void write_le16(FILE *file, uint16_t value)
+{
+	uint8_t bytes[2] = {(uint8_t)value, (uint8_t)(value >> 8)};
+	(void)fwrite(bytes, sizeof(bytes), 1, file);
+}
+
+static void write_le32(FILE *file, uint32_t value)
+{
+	uint8_t bytes[4] = {(uint8_t)value, (uint8_t)(value >> 8), (uint8_t)(value >> 16), (uint8_t)(value >> 24)};
+	(void)fwrite(bytes, sizeof(bytes), 1, file);
+}
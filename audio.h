@@ -0,0 +1,71 @@
+#ifndef AUDIO_H_
+#define AUDIO_H_
+
+#include <stdint.h>
+
+/* Typedefs */
+
+typedef struct audio_s audio_t;
+
+typedef enum audio_sink_e
+{
+	AUDIO_SINK_NULL = 0, /* Samples are generated and discarded. */
+	AUDIO_SINK_SDL,		 /* Samples are played through an SDL audio device. */
+	AUDIO_SINK_WAV		 /* Samples are written to a WAV file. */
+} audio_sink_t;
+
+/* Public function declarations */
+
+/**
+ * @brief Allocate audio output.
+ *
+ * The SDL sink requires the SDL audio subsystem to be initialized.
+ *
+ * @param[in]	sink	Sink receiving the generated samples.
+ * @param[in]	path	Output file path (AUDIO_SINK_WAV only, else ignored).
+ *
+ * @return Pointer to allocated audio output, or NULL if allocation failed.
+ */
+audio_t *audio_allocate(audio_sink_t sink, const char *path);
+
+/**
+ * @brief Stop audio output and release its resources.
+ *
+ * @param[in]	p_audio	Pointer to audio output.
+ */
+void audio_free(audio_t *p_audio);
+
+/**
+ * @brief Set whether the beep is sounding.
+ *
+ * Safe to call from any thread, the state is handed over atomically.
+ *
+ * @param[in]	p_audio	Pointer to audio output.
+ * @param[in]	enabled	1 to sound the beep, 0 to silence it.
+ */
+void audio_set_tone(audio_t *p_audio, int enabled);
+
+/**
+ * @brief Set the XO-CHIP audio pattern sounded in place of the beep.
+ *
+ * Must be called from the thread calling audio_update.
+ *
+ * @param[in]	p_audio	Pointer to audio output.
+ * @param[in]	pattern	16 bytes, 128 one-bit samples played most significant bit first, NULL for the beep.
+ * @param[in]	pitch	Samples play at 4000 * 2^((pitch - 64) / 48) Hz.
+ */
+void audio_set_pattern(audio_t *p_audio, const uint8_t *pattern, uint8_t pitch);
+
+/**
+ * @brief Run the beep generator.
+ *
+ * For the SDL sink the ring buffer feeding the audio callback is topped up,
+ * for the other sinks the samples covering the elapsed emulated time are produced.
+ * Must always be called from the same thread.
+ *
+ * @param[in]	p_audio		Pointer to audio output.
+ * @param[in]	elapsed_us	Emulated time elapsed since the previous call, in microseconds.
+ */
+void audio_update(audio_t *p_audio, uint32_t elapsed_us);
+
+#endif /* AUDIO_H_ */
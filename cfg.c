@@ -0,0 +1,1108 @@
+#include "cfg.h"
+
+#include "cpu_internal.h"
+#include "hash.h"
+#include "log.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Defines */
+
+#define CFG_MAGIC (0x46433843u) /* "C8CF" */
+#define CFG_VERSION (1)
+
+#define CFG_BLOCKS_MAX (MEM_SIZE) /* Blocks may start at any address, odd ones included. */
+#define CFG_CALLS_MAX (MEM_SIZE / 2)
+
+#define LISTING_DATA_PER_LINE (8)
+
+/* Value of I at a block entry. */
+#define I_UNSET (0) /* Entry not reached yet. */
+#define I_KNOWN (1)
+#define I_UNKNOWN (2)
+
+/* Typedefs */
+
+struct cfg_s
+{
+	uint64_t rom_hash;
+	uint16_t rom_size;
+	uint32_t summary;
+
+	uint8_t flags[MEM_SIZE];
+
+	cfg_block_t *blocks;
+	uint32_t block_count;
+
+	cfg_call_t *calls;
+	uint32_t call_count;
+};
+
+/* File layout, host byte order: header, flags, blocks, then calls. */
+typedef struct cfg_header_s
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t rom_hash;
+	uint32_t rom_size;
+	uint32_t summary;
+	uint32_t block_count;
+	uint32_t call_count;
+	uint64_t reserved[4];
+} cfg_header_t;
+
+/* Working state of cfg_analyze. */
+typedef struct analysis_s
+{
+	uint8_t memory[MEM_SIZE];
+	uint16_t end; /* First address past the ROM. */
+
+	uint16_t worklist[2 * MEM_SIZE]; /* propagate_i pushes a block at most twice: set, then unknown. */
+	uint32_t worklist_size;
+
+	uint16_t block_index[MEM_SIZE]; /* Index + 1 of the block starting at each address. */
+	uint8_t i_state[MEM_SIZE];		/* Of the block starting at each address. */
+	uint16_t i_value[MEM_SIZE];
+	uint8_t visited[CFG_BLOCKS_MAX];
+} analysis_t;
+
+/* Private function declarations */
+
+static cfg_t *cfg_allocate(uint32_t block_count, uint32_t call_count);
+static int cfg_valid(const cfg_t *p_cfg);
+static uint16_t opcode_at(const analysis_t *p_analysis, uint16_t address);
+static void add_block(cfg_t *p_cfg, analysis_t *p_analysis, uint16_t address);
+static void discover_blocks(cfg_t *p_cfg, analysis_t *p_analysis);
+static uint32_t build_blocks(cfg_t *p_cfg, analysis_t *p_analysis, cfg_block_t *blocks);
+static void propagate_i(cfg_t *p_cfg, analysis_t *p_analysis);
+static void merge_i(analysis_t *p_analysis, uint16_t address, uint8_t state, uint16_t value);
+static void find_accesses(cfg_t *p_cfg, analysis_t *p_analysis);
+static void mark_range(cfg_t *p_cfg, uint16_t address, uint16_t size, uint8_t flag);
+static uint32_t find_calls(cfg_t *p_cfg, analysis_t *p_analysis, cfg_call_t *calls);
+static int call_compare(const void *p_a, const void *p_b);
+static int make_directories(const char *directory);
+
+/* Public function definitions */
+
+cfg_t *cfg_analyze(const uint8_t *program, size_t size)
+{
+	if ((!program && size) || (size > (MEM_SIZE - ROM_ADDRESS)))
+	{
+		return NULL;
+	}
+
+	analysis_t *p_analysis = calloc(1, sizeof(analysis_t));
+	cfg_block_t *blocks = calloc(CFG_BLOCKS_MAX, sizeof(cfg_block_t));
+	cfg_call_t *calls = calloc(CFG_CALLS_MAX, sizeof(cfg_call_t));
+	cfg_t *p_cfg = calloc(1, sizeof(struct cfg_s));
+	if (!p_analysis || !blocks || !calls || !p_cfg)
+	{
+		free(p_analysis);
+		free(blocks);
+		free(calls);
+		cfg_free(p_cfg);
+		return NULL;
+	}
+
+	if (size)
+	{
+		(void)memcpy(p_analysis->memory + ROM_ADDRESS, program, size);
+	}
+	p_analysis->end = (uint16_t)(ROM_ADDRESS + size);
+
+	p_cfg->rom_hash = hash_fnv1a(program, size, HASH_SEED);
+	p_cfg->rom_size = (uint16_t)size;
+
+	discover_blocks(p_cfg, p_analysis);
+
+	p_cfg->blocks = blocks;
+	p_cfg->block_count = build_blocks(p_cfg, p_analysis, blocks);
+
+	propagate_i(p_cfg, p_analysis);
+	find_accesses(p_cfg, p_analysis);
+
+	p_cfg->calls = calls;
+	p_cfg->call_count = find_calls(p_cfg, p_analysis, calls);
+
+	free(p_analysis);
+
+	return p_cfg;
+}
+
+cfg_t *cfg_load(const char *path, const uint8_t *program, size_t size)
+{
+	if (size > (MEM_SIZE - ROM_ADDRESS))
+	{
+		return NULL;
+	}
+
+	FILE *file = fopen(path, "rb");
+	if (!file)
+	{
+		return NULL;
+	}
+
+	cfg_header_t header;
+	cfg_t *p_cfg = NULL;
+
+	if ((fread(&header, sizeof(header), 1, file) == 1) && (header.magic == CFG_MAGIC) &&
+		(header.version == CFG_VERSION) && (header.rom_size == size) &&
+		(header.rom_hash == hash_fnv1a(program, size, HASH_SEED)) && (header.block_count <= CFG_BLOCKS_MAX) &&
+		(header.call_count <= CFG_CALLS_MAX))
+	{
+		p_cfg = cfg_allocate(header.block_count, header.call_count);
+	}
+
+	if (p_cfg)
+	{
+		p_cfg->rom_hash = header.rom_hash;
+		p_cfg->rom_size = (uint16_t)size;
+		p_cfg->summary = header.summary;
+
+		if ((fread(p_cfg->flags, sizeof(p_cfg->flags), 1, file) != 1) ||
+			(fread(p_cfg->blocks, sizeof(cfg_block_t), p_cfg->block_count, file) != p_cfg->block_count) ||
+			(fread(p_cfg->calls, sizeof(cfg_call_t), p_cfg->call_count, file) != p_cfg->call_count) ||
+			!cfg_valid(p_cfg))
+		{
+			cfg_free(p_cfg);
+			p_cfg = NULL;
+		}
+	}
+
+	(void)fclose(file);
+
+	return p_cfg;
+}
+
+int cfg_save(const cfg_t *p_cfg, const char *path)
+{
+	if (!p_cfg || !path)
+	{
+		return -1;
+	}
+
+	/* Written aside then renamed, concurrent readers never see a partial file. */
+	char temporary[4096];
+	if (snprintf(temporary, sizeof(temporary), "%s.%ld.tmp", path, (long)getpid()) >= (int)sizeof(temporary))
+	{
+		return -1;
+	}
+
+	FILE *file = fopen(temporary, "wb");
+	if (!file)
+	{
+		ERROR_PRINT_ARGS("fopen failed (%s).\n", temporary);
+		return -1;
+	}
+
+	cfg_header_t header;
+	(void)memset(&header, 0, sizeof(header));
+	header.magic = CFG_MAGIC;
+	header.version = CFG_VERSION;
+	header.rom_hash = p_cfg->rom_hash;
+	header.rom_size = p_cfg->rom_size;
+	header.summary = p_cfg->summary;
+	header.block_count = p_cfg->block_count;
+	header.call_count = p_cfg->call_count;
+
+	int failed = (fwrite(&header, sizeof(header), 1, file) != 1) ||
+				 (fwrite(p_cfg->flags, sizeof(p_cfg->flags), 1, file) != 1) ||
+				 (fwrite(p_cfg->blocks, sizeof(cfg_block_t), p_cfg->block_count, file) != p_cfg->block_count) ||
+				 (fwrite(p_cfg->calls, sizeof(cfg_call_t), p_cfg->call_count, file) != p_cfg->call_count);
+	failed |= (fclose(file) != 0);
+
+	if (failed || (rename(temporary, path) != 0))
+	{
+		ERROR_PRINT_ARGS("Writing failed (%s).\n", path);
+		(void)unlink(temporary);
+		return -1;
+	}
+
+	return 0;
+}
+
+cfg_t *cfg_cached(const char *directory, const uint8_t *program, size_t size, int *p_hit)
+{
+	if (p_hit)
+	{
+		*p_hit = 0;
+	}
+
+	if (!directory)
+	{
+		return cfg_analyze(program, size);
+	}
+
+	char path[4096];
+	if (snprintf(path, sizeof(path), "%s/%016llx.cfg", directory,
+				 (unsigned long long)hash_fnv1a(program, size, HASH_SEED)) >= (int)sizeof(path))
+	{
+		return cfg_analyze(program, size);
+	}
+
+	cfg_t *p_cfg = cfg_load(path, program, size);
+	if (p_cfg)
+	{
+		if (p_hit)
+		{
+			*p_hit = 1;
+		}
+		return p_cfg;
+	}
+
+	p_cfg = cfg_analyze(program, size);
+
+	/* Not caching only costs the next run an analysis. */
+	if (p_cfg && ((make_directories(directory) != 0) || (cfg_save(p_cfg, path) != 0)))
+	{
+		ERROR_PRINT_ARGS("Caching failed (%s).\n", path);
+	}
+
+	return p_cfg;
+}
+
+const char *cfg_cache_directory(void)
+{
+	static char directory[4096];
+
+	const char *path = getenv("CHIP8_CACHE_DIR");
+	if (path && path[0])
+	{
+		return path;
+	}
+
+	path = getenv("XDG_CACHE_HOME");
+	if (path && path[0])
+	{
+		(void)snprintf(directory, sizeof(directory), "%s/chip8", path);
+		return directory;
+	}
+
+	path = getenv("HOME");
+	if (path && path[0])
+	{
+		(void)snprintf(directory, sizeof(directory), "%s/.cache/chip8", path);
+		return directory;
+	}
+
+	return NULL;
+}
+
+void cfg_free(cfg_t *p_cfg)
+{
+	if (p_cfg)
+	{
+		free(p_cfg->blocks);
+		free(p_cfg->calls);
+		free(p_cfg);
+	}
+}
+
+uint8_t cfg_flags(const cfg_t *p_cfg, uint16_t address)
+{
+	return (p_cfg && (address < MEM_SIZE)) ? p_cfg->flags[address] : 0;
+}
+
+uint32_t cfg_summary(const cfg_t *p_cfg)
+{
+	return p_cfg ? p_cfg->summary : 0;
+}
+
+uint64_t cfg_rom_hash(const cfg_t *p_cfg)
+{
+	return p_cfg ? p_cfg->rom_hash : 0;
+}
+
+const cfg_block_t *cfg_blocks(const cfg_t *p_cfg, uint32_t *p_count)
+{
+	*p_count = p_cfg ? p_cfg->block_count : 0;
+	return p_cfg ? p_cfg->blocks : NULL;
+}
+
+const cfg_call_t *cfg_calls(const cfg_t *p_cfg, uint32_t *p_count)
+{
+	*p_count = p_cfg ? p_cfg->call_count : 0;
+	return p_cfg ? p_cfg->calls : NULL;
+}
+
+int cfg_ends_block(uint16_t opcode)
+{
+	uint16_t nn = opcode & 0x00FF;
+
+	switch (opcode >> 12)
+	{
+	case 0x0:
+		return opcode != 0x00E0;
+	case 0x1:
+	case 0x2:
+	case 0xB:
+		return 1;
+	case 0x8:
+	{
+		uint8_t n = opcode & 0x000F;
+		return (n > 0x07) && (n != 0x0E);
+	}
+	case 0xE:
+		return (nn != 0x9E) && (nn != 0xA1);
+	case 0xF:
+		/* Halting and memory writes that may modify code end the block. */
+		return (nn == 0x0A) || (nn == 0x33) || (nn == 0x55) ||
+			   ((nn != 0x07) && (nn != 0x15) && (nn != 0x18) && (nn != 0x1E) && (nn != 0x29) && (nn != 0x65));
+	default:
+		return 0;
+	}
+}
+
+void cfg_mnemonic(uint16_t opcode, char *text, uint32_t size)
+{
+	static const char *const alu_names[16] = {
+		"LD", "OR", "AND", "XOR", "ADD", "SUB", "SHR", "SUBN", NULL, NULL, NULL, NULL, NULL, NULL, "SHL", NULL};
+
+	uint16_t nnn = opcode & 0x0FFF;
+	uint8_t nn = opcode & 0x00FF;
+	uint8_t n = opcode & 0x000F;
+	uint8_t x = (opcode >> 8) & 0x0F;
+	uint8_t y = (opcode >> 4) & 0x0F;
+
+	switch (opcode >> 12)
+	{
+	case 0x0:
+		if (opcode == 0x00E0)
+		{
+			(void)snprintf(text, size, "CLS");
+		}
+		else if (opcode == 0x00EE)
+		{
+			(void)snprintf(text, size, "RET");
+		}
+		else
+		{
+			(void)snprintf(text, size, "SYS 0x%03X", nnn);
+		}
+		return;
+	case 0x1:
+		(void)snprintf(text, size, "JP 0x%03X", nnn);
+		return;
+	case 0x2:
+		(void)snprintf(text, size, "CALL 0x%03X", nnn);
+		return;
+	case 0x3:
+		(void)snprintf(text, size, "SE V%X, 0x%02X", x, nn);
+		return;
+	case 0x4:
+		(void)snprintf(text, size, "SNE V%X, 0x%02X", x, nn);
+		return;
+	case 0x5:
+		if (n)
+		{
+			(void)snprintf(text, size, "DW 0x%04X", opcode);
+		}
+		else
+		{
+			(void)snprintf(text, size, "SE V%X, V%X", x, y);
+		}
+		return;
+	case 0x6:
+		(void)snprintf(text, size, "LD V%X, 0x%02X", x, nn);
+		return;
+	case 0x7:
+		(void)snprintf(text, size, "ADD V%X, 0x%02X", x, nn);
+		return;
+	case 0x8:
+		if (alu_names[n])
+		{
+			(void)snprintf(text, size, "%s V%X, V%X", alu_names[n], x, y);
+		}
+		else
+		{
+			(void)snprintf(text, size, "DW 0x%04X", opcode);
+		}
+		return;
+	case 0x9:
+		if (n)
+		{
+			(void)snprintf(text, size, "DW 0x%04X", opcode);
+		}
+		else
+		{
+			(void)snprintf(text, size, "SNE V%X, V%X", x, y);
+		}
+		return;
+	case 0xA:
+		(void)snprintf(text, size, "LD I, 0x%03X", nnn);
+		return;
+	case 0xB:
+		(void)snprintf(text, size, "JP V0, 0x%03X", nnn);
+		return;
+	case 0xC:
+		(void)snprintf(text, size, "RND V%X, 0x%02X", x, nn);
+		return;
+	case 0xD:
+		(void)snprintf(text, size, "DRW V%X, V%X, %u", x, y, n);
+		return;
+	case 0xE:
+		if (nn == 0x9E)
+		{
+			(void)snprintf(text, size, "SKP V%X", x);
+		}
+		else if (nn == 0xA1)
+		{
+			(void)snprintf(text, size, "SKNP V%X", x);
+		}
+		else
+		{
+			(void)snprintf(text, size, "DW 0x%04X", opcode);
+		}
+		return;
+	default:
+		break;
+	}
+
+	switch (nn)
+	{
+	case 0x07:
+		(void)snprintf(text, size, "LD V%X, DT", x);
+		break;
+	case 0x0A:
+		(void)snprintf(text, size, "LD V%X, K", x);
+		break;
+	case 0x15:
+		(void)snprintf(text, size, "LD DT, V%X", x);
+		break;
+	case 0x18:
+		(void)snprintf(text, size, "LD ST, V%X", x);
+		break;
+	case 0x1E:
+		(void)snprintf(text, size, "ADD I, V%X", x);
+		break;
+	case 0x29:
+		(void)snprintf(text, size, "LD F, V%X", x);
+		break;
+	case 0x33:
+		(void)snprintf(text, size, "LD B, V%X", x);
+		break;
+	case 0x55:
+		(void)snprintf(text, size, "LD [I], V%X", x);
+		break;
+	case 0x65:
+		(void)snprintf(text, size, "LD V%X, [I]", x);
+		break;
+	default:
+		(void)snprintf(text, size, "DW 0x%04X", opcode);
+		break;
+	}
+}
+
+void cfg_listing(const cfg_t *p_cfg, const uint8_t *program, size_t size, FILE *out)
+{
+	if (size > (MEM_SIZE - ROM_ADDRESS))
+	{
+		return;
+	}
+
+	uint32_t subroutines = 0;
+	for (uint32_t address = ROM_ADDRESS; address < MEM_SIZE; address++)
+	{
+		subroutines += !!(p_cfg->flags[address] & CFG_SUBROUTINE);
+	}
+
+	fprintf(out, "; ROM 0x%016llx, %zu bytes, %u blocks, %u subroutines, %u calls\n",
+			(unsigned long long)p_cfg->rom_hash, size, p_cfg->block_count, subroutines, p_cfg->call_count);
+	if (p_cfg->summary)
+	{
+		fprintf(out, ";%s%s%s\n", (p_cfg->summary & CFG_SELF_MODIFYING) ? " self-modifying" : "",
+				(p_cfg->summary & CFG_UNKNOWN_WRITES) ? " writes-through-unknown-I" : "",
+				(p_cfg->summary & CFG_COMPUTED_JUMPS) ? " computed-jumps" : "");
+	}
+
+	uint32_t end = ROM_ADDRESS + (uint32_t)size;
+	uint32_t address = ROM_ADDRESS;
+	while (address < end)
+	{
+		uint8_t flags = p_cfg->flags[address];
+
+		if ((flags & CFG_CODE) && ((address + 1) < end))
+		{
+			if (flags & CFG_BLOCK_START)
+			{
+				fprintf(out, "\n%s%03X:", (flags & CFG_SUBROUTINE) ? "sub_" : "L", address);
+
+				const char *separator = " ; called from ";
+				for (uint32_t call = 0; call < p_cfg->call_count; call++)
+				{
+					if (p_cfg->calls[call].target == address)
+					{
+						fprintf(out, "%s%03X", separator, p_cfg->calls[call].site);
+						separator = ", ";
+					}
+				}
+				fprintf(out, "\n");
+			}
+
+			uint16_t opcode = (uint16_t)((program[address - ROM_ADDRESS] << 8) | program[address + 1 - ROM_ADDRESS]);
+			char text[32];
+			cfg_mnemonic(opcode, text, sizeof(text));
+
+			int written = (flags | p_cfg->flags[address + 1]) & CFG_WRITTEN;
+			if (written)
+			{
+				fprintf(out, "    %03X  %04X  %-16s; written\n", address, opcode, text);
+			}
+			else
+			{
+				fprintf(out, "    %03X  %04X  %s\n", address, opcode, text);
+			}
+
+			address += 2;
+			continue;
+		}
+
+		/* Bytes not reached as code, up to the next instruction. */
+		fprintf(out, "    %03X  db", address);
+		int written = 0;
+		for (uint32_t count = 0; (count < LISTING_DATA_PER_LINE) && (address < end); count++)
+		{
+			if (count && (p_cfg->flags[address] & CFG_CODE))
+			{
+				break;
+			}
+
+			written |= p_cfg->flags[address] & CFG_WRITTEN;
+			fprintf(out, "%s0x%02X", count ? ", " : " ", program[address - ROM_ADDRESS]);
+			address++;
+		}
+		fprintf(out, "%s\n", written ? " ; written" : "");
+	}
+}
+
+/* Private function definitions */
+
+static cfg_t *cfg_allocate(uint32_t block_count, uint32_t call_count)
+{
+	cfg_t *p_cfg = calloc(1, sizeof(struct cfg_s));
+	if (!p_cfg)
+	{
+		return NULL;
+	}
+
+	p_cfg->block_count = block_count;
+	p_cfg->call_count = call_count;
+	p_cfg->blocks = calloc(block_count ? block_count : 1, sizeof(cfg_block_t));
+	p_cfg->calls = calloc(call_count ? call_count : 1, sizeof(cfg_call_t));
+	if (!p_cfg->blocks || !p_cfg->calls)
+	{
+		cfg_free(p_cfg);
+		return NULL;
+	}
+
+	return p_cfg;
+}
+
+/* Blocks and calls of a loaded analysis lie in the ROM, jumps and calls may leave it. */
+static int cfg_valid(const cfg_t *p_cfg)
+{
+	uint32_t end = ROM_ADDRESS + (uint32_t)p_cfg->rom_size;
+
+	for (uint32_t index = 0; index < p_cfg->block_count; index++)
+	{
+		const cfg_block_t *p_block = &(p_cfg->blocks[index]);
+		uint32_t block_end = p_block->start + (2u * p_block->length);
+
+		if ((p_block->start < ROM_ADDRESS) || !p_block->length || (block_end > end) ||
+			(p_block->end > CFG_END_STOP) || (p_block->target > MEM_SIZE) ||
+			((p_block->end == CFG_END_FALLTHROUGH) && ((p_block->target < ROM_ADDRESS) || (p_block->target > end))))
+		{
+			return 0;
+		}
+	}
+
+	for (uint32_t index = 0; index < p_cfg->call_count; index++)
+	{
+		const cfg_call_t *p_call = &(p_cfg->calls[index]);
+
+		if ((p_call->caller < ROM_ADDRESS) || (p_call->caller >= end) || (p_call->site < ROM_ADDRESS) ||
+			(p_call->site >= end) || (p_call->target >= MEM_SIZE))
+		{
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+static uint16_t opcode_at(const analysis_t *p_analysis, uint16_t address)
+{
+	return (uint16_t)((p_analysis->memory[address] << 8) | p_analysis->memory[address + 1]);
+}
+
+static void add_block(cfg_t *p_cfg, analysis_t *p_analysis, uint16_t address)
+{
+	/* Only code inside the loaded ROM is known ahead of time. */
+	if ((address < ROM_ADDRESS) || ((address + 2) > p_analysis->end) || (p_cfg->flags[address] & CFG_BLOCK_START))
+	{
+		return;
+	}
+
+	p_cfg->flags[address] |= CFG_BLOCK_START;
+	p_analysis->worklist[p_analysis->worklist_size++] = address;
+}
+
+static void discover_blocks(cfg_t *p_cfg, analysis_t *p_analysis)
+{
+	add_block(p_cfg, p_analysis, ROM_ADDRESS);
+
+	while (p_analysis->worklist_size)
+	{
+		uint16_t address = p_analysis->worklist[--p_analysis->worklist_size];
+		uint32_t count = 0;
+		int ended = 0;
+
+		while (((address + 2) <= p_analysis->end) && (count < CFG_BLOCK_INSTRUCTIONS_MAX))
+		{
+			uint16_t opcode = opcode_at(p_analysis, address);
+			uint16_t nnn = opcode & 0x0FFF;
+			uint8_t nn = opcode & 0x00FF;
+
+			p_cfg->flags[address] |= CFG_CODE;
+
+			switch (opcode >> 12)
+			{
+			case 0x1:
+				add_block(p_cfg, p_analysis, nnn);
+				break;
+			case 0x2:
+				add_block(p_cfg, p_analysis, nnn);
+				add_block(p_cfg, p_analysis, address + 2);
+				if (p_cfg->flags[nnn] & CFG_BLOCK_START)
+				{
+					p_cfg->flags[nnn] |= CFG_SUBROUTINE;
+				}
+				break;
+			case 0x3:
+			case 0x4:
+			case 0x5:
+			case 0x9:
+				add_block(p_cfg, p_analysis, address + 4);
+				break;
+			case 0xE:
+				if ((nn == 0x9E) || (nn == 0xA1))
+				{
+					add_block(p_cfg, p_analysis, address + 4);
+				}
+				break;
+			case 0xF:
+				if ((nn == 0x0A) || (nn == 0x33) || (nn == 0x55))
+				{
+					add_block(p_cfg, p_analysis, address + 2);
+				}
+				break;
+			default:
+				break;
+			}
+
+			count++;
+			if (cfg_ends_block(opcode))
+			{
+				ended = 1;
+				break;
+			}
+
+			address += 2;
+		}
+
+		/* Block cut by the length limit continues in a new block. */
+		if (!ended)
+		{
+			add_block(p_cfg, p_analysis, address);
+		}
+	}
+}
+
+/* Splits the code at block starts, so each instruction is in one block. */
+static uint32_t build_blocks(cfg_t *p_cfg, analysis_t *p_analysis, cfg_block_t *blocks)
+{
+	uint32_t count = 0;
+
+	for (uint32_t start = ROM_ADDRESS; start < p_analysis->end; start++)
+	{
+		if (!(p_cfg->flags[start] & CFG_BLOCK_START))
+		{
+			continue;
+		}
+
+		cfg_block_t *p_block = &(blocks[count++]);
+		p_block->start = (uint16_t)start;
+		p_block->end = CFG_END_STOP;
+
+		uint16_t address = (uint16_t)start;
+		while (1)
+		{
+			uint16_t opcode = opcode_at(p_analysis, address);
+			p_block->length++;
+
+			if (cfg_ends_block(opcode))
+			{
+				p_block->target = opcode & 0x0FFF;
+				switch (opcode >> 12)
+				{
+				case 0x0:
+					p_block->end = (opcode == 0x00EE) ? CFG_END_RETURN : CFG_END_STOP;
+					break;
+				case 0x1:
+					p_block->end = CFG_END_JUMP;
+					break;
+				case 0x2:
+					p_block->end = CFG_END_CALL;
+					break;
+				case 0xB:
+					p_block->end = CFG_END_COMPUTED;
+					break;
+				case 0xF:
+					if (((opcode & 0xFF) == 0x0A) || ((opcode & 0xFF) == 0x33) || ((opcode & 0xFF) == 0x55))
+					{
+						p_block->end = CFG_END_FALLTHROUGH;
+						p_block->target = address + 2;
+						break;
+					}
+					/* fall through */
+				default:
+					p_block->end = CFG_END_STOP;
+					break;
+				}
+				break;
+			}
+
+			address += 2;
+			if ((address + 2) > p_analysis->end)
+			{
+				p_block->target = address;
+				break;
+			}
+
+			if (p_cfg->flags[address] & CFG_BLOCK_START)
+			{
+				p_block->end = CFG_END_FALLTHROUGH;
+				p_block->target = address;
+				break;
+			}
+		}
+	}
+
+	for (uint32_t index = 0; index < count; index++)
+	{
+		p_analysis->block_index[blocks[index].start] = (uint16_t)(index + 1);
+	}
+
+	return count;
+}
+
+/* I at each block entry: a constant when all paths agree, else unknown. */
+static void propagate_i(cfg_t *p_cfg, analysis_t *p_analysis)
+{
+	if (!p_cfg->block_count)
+	{
+		return;
+	}
+
+	p_analysis->worklist_size = 0;
+	merge_i(p_analysis, ROM_ADDRESS, I_KNOWN, 0);
+
+	while (p_analysis->worklist_size)
+	{
+		uint16_t start = p_analysis->worklist[--p_analysis->worklist_size];
+		const cfg_block_t *p_block = &(p_cfg->blocks[p_analysis->block_index[start] - 1]);
+
+		uint8_t state = p_analysis->i_state[start];
+		uint16_t value = p_analysis->i_value[start];
+		uint16_t address = start;
+
+		for (uint16_t count = 0; count < p_block->length; count++, address += 2)
+		{
+			uint16_t opcode = opcode_at(p_analysis, address);
+			uint8_t nn = opcode & 0x00FF;
+
+			switch (opcode >> 12)
+			{
+			case 0x3:
+			case 0x4:
+			case 0x5:
+			case 0x9:
+				merge_i(p_analysis, address + 4, state, value);
+				break;
+			case 0xA:
+				state = I_KNOWN;
+				value = opcode & 0x0FFF;
+				break;
+			case 0xE:
+				if ((nn == 0x9E) || (nn == 0xA1))
+				{
+					merge_i(p_analysis, address + 4, state, value);
+				}
+				break;
+			case 0xF:
+				if ((nn == 0x1E) || (nn == 0x29))
+				{
+					state = I_UNKNOWN;
+				}
+				break;
+			default:
+				break;
+			}
+		}
+
+		switch (p_block->end)
+		{
+		case CFG_END_FALLTHROUGH:
+		case CFG_END_JUMP:
+			merge_i(p_analysis, p_block->target, state, value);
+			break;
+		case CFG_END_CALL:
+			/* The subroutine may change I before returning. */
+			merge_i(p_analysis, p_block->target, state, value);
+			merge_i(p_analysis, address, I_UNKNOWN, 0);
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+static void merge_i(analysis_t *p_analysis, uint16_t address, uint8_t state, uint16_t value)
+{
+	if ((address >= MEM_SIZE) || !p_analysis->block_index[address])
+	{
+		return;
+	}
+
+	uint8_t old_state = p_analysis->i_state[address];
+	if (old_state == I_UNKNOWN)
+	{
+		return;
+	}
+
+	if (old_state == I_UNSET)
+	{
+		p_analysis->i_state[address] = state;
+		p_analysis->i_value[address] = value;
+	}
+	else if ((state != I_KNOWN) || (value != p_analysis->i_value[address]))
+	{
+		p_analysis->i_state[address] = I_UNKNOWN;
+	}
+	else
+	{
+		return;
+	}
+
+	p_analysis->worklist[p_analysis->worklist_size++] = address;
+}
+
+static void find_accesses(cfg_t *p_cfg, analysis_t *p_analysis)
+{
+	for (uint32_t index = 0; index < p_cfg->block_count; index++)
+	{
+		const cfg_block_t *p_block = &(p_cfg->blocks[index]);
+		uint8_t state = p_analysis->i_state[p_block->start];
+		uint16_t value = p_analysis->i_value[p_block->start];
+		uint16_t address = p_block->start;
+
+		for (uint16_t count = 0; count < p_block->length; count++, address += 2)
+		{
+			uint16_t opcode = opcode_at(p_analysis, address);
+			uint8_t x = (opcode >> 8) & 0x0F;
+			int known = (state == I_KNOWN);
+
+			switch (opcode >> 12)
+			{
+			case 0xA:
+				state = I_KNOWN;
+				value = opcode & 0x0FFF;
+				mark_range(p_cfg, value, 1, CFG_DATA);
+				break;
+			case 0xB:
+				p_cfg->summary |= CFG_COMPUTED_JUMPS;
+				break;
+			case 0xD:
+				if (known)
+				{
+					mark_range(p_cfg, value, opcode & 0x000F, CFG_DATA);
+				}
+				break;
+			case 0xF:
+				switch (opcode & 0xFF)
+				{
+				case 0x1E:
+				case 0x29:
+					state = I_UNKNOWN;
+					break;
+				case 0x33:
+				case 0x55:
+					if (known)
+					{
+						mark_range(p_cfg, value, ((opcode & 0xFF) == 0x33) ? 3 : (uint16_t)(x + 1), CFG_WRITTEN);
+					}
+					else
+					{
+						p_cfg->summary |= CFG_UNKNOWN_WRITES;
+					}
+					break;
+				case 0x65:
+					if (known)
+					{
+						mark_range(p_cfg, value, (uint16_t)(x + 1), CFG_DATA);
+					}
+					break;
+				default:
+					break;
+				}
+				break;
+			default:
+				break;
+			}
+		}
+	}
+
+	for (uint32_t address = ROM_ADDRESS; address < MEM_SIZE; address++)
+	{
+		if ((p_cfg->flags[address] & CFG_CODE) &&
+			((p_cfg->flags[address] | p_cfg->flags[(address + 1) & (MEM_SIZE - 1)]) & CFG_WRITTEN))
+		{
+			p_cfg->summary |= CFG_SELF_MODIFYING;
+		}
+	}
+}
+
+static void mark_range(cfg_t *p_cfg, uint16_t address, uint16_t size, uint8_t flag)
+{
+	/* Addresses wrap as the cpu's do. */
+	for (uint16_t offset = 0; offset < size; offset++)
+	{
+		p_cfg->flags[(address + offset) & (MEM_SIZE - 1)] |= flag;
+	}
+}
+
+/* Follows each subroutine, and the ROM start, up to its returns; calls found on the way are its callees. */
+static uint32_t find_calls(cfg_t *p_cfg, analysis_t *p_analysis, cfg_call_t *calls)
+{
+	uint32_t count = 0;
+
+	for (uint32_t entry = ROM_ADDRESS; entry < MEM_SIZE; entry++)
+	{
+		if (!p_analysis->block_index[entry] || ((entry != ROM_ADDRESS) && !(p_cfg->flags[entry] & CFG_SUBROUTINE)))
+		{
+			continue;
+		}
+
+		(void)memset(p_analysis->visited, 0, sizeof(p_analysis->visited));
+		p_analysis->worklist_size = 0;
+		p_analysis->worklist[p_analysis->worklist_size++] = (uint16_t)entry;
+		p_analysis->visited[p_analysis->block_index[entry] - 1] = 1;
+
+		while (p_analysis->worklist_size)
+		{
+			uint16_t start = p_analysis->worklist[--p_analysis->worklist_size];
+			const cfg_block_t *p_block = &(p_cfg->blocks[p_analysis->block_index[start] - 1]);
+
+			/* Successors: skip targets, then where the block leaves to. */
+			uint16_t successors[CFG_BLOCK_INSTRUCTIONS_MAX + 1];
+			uint32_t successor_count = 0;
+			uint16_t address = start;
+
+			for (uint16_t instruction = 0; instruction < p_block->length; instruction++, address += 2)
+			{
+				uint16_t opcode = opcode_at(p_analysis, address);
+				uint8_t op = (uint8_t)(opcode >> 12);
+				uint8_t nn = opcode & 0x00FF;
+				if ((op == 0x3) || (op == 0x4) || (op == 0x5) || (op == 0x9) ||
+					((op == 0xE) && ((nn == 0x9E) || (nn == 0xA1))))
+				{
+					successors[successor_count++] = address + 4;
+				}
+			}
+
+			switch (p_block->end)
+			{
+			case CFG_END_FALLTHROUGH:
+			case CFG_END_JUMP:
+				successors[successor_count++] = p_block->target;
+				break;
+			case CFG_END_CALL:
+				/* Only reached by ROMs made of calls, the graph is then truncated. */
+				if (count < CFG_CALLS_MAX)
+				{
+					calls[count].caller = (uint16_t)entry;
+					calls[count].site = (uint16_t)(address - 2);
+					calls[count].target = p_block->target;
+					count++;
+				}
+				successors[successor_count++] = address;
+				break;
+			default:
+				break;
+			}
+
+			for (uint32_t successor = 0; successor < successor_count; successor++)
+			{
+				uint16_t target = successors[successor];
+				if ((target < MEM_SIZE) && p_analysis->block_index[target] &&
+					!p_analysis->visited[p_analysis->block_index[target] - 1])
+				{
+					p_analysis->visited[p_analysis->block_index[target] - 1] = 1;
+					p_analysis->worklist[p_analysis->worklist_size++] = target;
+				}
+			}
+		}
+	}
+
+	qsort(calls, count, sizeof(cfg_call_t), call_compare);
+
+	return count;
+}
+
+static int call_compare(const void *p_a, const void *p_b)
+{
+	const cfg_call_t *p_call_a = (const cfg_call_t *)p_a;
+	const cfg_call_t *p_call_b = (const cfg_call_t *)p_b;
+
+	if (p_call_a->caller != p_call_b->caller)
+	{
+		return (int)p_call_a->caller - (int)p_call_b->caller;
+	}
+
+	return (int)p_call_a->site - (int)p_call_b->site;
+}
+
+static int make_directories(const char *directory)
+{
+	char path[4096];
+	if (snprintf(path, sizeof(path), "%s", directory) >= (int)sizeof(path))
+	{
+		return -1;
+	}
+
+	for (char *p_slash = strchr(path + 1, '/');; p_slash = strchr(p_slash + 1, '/'))
+	{
+		if (p_slash)
+		{
+			*p_slash = '\0';
+		}
+
+		if ((mkdir(path, 0755) != 0) && (errno != EEXIST))
+		{
+			return -1;
+		}
+
+		if (!p_slash)
+		{
+			return 0;
+		}
+
+		*p_slash = '/';
+	}
+}
@@ -0,0 +1,203 @@
+#ifndef CFG_H_
+#define CFG_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Static analysis of a ROM: reachable code, basic blocks, call graph and the
+ * memory its FX33 and FX55 instructions write to.
+ *
+ * Code is followed from the ROM start through jumps, calls, returns and skips.
+ * Computed jumps (BNNN) are not followed. I is propagated as a constant across
+ * blocks where all paths agree, so writes through a known I are located and
+ * checked against the reachable code.
+ *
+ * Results depend only on the ROM bytes, so they are cached in a file named after
+ * the ROM hash (hash_fnv1a, as chip8-aot modules are keyed).
+ */
+
+/* Defines */
+
+#define CFG_BLOCK_INSTRUCTIONS_MAX (256) /* Longer straight code is split. */
+
+/* Flags of each memory address. */
+#define CFG_CODE (1u << 0)		  /* First byte of a reachable instruction. */
+#define CFG_BLOCK_START (1u << 1) /* Entry of a block: ROM start, jump, call, return or skip target. */
+#define CFG_SUBROUTINE (1u << 2)  /* Target of a call. */
+#define CFG_WRITTEN (1u << 3)	  /* Written by FX33 or FX55. */
+#define CFG_DATA (1u << 4)		  /* Read by DXYN or FX65, or loaded into I by ANNN. */
+
+/* Flags of the whole ROM. */
+#define CFG_SELF_MODIFYING (1u << 0) /* Code is written by FX33 or FX55. */
+#define CFG_UNKNOWN_WRITES (1u << 1) /* FX33 or FX55 runs with I unknown, it may write anywhere. */
+#define CFG_COMPUTED_JUMPS (1u << 2) /* BNNN is reachable, its targets are not. */
+
+/* Typedefs */
+
+typedef struct cfg_s cfg_t;
+
+typedef enum cfg_end_e
+{
+	CFG_END_FALLTHROUGH = 0, /* Continues at target, the next block. */
+	CFG_END_JUMP,			 /* 1NNN to target. */
+	CFG_END_CALL,			 /* 2NNN to target, returning to the next block. */
+	CFG_END_RETURN,			 /* 00EE. */
+	CFG_END_COMPUTED,		 /* BNNN. */
+	CFG_END_STOP			 /* Unhandled instruction, or the end of the ROM. */
+} cfg_end_t;
+
+typedef struct cfg_block_s
+{
+	uint16_t start;
+	uint16_t length; /* Instructions, skips inside the block may leave it early. */
+	uint16_t target;
+	uint8_t end; /* cfg_end_t */
+} cfg_block_t;
+
+typedef struct cfg_call_s
+{
+	uint16_t caller; /* Entry of the calling subroutine, or the ROM start. */
+	uint16_t site;	 /* Address of the 2NNN. */
+	uint16_t target;
+} cfg_call_t;
+
+/* Public function declarations */
+
+/**
+ * @brief Analyze a ROM.
+ *
+ * @param[in]	program	ROM, as given to cpu_load.
+ * @param[in]	size	ROM size.
+ *
+ * @return Pointer to analysis, or NULL if out of memory or the ROM does not fit in memory.
+ */
+cfg_t *cfg_analyze(const uint8_t *program, size_t size);
+
+/**
+ * @brief Load an analysis saved by cfg_save.
+ *
+ * @param[in]	path	Path of the file.
+ * @param[in]	program	ROM the analysis must have been made from.
+ * @param[in]	size	ROM size.
+ *
+ * @return Pointer to analysis, or NULL if missing, invalid or made from another ROM.
+ */
+cfg_t *cfg_load(const char *path, const uint8_t *program, size_t size);
+
+/**
+ * @brief Save an analysis.
+ *
+ * @param[in]	p_cfg	Pointer to analysis.
+ * @param[in]	path	Path of the file, replaced atomically.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int cfg_save(const cfg_t *p_cfg, const char *path);
+
+/**
+ * @brief Load an analysis from a cache directory, or analyze and add it.
+ *
+ * @param[in]	directory	Cache directory, created if missing. NULL to only analyze.
+ * @param[in]	program		ROM.
+ * @param[in]	size		ROM size.
+ * @param[out]	p_hit		Set to 1 if loaded from the cache, else 0. May be NULL.
+ *
+ * @return Pointer to analysis, or NULL on error.
+ */
+cfg_t *cfg_cached(const char *directory, const uint8_t *program, size_t size, int *p_hit);
+
+/**
+ * @brief Default cache directory: $CHIP8_CACHE_DIR, $XDG_CACHE_HOME/chip8 or ~/.cache/chip8.
+ *
+ * @return Directory path, or NULL if none is set.
+ */
+const char *cfg_cache_directory(void);
+
+/**
+ * @brief Free an analysis.
+ *
+ * @param[in]	p_cfg	Pointer to analysis, may be NULL.
+ */
+void cfg_free(cfg_t *p_cfg);
+
+/**
+ * @brief Get the flags of an address.
+ *
+ * @param[in]	p_cfg	Pointer to analysis.
+ * @param[in]	address	Memory address.
+ *
+ * @return CFG_CODE, CFG_BLOCK_START, CFG_SUBROUTINE, CFG_WRITTEN and CFG_DATA flags.
+ */
+uint8_t cfg_flags(const cfg_t *p_cfg, uint16_t address);
+
+/**
+ * @brief Get the flags of the whole ROM.
+ *
+ * @param[in]	p_cfg	Pointer to analysis.
+ *
+ * @return CFG_SELF_MODIFYING, CFG_UNKNOWN_WRITES and CFG_COMPUTED_JUMPS flags.
+ */
+uint32_t cfg_summary(const cfg_t *p_cfg);
+
+/**
+ * @brief Get the ROM hash the analysis was made from.
+ *
+ * @param[in]	p_cfg	Pointer to analysis.
+ *
+ * @return ROM hash.
+ */
+uint64_t cfg_rom_hash(const cfg_t *p_cfg);
+
+/**
+ * @brief Get the basic blocks, ordered by address.
+ *
+ * @param[in]	p_cfg	Pointer to analysis.
+ * @param[out]	p_count	Number of blocks.
+ *
+ * @return Blocks, valid until cfg_free.
+ */
+const cfg_block_t *cfg_blocks(const cfg_t *p_cfg, uint32_t *p_count);
+
+/**
+ * @brief Get the calls, ordered by caller then site.
+ *
+ * @param[in]	p_cfg	Pointer to analysis.
+ * @param[out]	p_count	Number of calls.
+ *
+ * @return Calls, valid until cfg_free.
+ */
+const cfg_call_t *cfg_calls(const cfg_t *p_cfg, uint32_t *p_count);
+
+/**
+ * @brief Check whether an instruction leaves the straight-line code it is part of.
+ *
+ * Jumps, calls, returns, FX0A, writes to memory and unhandled instructions do.
+ *
+ * @param[in]	opcode	Instruction.
+ *
+ * @return 1 if it ends a block, else 0.
+ */
+int cfg_ends_block(uint16_t opcode);
+
+/**
+ * @brief Disassemble an instruction.
+ *
+ * @param[in]	opcode	Instruction.
+ * @param[out]	text	Mnemonic and operands.
+ * @param[in]	size	Size of text.
+ */
+void cfg_mnemonic(uint16_t opcode, char *text, uint32_t size);
+
+/**
+ * @brief Write a disassembly listing of the ROM, code and data.
+ *
+ * @param[in]	p_cfg	Pointer to analysis.
+ * @param[in]	program	ROM the analysis was made from.
+ * @param[in]	size	ROM size.
+ * @param[in]	out		Output stream.
+ */
+void cfg_listing(const cfg_t *p_cfg, const uint8_t *program, size_t size, FILE *out);
+
+#endif /* CFG_H_ */
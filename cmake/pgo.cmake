@@ -0,0 +1,131 @@
+# Profile-guided build of chip8-emulator, run by the pgo target.
+#
+# Builds a plain release emulator and an instrumented one, trains the latter on
+# the ROMs in corpus/ (headless, with their .keys scripts), rebuilds it with the
+# profile and link-time optimization, then times the corpus on both binaries.
+#
+# Variables: SOURCE_DIR, PARENT_DIR (build tree the settings are taken from),
+# BINARY_DIR, and optionally FRAMES (per ROM and run) and RUNS (timing runs).
+
+cmake_minimum_required(VERSION 3.23) # TIMESTAMP %f
+
+if(NOT FRAMES)
+	set(FRAMES 1000000)
+endif()
+if(NOT RUNS)
+	set(RUNS 3)
+endif()
+
+set(EMULATOR chip8-emulator)
+set(PROFILE_DIR ${BINARY_DIR}/profile-data)
+
+# Same compiler, generator and SDL as the build tree the target runs from.
+load_cache(${PARENT_DIR} READ_WITH_PREFIX PARENT_
+	CMAKE_GENERATOR CMAKE_C_COMPILER CMAKE_C_FLAGS SDL2_INCLUDE_DIR SDL2_LIBRARY SDL2MAIN_LIBRARY)
+
+file(MAKE_DIRECTORY ${BINARY_DIR})
+file(WRITE ${BINARY_DIR}/settings.cmake "")
+foreach(NAME CMAKE_C_COMPILER CMAKE_C_FLAGS SDL2_INCLUDE_DIR SDL2_LIBRARY SDL2MAIN_LIBRARY)
+	if(PARENT_${NAME})
+		file(APPEND ${BINARY_DIR}/settings.cmake "set(${NAME} \"${PARENT_${NAME}}\" CACHE STRING \"\")\n")
+	endif()
+endforeach()
+
+function(build DIRECTORY)
+	execute_process(
+		COMMAND ${CMAKE_COMMAND} -S ${SOURCE_DIR} -B ${DIRECTORY} -G ${PARENT_CMAKE_GENERATOR}
+			-C ${BINARY_DIR}/settings.cmake -DCMAKE_BUILD_TYPE=Release -Wno-dev ${ARGN}
+		OUTPUT_QUIET
+		RESULT_VARIABLE RESULT)
+	if(NOT RESULT EQUAL 0)
+		message(FATAL_ERROR "Configuring ${DIRECTORY} failed.")
+	endif()
+
+	execute_process(
+		COMMAND ${CMAKE_COMMAND} --build ${DIRECTORY} --target ${EMULATOR} --parallel
+		OUTPUT_QUIET
+		RESULT_VARIABLE RESULT)
+	if(NOT RESULT EQUAL 0)
+		message(FATAL_ERROR "Building ${DIRECTORY} failed.")
+	endif()
+endfunction()
+
+# Run the corpus once, OUTPUT is set to the elapsed time in microseconds.
+function(run_corpus PROGRAM OUTPUT)
+	file(GLOB ROMS ${SOURCE_DIR}/corpus/*.ch8)
+	if(NOT ROMS)
+		message(FATAL_ERROR "No ROM in ${SOURCE_DIR}/corpus.")
+	endif()
+
+	string(TIMESTAMP START "%s%f" UTC)
+	foreach(ROM ${ROMS})
+		get_filename_component(NAME ${ROM} NAME_WE)
+		set(ARGUMENTS -H -n ${FRAMES})
+		if(EXISTS ${SOURCE_DIR}/corpus/${NAME}.keys)
+			list(APPEND ARGUMENTS -s ${SOURCE_DIR}/corpus/${NAME}.keys)
+		endif()
+
+		execute_process(COMMAND ${PROGRAM} ${ARGUMENTS} ${ROM} RESULT_VARIABLE RESULT)
+		if(NOT RESULT EQUAL 0)
+			message(FATAL_ERROR "${PROGRAM} failed on ${ROM}.")
+		endif()
+	endforeach()
+	string(TIMESTAMP END "%s%f" UTC)
+
+	math(EXPR ELAPSED "${END} - ${START}")
+	set(${OUTPUT} ${ELAPSED} PARENT_SCOPE)
+endfunction()
+
+message(STATUS "Building plain release")
+build(${BINARY_DIR}/plain)
+
+message(STATUS "Building instrumented")
+file(REMOVE_RECURSE ${PROFILE_DIR})
+build(${BINARY_DIR}/optimized -DCHIP8_PROFILE=generate -DCHIP8_PROFILE_DIR=${PROFILE_DIR})
+
+message(STATUS "Training on corpus")
+run_corpus(${BINARY_DIR}/optimized/${EMULATOR} TRAINING)
+
+# Clang writes raw profiles that have to be merged, gcc's are used as they are.
+file(GLOB RAW_PROFILES ${PROFILE_DIR}/*.profraw)
+if(RAW_PROFILES)
+	find_program(LLVM_PROFDATA NAMES llvm-profdata)
+	if(NOT LLVM_PROFDATA)
+		message(FATAL_ERROR "llvm-profdata not found.")
+	endif()
+
+	execute_process(
+		COMMAND ${LLVM_PROFDATA} merge -output=${PROFILE_DIR}/default.profdata ${RAW_PROFILES}
+		RESULT_VARIABLE RESULT)
+	if(NOT RESULT EQUAL 0)
+		message(FATAL_ERROR "llvm-profdata merge failed.")
+	endif()
+endif()
+
+message(STATUS "Building optimized")
+build(${BINARY_DIR}/optimized -DCHIP8_PROFILE=use -DCHIP8_PROFILE_DIR=${PROFILE_DIR})
+
+# Alternate the binaries and keep the best run of each, to average out machine noise.
+message(STATUS "Timing ${RUNS} runs of ${FRAMES} frames per ROM")
+foreach(RUN RANGE 1 ${RUNS})
+	run_corpus(${BINARY_DIR}/plain/${EMULATOR} PLAIN)
+	run_corpus(${BINARY_DIR}/optimized/${EMULATOR} OPTIMIZED)
+	if(NOT BEST_PLAIN OR (PLAIN LESS BEST_PLAIN))
+		set(BEST_PLAIN ${PLAIN})
+	endif()
+	if(NOT BEST_OPTIMIZED OR (OPTIMIZED LESS BEST_OPTIMIZED))
+		set(BEST_OPTIMIZED ${OPTIMIZED})
+	endif()
+endforeach()
+
+math(EXPR PLAIN_MS "${BEST_PLAIN} / 1000")
+math(EXPR OPTIMIZED_MS "${BEST_OPTIMIZED} / 1000")
+math(EXPR SPEEDUP "(${BEST_PLAIN} * 100 + ${BEST_OPTIMIZED} / 2) / ${BEST_OPTIMIZED}")
+math(EXPR SPEEDUP_INTEGER "${SPEEDUP} / 100")
+math(EXPR SPEEDUP_FRACTION "${SPEEDUP} % 100")
+if(SPEEDUP_FRACTION LESS 10)
+	set(SPEEDUP_FRACTION "0${SPEEDUP_FRACTION}")
+endif()
+
+message(STATUS "Plain: ${PLAIN_MS} ms, optimized: ${OPTIMIZED_MS} ms, speedup: ${SPEEDUP_INTEGER}.${SPEEDUP_FRACTION}x")
+message(STATUS "Optimized emulator: ${BINARY_DIR}/optimized/${EMULATOR}")
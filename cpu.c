@@ -1,60 +1,60 @@
 #include "cpu.h"
+#include "cpu_internal.h"
+#include "native.h"
+#include "page.h"
 
 #include "log.h"
 
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
 /* Defines */
 
-#define PRINT_INSTR(str_) DEBUG_PRINT("%04x:%02x%02x %s\n", mem_offset(p_cpu, p_cpu->pc), *(p_cpu->pc), *(p_cpu->pc + 1), str_);
+#define PRINT_INSTR(str_) DEBUG_PRINT("%04x:%04x %s\n", p_cpu->pc, p_cpu->opcode, str_);
 
-#define FONT_CHAR_SIZE (5)
-#define FONT_CHAR_COUNT (16)
+#define RAND_SEED_DEFAULT (0x2545F491u)
 
-#define GRAPHICS_COLS (64)
-#define GRAPHICS_ROWS (32)
-#define GRAPHICS_SIZE (GRAPHICS_COLS * GRAPHICS_ROWS)
+#define WAIT_LOOP_LENGTH (3) /* FX07; 3X00; 1NNN */
 
-#define KEY_COUNT (16)
-
-#define REG_COUNT (16)
-
-#define MEM_SIZE (0x1000)
-
-#define FONT_ADDRESS (0x0000)
-#define FONT_SIZE (FONT_CHAR_SIZE * FONT_CHAR_COUNT)
-
-#define ROM_ADDRESS (0x0200)
-
-#define STACK_ADDRESS (0x0FA0)
+#define FUSED_LENGTH (3) /* Instructions in a superinstruction. */
 
 /* Typedefs */
 
-struct cpu_s
+typedef cpu_status_t (*opcode_handler_t)(cpu_t *p_cpu);
+
+typedef enum fused_kind_e
 {
-	uint8_t memory[MEM_SIZE];
-	uint8_t graphics[GRAPHICS_SIZE];
+	FUSED_NONE = 0,
+	FUSED_LOAD_LOAD_DRAW, /* 6XNN; 6YNN; DXYN */
+	FUSED_ADD_SKIP_JUMP,  /* 7XNN; 3XNN|4XNN; 1NNN */
+	FUSED_DELAY_SKIP_JUMP /* FX07; 3XNN|4XNN; 1NNN */
+} fused_kind_t;
 
-	uint8_t *font;
-	uint8_t *pc;
-	uint8_t *sp;
-	uint8_t *i;
+typedef struct fused_s
+{
+	uint16_t opcodes[FUSED_LENGTH];
+} fused_t;
 
-	uint8_t reg_v[REG_COUNT];
+struct cpu_pool_s
+{
+	uint32_t count;
+	struct cpu_s cpus[];
+};
 
-	uint8_t timer_delay;
-	uint8_t timer_sound;
+struct cpu_fusion_s
+{
+	atomic_uint refs;
 
-	uint8_t keys[KEY_COUNT];
+	/* Pages the sequences were decoded from, held so they cannot change. */
+	page_t *pages[MEM_PAGE_COUNT];
 
-	int draw_flag;
-	int halted_flag;
+	/* Indexed by the address of the first instruction, kinds apart so misses stay cheap. */
+	uint8_t kinds[MEM_SIZE];
+	fused_t sequences[MEM_SIZE];
 };
 
-typedef void (*opcode_handler_t)(cpu_t *p_cpu);
-
 /* Private variables */
 
 static const uint8_t fontset[FONT_SIZE] = {
@@ -78,24 +78,32 @@ static const uint8_t fontset[FONT_SIZE] = {
 
 /* Private function declarations */
 
-static void unhandled_opcode_handler(cpu_t *p_cpu);
-
-static void opcode00_handler(cpu_t *p_cpu);
-static void opcode01_handler(cpu_t *p_cpu);
-static void opcode02_handler(cpu_t *p_cpu);
-static void opcode03_handler(cpu_t *p_cpu);
-static void opcode04_handler(cpu_t *p_cpu);
-static void opcode05_handler(cpu_t *p_cpu);
-static void opcode06_handler(cpu_t *p_cpu);
-static void opcode07_handler(cpu_t *p_cpu);
-static void opcode08_handler(cpu_t *p_cpu);
-static void opcode09_handler(cpu_t *p_cpu);
-static void opcode10_handler(cpu_t *p_cpu);
-static void opcode11_handler(cpu_t *p_cpu);
-static void opcode12_handler(cpu_t *p_cpu);
-static void opcode13_handler(cpu_t *p_cpu);
-static void opcode14_handler(cpu_t *p_cpu);
-static void opcode15_handler(cpu_t *p_cpu);
+static void cpu_init(cpu_t *p_cpu);
+static void cpu_release_references(cpu_t *p_cpu);
+static int wait_loop_phase(const cpu_t *p_cpu, uint8_t *p_x);
+static cpu_status_t memory_own(cpu_t *p_cpu, uint16_t address, uint16_t size);
+static void fusion_release(struct cpu_fusion_s *p_fusion);
+static cpu_status_t fused_run_for(cpu_t *p_cpu, uint32_t cycles);
+static cpu_status_t fused_run(cpu_t *p_cpu, uint8_t kind, const fused_t *p_fused);
+
+static cpu_status_t unhandled_opcode_handler(cpu_t *p_cpu);
+
+static cpu_status_t opcode00_handler(cpu_t *p_cpu);
+static cpu_status_t opcode01_handler(cpu_t *p_cpu);
+static cpu_status_t opcode02_handler(cpu_t *p_cpu);
+static cpu_status_t opcode03_handler(cpu_t *p_cpu);
+static cpu_status_t opcode04_handler(cpu_t *p_cpu);
+static cpu_status_t opcode05_handler(cpu_t *p_cpu);
+static cpu_status_t opcode06_handler(cpu_t *p_cpu);
+static cpu_status_t opcode07_handler(cpu_t *p_cpu);
+static cpu_status_t opcode08_handler(cpu_t *p_cpu);
+static cpu_status_t opcode09_handler(cpu_t *p_cpu);
+static cpu_status_t opcode10_handler(cpu_t *p_cpu);
+static cpu_status_t opcode11_handler(cpu_t *p_cpu);
+static cpu_status_t opcode12_handler(cpu_t *p_cpu);
+static cpu_status_t opcode13_handler(cpu_t *p_cpu);
+static cpu_status_t opcode14_handler(cpu_t *p_cpu);
+static cpu_status_t opcode15_handler(cpu_t *p_cpu);
 
 static const opcode_handler_t opcode_handlers[16] = {
 	opcode00_handler,
@@ -117,241 +125,1260 @@ static const opcode_handler_t opcode_handlers[16] = {
 
 /* Inlined private function definitions */
 
-static inline uint8_t *mem_address(cpu_t *p_cpu, uint16_t offset)
+/* Callers own the page with memory_own first. */
+static inline void memory_write(cpu_t *p_cpu, uint16_t address, uint8_t value)
+{
+	address &= (uint16_t)(MEM_SIZE - 1);
+	p_cpu->pages[address >> PAGE_SHIFT_BITS]->data[address & (PAGE_BYTES - 1)] = value;
+}
+
+static inline cpu_status_t stack_push_pc(cpu_t *p_cpu)
+{
+	if (p_cpu->sp >= (STACK_ADDRESS + (STACK_DEPTH * sizeof(uint16_t))))
+	{
+		return CPU_ERROR_STACK;
+	}
+
+	uint16_t sp = p_cpu->sp + sizeof(uint16_t);
+	if (memory_own(p_cpu, sp, sizeof(uint16_t)) != CPU_OK)
+	{
+		return CPU_ERROR_MEMORY;
+	}
+
+	p_cpu->sp = sp;
+	memory_write(p_cpu, sp, (uint8_t)(p_cpu->pc >> 8));
+	memory_write(p_cpu, sp + 1, (uint8_t)p_cpu->pc);
+	return CPU_OK;
+}
+
+static inline cpu_status_t stack_pop_pc(cpu_t *p_cpu)
+{
+	if (p_cpu->sp <= STACK_ADDRESS)
+	{
+		return CPU_ERROR_STACK;
+	}
+
+	uint16_t address = (uint16_t)((cpu_read(p_cpu, p_cpu->sp) << 8) | cpu_read(p_cpu, p_cpu->sp + 1));
+	if (address >= MEM_SIZE)
+	{
+		return CPU_ERROR_ADDRESS;
+	}
+
+	p_cpu->pc = address;
+	p_cpu->sp -= sizeof(uint16_t);
+	return CPU_OK;
+}
+
+static inline uint16_t decode_NNN(const cpu_t *p_cpu)
+{
+	uint16_t nnn = p_cpu->opcode;
+	nnn &= (uint16_t)0x0FFF;
+	return nnn;
+}
+
+static inline uint8_t decode_NN(const cpu_t *p_cpu)
+{
+	uint8_t nn = (uint8_t)p_cpu->opcode;
+	return nn;
+}
+
+static inline uint8_t decode_N(const cpu_t *p_cpu)
+{
+	uint8_t n = (uint8_t)p_cpu->opcode;
+	n &= (uint8_t)0x0F;
+	return n;
+}
+
+static inline uint8_t decode_X(const cpu_t *p_cpu)
+{
+	uint8_t x = (uint8_t)(p_cpu->opcode >> 8);
+	x &= (uint8_t)0x0F;
+	return x;
+}
+
+static inline uint8_t decode_Y(const cpu_t *p_cpu)
+{
+	uint8_t y = (uint8_t)p_cpu->opcode;
+	y >>= 4;
+	y &= (uint8_t)0x0F;
+	return y;
+}
+
+static inline uint8_t decode_op(const cpu_t *p_cpu)
+{
+	uint8_t op = (uint8_t)(p_cpu->opcode >> 8);
+	op >>= 4;
+	op &= (uint8_t)0x0F;
+	return op;
+}
+
+/* Public function definitions */
+
+cpu_t *cpu_allocate(void)
+{
+	cpu_t *p_cpu = calloc(1, sizeof(struct cpu_s));
+
+	if (p_cpu)
+	{
+		cpu_init(p_cpu);
+	}
+
+	return p_cpu;
+}
+
+void cpu_free(cpu_t *p_cpu)
+{
+	if (p_cpu)
+	{
+		cpu_release_references(p_cpu);
+
+		if (p_cpu->pooled)
+		{
+			/* Pool slots go back to their freshly allocated state. */
+			(void)memset(p_cpu, 0, sizeof(struct cpu_s));
+			cpu_init(p_cpu);
+			p_cpu->pooled = 1;
+		}
+		else
+		{
+			free(p_cpu);
+		}
+	}
+}
+
+cpu_pool_t *cpu_pool_allocate(uint32_t count)
+{
+	cpu_pool_t *p_pool = calloc(1, sizeof(struct cpu_pool_s) + (count * sizeof(struct cpu_s)));
+
+	if (p_pool)
+	{
+		p_pool->count = count;
+
+		for (uint32_t index = 0; index < count; index++)
+		{
+			cpu_init(&(p_pool->cpus[index]));
+			p_pool->cpus[index].pooled = 1;
+		}
+	}
+
+	return p_pool;
+}
+
+void cpu_pool_free(cpu_pool_t *p_pool)
+{
+	if (p_pool)
+	{
+		for (uint32_t index = 0; index < p_pool->count; index++)
+		{
+			cpu_release_references(&(p_pool->cpus[index]));
+		}
+
+		free(p_pool);
+	}
+}
+
+cpu_t *cpu_pool_get(cpu_pool_t *p_pool, uint32_t index)
+{
+	if (p_pool && (index < p_pool->count))
+	{
+		return &(p_pool->cpus[index]);
+	}
+	else
+	{
+		return NULL;
+	}
+}
+
+cpu_status_t cpu_fork(cpu_t *p_dst, const cpu_t *p_src)
+{
+	if (!p_dst || !p_src)
+	{
+		return CPU_ERROR_ARGUMENT;
+	}
+
+	if (p_dst == p_src)
+	{
+		return CPU_OK;
+	}
+
+	/* XO-CHIP state is copied, into the buffer p_dst already has if any. */
+	struct cpu_xo_s *p_xo = p_dst->xo;
+	if (p_src->xo && !p_xo)
+	{
+		p_xo = malloc(sizeof(struct cpu_xo_s));
+		if (!p_xo)
+		{
+			return CPU_ERROR_MEMORY;
+		}
+	}
+	p_dst->xo = NULL;
+
+	/* Take the references first, p_dst may already share pages with p_src. */
+	for (uint32_t page = 0; page < MEM_PAGE_COUNT; page++)
+	{
+		(void)page_retain(p_src->pages[page]);
+	}
+	(void)page_retain(p_src->graphics);
+	if (p_src->fusion)
+	{
+		(void)atomic_fetch_add_explicit(&(p_src->fusion->refs), 1, memory_order_relaxed);
+	}
+
+	cpu_release_references(p_dst);
+
+	uint8_t pooled = p_dst->pooled;
+	(void)memcpy(p_dst, p_src, sizeof(struct cpu_s));
+	p_dst->pooled = pooled;
+
+	if (p_src->xo)
+	{
+		(void)memcpy(p_xo, p_src->xo, sizeof(struct cpu_xo_s));
+		p_dst->xo = p_xo;
+	}
+	else
+	{
+		free(p_xo);
+	}
+
+	return CPU_OK;
+}
+
+uint32_t cpu_pool_fork_run(cpu_pool_t *p_pool, uint32_t first, const cpu_t *p_src, const uint16_t *masks,
+						   uint32_t count, uint32_t cycles, cpu_status_t *p_statuses)
+{
+	if (!p_pool || !p_src || !masks || (first > p_pool->count))
+	{
+		return 0;
+	}
+
+	if (count > (p_pool->count - first))
+	{
+		count = p_pool->count - first;
+	}
+
+	for (uint32_t index = 0; index < count; index++)
+	{
+		cpu_t *p_child = &(p_pool->cpus[first + index]);
+
+		cpu_status_t status = cpu_fork(p_child, p_src);
+		if (status == CPU_OK)
+		{
+			p_child->keys = masks[index];
+			status = cpu_run_for(p_child, cycles);
+		}
+
+		if (p_statuses)
+		{
+			p_statuses[index] = status;
+		}
+	}
+
+	return count;
+}
+
+void cpu_seed(cpu_t *p_cpu, uint32_t seed)
+{
+	if (p_cpu)
+	{
+		/* xorshift has a fixed point at zero. */
+		p_cpu->rand_state = seed ? seed : RAND_SEED_DEFAULT;
+	}
+}
+
+cpu_status_t cpu_load(cpu_t *p_cpu, const uint8_t *program, size_t size)
+{
+	if (!p_cpu || !program || (size > CPU_PROGRAM_SIZE_MAX))
+	{
+		return CPU_ERROR_ARGUMENT;
+	}
+
+	cpu_image_t *p_image = cpu_image_allocate(program, size);
+	if (!p_image)
+	{
+		ERROR_PRINT("cpu_image_allocate failed.\n");
+		return CPU_ERROR_MEMORY;
+	}
+
+	cpu_status_t status = cpu_load_image(p_cpu, p_image);
+	cpu_image_free(p_image);
+
+	return status;
+}
+
+cpu_image_t *cpu_image_allocate(const uint8_t *program, size_t size)
+{
+	return cpu_image_allocate_mode(program, size, CPU_MODE_CHIP8);
+}
+
+cpu_image_t *cpu_image_allocate_mode(const uint8_t *program, size_t size, cpu_mode_t mode)
+{
+	size_t size_max = (mode == CPU_MODE_XO) ? CPU_XO_PROGRAM_SIZE_MAX : CPU_PROGRAM_SIZE_MAX;
+	if (!program || (size > size_max))
+	{
+		return NULL;
+	}
+
+	cpu_image_t *p_image = calloc(1, sizeof(struct cpu_image_s));
+	if (!p_image)
+	{
+		return NULL;
+	}
+
+	/* XO-CHIP memory is flat, copied by each cpu the image is loaded on. */
+	if (mode == CPU_MODE_XO)
+	{
+		p_image->xo_memory = calloc(1, XO_MEM_SIZE);
+		if (!p_image->xo_memory)
+		{
+			free(p_image);
+			return NULL;
+		}
+
+		(void)memcpy(p_image->xo_memory + FONT_ADDRESS, fontset, sizeof(fontset));
+		xo_font(p_image->xo_memory);
+		(void)memcpy(p_image->xo_memory + ROM_ADDRESS, program, size);
+
+		/* CHIP-8 pages stay zero, as cpus in XO-CHIP mode do not use them. */
+		for (uint32_t page = 0; page < MEM_PAGE_COUNT; page++)
+		{
+			p_image->pages[page] = page_zero();
+		}
+
+		return p_image;
+	}
+
+	uint8_t memory[MEM_SIZE];
+	(void)memset(memory, 0, MEM_SIZE);
+	(void)memcpy(memory + FONT_ADDRESS, fontset, sizeof(fontset));
+	(void)memcpy(memory + ROM_ADDRESS, program, size);
+
+	/* Untouched pages all share the zero page. */
+	static const uint8_t zero[PAGE_BYTES];
+	for (uint32_t page = 0; page < MEM_PAGE_COUNT; page++)
+	{
+		const uint8_t *data = memory + (page * PAGE_BYTES);
+
+		if (memcmp(data, zero, PAGE_BYTES) == 0)
+		{
+			p_image->pages[page] = page_zero();
+			continue;
+		}
+
+		p_image->pages[page] = page_allocate();
+		if (!p_image->pages[page])
+		{
+			cpu_image_free(p_image);
+			return NULL;
+		}
+
+		(void)memcpy(p_image->pages[page]->data, data, PAGE_BYTES);
+	}
+
+	return p_image;
+}
+
+void cpu_image_free(cpu_image_t *p_image)
+{
+	if (p_image)
+	{
+		for (uint32_t page = 0; page < MEM_PAGE_COUNT; page++)
+		{
+			page_release(p_image->pages[page]);
+		}
+
+		fusion_release(p_image->fusion);
+		free(p_image->xo_memory);
+		free(p_image);
+	}
+}
+
+cpu_status_t cpu_image_fuse(cpu_image_t *p_image)
+{
+	if (!p_image)
+	{
+		return CPU_ERROR_ARGUMENT;
+	}
+
+	/* Superinstructions are CHIP-8 only. */
+	if (p_image->fusion || p_image->xo_memory)
+	{
+		return CPU_OK;
+	}
+
+	struct cpu_fusion_s *p_fusion = calloc(1, sizeof(struct cpu_fusion_s));
+	if (!p_fusion)
+	{
+		return CPU_ERROR_MEMORY;
+	}
+
+	atomic_init(&(p_fusion->refs), 1);
+	for (uint32_t page = 0; page < MEM_PAGE_COUNT; page++)
+	{
+		p_fusion->pages[page] = page_retain(p_image->pages[page]);
+	}
+
+	uint32_t count = 0;
+	for (uint16_t address = 0; address <= (MEM_SIZE - (2 * FUSED_LENGTH)); address++)
+	{
+		fused_t *p_fused = &(p_fusion->sequences[address]);
+
+		for (uint16_t index = 0; index < FUSED_LENGTH; index++)
+		{
+			uint16_t first = address + (2 * index);
+			uint16_t second = first + 1;
+			p_fused->opcodes[index] = (uint16_t)(
+				(p_image->pages[first >> PAGE_SHIFT_BITS]->data[first & (PAGE_BYTES - 1)] << 8) |
+				p_image->pages[second >> PAGE_SHIFT_BITS]->data[second & (PAGE_BYTES - 1)]);
+		}
+
+		uint16_t op0 = p_fused->opcodes[0] & (uint16_t)0xF000;
+		uint16_t op1 = p_fused->opcodes[1] & (uint16_t)0xF000;
+		uint16_t op2 = p_fused->opcodes[2] & (uint16_t)0xF000;
+		int skip_jump = ((op1 == 0x3000) || (op1 == 0x4000)) && (op2 == 0x1000);
+
+		if ((op0 == 0x6000) && (op1 == 0x6000) && (op2 == 0xD000))
+		{
+			p_fusion->kinds[address] = FUSED_LOAD_LOAD_DRAW;
+		}
+		else if ((op0 == 0x7000) && skip_jump)
+		{
+			p_fusion->kinds[address] = FUSED_ADD_SKIP_JUMP;
+		}
+		else if (((p_fused->opcodes[0] & (uint16_t)0xF0FF) == 0xF007) && skip_jump)
+		{
+			p_fusion->kinds[address] = FUSED_DELAY_SKIP_JUMP;
+		}
+
+		count += (p_fusion->kinds[address] != FUSED_NONE);
+	}
+
+	/* Without sequences the table would only slow cpu_run_for down. */
+	if (count)
+	{
+		p_image->fusion = p_fusion;
+	}
+	else
+	{
+		fusion_release(p_fusion);
+	}
+
+	return CPU_OK;
+}
+
+cpu_status_t cpu_load_image(cpu_t *p_cpu, const cpu_image_t *p_image)
+{
+	if (!p_cpu || !p_image)
+	{
+		return CPU_ERROR_ARGUMENT;
+	}
+
+	if (p_image->xo_memory)
+	{
+		if (!p_cpu->xo)
+		{
+			p_cpu->xo = calloc(1, sizeof(struct cpu_xo_s));
+			if (!p_cpu->xo)
+			{
+				return CPU_ERROR_MEMORY;
+			}
+		}
+
+		xo_reset(p_cpu->xo, p_image->xo_memory);
+	}
+	else
+	{
+		free(p_cpu->xo);
+		p_cpu->xo = NULL;
+	}
+
+	p_cpu->pc = ROM_ADDRESS;
+
+	for (uint32_t page = 0; page < MEM_PAGE_COUNT; page++)
+	{
+		page_release(p_cpu->pages[page]);
+		p_cpu->pages[page] = page_retain(p_image->pages[page]);
+	}
+
+	fusion_release(p_cpu->fusion);
+	p_cpu->fusion = p_image->fusion;
+	if (p_cpu->fusion)
+	{
+		(void)atomic_fetch_add_explicit(&(p_cpu->fusion->refs), 1, memory_order_relaxed);
+	}
+
+	/* Back to the power-on state, the seed, timer period and native module are configuration and kept. */
+	page_release(p_cpu->graphics);
+	p_cpu->graphics = page_zero();
+
+	p_cpu->sp = STACK_ADDRESS;
+	p_cpu->i = 0;
+	p_cpu->opcode = 0;
+	(void)memset(p_cpu->reg_v, 0, sizeof(p_cpu->reg_v));
+
+	p_cpu->cycles = 0;
+	p_cpu->idle_cycles = 0;
+	p_cpu->timer_delay = 0;
+	p_cpu->timer_sound = 0;
+	p_cpu->timer_delay_cycle = 0;
+	p_cpu->timer_sound_cycle = 0;
+
+	p_cpu->keys = 0;
+	p_cpu->draw_flag = 0;
+	p_cpu->halted_flag = 0;
+	p_cpu->keys_read_flag = 0;
+
+	return CPU_OK;
+}
+
+cpu_mode_t cpu_mode(cpu_t *p_cpu)
+{
+	if (p_cpu && p_cpu->xo)
+	{
+		return CPU_MODE_XO;
+	}
+	else
+	{
+		return CPU_MODE_CHIP8;
+	}
+}
+
+size_t cpu_footprint(cpu_t *p_cpu)
+{
+	if (!p_cpu)
+	{
+		return 0;
+	}
+
+	size_t size = sizeof(struct cpu_s);
+	for (uint32_t page = 0; page < MEM_PAGE_COUNT; page++)
+	{
+		if (!page_shared(p_cpu->pages[page]))
+		{
+			size += sizeof(page_t);
+		}
+	}
+
+	if (!page_shared(p_cpu->graphics))
+	{
+		size += sizeof(page_t);
+	}
+
+	if (p_cpu->xo)
+	{
+		size += sizeof(struct cpu_xo_s);
+	}
+
+	return size;
+}
+
+cpu_status_t cpu_run(cpu_t *p_cpu)
+{
+	if (!p_cpu)
+	{
+		return CPU_ERROR_ARGUMENT;
+	}
+
+	if (p_cpu->xo)
+	{
+		return xo_run(p_cpu);
+	}
+
+	if (p_cpu->pc > (MEM_SIZE - 2))
+	{
+		return CPU_ERROR_ADDRESS;
+	}
+
+	p_cpu->opcode = (uint16_t)((cpu_read(p_cpu, p_cpu->pc) << 8) | cpu_read(p_cpu, p_cpu->pc + 1));
+
+	cpu_status_t status = opcode_handlers[decode_op(p_cpu)](p_cpu);
+	if (status == CPU_OK)
+	{
+		p_cpu->cycles++;
+	}
+
+	return status;
+}
+
+cpu_status_t cpu_run_for(cpu_t *p_cpu, uint32_t cycles)
+{
+	if (p_cpu && p_cpu->xo)
+	{
+		for (uint32_t cycle = 0; cycle < cycles; cycle++)
+		{
+			cpu_status_t status = xo_run(p_cpu);
+			if (status != CPU_OK)
+			{
+				return status;
+			}
+		}
+
+		return CPU_OK;
+	}
+
+	if (p_cpu && p_cpu->native)
+	{
+		return native_run_for(p_cpu->native, p_cpu, cycles);
+	}
+
+	if (p_cpu && p_cpu->fusion)
+	{
+		return fused_run_for(p_cpu, cycles);
+	}
+
+	for (uint32_t cycle = 0; cycle < cycles; cycle++)
+	{
+		cpu_status_t status = cpu_run(p_cpu);
+		if (status != CPU_OK)
+		{
+			return status;
+		}
+	}
+
+	return CPU_OK;
+}
+
+const char *cpu_status_string(cpu_status_t status)
+{
+	switch (status)
+	{
+	case CPU_OK:
+		return "ok";
+	case CPU_ERROR_ARGUMENT:
+		return "invalid argument";
+	case CPU_ERROR_ADDRESS:
+		return "address out of bound";
+	case CPU_ERROR_MEMORY:
+		return "out of memory";
+	case CPU_ERROR_OPCODE:
+		return "unhandled opcode";
+	case CPU_ERROR_STACK:
+		return "stack overflow or underflow";
+	default:
+		return "unknown status";
+	}
+}
+
+int cpu_halted(cpu_t *p_cpu)
+{
+	if (p_cpu)
+	{
+		return p_cpu->halted_flag;
+	}
+	else
+	{
+		return 0;
+	}
+}
+
+uint32_t cpu_wait_cycles(cpu_t *p_cpu)
+{
+	uint8_t x;
+	int phase = p_cpu ? wait_loop_phase(p_cpu, &x) : -1;
+	if (phase < 0)
+	{
+		return 0;
+	}
+
+	/* Cycles until pc is back at FX07, then first cycle at which FX07 reads zero. */
+	uint32_t align = (uint32_t)(WAIT_LOOP_LENGTH - phase) % WAIT_LOOP_LENGTH;
+	uint64_t start = p_cpu->cycles + align;
+	uint64_t expiry = p_cpu->timer_delay_cycle + ((uint64_t)p_cpu->timer_delay * p_cpu->timer_period);
+	if (expiry <= start)
+	{
+		return 0;
+	}
+
+	uint64_t iterations = (expiry - start + WAIT_LOOP_LENGTH - 1) / WAIT_LOOP_LENGTH;
+	if (iterations > ((UINT32_MAX / WAIT_LOOP_LENGTH) - 1))
+	{
+		iterations = (UINT32_MAX / WAIT_LOOP_LENGTH) - 1;
+	}
+
+	return align + (uint32_t)(iterations * WAIT_LOOP_LENGTH);
+}
+
+void cpu_skip_wait(cpu_t *p_cpu, uint32_t cycles)
+{
+	uint8_t x;
+	int phase = p_cpu ? wait_loop_phase(p_cpu, &x) : -1;
+	if (phase < 0)
+	{
+		return;
+	}
+
+	uint32_t wait = cpu_wait_cycles(p_cpu);
+	uint32_t align = (uint32_t)(WAIT_LOOP_LENGTH - phase) % WAIT_LOOP_LENGTH;
+	if (cycles > wait)
+	{
+		cycles = wait;
+	}
+
+	if (cycles < align)
+	{
+		return;
+	}
+
+	/* Run the rest of the current iteration, then skip whole ones. */
+	for (uint32_t step = 0; step < align; step++)
+	{
+		(void)cpu_run(p_cpu);
+	}
+
+	cycles -= align;
+	cycles -= cycles % WAIT_LOOP_LENGTH;
+
+	if (cycles)
+	{
+		/* VX holds what the last skipped FX07 would have read. */
+		p_cpu->cycles += cycles - WAIT_LOOP_LENGTH;
+		p_cpu->reg_v[x] = cpu_timer_value(p_cpu, p_cpu->timer_delay, p_cpu->timer_delay_cycle);
+		p_cpu->cycles += WAIT_LOOP_LENGTH;
+		p_cpu->idle_cycles += cycles;
+	}
+}
+
+void cpu_set_timer_period(cpu_t *p_cpu, uint32_t cycles)
+{
+	if (p_cpu && cycles)
+	{
+		/* Rebase running timers so their current values are preserved. */
+		p_cpu->timer_delay = cpu_timer_value(p_cpu, p_cpu->timer_delay, p_cpu->timer_delay_cycle);
+		p_cpu->timer_sound = cpu_timer_value(p_cpu, p_cpu->timer_sound, p_cpu->timer_sound_cycle);
+		p_cpu->timer_delay_cycle = p_cpu->cycles;
+		p_cpu->timer_sound_cycle = p_cpu->cycles;
+
+		p_cpu->timer_period = cycles;
+	}
+}
+
+uint64_t cpu_cycles(cpu_t *p_cpu)
+{
+	if (p_cpu)
+	{
+		return p_cpu->cycles;
+	}
+	else
+	{
+		return 0;
+	}
+}
+
+uint64_t cpu_instructions(cpu_t *p_cpu)
+{
+	if (p_cpu)
+	{
+		return p_cpu->cycles - p_cpu->idle_cycles;
+	}
+	else
+	{
+		return 0;
+	}
+}
+
+void cpu_idle(cpu_t *p_cpu, uint32_t cycles)
+{
+	if (p_cpu)
+	{
+		p_cpu->cycles += cycles;
+		p_cpu->idle_cycles += cycles;
+	}
+}
+
+int cpu_sound_active(cpu_t *p_cpu)
+{
+	if (p_cpu)
+	{
+		return cpu_timer_value(p_cpu, p_cpu->timer_sound, p_cpu->timer_sound_cycle) ? 1 : 0;
+	}
+	else
+	{
+		return 0;
+	}
+}
+
+int cpu_keys_read(cpu_t *p_cpu)
+{
+	if (p_cpu)
+	{
+		int flag = p_cpu->keys_read_flag;
+		p_cpu->keys_read_flag = 0;
+		return flag;
+	}
+	else
+	{
+		return 0;
+	}
+}
+
+int cpu_graphics_changed(cpu_t *p_cpu)
 {
-	if (offset >= MEM_SIZE)
+	if (p_cpu)
+	{
+		int flag = p_cpu->draw_flag;
+		p_cpu->draw_flag = 0;
+		return flag;
+	}
+	else
 	{
-		ERROR_PRINT("ADDRESS OUT OF BOUND.");
-		exit(-1);
+		return 0;
 	}
-	return p_cpu->memory + offset;
 }
 
-static inline uint16_t mem_offset(cpu_t *p_cpu, uint8_t *address)
+const uint8_t *cpu_graphics(cpu_t *p_cpu)
 {
-	uint16_t offset = (uint16_t)(address - p_cpu->memory);
-	if (offset >= MEM_SIZE)
+	if (p_cpu && p_cpu->xo)
+	{
+		return xo_view(p_cpu->xo);
+	}
+	else if (p_cpu)
+	{
+		return p_cpu->graphics->data;
+	}
+	else
 	{
-		ERROR_PRINT("ADDRESS OUT OF BOUND.");
-		exit(-1);
+		return NULL;
 	}
-	return (uint16_t)(address - p_cpu->memory);
 }
 
-static inline void stack_push_pc(cpu_t *p_cpu)
+void cpu_compose(cpu_t *p_cpu, const uint32_t *palette, uint32_t *pixels)
 {
-	p_cpu->sp += sizeof(uint16_t);
-	*((uint16_t *)p_cpu->sp) = mem_offset(p_cpu, p_cpu->pc);
+	if (!p_cpu || !palette || !pixels)
+	{
+		return;
+	}
+
+	const uint8_t *planes[CPU_PLANE_COUNT] = {NULL, NULL, NULL, NULL};
+	if (p_cpu->xo)
+	{
+		for (uint32_t plane = 0; plane < CPU_PLANE_COUNT; plane++)
+		{
+			planes[plane] = p_cpu->xo->planes[plane];
+		}
+
+		xo_compose(planes, palette, pixels);
+		return;
+	}
+
+	/* CHIP-8 pixels as XO-CHIP low resolution ones, 2x2. */
+	uint8_t plane[XO_PLANE_SIZE];
+	const uint8_t *graphics = p_cpu->graphics->data;
+	for (uint32_t row = 0; row < GRAPHICS_ROWS; row++)
+	{
+		uint8_t *line = plane + (2 * row * XO_ROW_SIZE);
+		for (uint32_t column = 0; column < GRAPHICS_ROW_SIZE; column++)
+		{
+			uint32_t doubled = xo_pixels_double((uint16_t)(graphics[(row * GRAPHICS_ROW_SIZE) + column] << 8));
+			line[2 * column] = (uint8_t)(doubled >> 24);
+			line[(2 * column) + 1] = (uint8_t)(doubled >> 16);
+		}
+		(void)memcpy(line + XO_ROW_SIZE, line, XO_ROW_SIZE);
+	}
+
+	planes[0] = plane;
+	xo_compose(planes, palette, pixels);
 }
 
-static inline void stack_pop_pc(cpu_t *p_cpu)
+int cpu_audio_pattern(cpu_t *p_cpu, uint8_t *pattern, uint8_t *p_pitch)
 {
-	p_cpu->pc = mem_address(p_cpu, *((uint16_t *)p_cpu->sp));
-	p_cpu->sp -= sizeof(uint16_t);
+	if (!p_cpu || !p_cpu->xo || !p_cpu->xo->pattern_loaded)
+	{
+		return 0;
+	}
+
+	if (pattern)
+	{
+		(void)memcpy(pattern, p_cpu->xo->pattern, CPU_AUDIO_PATTERN_SIZE);
+	}
+	if (p_pitch)
+	{
+		*p_pitch = p_cpu->xo->pitch;
+	}
+
+	return 1;
 }
 
-static inline uint16_t decode_NNN(const cpu_t *p_cpu)
+void cpu_press_key(cpu_t *p_cpu, uint8_t key)
 {
-	uint16_t nnn = *p_cpu->pc;
-	nnn <<= 8;
-	nnn |= *(p_cpu->pc + 1);
-	nnn &= (uint16_t)0x0FFF;
-	return nnn;
+	if (p_cpu && (key < KEY_COUNT))
+	{
+		p_cpu->keys |= (uint16_t)(1u << key);
+	}
 }
 
-static inline uint8_t decode_NN(const cpu_t *p_cpu)
+void cpu_release_key(cpu_t *p_cpu, uint8_t key)
 {
-	uint8_t nn = *(p_cpu->pc + 1);
-	return nn;
+	if (p_cpu && (key < KEY_COUNT))
+	{
+		p_cpu->keys &= (uint16_t)~(1u << key);
+	}
 }
 
-static inline uint8_t decode_N(const cpu_t *p_cpu)
+void cpu_set_keys(cpu_t *p_cpu, uint16_t mask)
 {
-	uint8_t n = *(p_cpu->pc + 1);
-	n &= (uint8_t)0x0F;
-	return n;
+	if (p_cpu)
+	{
+		p_cpu->keys = mask;
+	}
 }
 
-static inline uint8_t decode_X(const cpu_t *p_cpu)
+void cpu_registers(cpu_t *p_cpu, cpu_registers_t *p_registers)
 {
-	uint8_t x = *p_cpu->pc;
-	x &= (uint8_t)0x0F;
-	return x;
+	if (p_cpu && p_registers)
+	{
+		(void)memcpy(p_registers->v, p_cpu->reg_v, sizeof(p_registers->v));
+		p_registers->i = p_cpu->i;
+		p_registers->pc = p_cpu->pc;
+		p_registers->sp = p_cpu->sp;
+		p_registers->delay = cpu_timer_value(p_cpu, p_cpu->timer_delay, p_cpu->timer_delay_cycle);
+		p_registers->sound = cpu_timer_value(p_cpu, p_cpu->timer_sound, p_cpu->timer_sound_cycle);
+	}
 }
 
-static inline uint8_t decode_Y(const cpu_t *p_cpu)
+uint8_t cpu_peek(cpu_t *p_cpu, uint16_t address)
 {
-	uint8_t y = *(p_cpu->pc + 1);
-	y >>= 4;
-	y &= (uint8_t)0x0F;
-	return y;
+	if (p_cpu && p_cpu->xo)
+	{
+		return p_cpu->xo->memory[address];
+	}
+	else if (p_cpu && (address < MEM_SIZE))
+	{
+		return cpu_read(p_cpu, address);
+	}
+	else
+	{
+		return 0;
+	}
 }
 
-static inline uint8_t decode_op(const cpu_t *p_cpu)
+cpu_status_t cpu_poke(cpu_t *p_cpu, uint16_t address, const uint8_t *data, uint16_t size)
 {
-	uint8_t op = *p_cpu->pc;
-	op >>= 4;
-	op &= (uint8_t)0x0F;
-	return op;
-}
+	if (!p_cpu || (!data && size))
+	{
+		return CPU_ERROR_ARGUMENT;
+	}
 
-/* Public function definitions */
+	if (p_cpu->xo)
+	{
+		if (size > (XO_MEM_SIZE - address))
+		{
+			return CPU_ERROR_ADDRESS;
+		}
 
-cpu_t *cpu_allocate(void)
-{
-	cpu_t *p_cpu = calloc(1, sizeof(struct cpu_s));
+		(void)memcpy(p_cpu->xo->memory + address, data, size);
+		return CPU_OK;
+	}
 
-	if (p_cpu)
+	if ((address > MEM_SIZE) || (size > (MEM_SIZE - address)))
 	{
-		p_cpu->sp = mem_address(p_cpu, STACK_ADDRESS);
-		p_cpu->pc = mem_address(p_cpu, ROM_ADDRESS);
-		p_cpu->font = mem_address(p_cpu, FONT_ADDRESS);
-		p_cpu->i = mem_address(p_cpu, 0);
+		return CPU_ERROR_ADDRESS;
 	}
 
-	return p_cpu;
+	cpu_status_t status = memory_own(p_cpu, address, size);
+	if (status != CPU_OK)
+	{
+		return status;
+	}
+
+	/* Page by page, the range is in bound. */
+	while (size)
+	{
+		uint16_t offset = address & (PAGE_BYTES - 1);
+		uint16_t chunk = (uint16_t)(PAGE_BYTES - offset);
+		if (chunk > size)
+		{
+			chunk = size;
+		}
+
+		(void)memcpy(p_cpu->pages[address >> PAGE_SHIFT_BITS]->data + offset, data, chunk);
+
+		address = (uint16_t)(address + chunk);
+		data += chunk;
+		size = (uint16_t)(size - chunk);
+	}
+
+	return CPU_OK;
 }
 
-void cpu_load(cpu_t *p_cpu, uint8_t *program, uint16_t size)
+/* Private function definitions */
+
+static void cpu_init(cpu_t *p_cpu)
 {
-	if (p_cpu && program)
+	for (uint32_t page = 0; page < MEM_PAGE_COUNT; page++)
 	{
-		p_cpu->pc = mem_address(p_cpu, ROM_ADDRESS);
-
-		(void)memset(p_cpu->memory, 0, MEM_SIZE);
-		(void)memcpy(p_cpu->pc, program, size);
-		(void)memcpy(p_cpu->font, fontset, sizeof(fontset));
+		p_cpu->pages[page] = page_zero();
 	}
+	p_cpu->graphics = page_zero();
+
+	p_cpu->sp = STACK_ADDRESS;
+	p_cpu->pc = ROM_ADDRESS;
+	p_cpu->i = 0;
+	p_cpu->timer_period = TIMER_PERIOD_DEFAULT;
+	p_cpu->rand_state = RAND_SEED_DEFAULT;
 }
 
-void cpu_run(cpu_t *p_cpu)
+static void cpu_release_references(cpu_t *p_cpu)
 {
-	if (p_cpu)
+	for (uint32_t page = 0; page < MEM_PAGE_COUNT; page++)
 	{
-		opcode_handlers[decode_op(p_cpu)](p_cpu);
+		page_release(p_cpu->pages[page]);
 	}
+	page_release(p_cpu->graphics);
+
+	fusion_release(p_cpu->fusion);
+	free(p_cpu->xo);
 }
 
-int cpu_halted(cpu_t *p_cpu)
+static int wait_loop_phase(const cpu_t *p_cpu, uint8_t *p_x)
 {
-	if (p_cpu)
+	/* XO-CHIP cpus run their waits. */
+	if (p_cpu->xo)
 	{
-		return p_cpu->halted_flag;
+		return -1;
 	}
-	else
+
+	/* FX07; 3X00; 1NNN with NNN pointing back at FX07, pc may be on any of them. */
+	for (int phase = 0; phase < WAIT_LOOP_LENGTH; phase++)
 	{
-		return 0;
+		int start = (int)p_cpu->pc - (2 * phase);
+		if ((start < 0) || (start > (MEM_SIZE - (2 * WAIT_LOOP_LENGTH))))
+		{
+			continue;
+		}
+
+		uint8_t code[2 * WAIT_LOOP_LENGTH];
+		for (int offset = 0; offset < (2 * WAIT_LOOP_LENGTH); offset++)
+		{
+			code[offset] = cpu_read(p_cpu, (uint16_t)(start + offset));
+		}
+		uint8_t x = code[0] & (uint8_t)0x0F;
+
+		if (((code[0] & (uint8_t)0xF0) != 0xF0) || (code[1] != 0x07) ||
+			(code[2] != (0x30 | x)) || (code[3] != 0x00) ||
+			(code[4] != (0x10 | (start >> 8))) || (code[5] != (uint8_t)start))
+		{
+			continue;
+		}
+
+		/* Past the read of a zero, the loop is exiting. */
+		if ((phase == 1) && (p_cpu->reg_v[x] == 0))
+		{
+			return -1;
+		}
+
+		*p_x = x;
+		return phase;
 	}
+
+	return -1;
 }
 
-void cpu_tick(cpu_t *p_cpu)
+static cpu_status_t memory_own(cpu_t *p_cpu, uint16_t address, uint16_t size)
 {
-	if (p_cpu)
+	/* Copy every shared page of the range before the first write, so a failure changes nothing. */
+	for (uint32_t offset = 0; offset < size;)
 	{
-		if (p_cpu->timer_delay)
-			p_cpu->timer_delay--;
+		uint16_t current = (uint16_t)((address + offset) & (MEM_SIZE - 1));
 
-		if (p_cpu->timer_sound)
-			p_cpu->timer_sound--;
+		if (!page_unshare(&(p_cpu->pages[current >> PAGE_SHIFT_BITS])))
+		{
+			return CPU_ERROR_MEMORY;
+		}
+
+		/* Next page of the range. */
+		offset += PAGE_BYTES - (current & (PAGE_BYTES - 1));
 	}
+
+	return CPU_OK;
 }
 
-int cpu_graphics_changed(cpu_t *p_cpu)
+static void fusion_release(struct cpu_fusion_s *p_fusion)
 {
-	if (p_cpu)
-	{
-		int flag = p_cpu->draw_flag;
-		p_cpu->draw_flag = 0;
-		return flag;
-	}
-	else
+	if (p_fusion && (atomic_fetch_sub_explicit(&(p_fusion->refs), 1, memory_order_acq_rel) == 1))
 	{
-		return 0;
+		for (uint32_t page = 0; page < MEM_PAGE_COUNT; page++)
+		{
+			page_release(p_fusion->pages[page]);
+		}
+
+		free(p_fusion);
 	}
 }
 
-uint8_t *cpu_graphics(cpu_t *p_cpu)
+static cpu_status_t fused_run_for(cpu_t *p_cpu, uint32_t cycles)
 {
-	if (p_cpu)
-	{
-		return p_cpu->graphics;
-	}
-	else
+	const struct cpu_fusion_s *p_fusion = p_cpu->fusion;
+
+	uint32_t cycle = 0;
+	while (cycle < cycles)
 	{
-		return NULL;
+		uint16_t pc = p_cpu->pc;
+		uint8_t kind = (pc < MEM_SIZE) ? p_fusion->kinds[pc] : FUSED_NONE;
+
+		/* Fused only while both pages the sequence spans are the ones it was decoded from. */
+		if ((kind != FUSED_NONE) && ((cycles - cycle) >= FUSED_LENGTH) &&
+			(p_cpu->pages[pc >> PAGE_SHIFT_BITS] == p_fusion->pages[pc >> PAGE_SHIFT_BITS]) &&
+			(p_cpu->pages[(pc + (2 * FUSED_LENGTH) - 1) >> PAGE_SHIFT_BITS] ==
+			 p_fusion->pages[(pc + (2 * FUSED_LENGTH) - 1) >> PAGE_SHIFT_BITS]))
+		{
+			uint64_t start = p_cpu->cycles;
+
+			cpu_status_t status = fused_run(p_cpu, kind, &(p_fusion->sequences[pc]));
+			if (status != CPU_OK)
+			{
+				return status;
+			}
+
+			cycle += (uint32_t)(p_cpu->cycles - start);
+			continue;
+		}
+
+		cpu_status_t status = cpu_run(p_cpu);
+		if (status != CPU_OK)
+		{
+			return status;
+		}
+
+		cycle++;
 	}
+
+	return CPU_OK;
 }
 
-void cpu_press_key(cpu_t *p_cpu, uint8_t key)
+static cpu_status_t fused_run(cpu_t *p_cpu, uint8_t kind, const fused_t *p_fused)
 {
-	if (p_cpu && (key < KEY_COUNT))
+	/* The handlers cpu_run would dispatch to, in order, without fetching or decoding. */
+	cpu_status_t status;
+	uint16_t pc = p_cpu->pc;
+
+	switch (kind)
 	{
-		p_cpu->keys[key] = 1;
+	case FUSED_LOAD_LOAD_DRAW:
+		p_cpu->opcode = p_fused->opcodes[0];
+		(void)opcode06_handler(p_cpu);
+		p_cpu->cycles++;
+
+		p_cpu->opcode = p_fused->opcodes[1];
+		(void)opcode06_handler(p_cpu);
+		p_cpu->cycles++;
+
+		p_cpu->opcode = p_fused->opcodes[2];
+		status = opcode13_handler(p_cpu);
+		break;
+
+	case FUSED_ADD_SKIP_JUMP:
+	case FUSED_DELAY_SKIP_JUMP:
+		p_cpu->opcode = p_fused->opcodes[0];
+		if (kind == FUSED_ADD_SKIP_JUMP)
+		{
+			(void)opcode07_handler(p_cpu);
+		}
+		else
+		{
+			(void)opcode15_handler(p_cpu);
+		}
+		p_cpu->cycles++;
+
+		p_cpu->opcode = p_fused->opcodes[1];
+		if ((p_fused->opcodes[1] & (uint16_t)0xF000) == 0x3000)
+		{
+			(void)opcode03_handler(p_cpu);
+		}
+		else
+		{
+			(void)opcode04_handler(p_cpu);
+		}
+
+		/* The jump only runs if it was not skipped. */
+		status = CPU_OK;
+		if (p_cpu->pc == (pc + 4))
+		{
+			p_cpu->cycles++;
+
+			p_cpu->opcode = p_fused->opcodes[2];
+			status = opcode01_handler(p_cpu);
+		}
+		break;
+
+	default:
+		return cpu_run(p_cpu);
 	}
-}
 
-void cpu_release_key(cpu_t *p_cpu, uint8_t key)
-{
-	if (p_cpu && (key < KEY_COUNT))
+	if (status == CPU_OK)
 	{
-		p_cpu->keys[key] = 0;
+		p_cpu->cycles++;
 	}
-}
 
-/* Private function definitions */
+	return status;
+}
 
-static void unhandled_opcode_handler(cpu_t *p_cpu)
+static cpu_status_t unhandled_opcode_handler(cpu_t *p_cpu)
 {
+	(void)p_cpu;
 	PRINT_INSTR("UNHANDLED OPCODE");
-	exit(-1);
+	return CPU_ERROR_OPCODE;
 }
 
 /* 0NNN	Call	Calls RCA 1802 program at address NNN. Not necessary for most ROMs. */
 /* 00E0	Display	disp_clear()	Clears the screen. */
 /* 00EE	Flow	return;	Returns from a subroutine. */
-static void opcode00_handler(cpu_t *p_cpu)
+static cpu_status_t opcode00_handler(cpu_t *p_cpu)
 {
-	switch (*(p_cpu->pc + 1))
+	switch (decode_NN(p_cpu))
 	{
 	case 0xE0:
 		PRINT_INSTR("CLR");
 
-		(void)memset(p_cpu->graphics, 0, GRAPHICS_SIZE);
+		/* A blank screen is the shared zero page. */
+		page_release(p_cpu->graphics);
+		p_cpu->graphics = page_zero();
 		p_cpu->pc += 2;
 		break;
 
 	case 0xEE:
+	{
 		PRINT_INSTR("RETURN");
 
-		stack_pop_pc(p_cpu);
+		cpu_status_t status = stack_pop_pc(p_cpu);
+		if (status != CPU_OK)
+		{
+			return status;
+		}
 		p_cpu->pc += 2;
-		break;
+	}
+	break;
 
 	default:
-		unhandled_opcode_handler(p_cpu);
-		break;
+		return unhandled_opcode_handler(p_cpu);
 	}
+
+	return CPU_OK;
 }
 
 /* 1NNN	Flow	goto NNN;	Jumps to address NNN. */
-static void opcode01_handler(cpu_t *p_cpu)
+static cpu_status_t opcode01_handler(cpu_t *p_cpu)
 {
 	PRINT_INSTR("JUMP");
 
-	p_cpu->pc = mem_address(p_cpu, decode_NNN(p_cpu));
+	p_cpu->pc = decode_NNN(p_cpu);
+	return CPU_OK;
 }
 
 /* 2NNN	Flow	*(0xNNN)()	Calls subroutine at NNN. */
-static void opcode02_handler(cpu_t *p_cpu)
+static cpu_status_t opcode02_handler(cpu_t *p_cpu)
 {
 	PRINT_INSTR("CALL");
 
-	stack_push_pc(p_cpu);
-	p_cpu->pc = mem_address(p_cpu, decode_NNN(p_cpu));
+	cpu_status_t status = stack_push_pc(p_cpu);
+	if (status != CPU_OK)
+	{
+		return status;
+	}
+	p_cpu->pc = decode_NNN(p_cpu);
+	return CPU_OK;
 }
 
 /* 3XNN	Cond	if(Vx==NN)	Skips the next instruction if VX equals NN. (Usually the next instruction is a jump to skip a code block) */
-static void opcode03_handler(cpu_t *p_cpu)
+static cpu_status_t opcode03_handler(cpu_t *p_cpu)
 {
 	PRINT_INSTR("if(Vx==NN)");
 
@@ -367,10 +1394,12 @@ static void opcode03_handler(cpu_t *p_cpu)
 	{
 		p_cpu->pc += 2;
 	}
+
+	return CPU_OK;
 }
 
 /* 4XNN	Cond	if(Vx!=NN)	Skips the next instruction if VX doesn't equal NN. (Usually the next instruction is a jump to skip a code block) */
-static void opcode04_handler(cpu_t *p_cpu)
+static cpu_status_t opcode04_handler(cpu_t *p_cpu)
 {
 	PRINT_INSTR("if(Vx!=NN)");
 
@@ -386,10 +1415,12 @@ static void opcode04_handler(cpu_t *p_cpu)
 	{
 		p_cpu->pc += 2;
 	}
+
+	return CPU_OK;
 }
 
 /* 5XY0	Cond	if(Vx!=Vy)	Skips the next instruction if VX equals VY. (Usually the next instruction is a jump to skip a code block) */
-static void opcode05_handler(cpu_t *p_cpu)
+static cpu_status_t opcode05_handler(cpu_t *p_cpu)
 {
 	PRINT_INSTR("if(Vx!=Vy)");
 
@@ -405,10 +1436,12 @@ static void opcode05_handler(cpu_t *p_cpu)
 	{
 		p_cpu->pc += 2;
 	}
+
+	return CPU_OK;
 }
 
 /* 6XNN	Const	Vx = NN	Sets VX to NN. */
-static void opcode06_handler(cpu_t *p_cpu)
+static cpu_status_t opcode06_handler(cpu_t *p_cpu)
 {
 	PRINT_INSTR("Vx=NN");
 
@@ -417,10 +1450,12 @@ static void opcode06_handler(cpu_t *p_cpu)
 
 	p_cpu->reg_v[x] = nn;
 	p_cpu->pc += 2;
+
+	return CPU_OK;
 }
 
 /* 7XNN	Const	Vx += NN	Adds NN to VX. (Carry flag is not changed) */
-static void opcode07_handler(cpu_t *p_cpu)
+static cpu_status_t opcode07_handler(cpu_t *p_cpu)
 {
 	PRINT_INSTR("Vx+=NN");
 
@@ -429,6 +1464,8 @@ static void opcode07_handler(cpu_t *p_cpu)
 
 	p_cpu->reg_v[x] += nn;
 	p_cpu->pc += 2;
+
+	return CPU_OK;
 }
 
 /* 8XY0	Assign	Vx=Vy	Sets VX to the value of VY. */
@@ -440,7 +1477,7 @@ static void opcode07_handler(cpu_t *p_cpu)
 /* 8XY6	BitOp	Vx>>=1	Stores the least significant bit of VX in VF and then shifts VX to the right by 1.[2] */
 /* 8XY7	Math	Vx=Vy-Vx	Sets VX to VY minus VX. VF is set to 0 when there's a borrow, and 1 when there isn't. */
 /* 8XYE	BitOp	Vx<<=1	Stores the most significant bit of VX in VF and then shifts VX to the left by 1.[3] */
-static void opcode08_handler(cpu_t *p_cpu)
+static cpu_status_t opcode08_handler(cpu_t *p_cpu)
 {
 	uint8_t x = decode_X(p_cpu);
 	uint8_t y = decode_Y(p_cpu);
@@ -539,13 +1576,14 @@ static void opcode08_handler(cpu_t *p_cpu)
 		p_cpu->pc += 2;
 		break;
 	default:
-		unhandled_opcode_handler(p_cpu);
-		break;
+		return unhandled_opcode_handler(p_cpu);
 	}
+
+	return CPU_OK;
 }
 
 /* 9XY0	Cond	if(Vx==Vy)	Skips the next instruction if VX doesn't equal VY. (Usually the next instruction is a jump to skip a code block) */
-static void opcode09_handler(cpu_t *p_cpu)
+static cpu_status_t opcode09_handler(cpu_t *p_cpu)
 {
 	PRINT_INSTR("if(Vx==Vy)");
 
@@ -561,46 +1599,59 @@ static void opcode09_handler(cpu_t *p_cpu)
 	{
 		p_cpu->pc += 2;
 	}
+
+	return CPU_OK;
 }
 
 /* ANNN	MEM	I=NNN	Sets I to the address NNN. */
-static void opcode10_handler(cpu_t *p_cpu)
+static cpu_status_t opcode10_handler(cpu_t *p_cpu)
 {
 	PRINT_INSTR("I=NNN");
 
 	uint16_t nnn = decode_NNN(p_cpu);
 
-	p_cpu->i = mem_address(p_cpu, nnn);
+	p_cpu->i = nnn;
 	p_cpu->pc += 2;
+
+	return CPU_OK;
 }
 
 /* BNNN	Flow	PC=V0+NNN	Jumps to the address NNN plus V0. */
-static void opcode11_handler(cpu_t *p_cpu)
+static cpu_status_t opcode11_handler(cpu_t *p_cpu)
 {
 	PRINT_INSTR("PC=V0+NNN");
 
 	uint8_t v0 = p_cpu->reg_v[0];
 	uint16_t nnn = decode_NNN(p_cpu);
 
-	p_cpu->pc = mem_address(p_cpu, v0 + nnn);
+	uint16_t address = v0 + nnn;
+	if (address >= MEM_SIZE)
+	{
+		return CPU_ERROR_ADDRESS;
+	}
+
+	p_cpu->pc = address;
+	return CPU_OK;
 }
 
 /* CXNN	Rand	Vx=rand()&NN	Sets VX to the result of a bitwise and operation on a random number (Typically: 0 to 255) and NN. */
-static void opcode12_handler(cpu_t *p_cpu)
+static cpu_status_t opcode12_handler(cpu_t *p_cpu)
 {
 	PRINT_INSTR("Vx=rand()&NN");
 
 	uint8_t x = decode_X(p_cpu);
 	uint8_t nn = decode_NN(p_cpu);
 
-	p_cpu->reg_v[x] = ((uint8_t)(rand() % 256)) & nn;
+	p_cpu->reg_v[x] = ((uint8_t)cpu_rand_next(p_cpu)) & nn;
 	p_cpu->pc += 2;
+
+	return CPU_OK;
 }
 
 /* DXYN	Disp	draw(Vx,Vy,N)	Draws a sprite at coordinate (VX, VY) that has a width of 8 pixels and a height of N pixels. 
     Each row of 8 pixels is read as bit-coded starting from memory location I; I value doesn’t change after the execution of this instruction. 
     As described above, VF is set to 1 if any screen pixels are flipped from set to unset when the sprite is drawn, and to 0 if that doesn’t happen. */
-static void opcode13_handler(cpu_t *p_cpu)
+static cpu_status_t opcode13_handler(cpu_t *p_cpu)
 {
 	PRINT_INSTR("draw(Vx,Vy,N)");
 
@@ -608,42 +1659,47 @@ static void opcode13_handler(cpu_t *p_cpu)
 	uint8_t y = decode_Y(p_cpu);
 	uint8_t n = decode_N(p_cpu);
 
-	p_cpu->reg_v[0xF] = 0;
-
-	int line, column;
-	for (line = 0; line < (int)n; line++)
+	if (!page_unshare(&(p_cpu->graphics)))
 	{
+		return CPU_ERROR_MEMORY;
+	}
 
-		uint8_t sprite = *(p_cpu->i + line);
-
-		for (column = 0; column < 8; column++)
-		{
-
-			uint8_t X = (p_cpu->reg_v[x] + column) % GRAPHICS_COLS;
-			uint8_t Y = (p_cpu->reg_v[y] + line) % GRAPHICS_ROWS;
+	p_cpu->reg_v[0xF] = 0;
 
-			uint8_t *pixel_screen = p_cpu->graphics + X + (Y * GRAPHICS_COLS);
+	/* Sprite rows straddle two bytes of the packed row, wrapping around the screen. */
+	uint8_t column = p_cpu->reg_v[x] % GRAPHICS_COLS;
+	uint8_t row = p_cpu->reg_v[y] % GRAPHICS_ROWS;
+	uint8_t shift = column % 8;
+	uint8_t left_byte = column / 8;
+	uint8_t right_byte = (left_byte + 1) % GRAPHICS_ROW_SIZE;
 
-			uint8_t sprite_bit = sprite >> (7 - column);
-			sprite_bit &= (uint8_t)0x01;
+	for (uint8_t line = 0; line < n; line++)
+	{
+		uint8_t sprite = cpu_read(p_cpu, p_cpu->i + line);
+		uint8_t left = sprite >> shift;
+		uint8_t right = (uint8_t)(sprite << (8 - shift));
 
-			if (sprite_bit && *pixel_screen)
-			{
-				p_cpu->reg_v[0xF] = 1;
-			}
+		uint8_t *pixels = p_cpu->graphics->data + (((row + line) % GRAPHICS_ROWS) * GRAPHICS_ROW_SIZE);
 
-			*pixel_screen = *pixel_screen ^ sprite_bit;
+		if ((pixels[left_byte] & left) || (pixels[right_byte] & right))
+		{
+			p_cpu->reg_v[0xF] = 1;
 		}
+
+		pixels[left_byte] ^= left;
+		pixels[right_byte] ^= right;
 	}
 
 	p_cpu->draw_flag = 1;
 	p_cpu->pc += 2;
+
+	return CPU_OK;
 }
 
 /*
 EX9E	KeyOp	if(key()==Vx)	Skips the next instruction if the key stored in VX is pressed. (Usually the next instruction is a jump to skip a code block)
 EXA1	KeyOp	if(key()!=Vx)	Skips the next instruction if the key stored in VX isn't pressed. (Usually the next instruction is a jump to skip a code block)*/
-static void opcode14_handler(cpu_t *p_cpu)
+static cpu_status_t opcode14_handler(cpu_t *p_cpu)
 {
 	uint8_t x = decode_X(p_cpu);
 	uint8_t nn = decode_NN(p_cpu);
@@ -655,8 +1711,9 @@ static void opcode14_handler(cpu_t *p_cpu)
 		PRINT_INSTR("if(key()==Vx)");
 
 		uint8_t key = p_cpu->reg_v[x];
+		p_cpu->keys_read_flag = 1;
 
-		if ((key < KEY_COUNT) && (p_cpu->keys[key]))
+		if ((key < KEY_COUNT) && ((p_cpu->keys >> key) & 1))
 		{
 			p_cpu->pc += 4;
 		}
@@ -671,8 +1728,9 @@ static void opcode14_handler(cpu_t *p_cpu)
 		PRINT_INSTR("if(key()!=Vx)");
 
 		uint8_t key = p_cpu->reg_v[x];
+		p_cpu->keys_read_flag = 1;
 
-		if ((key < KEY_COUNT) && (!p_cpu->keys[key]))
+		if ((key < KEY_COUNT) && !((p_cpu->keys >> key) & 1))
 		{
 			p_cpu->pc += 4;
 		}
@@ -683,9 +1741,10 @@ static void opcode14_handler(cpu_t *p_cpu)
 	}
 	break;
 	default:
-		unhandled_opcode_handler(p_cpu);
-		break;
+		return unhandled_opcode_handler(p_cpu);
 	}
+
+	return CPU_OK;
 }
 
 /*
@@ -707,7 +1766,7 @@ Stores the binary-coded decimal representation of VX, with the most significant
 FX55	MEM	reg_dump(Vx,&I)	Stores V0 to VX (including VX) in memory starting at address I. The offset from I is increased by 1 for each value written, but I itself is left unmodified.
 FX65	MEM	reg_load(Vx,&I)	Fills V0 to VX (including VX) with values from memory starting at address I. The offset from I is increased by 1 for each value written, but I itself is left unmodified.
 */
-static void opcode15_handler(cpu_t *p_cpu)
+static cpu_status_t opcode15_handler(cpu_t *p_cpu)
 {
 	uint8_t x = decode_X(p_cpu);
 
@@ -716,16 +1775,17 @@ static void opcode15_handler(cpu_t *p_cpu)
 	case (uint8_t)0x07:
 		PRINT_INSTR("Vx=get_delay()");
 
-		p_cpu->reg_v[x] = p_cpu->timer_delay;
+		p_cpu->reg_v[x] = cpu_timer_value(p_cpu, p_cpu->timer_delay, p_cpu->timer_delay_cycle);
 		p_cpu->pc += 2;
 		break;
 	case (uint8_t)0x0A:
 		PRINT_INSTR("Vx=get_key()");
 
+		p_cpu->keys_read_flag = 1;
 		p_cpu->halted_flag = 1;
 		for (uint8_t i = 0; i < KEY_COUNT; i++)
 		{
-			if (p_cpu->keys[i])
+			if ((p_cpu->keys >> i) & 1)
 			{
 				p_cpu->halted_flag = 0;
 				p_cpu->reg_v[x] = i;
@@ -733,17 +1793,24 @@ static void opcode15_handler(cpu_t *p_cpu)
 				break;
 			}
 		}
+
+		if (p_cpu->halted_flag)
+		{
+			p_cpu->idle_cycles++;
+		}
 		break;
 	case (uint8_t)0x15:
 		PRINT_INSTR("delay_timer(Vx)");
 
 		p_cpu->timer_delay = p_cpu->reg_v[x];
+		p_cpu->timer_delay_cycle = p_cpu->cycles;
 		p_cpu->pc += 2;
 		break;
 	case (uint8_t)0x18:
 		PRINT_INSTR("sound_timer(Vx)");
 
 		p_cpu->timer_sound = p_cpu->reg_v[x];
+		p_cpu->timer_sound_cycle = p_cpu->cycles;
 		p_cpu->pc += 2;
 		break;
 	case (uint8_t)0x1E:
@@ -755,20 +1822,25 @@ static void opcode15_handler(cpu_t *p_cpu)
 	case (uint8_t)0x29:
 		PRINT_INSTR("I=sprite_addr[Vx]");
 
-		p_cpu->i = p_cpu->font + (p_cpu->reg_v[x] * FONT_CHAR_SIZE);
+		p_cpu->i = FONT_ADDRESS + (p_cpu->reg_v[x] * FONT_CHAR_SIZE);
 		p_cpu->pc += 2;
 		break;
 	case (uint8_t)0x33:
 	{
 		PRINT_INSTR("BCD(Vx)");
 
+		if (memory_own(p_cpu, p_cpu->i, 3) != CPU_OK)
+		{
+			return CPU_ERROR_MEMORY;
+		}
+
 		uint8_t vx = p_cpu->reg_v[x];
 
-		*(p_cpu->i + 2) = vx % 10;
+		memory_write(p_cpu, p_cpu->i + 2, vx % 10);
 		vx /= 10;
-		*(p_cpu->i + 1) = vx % 10;
+		memory_write(p_cpu, p_cpu->i + 1, vx % 10);
 		vx /= 10;
-		*(p_cpu->i + 0) = vx % 10;
+		memory_write(p_cpu, p_cpu->i + 0, vx % 10);
 
 		p_cpu->pc += 2;
 	}
@@ -776,17 +1848,29 @@ static void opcode15_handler(cpu_t *p_cpu)
 	case (uint8_t)0x55:
 		PRINT_INSTR("reg_dump(Vx,&I)");
 
-		(void)memcpy(p_cpu->i, p_cpu->reg_v, (x + 1) * sizeof(uint8_t));
+		if (memory_own(p_cpu, p_cpu->i, x + 1) != CPU_OK)
+		{
+			return CPU_ERROR_MEMORY;
+		}
+
+		for (uint8_t reg = 0; reg <= x; reg++)
+		{
+			memory_write(p_cpu, p_cpu->i + reg, p_cpu->reg_v[reg]);
+		}
 		p_cpu->pc += 2;
 		break;
 	case (uint8_t)0x65:
 		PRINT_INSTR("reg_load(Vx,&I)");
 
-		(void)memcpy(p_cpu->reg_v, p_cpu->i, (x + 1) * sizeof(uint8_t));
+		for (uint8_t reg = 0; reg <= x; reg++)
+		{
+			p_cpu->reg_v[reg] = cpu_read(p_cpu, p_cpu->i + reg);
+		}
 		p_cpu->pc += 2;
 		break;
 	default:
-		unhandled_opcode_handler(p_cpu);
-		break;
+		return unhandled_opcode_handler(p_cpu);
 	}
+
+	return CPU_OK;
 }
@@ -1,12 +1,76 @@
 #ifndef CPU_H_
 #define CPU_H_
 
+#include <stddef.h>
 #include <stdint.h>
 
+/* Defines */
+
+/* Graphics are packed one bit per pixel, 8 bytes per row, most significant bit leftmost. */
+#define CPU_GRAPHICS_COLS (64)
+#define CPU_GRAPHICS_ROWS (32)
+#define CPU_GRAPHICS_SIZE ((CPU_GRAPHICS_COLS / 8) * CPU_GRAPHICS_ROWS)
+
+#define CPU_PROGRAM_SIZE_MAX (0x0E00)    /* Memory from the program start (0x200) to its end. */
+#define CPU_XO_PROGRAM_SIZE_MAX (0xFE00) /* Same, with the 64 KB of XO-CHIP. */
+
+/* Display composed by cpu_compose: 128x64, CHIP-8 pixels are 2x2 blocks. */
+#define CPU_DISPLAY_COLS (128)
+#define CPU_DISPLAY_ROWS (64)
+
+#define CPU_PLANE_COUNT (4)                     /* XO-CHIP bitplanes. */
+#define CPU_COLOR_COUNT (1u << CPU_PLANE_COUNT) /* Palette entries, indexed by the plane bits of a pixel. */
+
+#define CPU_AUDIO_PATTERN_SIZE (16) /* XO-CHIP audio pattern, 128 one-bit samples. */
+
 /* Typedefs */
 
 typedef struct cpu_s cpu_t;
 
+/* Read-only font and program image, shared by the cpus it is loaded on. */
+typedef struct cpu_image_s cpu_image_t;
+
+/* Preallocated cpus, fork targets for tree searches. */
+typedef struct cpu_pool_s cpu_pool_t;
+
+/*
+ * CHIP-8 mode runs 4 KB of copy-on-write memory and a 64x32 display.
+ *
+ * XO-CHIP mode runs 64 KB of memory (F000 NNNN loads a 16-bit I), the SUPER-CHIP
+ * instructions (00CN, 00DN, 00FB, 00FC, 00FD, 00FE, 00FF, DXY0, FX30, FX75, FX85)
+ * and four bitplanes of 128x64 pixels selected by FN01, which 00E0, DXYN and
+ * scrolls apply to. 5XY2 and 5XY3 save and load VX to VY, F002 and FX3A set the
+ * audio pattern and its pitch. It follows the Octo XO-CHIP behaviors: 8XY6 and
+ * 8XYE shift VY, FX55 and FX65 advance I, VF is written after the result.
+ * XO-CHIP state is private to each cpu and copied by cpu_fork, it is not saved
+ * by store.h, and compiled blocks and superinstructions are CHIP-8 only.
+ */
+typedef enum cpu_mode_e
+{
+	CPU_MODE_CHIP8 = 0,
+	CPU_MODE_XO
+} cpu_mode_t;
+
+typedef enum cpu_status_e
+{
+	CPU_OK = 0,
+	CPU_ERROR_ARGUMENT, /* Invalid argument, e.g. NULL cpu. */
+	CPU_ERROR_ADDRESS,	/* Jump, return or fetch outside of memory. */
+	CPU_ERROR_OPCODE,	/* Unhandled opcode. */
+	CPU_ERROR_MEMORY,	/* Out of memory copying a shared page on write. */
+	CPU_ERROR_STACK		/* Call nested too deep, or return with an empty stack. */
+} cpu_status_t;
+
+typedef struct cpu_registers_s
+{
+	uint8_t v[16];
+	uint16_t i;
+	uint16_t pc;
+	uint16_t sp;
+	uint8_t delay; /* Current delay timer value. */
+	uint8_t sound; /* Current sound timer value. */
+} cpu_registers_t;
+
 /* Public function declarations */
 
 /**
@@ -16,28 +80,268 @@ typedef struct cpu_s cpu_t;
  */
 cpu_t *cpu_allocate(void);
 
+/**
+ * @brief Free cpu.
+ * 
+ * @param[in]	p_cpu	Pointer to cpu, may be NULL.
+ */
+void cpu_free(cpu_t *p_cpu);
+
+/**
+ * @brief Allocate a pool of cpus, each as returned by cpu_allocate.
+ * 
+ * Slots are cpus like any other, cpu_free resets a slot instead of freeing it.
+ * 
+ * @param[in]	count	Number of cpus.
+ * 
+ * @return Pointer to pool, or NULL if allocation failed.
+ */
+cpu_pool_t *cpu_pool_allocate(uint32_t count);
+
+/**
+ * @brief Free a pool and the pages its cpus hold.
+ * 
+ * @param[in]	p_pool	Pointer to pool, may be NULL.
+ */
+void cpu_pool_free(cpu_pool_t *p_pool);
+
+/**
+ * @brief Get a cpu of a pool.
+ * 
+ * @param[in]	p_pool	Pointer to pool.
+ * @param[in]	index	Slot index.
+ * 
+ * @return Pointer to cpu, or NULL if index is out of bound.
+ */
+cpu_t *cpu_pool_get(cpu_pool_t *p_pool, uint32_t index);
+
+/**
+ * @brief Make p_dst an exact copy of p_src.
+ * 
+ * Memory and graphics pages are shared, not copied: either cpu copies a page on its
+ * next write to it, so both run exactly as independent copies would.
+ * 
+ * @param[in]	p_dst	Pointer to destination cpu, its previous state is dropped.
+ * @param[in]	p_src	Pointer to source cpu.
+ * 
+ * @return CPU_OK, CPU_ERROR_ARGUMENT, or CPU_ERROR_MEMORY if the XO-CHIP state could not be
+ * allocated, p_dst is then unchanged.
+ */
+cpu_status_t cpu_fork(cpu_t *p_dst, const cpu_t *p_src);
+
+/**
+ * @brief Fork a cpu into consecutive pool slots and run each with its own keys.
+ * 
+ * @param[in]	p_pool		Pointer to pool.
+ * @param[in]	first		First slot.
+ * @param[in]	p_src		Pointer to cpu to fork, left unchanged.
+ * @param[in]	masks		Key mask per child, as for cpu_set_keys.
+ * @param[in]	count		Number of children.
+ * @param[in]	cycles		Cycles to run each child.
+ * @param[out]	p_statuses	Status of each child's run, may be NULL.
+ * 
+ * @return Number of children forked, limited by the pool size.
+ */
+uint32_t cpu_pool_fork_run(cpu_pool_t *p_pool, uint32_t first, const cpu_t *p_src, const uint16_t *masks,
+						   uint32_t count, uint32_t cycles, cpu_status_t *p_statuses);
+
+/**
+ * @brief Seed the cpu random number generator (CXNN).
+ * 
+ * Each cpu owns its generator, instances with the same seed run identically.
+ * 
+ * @param[in]	p_cpu	Pointer to cpu.
+ * @param[in]	seed	Seed value.
+ */
+void cpu_seed(cpu_t *p_cpu, uint32_t seed);
+
 /**
  * @brief Load program on cpu.
  * 
+ * The program is copied, it may be released (or unmapped) afterwards. The cpu is
+ * reset to its power-on state: registers, stack, timers, keys and display are
+ * cleared. Its seed, timer period and native module are kept.
+ * 
  * @param[in]	p_cpu	Pointer to cpu.
  * @param[in]	program	Program to load.
- * @param[in]	size	Program size.
+ * @param[in]	size	Program size, at most CPU_PROGRAM_SIZE_MAX.
+ * 
+ * @return CPU_OK, CPU_ERROR_ARGUMENT if the program does not fit in memory, or CPU_ERROR_MEMORY.
+ */
+cpu_status_t cpu_load(cpu_t *p_cpu, const uint8_t *program, size_t size);
+
+/**
+ * @brief Build a program image to load on many cpus.
+ * 
+ * Cpus loaded with the same image share its memory pages until they write to them.
+ * 
+ * @param[in]	program	Program to load.
+ * @param[in]	size	Program size, at most CPU_PROGRAM_SIZE_MAX.
+ * 
+ * @return Pointer to image, or NULL if the program does not fit in memory or allocation failed.
+ */
+cpu_image_t *cpu_image_allocate(const uint8_t *program, size_t size);
+
+/**
+ * @brief Build a program image for a mode.
+ * 
+ * @param[in]	program	Program to load.
+ * @param[in]	size	Program size, at most CPU_PROGRAM_SIZE_MAX, or CPU_XO_PROGRAM_SIZE_MAX for XO-CHIP.
+ * @param[in]	mode	Mode the cpus the image is loaded on run in.
+ * 
+ * @return Pointer to image, or NULL if the program does not fit in memory or allocation failed.
+ */
+cpu_image_t *cpu_image_allocate_mode(const uint8_t *program, size_t size, cpu_mode_t mode);
+
+/**
+ * @brief Free an image, cpus it was loaded on keep their references to its pages.
+ * 
+ * @param[in]	p_image	Pointer to image, may be NULL.
+ */
+void cpu_image_free(cpu_image_t *p_image);
+
+/**
+ * @brief Recognize frequent instruction sequences of an image to run them as superinstructions.
+ * 
+ * Cpus the image is loaded on afterwards run each recognized sequence (e.g.
+ * 6XNN; 6YNN; DXYN or FX07; 3X00; 1NNN) as a single step of cpu_run_for, with
+ * the same results as running it instruction by instruction. A sequence is only
+ * fused while the cpu has not written to the memory holding it.
+ * 
+ * @param[in]	p_image	Pointer to image.
+ * 
+ * @return CPU_OK, or CPU_ERROR_MEMORY if the sequence table could not be allocated.
+ */
+cpu_status_t cpu_image_fuse(cpu_image_t *p_image);
+
+/**
+ * @brief Load an image on cpu, as cpu_load does with the program it was built from.
+ * 
+ * The cpu is reset to its power-on state, as by cpu_load, and switches to the mode
+ * of the image.
+ * 
+ * @param[in]	p_cpu	Pointer to cpu.
+ * @param[in]	p_image	Pointer to image.
+ * 
+ * @return CPU_OK, CPU_ERROR_ARGUMENT, or CPU_ERROR_MEMORY if the XO-CHIP state could not be allocated.
  */
-void cpu_load(cpu_t *p_cpu, uint8_t *program, uint16_t size);
+cpu_status_t cpu_load_image(cpu_t *p_cpu, const cpu_image_t *p_image);
+
+/**
+ * @brief Get the mode of a cpu.
+ * 
+ * @param[in]	p_cpu	Pointer to cpu.
+ * 
+ * @return CPU_MODE_XO if the last image loaded was built for XO-CHIP, else CPU_MODE_CHIP8.
+ */
+cpu_mode_t cpu_mode(cpu_t *p_cpu);
+
+/**
+ * @brief Get the memory held by the cpu alone: its state and its private pages.
+ * 
+ * @param[in]	p_cpu	Pointer to cpu.
+ * 
+ * @return Size in bytes.
+ */
+size_t cpu_footprint(cpu_t *p_cpu);
 
 /**
  * @brief Run a single cpu cycle.
  * 
+ * On error the cpu state is left as it was before the faulting instruction.
+ * 
  * @param[in]	p_cpu	Pointer to cpu.
+ * 
+ * @return CPU_OK, or the fault that stopped the instruction.
+ */
+cpu_status_t cpu_run(cpu_t *p_cpu);
+
+/**
+ * @brief Run cpu cycles.
+ * 
+ * Halted cycles (FX0A without key) count towards the budget.
+ * 
+ * @param[in]	p_cpu	Pointer to cpu.
+ * @param[in]	cycles	Number of cycles to run.
+ * 
+ * @return CPU_OK, or the fault that stopped the run.
+ */
+cpu_status_t cpu_run_for(cpu_t *p_cpu, uint32_t cycles);
+
+/**
+ * @brief Get a human readable description of a status.
+ * 
+ * @param[in]	status	Status returned by the cpu.
+ * 
+ * @return Static string.
+ */
+const char *cpu_status_string(cpu_status_t status);
+
+/**
+ * @brief Set the number of cycles per timer tick.
+ * 
+ * Timers are derived from the cycle counter, so they stay exact at any emulation speed.
+ * 
+ * @param[in]	p_cpu	Pointer to cpu.
+ * @param[in]	cycles	Cycles per timer tick (cpu frequency / timer frequency).
+ */
+void cpu_set_timer_period(cpu_t *p_cpu, uint32_t cycles);
+
+/**
+ * @brief Get the number of cycles run since the program was loaded.
+ * 
+ * @param[in]	p_cpu	Pointer to cpu.
+ * 
+ * @return Cycle counter.
+ */
+uint64_t cpu_cycles(cpu_t *p_cpu);
+
+/**
+ * @brief Get the number of instructions executed since the program was loaded.
+ * 
+ * Cycles spent halted on FX0A, idle or skipped in a delay timer wait loop are not counted.
+ * 
+ * @param[in]	p_cpu	Pointer to cpu.
+ * 
+ * @return Instruction counter.
+ */
+uint64_t cpu_instructions(cpu_t *p_cpu);
+
+/**
+ * @brief Let cycles elapse without running instructions, e.g. while halted.
+ * 
+ * @param[in]	p_cpu	Pointer to cpu.
+ * @param[in]	cycles	Number of cycles to skip.
+ */
+void cpu_idle(cpu_t *p_cpu, uint32_t cycles);
+
+/**
+ * @brief Check whether the cpu spins in a delay timer wait loop (FX07; 3X00; 1NNN back to FX07).
+ * 
+ * @param[in]	p_cpu	Pointer to cpu.
+ * 
+ * @return Cycles the loop spins before FX07 reads zero, 0 if pc is not at such a loop.
+ */
+uint32_t cpu_wait_cycles(cpu_t *p_cpu);
+
+/**
+ * @brief Skip spinning in a delay timer wait loop without running it.
+ * 
+ * The resulting state is the one running the loop for the same cycles would produce.
+ * 
+ * @param[in]	p_cpu	Pointer to cpu.
+ * @param[in]	cycles	Cycles to skip, at most cpu_wait_cycles.
  */
-void cpu_run(cpu_t *p_cpu);
+void cpu_skip_wait(cpu_t *p_cpu, uint32_t cycles);
 
 /**
- * @brief Decrement cpu running timers by one tick.
+ * @brief Check whether the sound timer is running.
  * 
  * @param[in]	p_cpu	Pointer to cpu.
+ * 
+ * @return 1 if the beep should sound, else 0.
  */
-void cpu_tick(cpu_t *p_cpu);
+int cpu_sound_active(cpu_t *p_cpu);
 
 /**
  * @brief Check whether the cpu is halted, waiting for a key press.
@@ -58,13 +362,51 @@ int cpu_halted(cpu_t *p_cpu);
 int cpu_graphics_changed(cpu_t *p_cpu);
 
 /**
- * @brief Get pointer to cpu graphics.
+ * @brief Check whether an instruction read the keys (EX9E, EXA1, FX0A) since the last call.
+ * 
+ * @param[in]	p_cpu	Pointer to cpu.
+ * 
+ * @return 1 if the keys were read, else 0.
+ */
+int cpu_keys_read(cpu_t *p_cpu);
+
+/**
+ * @brief Get pointer to cpu graphics, CPU_GRAPHICS_SIZE packed bytes.
+ * 
+ * In XO-CHIP mode this is a 64x32 view of the display, every other pixel of
+ * every other line, set where any plane is: exact for low resolution. Use
+ * cpu_compose for the full display.
+ * 
+ * The pointer is valid until the cpu runs again.
  * 
  * @param[in]	p_cpu	Pointer to cpu.
  * 
  * @return Pointer to cpu graphics.
  */
-uint8_t *cpu_graphics(cpu_t *p_cpu);
+const uint8_t *cpu_graphics(cpu_t *p_cpu);
+
+/**
+ * @brief Compose the display into pixels through a palette.
+ * 
+ * Each pixel takes the palette entry indexed by its plane bits (plane 0 in bit
+ * 0). CHIP-8 pixels are entries 0 and 1. Eight pixels are composed at a time.
+ * 
+ * @param[in]	p_cpu	Pointer to cpu.
+ * @param[in]	palette	CPU_COLOR_COUNT colors.
+ * @param[out]	pixels	CPU_DISPLAY_COLS * CPU_DISPLAY_ROWS colors, row after row.
+ */
+void cpu_compose(cpu_t *p_cpu, const uint32_t *palette, uint32_t *pixels);
+
+/**
+ * @brief Get the XO-CHIP audio pattern, played in place of the beep while the sound timer runs.
+ * 
+ * @param[in]	p_cpu		Pointer to cpu.
+ * @param[out]	pattern		CPU_AUDIO_PATTERN_SIZE bytes, one-bit samples, most significant bit first.
+ * @param[out]	p_pitch		Pitch: samples play at 4000 * 2^((pitch - 64) / 48) Hz.
+ * 
+ * @return 1 if a pattern was loaded (F002), else 0 and the beep sounds.
+ */
+int cpu_audio_pattern(cpu_t *p_cpu, uint8_t *pattern, uint8_t *p_pitch);
 
 /**
  * @brief Press the given key.
@@ -82,4 +424,50 @@ void cpu_press_key(cpu_t *p_cpu, uint8_t key);
  */
 void cpu_release_key(cpu_t *p_cpu, uint8_t key);
 
+/**
+ * @brief Set the state of all keys at once.
+ * 
+ * @param[in]	p_cpu	Pointer to cpu.
+ * @param[in]	mask	Bit n set if key n is pressed.
+ */
+void cpu_set_keys(cpu_t *p_cpu, uint16_t mask);
+
+/**
+ * @brief Get a copy of the cpu registers.
+ * 
+ * @param[in]	p_cpu		Pointer to cpu.
+ * @param[out]	p_registers	Registers.
+ */
+void cpu_registers(cpu_t *p_cpu, cpu_registers_t *p_registers);
+
+/**
+ * @brief Read a byte of cpu memory.
+ * 
+ * @param[in]	p_cpu	Pointer to cpu.
+ * @param[in]	address	Memory address.
+ * 
+ * @return Byte at address, 0 if out of bound.
+ */
+uint8_t cpu_peek(cpu_t *p_cpu, uint16_t address);
+
+/**
+ * @brief Write to cpu memory, copying shared pages first.
+ * 
+ * @param[in]	p_cpu	Pointer to cpu.
+ * @param[in]	address	First memory address.
+ * @param[in]	data	Bytes to write.
+ * @param[in]	size	Number of bytes.
+ * 
+ * @return CPU_OK, CPU_ERROR_ADDRESS if the range is out of bound (nothing is
+ * written), or CPU_ERROR_MEMORY.
+ */
+cpu_status_t cpu_poke(cpu_t *p_cpu, uint16_t address, const uint8_t *data, uint16_t size);
+
+/* Inlined function definitions */
+
+static inline int cpu_graphics_pixel(const uint8_t *graphics, uint32_t column, uint32_t line)
+{
+	return (graphics[(line * (CPU_GRAPHICS_COLS / 8)) + (column / 8)] >> (7 - (column % 8))) & 1;
+}
+
 #endif /* CPU_H_ */
@@ -0,0 +1,248 @@
+#ifndef CPU_INTERNAL_H_
+#define CPU_INTERNAL_H_
+
+/*
+ * Layout of the cpu state, shared by the interpreter in cpu.c and by execution
+ * engines operating on the same state (natively compiled ROMs).
+ * Not part of the stable embedding API: cpu.h is.
+ */
+
+#include "cpu.h"
+#include "page.h"
+
+#include <stdint.h>
+#include <string.h>
+
+/* Defines */
+
+#define FONT_CHAR_SIZE (5)
+#define FONT_CHAR_COUNT (16)
+
+#define GRAPHICS_COLS (CPU_GRAPHICS_COLS)
+#define GRAPHICS_ROWS (CPU_GRAPHICS_ROWS)
+#define GRAPHICS_ROW_SIZE (GRAPHICS_COLS / 8)
+#define GRAPHICS_SIZE (CPU_GRAPHICS_SIZE) /* One page. */
+
+#define KEY_COUNT (16)
+
+#define REG_COUNT (16)
+
+#define MEM_SIZE (0x1000)
+#define MEM_PAGE_COUNT (MEM_SIZE / PAGE_BYTES)
+
+#define FONT_ADDRESS (0x0000)
+#define FONT_SIZE (FONT_CHAR_SIZE * FONT_CHAR_COUNT)
+
+#define ROM_ADDRESS (0x0200)
+
+#define STACK_ADDRESS (0x0FA0)
+#define STACK_DEPTH (16) /* Nested calls. */
+
+#define TIMER_PERIOD_DEFAULT (10) /* 600 Hz cpu, 60 Hz timers. */
+
+/* XO-CHIP, xo.c. */
+#define XO_MEM_SIZE (0x10000)
+#define XO_COLS (CPU_DISPLAY_COLS) /* Planes are always high resolution, low resolution pixels are 2x2. */
+#define XO_ROWS (CPU_DISPLAY_ROWS)
+#define XO_ROW_SIZE (XO_COLS / 8)
+#define XO_PLANE_SIZE (XO_ROW_SIZE * XO_ROWS)
+#define XO_FONT_BIG_ADDRESS (FONT_ADDRESS + FONT_SIZE)
+#define XO_FONT_BIG_CHAR_SIZE (10)
+#define XO_FONT_BIG_SIZE (XO_FONT_BIG_CHAR_SIZE * FONT_CHAR_COUNT)
+#define XO_FLAG_COUNT (16) /* FX75 and FX85 persistent flags. */
+
+/* Typedefs */
+
+struct cpu_image_s
+{
+	page_t *pages[MEM_PAGE_COUNT];
+	struct cpu_fusion_s *fusion; /* Superinstruction table, NULL unless fused. */
+	uint8_t *xo_memory;			 /* XO_MEM_SIZE bytes for XO-CHIP images, else NULL. */
+};
+
+/* XO-CHIP state, owned by one cpu. pc, i, registers, timers and keys stay in cpu_s. */
+struct cpu_xo_s
+{
+	uint8_t memory[XO_MEM_SIZE];
+	uint8_t planes[CPU_PLANE_COUNT][XO_PLANE_SIZE];
+	uint8_t view[GRAPHICS_SIZE]; /* cpu_graphics view of the planes. */
+	uint16_t stack[STACK_DEPTH];
+	uint8_t pattern[CPU_AUDIO_PATTERN_SIZE];
+	uint8_t flags[XO_FLAG_COUNT];
+	uint8_t plane_mask; /* Planes drawn on, bit n for plane n. */
+	uint8_t pitch;
+	uint8_t hires;
+	uint8_t pattern_loaded;
+	uint8_t view_stale;
+};
+
+struct cpu_s
+{
+	/* Memory pages, shared with the image and other cpus until written to. */
+	page_t *pages[MEM_PAGE_COUNT];
+	page_t *graphics;
+
+	/* Offsets into memory. */
+	uint16_t pc;
+	uint16_t sp;
+	uint16_t i;
+
+	uint16_t opcode; /* Instruction being executed. */
+
+	uint8_t reg_v[REG_COUNT];
+
+	/* Timers hold the value written at timer_*_cycle, the current value is derived on read. */
+	uint8_t timer_delay;
+	uint8_t timer_sound;
+	uint64_t timer_delay_cycle;
+	uint64_t timer_sound_cycle;
+	uint32_t timer_period;
+
+	uint64_t cycles;
+	uint64_t idle_cycles; /* Cycles spent halted or skipped, the others ran an instruction. */
+
+	uint16_t keys; /* Bit n set if key n is pressed. */
+
+	uint32_t rand_state;
+
+	uint8_t draw_flag;
+	uint8_t halted_flag;
+	uint8_t keys_read_flag; /* Set by instructions reading the keys. */
+	uint8_t pooled; /* Slot of a cpu_pool_t, not freed on its own. */
+
+	/* Natively compiled ROM used by cpu_run_for, NULL to interpret. */
+	const struct native_s *native;
+
+	/* Superinstruction table of the loaded image, used by cpu_run_for, may be NULL. */
+	struct cpu_fusion_s *fusion;
+
+	/* XO-CHIP state, NULL in CHIP-8 mode. Last so the CHIP-8 layout does not move. */
+	struct cpu_xo_s *xo;
+};
+
+/* Public function declarations */
+
+/**
+ * @brief Run one XO-CHIP instruction.
+ * 
+ * @param[in]	p_cpu	Pointer to cpu, in XO-CHIP mode.
+ * 
+ * @return CPU_OK, or the fault, the cpu is left unchanged.
+ */
+cpu_status_t xo_run(cpu_t *p_cpu);
+
+/**
+ * @brief Reset XO-CHIP state to the power-on state with the memory of an image.
+ * 
+ * @param[in]	p_xo	Pointer to XO-CHIP state.
+ * @param[in]	memory	XO_MEM_SIZE bytes of memory, font and program included.
+ */
+void xo_reset(struct cpu_xo_s *p_xo, const uint8_t *memory);
+
+/**
+ * @brief Write the big font of FX30 to memory, after the CHIP-8 font.
+ * 
+ * @param[out]	memory	XO_MEM_SIZE bytes of memory.
+ */
+void xo_font(uint8_t *memory);
+
+/**
+ * @brief Update the cpu_graphics view of the planes if they changed.
+ * 
+ * @param[in]	p_xo	Pointer to XO-CHIP state.
+ * 
+ * @return View, GRAPHICS_SIZE packed bytes.
+ */
+const uint8_t *xo_view(struct cpu_xo_s *p_xo);
+
+/**
+ * @brief Compose the planes into pixels through a palette.
+ * 
+ * @param[in]	planes		CPU_PLANE_COUNT planes of XO_PLANE_SIZE bytes, NULL for an empty plane.
+ * @param[in]	palette		CPU_COLOR_COUNT colors.
+ * @param[out]	pixels		XO_COLS * XO_ROWS colors.
+ */
+void xo_compose(const uint8_t *const *planes, const uint32_t *palette, uint32_t *pixels);
+
+/* Inlined function definitions */
+
+static inline uint8_t cpu_read(const cpu_t *p_cpu, uint16_t address)
+{
+	address &= (uint16_t)(MEM_SIZE - 1);
+	return p_cpu->pages[address >> PAGE_SHIFT_BITS]->data[address & (PAGE_BYTES - 1)];
+}
+
+static inline int cpu_memory_equal(const cpu_t *p_cpu, uint16_t address, const uint8_t *data, uint16_t size)
+{
+	while (size)
+	{
+		address &= (uint16_t)(MEM_SIZE - 1);
+		uint16_t offset = address & (PAGE_BYTES - 1);
+		uint16_t chunk = (uint16_t)(PAGE_BYTES - offset);
+		if (chunk > size)
+		{
+			chunk = size;
+		}
+
+		if (memcmp(p_cpu->pages[address >> PAGE_SHIFT_BITS]->data + offset, data, chunk) != 0)
+		{
+			return 0;
+		}
+
+		address = (uint16_t)(address + chunk);
+		data += chunk;
+		size = (uint16_t)(size - chunk);
+	}
+
+	return 1;
+}
+
+static inline uint32_t cpu_rand_next(cpu_t *p_cpu)
+{
+	/* xorshift32, per cpu so instances stay independent and reproducible. */
+	uint32_t x = p_cpu->rand_state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	p_cpu->rand_state = x;
+	return x;
+}
+
+/* Each pixel of a 16-pixel row becomes two, as low resolution pixels are drawn. */
+static inline uint32_t xo_pixels_double(uint16_t pixels)
+{
+	uint32_t x = pixels;
+	x = (x | (x << 8)) & 0x00FF00FFu;
+	x = (x | (x << 4)) & 0x0F0F0F0Fu;
+	x = (x | (x << 2)) & 0x33333333u;
+	x = (x | (x << 1)) & 0x55555555u;
+	return x | (x << 1);
+}
+
+/* Every other pixel of a 16-pixel row, the first one included: the inverse of xo_pixels_double. */
+static inline uint8_t xo_pixels_halve(uint32_t pixels)
+{
+	uint32_t x = (pixels >> 1) & 0x5555u;
+	x = (x | (x >> 1)) & 0x3333u;
+	x = (x | (x >> 2)) & 0x0F0Fu;
+	x = (x | (x >> 4)) & 0x00FFu;
+	return (uint8_t)x;
+}
+
+/* Bit n of a byte to bit 4n of a word, so four planes interleave into eight nibbles. */
+static inline uint32_t xo_nibbles_spread(uint8_t bits)
+{
+	uint32_t x = bits;
+	x = (x | (x << 12)) & 0x000F000Fu;
+	x = (x | (x << 6)) & 0x03030303u;
+	x = (x | (x << 3)) & 0x11111111u;
+	return x;
+}
+
+static inline uint8_t cpu_timer_value(const cpu_t *p_cpu, uint8_t value, uint64_t set_cycle)
+{
+	uint64_t ticks = (p_cpu->cycles - set_cycle) / p_cpu->timer_period;
+	return (ticks >= value) ? 0 : (uint8_t)(value - ticks);
+}
+
+#endif /* CPU_INTERNAL_H_ */
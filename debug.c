@@ -0,0 +1,491 @@
+#include "debug.h"
+
+#include "cpu.h"
+#include "cpu_internal.h"
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Defines */
+
+#define DEBUG_CHUNK_CYCLES (4096) /* Cycles between interrupt checks when nothing is set. */
+
+/* Typedefs */
+
+typedef enum point_kind_e
+{
+	POINT_NONE = 0,
+	POINT_BREAK,
+	POINT_CONDITION,
+	POINT_WATCH
+} point_kind_t;
+
+typedef struct point_s
+{
+	point_kind_t kind;
+
+	uint16_t pc; /* Breakpoint. */
+
+	/* Condition, true is its value after the last instruction. */
+	uint8_t reg;
+	debug_compare_t compare;
+	uint16_t value;
+	uint8_t true_flag;
+
+	/* Watchpoint. */
+	uint16_t start;
+	uint16_t end;
+	uint32_t access;
+} point_t;
+
+typedef struct access_s
+{
+	uint32_t kind; /* DEBUG_WATCH_READ or DEBUG_WATCH_WRITE, 0 if none. */
+	uint16_t address;
+	uint16_t size;
+} access_t;
+
+struct debug_s
+{
+	point_t points[DEBUG_POINTS_MAX];
+	uint32_t count;
+	uint32_t conditions;
+
+	/* Derived from the points: a bit per breakpoint address, a bit per page watched for each access. */
+	uint8_t breaks[MEM_SIZE / 8];
+	uint32_t watch_pages[2];
+
+	/* Where the last run stopped before an instruction, to step over it when resuming. */
+	uint16_t stop_pc;
+	uint64_t stop_cycles;
+	uint8_t stopped_flag;
+
+	atomic_int interrupt;
+};
+
+/* Private function declarations */
+
+static int point_add(debug_t *p_debug, const point_t *p_point);
+static void points_index(debug_t *p_debug);
+static int condition_true(const point_t *p_point, const cpu_t *p_cpu);
+static access_t access_decode(const cpu_t *p_cpu);
+static int watch_find(const debug_t *p_debug, const access_t *p_access, uint16_t *p_address);
+static cpu_status_t run_plain(debug_t *p_debug, cpu_t *p_cpu, uint32_t cycles, debug_event_t *p_event);
+
+/* Public function definitions */
+
+debug_t *debug_allocate(void)
+{
+	return calloc(1, sizeof(struct debug_s));
+}
+
+void debug_free(debug_t *p_debug)
+{
+	free(p_debug);
+}
+
+int debug_break(debug_t *p_debug, uint16_t pc)
+{
+	if (!p_debug || (pc >= MEM_SIZE))
+	{
+		return -1;
+	}
+
+	point_t point = {.kind = POINT_BREAK, .pc = pc};
+	return point_add(p_debug, &point);
+}
+
+int debug_condition(debug_t *p_debug, uint8_t reg, debug_compare_t compare, uint16_t value)
+{
+	if (!p_debug || (reg > DEBUG_REGISTER_I) || (compare > DEBUG_GREATER_EQUAL))
+	{
+		return -1;
+	}
+
+	point_t point = {.kind = POINT_CONDITION, .reg = reg, .compare = compare, .value = value};
+	return point_add(p_debug, &point);
+}
+
+int debug_watch(debug_t *p_debug, uint16_t start, uint16_t end, uint32_t access)
+{
+	uint32_t all = DEBUG_WATCH_READ | DEBUG_WATCH_WRITE;
+	if (!p_debug || (start > end) || (end >= MEM_SIZE) || !(access & all) || (access & ~all))
+	{
+		return -1;
+	}
+
+	point_t point = {.kind = POINT_WATCH, .start = start, .end = end, .access = access};
+	return point_add(p_debug, &point);
+}
+
+int debug_remove(debug_t *p_debug, int id)
+{
+	if (!p_debug || (id < 1) || (id > DEBUG_POINTS_MAX) || (p_debug->points[id - 1].kind == POINT_NONE))
+	{
+		return -1;
+	}
+
+	p_debug->points[id - 1].kind = POINT_NONE;
+	points_index(p_debug);
+
+	return 0;
+}
+
+int debug_describe(debug_t *p_debug, int id, char *text, uint32_t size)
+{
+	static const char *const compare_names[] = {"==", "!=", "<", "<=", ">", ">="};
+	static const char *const access_names[] = {"", "read", "write", "read/write"};
+
+	if (!p_debug || !text || !size || (id < 1) || (id > DEBUG_POINTS_MAX))
+	{
+		return -1;
+	}
+
+	const point_t *p_point = &(p_debug->points[id - 1]);
+	switch (p_point->kind)
+	{
+	case POINT_BREAK:
+		(void)snprintf(text, size, "break 0x%03X", p_point->pc);
+		break;
+	case POINT_CONDITION:
+		if (p_point->reg == DEBUG_REGISTER_I)
+		{
+			(void)snprintf(text, size, "condition I %s 0x%03X", compare_names[p_point->compare], p_point->value);
+		}
+		else
+		{
+			(void)snprintf(text, size, "condition V%X %s 0x%02X", p_point->reg, compare_names[p_point->compare],
+						   p_point->value);
+		}
+		break;
+	case POINT_WATCH:
+		(void)snprintf(text, size, "watch 0x%03X-0x%03X %s", p_point->start, p_point->end,
+					   access_names[p_point->access]);
+		break;
+	default:
+		return -1;
+	}
+
+	return 0;
+}
+
+void debug_interrupt(debug_t *p_debug)
+{
+	if (p_debug)
+	{
+		atomic_store_explicit(&(p_debug->interrupt), 1, memory_order_relaxed);
+	}
+}
+
+cpu_status_t debug_run_for(debug_t *p_debug, cpu_t *p_cpu, uint32_t cycles, debug_event_t *p_event)
+{
+	if (!p_debug || !p_cpu || !p_event)
+	{
+		return CPU_ERROR_ARGUMENT;
+	}
+
+	p_event->stop = DEBUG_STOP_NONE;
+	p_event->id = 0;
+	p_event->address = 0;
+	p_event->cycles = 0;
+
+	/* Nothing set: the engines run unchanged. */
+	if (!p_debug->count)
+	{
+		p_debug->stopped_flag = 0;
+		return run_plain(p_debug, p_cpu, cycles, p_event);
+	}
+
+	int resume = p_debug->stopped_flag && (p_cpu->pc == p_debug->stop_pc) && (p_cpu->cycles == p_debug->stop_cycles);
+	p_debug->stopped_flag = 0;
+
+	/* Conditions stop when they become true, not while they stay true. */
+	for (uint32_t index = 0; p_debug->conditions && (index < DEBUG_POINTS_MAX); index++)
+	{
+		point_t *p_point = &(p_debug->points[index]);
+		if (p_point->kind == POINT_CONDITION)
+		{
+			p_point->true_flag = (uint8_t)condition_true(p_point, p_cpu);
+		}
+	}
+
+	uint64_t start = p_cpu->cycles;
+	cpu_status_t status = CPU_OK;
+
+	while ((p_cpu->cycles - start) < cycles)
+	{
+		if (atomic_exchange_explicit(&(p_debug->interrupt), 0, memory_order_relaxed))
+		{
+			p_event->stop = DEBUG_STOP_INTERRUPT;
+			break;
+		}
+
+		if (!resume)
+		{
+			uint16_t pc = p_cpu->pc;
+			if ((pc < MEM_SIZE) && (p_debug->breaks[pc / 8] & (1u << (pc % 8))))
+			{
+				for (uint32_t index = 0; index < DEBUG_POINTS_MAX; index++)
+				{
+					if ((p_debug->points[index].kind == POINT_BREAK) && (p_debug->points[index].pc == pc))
+					{
+						p_event->stop = DEBUG_STOP_BREAKPOINT;
+						p_event->id = (int)index + 1;
+						break;
+					}
+				}
+			}
+
+			if (!p_event->stop && (p_debug->watch_pages[0] | p_debug->watch_pages[1]))
+			{
+				access_t access = access_decode(p_cpu);
+				int id = watch_find(p_debug, &access, &(p_event->address));
+				if (id)
+				{
+					p_event->stop = (access.kind == DEBUG_WATCH_READ) ? DEBUG_STOP_WATCH_READ : DEBUG_STOP_WATCH_WRITE;
+					p_event->id = id;
+				}
+			}
+
+			if (p_event->stop)
+			{
+				p_debug->stop_pc = p_cpu->pc;
+				p_debug->stop_cycles = p_cpu->cycles;
+				p_debug->stopped_flag = 1;
+				break;
+			}
+		}
+		resume = 0;
+
+		status = cpu_run(p_cpu);
+		if (status != CPU_OK)
+		{
+			p_event->stop = DEBUG_STOP_FAULT;
+			break;
+		}
+
+		for (uint32_t index = 0; p_debug->conditions && (index < DEBUG_POINTS_MAX); index++)
+		{
+			point_t *p_point = &(p_debug->points[index]);
+			if (p_point->kind == POINT_CONDITION)
+			{
+				uint8_t was_true = p_point->true_flag;
+				p_point->true_flag = (uint8_t)condition_true(p_point, p_cpu);
+				if (p_point->true_flag && !was_true && !p_event->stop)
+				{
+					p_event->stop = DEBUG_STOP_CONDITION;
+					p_event->id = (int)index + 1;
+				}
+			}
+		}
+
+		if (p_event->stop)
+		{
+			break;
+		}
+	}
+
+	p_event->cycles = (uint32_t)(p_cpu->cycles - start);
+
+	return status;
+}
+
+/* Private function definitions */
+
+static int point_add(debug_t *p_debug, const point_t *p_point)
+{
+	for (uint32_t index = 0; index < DEBUG_POINTS_MAX; index++)
+	{
+		if (p_debug->points[index].kind == POINT_NONE)
+		{
+			p_debug->points[index] = *p_point;
+			points_index(p_debug);
+			return (int)index + 1;
+		}
+	}
+
+	return -1;
+}
+
+static void points_index(debug_t *p_debug)
+{
+	memset(p_debug->breaks, 0, sizeof(p_debug->breaks));
+	p_debug->watch_pages[0] = 0;
+	p_debug->watch_pages[1] = 0;
+	p_debug->count = 0;
+	p_debug->conditions = 0;
+
+	for (uint32_t index = 0; index < DEBUG_POINTS_MAX; index++)
+	{
+		const point_t *p_point = &(p_debug->points[index]);
+		switch (p_point->kind)
+		{
+		case POINT_BREAK:
+			p_debug->breaks[p_point->pc / 8] |= (uint8_t)(1u << (p_point->pc % 8));
+			break;
+		case POINT_CONDITION:
+			p_debug->conditions++;
+			break;
+		case POINT_WATCH:
+			for (uint32_t page = p_point->start >> PAGE_SHIFT_BITS; page <= (uint32_t)(p_point->end >> PAGE_SHIFT_BITS);
+				 page++)
+			{
+				if (p_point->access & DEBUG_WATCH_READ)
+				{
+					p_debug->watch_pages[0] |= 1u << page;
+				}
+				if (p_point->access & DEBUG_WATCH_WRITE)
+				{
+					p_debug->watch_pages[1] |= 1u << page;
+				}
+			}
+			break;
+		default:
+			continue;
+		}
+
+		p_debug->count++;
+	}
+}
+
+static int condition_true(const point_t *p_point, const cpu_t *p_cpu)
+{
+	uint16_t value = (p_point->reg == DEBUG_REGISTER_I) ? p_cpu->i : p_cpu->reg_v[p_point->reg];
+
+	switch (p_point->compare)
+	{
+	case DEBUG_EQUAL:
+		return value == p_point->value;
+	case DEBUG_NOT_EQUAL:
+		return value != p_point->value;
+	case DEBUG_LESS:
+		return value < p_point->value;
+	case DEBUG_LESS_EQUAL:
+		return value <= p_point->value;
+	case DEBUG_GREATER:
+		return value > p_point->value;
+	case DEBUG_GREATER_EQUAL:
+		return value >= p_point->value;
+	default:
+		return 0;
+	}
+}
+
+/* Memory the instruction at pc reads or writes, other than fetching itself. */
+static access_t access_decode(const cpu_t *p_cpu)
+{
+	access_t access = {0, 0, 0};
+
+	/* Watchpoints cover the CHIP-8 memory. */
+	if (p_cpu->xo || (p_cpu->pc > (MEM_SIZE - 2)))
+	{
+		return access;
+	}
+
+	uint16_t opcode = (uint16_t)((cpu_read(p_cpu, p_cpu->pc) << 8) | cpu_read(p_cpu, p_cpu->pc + 1));
+	uint8_t x = (uint8_t)((opcode >> 8) & 0x0F);
+
+	switch (opcode >> 12)
+	{
+	case 0x0:
+		if (opcode == 0x00EE)
+		{
+			access = (access_t){DEBUG_WATCH_READ, p_cpu->sp, sizeof(uint16_t)};
+		}
+		break;
+	case 0x2:
+		access = (access_t){DEBUG_WATCH_WRITE, (uint16_t)(p_cpu->sp + sizeof(uint16_t)), sizeof(uint16_t)};
+		break;
+	case 0xD:
+		access = (access_t){DEBUG_WATCH_READ, p_cpu->i, (uint16_t)(opcode & 0x0F)};
+		break;
+	case 0xF:
+		switch (opcode & 0xFF)
+		{
+		case 0x33:
+			access = (access_t){DEBUG_WATCH_WRITE, p_cpu->i, 3};
+			break;
+		case 0x55:
+			access = (access_t){DEBUG_WATCH_WRITE, p_cpu->i, (uint16_t)(x + 1)};
+			break;
+		case 0x65:
+			access = (access_t){DEBUG_WATCH_READ, p_cpu->i, (uint16_t)(x + 1)};
+			break;
+		default:
+			break;
+		}
+		break;
+	default:
+		break;
+	}
+
+	return access;
+}
+
+/* Returns the id of the first watchpoint hit by the access and sets the address, 0 if none. */
+static int watch_find(const debug_t *p_debug, const access_t *p_access, uint16_t *p_address)
+{
+	uint32_t pages = p_debug->watch_pages[(p_access->kind == DEBUG_WATCH_READ) ? 0 : 1];
+	if (!p_access->kind || !pages)
+	{
+		return 0;
+	}
+
+	/* Addresses wrap as the cpu's do. */
+	for (uint16_t offset = 0; offset < p_access->size; offset++)
+	{
+		uint16_t address = (uint16_t)(p_access->address + offset) & (uint16_t)(MEM_SIZE - 1);
+		if (!(pages & (1u << (address >> PAGE_SHIFT_BITS))))
+		{
+			continue;
+		}
+
+		for (uint32_t index = 0; index < DEBUG_POINTS_MAX; index++)
+		{
+			const point_t *p_point = &(p_debug->points[index]);
+			if ((p_point->kind == POINT_WATCH) && (p_point->access & p_access->kind) && (address >= p_point->start) &&
+				(address <= p_point->end))
+			{
+				*p_address = address;
+				return (int)index + 1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+static cpu_status_t run_plain(debug_t *p_debug, cpu_t *p_cpu, uint32_t cycles, debug_event_t *p_event)
+{
+	uint64_t start = p_cpu->cycles;
+	cpu_status_t status = CPU_OK;
+
+	while ((status == CPU_OK) && ((p_cpu->cycles - start) < cycles))
+	{
+		if (atomic_exchange_explicit(&(p_debug->interrupt), 0, memory_order_relaxed))
+		{
+			p_event->stop = DEBUG_STOP_INTERRUPT;
+			break;
+		}
+
+		uint64_t before = p_cpu->cycles;
+		uint64_t left = cycles - (before - start);
+		status = cpu_run_for(p_cpu, (left < DEBUG_CHUNK_CYCLES) ? (uint32_t)left : DEBUG_CHUNK_CYCLES);
+		if (p_cpu->cycles == before)
+		{
+			break;
+		}
+	}
+
+	if (status != CPU_OK)
+	{
+		p_event->stop = DEBUG_STOP_FAULT;
+	}
+
+	p_event->cycles = (uint32_t)(p_cpu->cycles - start);
+
+	return status;
+}
@@ -0,0 +1,159 @@
+#ifndef DEBUG_H_
+#define DEBUG_H_
+
+#include "cpu.h"
+
+#include <stdint.h>
+
+/*
+ * Debugger: breakpoints, register conditions and memory watchpoints.
+ *
+ * debug_run_for replaces cpu_run_for while debugging. With nothing set it is
+ * cpu_run_for (compiled blocks and superinstructions included), so a debugger
+ * can stay attached to a run at full speed. Instructions are checked one at a
+ * time only while breakpoints, conditions or watchpoints exist, watchpoints
+ * first against a mask of the pages they cover.
+ *
+ * Watchpoints see the data accesses of instructions (DXYN, FX33, FX55, FX65 and
+ * the stack), not instruction fetches.
+ */
+
+/* Defines */
+
+#define DEBUG_POINTS_MAX (32)
+
+#define DEBUG_REGISTER_I (16) /* Register index of I in conditions, V0 to VF are 0 to 15. */
+
+/* Typedefs */
+
+typedef struct debug_s debug_t;
+
+typedef enum debug_stop_e
+{
+	DEBUG_STOP_NONE = 0,	/* Ran all cycles. */
+	DEBUG_STOP_BREAKPOINT,	/* Before the instruction at a breakpoint. */
+	DEBUG_STOP_CONDITION,	/* After the instruction that made a condition true. */
+	DEBUG_STOP_WATCH_READ,	/* Before an instruction reading a watched range. */
+	DEBUG_STOP_WATCH_WRITE, /* Before an instruction writing a watched range. */
+	DEBUG_STOP_INTERRUPT,	/* debug_interrupt was called. */
+	DEBUG_STOP_FAULT		/* The cpu faulted, see the returned status. */
+} debug_stop_t;
+
+typedef enum debug_compare_e
+{
+	DEBUG_EQUAL = 0,
+	DEBUG_NOT_EQUAL,
+	DEBUG_LESS,
+	DEBUG_LESS_EQUAL,
+	DEBUG_GREATER,
+	DEBUG_GREATER_EQUAL
+} debug_compare_t;
+
+#define DEBUG_WATCH_READ (1u << 0)
+#define DEBUG_WATCH_WRITE (1u << 1)
+
+typedef struct debug_event_s
+{
+	debug_stop_t stop;
+	int id;			  /* Breakpoint, condition or watchpoint that stopped the run. */
+	uint16_t address; /* First watched address accessed. */
+	uint32_t cycles;  /* Cycles run. */
+} debug_event_t;
+
+/* Public function declarations */
+
+/**
+ * @brief Allocate a debugger with nothing set.
+ *
+ * @return Pointer to debugger, or NULL if allocation failed.
+ */
+debug_t *debug_allocate(void);
+
+/**
+ * @brief Free a debugger.
+ *
+ * @param[in]	p_debug	Pointer to debugger, may be NULL.
+ */
+void debug_free(debug_t *p_debug);
+
+/**
+ * @brief Stop before executing the instruction at an address.
+ *
+ * @param[in]	p_debug	Pointer to debugger.
+ * @param[in]	pc		Instruction address.
+ *
+ * @return Breakpoint id, or -1 if full or out of memory.
+ */
+int debug_break(debug_t *p_debug, uint16_t pc);
+
+/**
+ * @brief Stop after the instruction making a register comparison true.
+ *
+ * @param[in]	p_debug		Pointer to debugger.
+ * @param[in]	reg			0 to 15 for V0 to VF, or DEBUG_REGISTER_I.
+ * @param[in]	compare		Comparison of the register with value.
+ * @param[in]	value		Value.
+ *
+ * @return Condition id, or -1 if full or invalid.
+ */
+int debug_condition(debug_t *p_debug, uint8_t reg, debug_compare_t compare, uint16_t value);
+
+/**
+ * @brief Stop before an instruction accessing a memory range.
+ *
+ * CHIP-8 memory only, watchpoints do not stop cpus in XO-CHIP mode.
+ *
+ * @param[in]	p_debug	Pointer to debugger.
+ * @param[in]	start	First address.
+ * @param[in]	end		Last address, included.
+ * @param[in]	access	DEBUG_WATCH_READ and/or DEBUG_WATCH_WRITE.
+ *
+ * @return Watchpoint id, or -1 if full or invalid.
+ */
+int debug_watch(debug_t *p_debug, uint16_t start, uint16_t end, uint32_t access);
+
+/**
+ * @brief Remove a breakpoint, condition or watchpoint.
+ *
+ * @param[in]	p_debug	Pointer to debugger.
+ * @param[in]	id		Id returned when it was set.
+ *
+ * @return 0 on success, -1 if not set.
+ */
+int debug_remove(debug_t *p_debug, int id);
+
+/**
+ * @brief Describe a breakpoint, condition or watchpoint.
+ *
+ * @param[in]	p_debug	Pointer to debugger.
+ * @param[in]	id		Id returned when it was set.
+ * @param[out]	text	Description.
+ * @param[in]	size	Size of text.
+ *
+ * @return 0 on success, -1 if not set.
+ */
+int debug_describe(debug_t *p_debug, int id, char *text, uint32_t size);
+
+/**
+ * @brief Make a running debug_run_for return, from any thread or a signal handler.
+ *
+ * @param[in]	p_debug	Pointer to debugger.
+ */
+void debug_interrupt(debug_t *p_debug);
+
+/**
+ * @brief Run cpu cycles, stopping at breakpoints, conditions and watchpoints.
+ *
+ * The first instruction is not checked when the cpu is where the last run
+ * stopped, so running again moves past the stop.
+ *
+ * @param[in]	p_debug	Pointer to debugger.
+ * @param[in]	p_cpu	Pointer to cpu.
+ * @param[in]	cycles	Maximum number of cycles to run.
+ * @param[out]	p_event	Why and where the run stopped.
+ *
+ * @return CPU_OK, or the fault that stopped the run.
+ */
+cpu_status_t debug_run_for(debug_t *p_debug, cpu_t *p_cpu, uint32_t cycles, debug_event_t *p_event);
+
+#endif /* DEBUG_H_ */
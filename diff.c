@@ -0,0 +1,593 @@
+#include "cpu.h"
+#include "cpu_internal.h"
+#include "log.h"
+#include "native.h"
+#include "rom.h"
+#include "script.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Defines */
+
+#define FRAMES_DEFAULT (36000)
+#define CYCLES_DEFAULT (100) /* Engines interpret the blocks longer than a frame. */
+#define KEY_PERIOD (30)		 /* Frames between random key changes. */
+
+#define TRACE_LENGTH (16) /* Instructions shown before a divergence. */
+#define DIFF_BYTES_MAX (16)
+
+#define ENGINE_COUNT (2)
+
+/* Typedefs */
+
+typedef enum engine_kind_e
+{
+	ENGINE_INTERPRETER = 0,
+	ENGINE_FUSED,
+	ENGINE_NATIVE
+} engine_kind_t;
+
+typedef struct options_s
+{
+	engine_kind_t engines[ENGINE_COUNT];
+	uint32_t engine_count;
+	uint64_t frames; /* Per ROM. */
+	uint32_t cycles; /* Per frame, states are compared after each. */
+	const char *script_path;
+	uint32_t seed;
+	int rom_index; /* First ROM path in argv. */
+} options_t;
+
+typedef struct engine_s
+{
+	engine_kind_t kind;
+	native_t *p_native;
+	cpu_t *p_cpu;
+	cpu_t *p_checkpoint; /* State at the start of the frame. */
+	cpu_t *p_probe;		 /* Replays from the checkpoint. */
+	cpu_status_t status;
+} engine_t;
+
+/* Private variables */
+
+static const char *const engine_names[] = {"interpreter", "fused", "native"};
+
+/* Private function declarations */
+
+static int parse_options(options_t *p_options, int argc, char *argv[]);
+static int parse_engine(const char *name, engine_kind_t *p_kind);
+static int check_input(const options_t *p_options, const char *path);
+static int check_entry(const options_t *p_options, const char *archive_path, const rom_entry_t *p_entry);
+static int check_rom(const options_t *p_options, const char *rom_name, const char *rom_path, const uint8_t *data,
+					 size_t size);
+static int engines_open(engine_t *engines, const options_t *p_options, const uint8_t *data, size_t size,
+						const char *rom_path);
+static void engines_close(engine_t *engines);
+static int state_equal(const cpu_t *p_a, const cpu_t *p_b);
+static void report_divergence(engine_t *engines, const char *rom_path, uint64_t frame, uint32_t cycles);
+static void print_trace(const cpu_t *p_checkpoint, uint32_t cycles);
+static void print_diff(const engine_t *engines, const cpu_t *p_a, const cpu_t *p_b);
+static uint16_t random_keys(uint32_t *p_state);
+
+/* Public function definitions */
+
+int main(int argc, char *argv[])
+{
+	options_t options;
+	if (parse_options(&options, argc, argv) != 0)
+	{
+		return -1;
+	}
+
+	int failures = 0;
+	for (int arg = options.rom_index; arg < argc; arg++)
+	{
+		failures += check_input(&options, argv[arg]);
+	}
+
+	return failures ? 1 : 0;
+}
+
+/* Private function definitions */
+
+static int parse_options(options_t *p_options, int argc, char *argv[])
+{
+	(void)memset(p_options, 0, sizeof(options_t));
+	p_options->frames = FRAMES_DEFAULT;
+	p_options->cycles = CYCLES_DEFAULT;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "e:n:c:s:r:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'e':
+			if (p_options->engine_count == ENGINE_COUNT)
+			{
+				ERROR_PRINT("Two engines at most.\n");
+				return -1;
+			}
+			if (parse_engine(optarg, &(p_options->engines[p_options->engine_count])) != 0)
+			{
+				ERROR_PRINT_ARGS("Unknown engine (%s).\n", optarg);
+				return -1;
+			}
+			p_options->engine_count++;
+			break;
+		case 'n':
+			p_options->frames = strtoull(optarg, NULL, 0);
+			break;
+		case 'c':
+			p_options->cycles = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			p_options->script_path = optarg;
+			break;
+		case 'r':
+			p_options->seed = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+		default:
+			ERROR_PRINT("Invalid argument.\n");
+			return -1;
+		}
+	}
+
+	/* The interpreter is the reference when a single engine is given, fused code by default. */
+	if (p_options->engine_count == 0)
+	{
+		p_options->engines[p_options->engine_count++] = ENGINE_FUSED;
+	}
+	if (p_options->engine_count == 1)
+	{
+		p_options->engines[1] = p_options->engines[0];
+		p_options->engines[0] = ENGINE_INTERPRETER;
+	}
+
+	if ((optind >= argc) || !p_options->cycles)
+	{
+		ERROR_PRINT("Missing argument.\n");
+		return -1;
+	}
+
+	p_options->rom_index = optind;
+
+	return 0;
+}
+
+static int parse_engine(const char *name, engine_kind_t *p_kind)
+{
+	for (uint32_t kind = 0; kind < (sizeof(engine_names) / sizeof(engine_names[0])); kind++)
+	{
+		if (strcmp(name, engine_names[kind]) == 0)
+		{
+			*p_kind = (engine_kind_t)kind;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+/* Checks a ROM file, every ROM of an archive, or one named "archive.c8a:name", returns the failure count. */
+static int check_input(const options_t *p_options, const char *path)
+{
+	int failures = 0;
+	rom_entry_t entry;
+
+	if (rom_is_archive(path))
+	{
+		rom_archive_t *p_archive = rom_archive_open(path);
+		if (!p_archive)
+		{
+			ERROR_PRINT_ARGS("rom_archive_open failed (%s).\n", path);
+			return 1;
+		}
+
+		for (uint32_t index = 0; rom_archive_entry(p_archive, index, &entry) == 0; index++)
+		{
+			if (check_entry(p_options, path, &entry) != 0)
+			{
+				failures++;
+			}
+		}
+
+		rom_archive_close(p_archive);
+		return failures;
+	}
+
+	rom_archive_t *p_archive = rom_archive_open_entry(path, &entry);
+	if (p_archive)
+	{
+		size_t length = strlen(path) - strlen(entry.name) - 1;
+		char archive_path[4096];
+		(void)snprintf(archive_path, sizeof(archive_path), "%.*s", (int)length, path);
+
+		failures = (check_entry(p_options, archive_path, &entry) != 0);
+		rom_archive_close(p_archive);
+		return failures;
+	}
+
+	rom_t rom;
+	if (rom_load(&rom, path) != 0)
+	{
+		ERROR_PRINT_ARGS("rom_load failed (%s).\n", path);
+		return 1;
+	}
+
+	failures = (check_rom(p_options, path, path, rom.data, rom.size) != 0);
+	rom_free(&rom);
+
+	return failures;
+}
+
+/* The script and native module of an archived ROM are looked for next to the archive, under the ROM's name. */
+static int check_entry(const options_t *p_options, const char *archive_path, const rom_entry_t *p_entry)
+{
+	char rom_name[4096];
+	(void)snprintf(rom_name, sizeof(rom_name), "%s:%s", archive_path, p_entry->name);
+
+	const char *slash = strrchr(archive_path, '/');
+	char rom_path[4096];
+	(void)snprintf(rom_path, sizeof(rom_path), "%.*s%s", slash ? (int)(slash + 1 - archive_path) : 0, archive_path,
+				   p_entry->name);
+
+	return check_rom(p_options, rom_name, rom_path, p_entry->data, p_entry->size);
+}
+
+static int check_rom(const options_t *p_options, const char *rom_name, const char *rom_path, const uint8_t *data,
+					 size_t size)
+{
+	engine_t engines[ENGINE_COUNT];
+	if (engines_open(engines, p_options, data, size, rom_path) != 0)
+	{
+		return -1;
+	}
+
+	/* Keys from the given script, else the one next to the ROM, else random taps. */
+	script_t *p_script = NULL;
+	char script_path[4096];
+	const char *extension = strrchr(rom_path, '.');
+	(void)snprintf(script_path, sizeof(script_path), "%.*s.keys",
+				   extension ? (int)(extension - rom_path) : (int)strlen(rom_path), rom_path);
+
+	if (p_options->script_path)
+	{
+		p_script = script_load(p_options->script_path);
+	}
+	else if (access(script_path, R_OK) == 0)
+	{
+		p_script = script_load(script_path);
+	}
+
+	uint32_t random_state = p_options->seed | 1u;
+	uint16_t keys = 0;
+	int result = 0;
+	uint64_t frame = 0;
+
+	for (; frame < p_options->frames; frame++)
+	{
+		if (p_script)
+		{
+			keys = script_keys(p_script, frame);
+		}
+		else if ((frame % KEY_PERIOD) == 0)
+		{
+			keys = random_keys(&random_state);
+		}
+
+		for (uint32_t engine = 0; engine < ENGINE_COUNT; engine++)
+		{
+			cpu_set_keys(engines[engine].p_cpu, keys);
+			(void)cpu_fork(engines[engine].p_checkpoint, engines[engine].p_cpu);
+			engines[engine].status = cpu_run_for(engines[engine].p_cpu, p_options->cycles);
+		}
+
+		if ((engines[0].status != engines[1].status) || !state_equal(engines[0].p_cpu, engines[1].p_cpu))
+		{
+			report_divergence(engines, rom_name, frame, p_options->cycles);
+			result = -1;
+			break;
+		}
+
+		if (engines[0].status != CPU_OK)
+		{
+			break;
+		}
+	}
+
+	if (result == 0)
+	{
+		printf("%s: %s and %s match over %llu frames%s%s\n", rom_name,
+			   engine_names[engines[0].kind], engine_names[engines[1].kind], (unsigned long long)frame,
+			   (engines[0].status == CPU_OK) ? "" : ", both stopped: ",
+			   (engines[0].status == CPU_OK) ? "" : cpu_status_string(engines[0].status));
+	}
+
+	script_free(p_script);
+	engines_close(engines);
+
+	return result;
+}
+
+static int engines_open(engine_t *engines, const options_t *p_options, const uint8_t *data, size_t size,
+						const char *rom_path)
+{
+	(void)memset(engines, 0, ENGINE_COUNT * sizeof(engine_t));
+
+	cpu_image_t *p_image = cpu_image_allocate(data, size);
+	if (!p_image)
+	{
+		ERROR_PRINT("cpu_image_allocate failed, ROM too large or out of memory.\n");
+		return -1;
+	}
+
+	cpu_image_t *p_fused_image = NULL;
+	int result = 0;
+
+	for (uint32_t index = 0; (index < ENGINE_COUNT) && (result == 0); index++)
+	{
+		engine_t *p_engine = &(engines[index]);
+		p_engine->kind = p_options->engines[index];
+		p_engine->p_cpu = cpu_allocate();
+		p_engine->p_checkpoint = cpu_allocate();
+		p_engine->p_probe = cpu_allocate();
+
+		if (!p_engine->p_cpu || !p_engine->p_checkpoint || !p_engine->p_probe)
+		{
+			ERROR_PRINT("cpu_allocate failed.\n");
+			result = -1;
+			break;
+		}
+
+		if ((p_engine->kind == ENGINE_FUSED) && !p_fused_image)
+		{
+			p_fused_image = cpu_image_allocate(data, size);
+			if (!p_fused_image || (cpu_image_fuse(p_fused_image) != CPU_OK))
+			{
+				ERROR_PRINT("cpu_image_fuse failed.\n");
+				result = -1;
+				break;
+			}
+		}
+
+		(void)cpu_load_image(p_engine->p_cpu, (p_engine->kind == ENGINE_FUSED) ? p_fused_image : p_image);
+		cpu_seed(p_engine->p_cpu, p_options->seed);
+
+		if (p_engine->kind == ENGINE_NATIVE)
+		{
+			/* chip8-aot's default output name. */
+			char native_path[4096];
+			(void)snprintf(native_path, sizeof(native_path), "%s.so", rom_path);
+
+			p_engine->p_native = native_load(native_path, data, (uint16_t)size);
+			if (!p_engine->p_native)
+			{
+				ERROR_PRINT_ARGS("native_load failed (%s).\n", native_path);
+				result = -1;
+				break;
+			}
+			native_attach(p_engine->p_cpu, p_engine->p_native);
+		}
+	}
+
+	cpu_image_free(p_fused_image);
+	cpu_image_free(p_image);
+
+	if (result != 0)
+	{
+		engines_close(engines);
+	}
+
+	return result;
+}
+
+static void engines_close(engine_t *engines)
+{
+	for (uint32_t index = 0; index < ENGINE_COUNT; index++)
+	{
+		/* Cpus first, they reference the module. */
+		cpu_free(engines[index].p_cpu);
+		cpu_free(engines[index].p_checkpoint);
+		cpu_free(engines[index].p_probe);
+		native_free(engines[index].p_native);
+		(void)memset(&(engines[index]), 0, sizeof(engine_t));
+	}
+}
+
+static int state_equal(const cpu_t *p_a, const cpu_t *p_b)
+{
+	if ((p_a->pc != p_b->pc) || (p_a->i != p_b->i) || (p_a->sp != p_b->sp) || (p_a->cycles != p_b->cycles) ||
+		(p_a->halted_flag != p_b->halted_flag) || (p_a->rand_state != p_b->rand_state) ||
+		(memcmp(p_a->reg_v, p_b->reg_v, REG_COUNT) != 0))
+	{
+		return 0;
+	}
+
+	if ((cpu_timer_value(p_a, p_a->timer_delay, p_a->timer_delay_cycle) !=
+		 cpu_timer_value(p_b, p_b->timer_delay, p_b->timer_delay_cycle)) ||
+		(cpu_timer_value(p_a, p_a->timer_sound, p_a->timer_sound_cycle) !=
+		 cpu_timer_value(p_b, p_b->timer_sound, p_b->timer_sound_cycle)))
+	{
+		return 0;
+	}
+
+	/* Pages both still share with the image compare without reading them. */
+	for (uint32_t page = 0; page < MEM_PAGE_COUNT; page++)
+	{
+		if ((p_a->pages[page] != p_b->pages[page]) &&
+			(memcmp(p_a->pages[page]->data, p_b->pages[page]->data, PAGE_BYTES) != 0))
+		{
+			return 0;
+		}
+	}
+
+	return (p_a->graphics == p_b->graphics) ||
+		   (memcmp(p_a->graphics->data, p_b->graphics->data, CPU_GRAPHICS_SIZE) == 0);
+}
+
+static void report_divergence(engine_t *engines, const char *rom_path, uint64_t frame, uint32_t cycles)
+{
+	/* Replay the frame with growing budgets, engines only run a block or superinstruction when it fits. */
+	uint32_t length = cycles;
+	for (uint32_t budget = 1; budget <= cycles; budget++)
+	{
+		for (uint32_t index = 0; index < ENGINE_COUNT; index++)
+		{
+			(void)cpu_fork(engines[index].p_probe, engines[index].p_checkpoint);
+			engines[index].status = cpu_run_for(engines[index].p_probe, budget);
+		}
+
+		if ((engines[0].status != engines[1].status) || !state_equal(engines[0].p_probe, engines[1].p_probe))
+		{
+			length = budget;
+			break;
+		}
+	}
+
+	printf("%s: %s and %s diverge in frame %llu, %u cycles after cycle %llu:\n", rom_path,
+		   engine_names[engines[0].kind], engine_names[engines[1].kind], (unsigned long long)frame, length,
+		   (unsigned long long)engines[0].p_checkpoint->cycles);
+
+	print_trace(engines[0].p_checkpoint, length);
+
+	/* Probes hold the states of the shortest diverging replay. */
+	for (uint32_t index = 0; index < ENGINE_COUNT; index++)
+	{
+		(void)cpu_fork(engines[index].p_probe, engines[index].p_checkpoint);
+		engines[index].status = cpu_run_for(engines[index].p_probe, length);
+	}
+
+	print_diff(engines, engines[0].p_probe, engines[1].p_probe);
+}
+
+static void print_trace(const cpu_t *p_checkpoint, uint32_t cycles)
+{
+	cpu_t *p_cpu = cpu_allocate();
+	if (!p_cpu)
+	{
+		return;
+	}
+
+	(void)cpu_fork(p_cpu, p_checkpoint);
+
+	/* The reference run, one instruction at a time. */
+	printf("  interpreter trace:\n");
+	for (uint32_t cycle = 0; cycle < cycles; cycle++)
+	{
+		uint16_t pc = p_cpu->pc;
+		uint16_t opcode = (uint16_t)((cpu_peek(p_cpu, pc) << 8) | cpu_peek(p_cpu, pc + 1));
+		cpu_status_t status = cpu_run(p_cpu);
+
+		if ((cycles - cycle) <= TRACE_LENGTH)
+		{
+			printf("    %04X  %04X%s%s\n", pc, opcode, (status == CPU_OK) ? "" : "  ",
+				   (status == CPU_OK) ? "" : cpu_status_string(status));
+		}
+
+		if (status != CPU_OK)
+		{
+			break;
+		}
+	}
+
+	cpu_free(p_cpu);
+}
+
+static void print_diff(const engine_t *engines, const cpu_t *p_a, const cpu_t *p_b)
+{
+	printf("  %-10s %-12s %-12s\n", "", engine_names[engines[0].kind], engine_names[engines[1].kind]);
+
+	if (engines[0].status != engines[1].status)
+	{
+		printf("  %-10s %-12s %-12s\n", "status", cpu_status_string(engines[0].status),
+			   cpu_status_string(engines[1].status));
+	}
+
+	const struct
+	{
+		const char *name;
+		uint64_t a;
+		uint64_t b;
+	} fields[] = {
+		{"pc", p_a->pc, p_b->pc},
+		{"i", p_a->i, p_b->i},
+		{"sp", p_a->sp, p_b->sp},
+		{"cycles", p_a->cycles, p_b->cycles},
+		{"halted", p_a->halted_flag, p_b->halted_flag},
+		{"rand", p_a->rand_state, p_b->rand_state},
+		{"delay", cpu_timer_value(p_a, p_a->timer_delay, p_a->timer_delay_cycle),
+		 cpu_timer_value(p_b, p_b->timer_delay, p_b->timer_delay_cycle)},
+		{"sound", cpu_timer_value(p_a, p_a->timer_sound, p_a->timer_sound_cycle),
+		 cpu_timer_value(p_b, p_b->timer_sound, p_b->timer_sound_cycle)},
+	};
+
+	for (uint32_t field = 0; field < (sizeof(fields) / sizeof(fields[0])); field++)
+	{
+		if (fields[field].a != fields[field].b)
+		{
+			printf("  %-10s 0x%-10llX 0x%-10llX\n", fields[field].name, (unsigned long long)fields[field].a,
+				   (unsigned long long)fields[field].b);
+		}
+	}
+
+	for (uint32_t reg = 0; reg < REG_COUNT; reg++)
+	{
+		if (p_a->reg_v[reg] != p_b->reg_v[reg])
+		{
+			printf("  V%-9X 0x%-10X 0x%-10X\n", reg, p_a->reg_v[reg], p_b->reg_v[reg]);
+		}
+	}
+
+	uint32_t bytes = 0;
+	for (uint32_t address = 0; address < MEM_SIZE; address++)
+	{
+		uint8_t a = cpu_read(p_a, (uint16_t)address);
+		uint8_t b = cpu_read(p_b, (uint16_t)address);
+
+		if ((a != b) && (bytes++ < DIFF_BYTES_MAX))
+		{
+			printf("  [%03X]      0x%-10X 0x%-10X\n", address, a, b);
+		}
+	}
+	if (bytes > DIFF_BYTES_MAX)
+	{
+		printf("  %u more memory bytes differ\n", bytes - DIFF_BYTES_MAX);
+	}
+
+	uint32_t pixels = 0;
+	for (uint32_t line = 0; line < CPU_GRAPHICS_ROWS; line++)
+	{
+		for (uint32_t column = 0; column < CPU_GRAPHICS_COLS; column++)
+		{
+			if (cpu_graphics_pixel(p_a->graphics->data, column, line) !=
+				cpu_graphics_pixel(p_b->graphics->data, column, line))
+			{
+				if (!pixels)
+				{
+					printf("  graphics differ, first at (%u, %u)", column, line);
+				}
+				pixels++;
+			}
+		}
+	}
+	if (pixels)
+	{
+		printf(", %u pixels\n", pixels);
+	}
+}
+
+static uint16_t random_keys(uint32_t *p_state)
+{
+	uint32_t x = *p_state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*p_state = x;
+
+	/* No key half of the time, else a single one. */
+	return (x & 1) ? (uint16_t)(1u << ((x >> 1) & 0x0F)) : 0;
+}
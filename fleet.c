@@ -0,0 +1,350 @@
+#include "cpu.h"
+#include "log.h"
+#include "native.h"
+#include "rom.h"
+#include "sched.h"
+#include "wall.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Defines */
+
+#define INSTANCE_COUNT_DEFAULT (1000)
+#define CYCLES_PER_FRAME_DEFAULT (10) /* 600 Hz cpu, 60 Hz frames. */
+#define FRAME_FREQUENCY_DEFAULT (60)
+#define DURATION_DEFAULT (10)
+#define WALL_FREQUENCY (60) /* Wall frames per second. */
+
+/* Typedefs */
+
+typedef struct options_s
+{
+	uint32_t instance_count;
+	uint32_t workers;
+	uint32_t cycles_per_frame;
+	uint32_t frame_frequency;
+	uint32_t duration;	/* Seconds, 0 to run until interrupted. */
+	uint32_t key_taps; /* Random key taps per second, spread over instances. */
+	uint32_t seed;
+	const char *native_path;
+	int fuse;
+	int wall;
+	const char *rom_path;
+} options_t;
+
+/* Private variables */
+
+static volatile sig_atomic_t quit = 0;
+
+/* Private function declarations */
+
+static int parse_options(options_t *p_options, int argc, char *argv[]);
+static void on_signal(int signal);
+static void wait_tick(wall_t *p_wall);
+
+/* Public function definitions */
+
+int main(int argc, char *argv[])
+{
+	options_t options;
+	if (parse_options(&options, argc, argv) != 0)
+	{
+		return -1;
+	}
+
+	/* A ROM file, a ROM named "archive.c8a:name", or an archive holding a single ROM. */
+	rom_t rom = {NULL, 0};
+	rom_entry_t entry;
+	rom_archive_t *p_archive = NULL;
+
+	if (rom_is_archive(options.rom_path))
+	{
+		p_archive = rom_archive_open(options.rom_path);
+		if (!p_archive || (rom_archive_count(p_archive) != 1))
+		{
+			ERROR_PRINT_ARGS("Archive invalid or holding several ROMs, name one (%s:name).\n", options.rom_path);
+			rom_archive_close(p_archive);
+			return -1;
+		}
+		(void)rom_archive_entry(p_archive, 0, &entry);
+	}
+	else
+	{
+		p_archive = rom_archive_open_entry(options.rom_path, &entry);
+	}
+
+	if (!p_archive)
+	{
+		if (rom_load(&rom, options.rom_path) != 0)
+		{
+			ERROR_PRINT("rom_load failed.\n");
+			return -1;
+		}
+		entry.data = rom.data;
+		entry.size = rom.size;
+	}
+
+	cpu_image_t *p_image = cpu_image_allocate(entry.data, entry.size);
+	if (!p_image)
+	{
+		ERROR_PRINT("cpu_image_allocate failed, ROM too large or out of memory.\n");
+		return -1;
+	}
+
+	if (options.fuse && (cpu_image_fuse(p_image) != CPU_OK))
+	{
+		ERROR_PRINT("cpu_image_fuse failed.\n");
+	}
+
+	native_t *p_native = NULL;
+	if (options.native_path)
+	{
+		p_native = native_load(options.native_path, entry.data, (uint16_t)entry.size);
+		if (!p_native)
+		{
+			ERROR_PRINT_ARGS("native_load failed (%s), interpreting.\n", options.native_path);
+		}
+	}
+
+	sched_config_t config;
+	config.workers = options.workers;
+	config.capacity = options.instance_count;
+	config.cycles_per_frame = options.cycles_per_frame;
+	config.frame_frequency = options.frame_frequency;
+
+	sched_t *p_sched = sched_allocate(&config);
+	cpu_t **cpus = calloc(options.instance_count, sizeof(cpu_t *));
+	if (!p_sched || !cpus)
+	{
+		ERROR_PRINT("sched_allocate failed.\n");
+		return -1;
+	}
+
+	for (uint32_t index = 0; index < options.instance_count; index++)
+	{
+		cpus[index] = cpu_allocate();
+		if (!cpus[index])
+		{
+			ERROR_PRINT("cpu_allocate failed.\n");
+			return -1;
+		}
+
+		(void)cpu_load_image(cpus[index], p_image);
+		cpu_seed(cpus[index], options.seed + index);
+		cpu_set_timer_period(cpus[index], options.cycles_per_frame);
+		native_attach(cpus[index], p_native);
+		(void)sched_add(p_sched, cpus[index]);
+	}
+
+	struct sigaction action;
+	(void)memset(&action, 0, sizeof(action));
+	action.sa_handler = on_signal;
+	(void)sigaction(SIGINT, &action, NULL);
+	(void)sigaction(SIGTERM, &action, NULL);
+
+	wall_t *p_wall = NULL;
+	if (options.wall)
+	{
+		p_wall = wall_open(p_sched, options.instance_count);
+		if (!p_wall)
+		{
+			ERROR_PRINT("wall_open failed.\n");
+			return -1;
+		}
+	}
+
+	if (sched_start(p_sched) != 0)
+	{
+		ERROR_PRINT("sched_start failed.\n");
+		return -1;
+	}
+
+	/* Key taps are spread over ten ticks per second. */
+	uint32_t taps = options.key_taps / 10;
+	uint32_t *tap_ids = calloc(taps + 1, sizeof(uint32_t));
+	uint8_t *tap_keys = calloc(taps + 1, sizeof(uint8_t));
+	if (!tap_ids || !tap_keys)
+	{
+		ERROR_PRINT("calloc failed.\n");
+		return -1;
+	}
+
+	uint32_t random_state = options.seed | 1u;
+	sched_stats_t last;
+	(void)memset(&last, 0, sizeof(last));
+
+	printf("%8s %8s %8s %8s %8s %10s %12s %12s %12s\n",
+		   "time", "runnable", "input", "timer", "stopped", "slices/s", "cycles/s", "skipped/s", "bytes/inst");
+
+	for (uint32_t second = 1; !quit && (!options.duration || (second <= options.duration)); second++)
+	{
+		/* Keys are held for a tenth of a second, long enough for a slice to see them. */
+		for (uint32_t tick = 0; (tick < 10) && !quit; tick++)
+		{
+			for (uint32_t tap = 0; tap < taps; tap++)
+			{
+				random_state ^= random_state << 13;
+				random_state ^= random_state >> 17;
+				random_state ^= random_state << 5;
+
+				tap_ids[tap] = random_state % options.instance_count;
+				tap_keys[tap] = (uint8_t)((random_state >> 24) & 0x0F);
+				sched_press_key(p_sched, tap_ids[tap], tap_keys[tap]);
+			}
+
+			wait_tick(p_wall);
+
+			for (uint32_t tap = 0; tap < taps; tap++)
+			{
+				sched_release_key(p_sched, tap_ids[tap], tap_keys[tap]);
+			}
+		}
+
+		sched_stats_t stats;
+		sched_stats(p_sched, &stats);
+
+		printf("%8u %8u %8u %8u %8u %10llu %12llu %12llu %12llu\n", second,
+			   stats.runnable, stats.input, stats.timer, stats.stopped,
+			   (unsigned long long)(stats.slices - last.slices),
+			   (unsigned long long)(stats.cycles - last.cycles),
+			   (unsigned long long)(stats.skipped_cycles - last.skipped_cycles),
+			   (unsigned long long)(stats.footprint / options.instance_count));
+		(void)fflush(stdout);
+
+		last = stats;
+	}
+
+	wall_close(p_wall);
+	sched_free(p_sched);
+	free(tap_ids);
+	free(tap_keys);
+
+	for (uint32_t index = 0; index < options.instance_count; index++)
+	{
+		cpu_free(cpus[index]);
+	}
+	free(cpus);
+	native_free(p_native);
+	cpu_image_free(p_image);
+	rom_archive_close(p_archive);
+	rom_free(&rom);
+
+	return 0;
+}
+
+/* Private function definitions */
+
+static int parse_options(options_t *p_options, int argc, char *argv[])
+{
+	(void)memset(p_options, 0, sizeof(options_t));
+	p_options->instance_count = INSTANCE_COUNT_DEFAULT;
+	p_options->cycles_per_frame = CYCLES_PER_FRAME_DEFAULT;
+	p_options->frame_frequency = FRAME_FREQUENCY_DEFAULT;
+	p_options->duration = DURATION_DEFAULT;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "n:w:c:f:t:k:r:N:FW")) != -1)
+	{
+		switch (opt)
+		{
+		case 'n':
+			p_options->instance_count = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			p_options->workers = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			p_options->cycles_per_frame = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			p_options->frame_frequency = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			p_options->duration = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'k':
+			p_options->key_taps = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			p_options->seed = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'N':
+			p_options->native_path = optarg;
+			break;
+		case 'F':
+			p_options->fuse = 1;
+			break;
+		case 'W':
+			p_options->wall = 1;
+			break;
+		default:
+			ERROR_PRINT("Invalid argument.\n");
+			return -1;
+		}
+	}
+
+	if (optind >= argc)
+	{
+		ERROR_PRINT("Missing argument.\n");
+		return -1;
+	}
+
+	if (!p_options->instance_count || !p_options->cycles_per_frame || !p_options->frame_frequency)
+	{
+		ERROR_PRINT("Invalid instance count, cycles per frame or frame frequency.\n");
+		return -1;
+	}
+
+	p_options->rom_path = argv[optind];
+
+	return 0;
+}
+
+static void on_signal(int signal)
+{
+	(void)signal;
+	quit = 1;
+}
+
+static void wait_tick(wall_t *p_wall)
+{
+	if (!p_wall)
+	{
+		struct timespec delay = {0, 100000000L};
+		while ((nanosleep(&delay, &delay) != 0) && (errno == EINTR) && !quit)
+		{
+		}
+		return;
+	}
+
+	/* The wall refreshes during the tick, on absolute deadlines so rendering does not stretch it. */
+	struct timespec deadline;
+	(void)clock_gettime(CLOCK_MONOTONIC, &deadline);
+
+	for (uint32_t frame = 0; (frame < (WALL_FREQUENCY / 10)) && !quit; frame++)
+	{
+		if (wall_frame(p_wall))
+		{
+			quit = 1;
+			break;
+		}
+
+		deadline.tv_nsec += 1000000000L / WALL_FREQUENCY;
+		if (deadline.tv_nsec >= 1000000000L)
+		{
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+
+		while ((clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR) && !quit)
+		{
+		}
+	}
+}
@@ -0,0 +1,127 @@
+#include "cpu.h"
+#include "cpu_internal.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * Fuzz target: arbitrary bytes are loaded as a ROM and run for a bounded number
+ * of cycles, with the keys changing along the way.
+ *
+ * cpu_load builds a memory image per call. Instead, the input is written over a
+ * blank cpu forked from a snapshot taken once, which is the same state but only
+ * copies the pages the input covers.
+ *
+ * Built for libFuzzer with clang, otherwise with a driver running each file given
+ * on the command line once, to reproduce crashes.
+ */
+
+/* Defines */
+
+#define FUZZ_CYCLES (20000)
+#define FUZZ_KEY_PERIOD (FUZZ_CYCLES / KEY_COUNT) /* Cycles between key changes. */
+
+/* Private variables */
+
+static cpu_t *p_snapshot;
+static cpu_t *p_cpu;
+
+/* Private function declarations */
+
+static void fuzz_check(int condition, const char *message);
+
+/* Public function definitions */
+
+int LLVMFuzzerInitialize(int *argc, char ***argv)
+{
+	(void)argc;
+	(void)argv;
+
+	static const uint8_t empty[1];
+
+	p_snapshot = cpu_allocate();
+	p_cpu = cpu_allocate();
+	fuzz_check(p_snapshot && p_cpu, "cpu_allocate failed");
+
+	fuzz_check(cpu_load(p_snapshot, empty, 0) == CPU_OK, "cpu_load failed");
+
+	return 0;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	if (!p_snapshot)
+	{
+		(void)LLVMFuzzerInitialize(NULL, NULL);
+	}
+
+	/* Larger ROMs are truncated, cpu_load would reject them. */
+	if (size > CPU_PROGRAM_SIZE_MAX)
+	{
+		size = CPU_PROGRAM_SIZE_MAX;
+	}
+
+	fuzz_check(cpu_fork(p_cpu, p_snapshot) == CPU_OK, "cpu_fork failed");
+	fuzz_check(cpu_poke(p_cpu, ROM_ADDRESS, data, (uint16_t)size) == CPU_OK, "cpu_poke failed");
+
+	cpu_status_t status = CPU_OK;
+	for (uint32_t key = 0; (key < KEY_COUNT) && (status == CPU_OK); key++)
+	{
+		/* Alternate no key with single keys so both FX0A outcomes are reached. */
+		cpu_set_keys(p_cpu, (key % 2) ? (uint16_t)(1u << key) : 0);
+		status = cpu_run_for(p_cpu, FUZZ_KEY_PERIOD);
+	}
+
+	/* Faults are expected from random bytes, leaving the machine state inconsistent is not. */
+	fuzz_check((status == CPU_OK) || (status == CPU_ERROR_ADDRESS) || (status == CPU_ERROR_OPCODE) ||
+				   (status == CPU_ERROR_STACK),
+			   "unexpected status");
+
+	cpu_registers_t registers;
+	cpu_registers(p_cpu, &registers);
+	fuzz_check(registers.pc < MEM_SIZE, "pc out of memory");
+	fuzz_check((registers.sp >= STACK_ADDRESS) && (registers.sp <= (STACK_ADDRESS + (STACK_DEPTH * 2))) &&
+				   !(registers.sp % 2),
+			   "sp out of the stack");
+
+	return 0;
+}
+
+#ifndef FUZZ_LIBFUZZER
+int main(int argc, char *argv[])
+{
+	(void)LLVMFuzzerInitialize(&argc, &argv);
+
+	for (int arg = 1; arg < argc; arg++)
+	{
+		FILE *file = fopen(argv[arg], "rb");
+		if (!file)
+		{
+			fprintf(stderr, "fopen failed (%s).\n", argv[arg]);
+			return -1;
+		}
+
+		static uint8_t data[MEM_SIZE];
+		size_t size = fread(data, 1, sizeof(data), file);
+		(void)fclose(file);
+
+		(void)LLVMFuzzerTestOneInput(data, size);
+		printf("%s: ok\n", argv[arg]);
+	}
+
+	return 0;
+}
+#endif
+
+/* Private function definitions */
+
+static void fuzz_check(int condition, const char *message)
+{
+	if (!condition)
+	{
+		fprintf(stderr, "fuzz: %s.\n", message);
+		abort();
+	}
+}
@@ -0,0 +1,35 @@
+#ifndef HASH_H_
+#define HASH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Defines */
+
+#define HASH_SEED (0xCBF29CE484222325ull)
+
+/* Inlined function definitions */
+
+/**
+ * @brief 64-bit FNV-1a hash, used to key ROMs and derived artifacts.
+ * 
+ * @param[in]	data	Data to hash.
+ * @param[in]	size	Data size.
+ * @param[in]	hash	HASH_SEED, or the result of a previous call to continue hashing.
+ * 
+ * @return Hash value.
+ */
+static inline uint64_t hash_fnv1a(const void *data, size_t size, uint64_t hash)
+{
+	const uint8_t *bytes = (const uint8_t *)data;
+
+	for (size_t n = 0; n < size; n++)
+	{
+		hash ^= bytes[n];
+		hash *= 0x100000001B3ull;
+	}
+
+	return hash;
+}
+
+#endif /* HASH_H_ */
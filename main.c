@@ -1,35 +1,103 @@
+#include "audio.h"
 #include "cpu.h"
+#include "debug.h"
 #include "log.h"
+#include "metrics.h"
+#include "native.h"
+#include "record.h"
+#include "rom.h"
+#include "script.h"
 
 #include "SDL2/SDL.h"
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <pthread.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
 
 /* Defines */
 
+#define METRICS_INTERVAL_DEFAULT (1000) /* ms */
+
+#define DEBUG_LINE_SIZE (128)
+#define DEBUG_DUMP_DEFAULT (16) /* Bytes shown by x without a length. */
+
+#define XO_CYCLES_PER_FRAME (1000) /* Octo's default XO-CHIP speed. */
+
 /* Typedefs */
 
+typedef enum input_stage_e
+{
+	INPUT_IDLE = 0,
+	INPUT_PRESSED, /* Handed to the cpu, not read yet. */
+	INPUT_READ	   /* Read by an instruction, result not presented yet. */
+} input_stage_t;
+
+typedef struct debugger_s
+{
+	debug_t *p_debug;
+	uint64_t steps; /* Instructions left before prompting, 0 to run until a stop. */
+	int prompt;		/* Prompt before running any further. */
+} debugger_t;
+
 typedef struct shared_data_s
 {
 	cpu_t *p_cpu;
+	audio_t *p_audio;
+	record_t *p_record;
+	metrics_t *p_metrics;
+	debugger_t *p_debugger; /* NULL unless debugging. */
 	pthread_mutex_t mutex;
 	pthread_cond_t key_pressed;
+
+	/* Last key press on its way to the display, protected by mutex. */
+	input_stage_t input_stage;
+	uint64_t input_event; /* SDL event time, on the metrics_now clock. */
+
+	SDL_Texture *texture; /* XO-CHIP display, created on the first frame. */
 } shared_data_t;
 
-typedef struct rom_s
+typedef struct options_s
 {
-	uint8_t *data;
-	size_t size;
-} rom_t;
+	audio_sink_t audio_sink;
+	const char *wav_path;
+
+	int headless;
+	int late_sampling;
+	uint64_t frames; /* Frames to run in headless mode, 0 to run forever. */
+	const char *script_path;
+
+	const char *record_path;
+	record_config_t record_config;
+
+	const char *native_path;
+	int fuse;
+
+	const char *metrics_path;
+	uint32_t metrics_interval; /* ms */
+
+	int debug;
+
+	int xo;
+
+	const char *rom_path;
+} options_t;
 
 /* Private variables */
 
 static const float draw_frequency = 60.0;  /* Hz */
-static const float cpu_frequency = 600.0;  /* Hz */
+static float cpu_frequency = 600.0;        /* Hz, XO_CYCLES_PER_FRAME per frame in XO-CHIP mode. */
 static const float timer_frequency = 60.0; /* Hz */
 
+static debug_t *p_interrupted; /* Debugger interrupted by SIGINT. */
+
+/* ARGB, indexed by the plane bits of a pixel: CHIP-8 pixels use the first two. */
+static const uint32_t palette[CPU_COLOR_COUNT] = {
+	0xFFFFFFFF, 0xFF000000, 0xFFAA0000, 0xFF0055AA, 0xFF00AA00, 0xFFAA00AA, 0xFF00AAAA, 0xFF555555,
+	0xFFAAAAAA, 0xFFFF5555, 0xFF5555FF, 0xFF55FF55, 0xFFFF55FF, 0xFF55FFFF, 0xFFFFFF55, 0xFFAA5500};
+
 static const uint8_t mapped_keys[16] = {
 	SDL_SCANCODE_X, // 0
 	SDL_SCANCODE_1, // 1
@@ -51,157 +119,647 @@ static const uint8_t mapped_keys[16] = {
 
 /* Private function declarations */
 
-static int load_rom(rom_t *p_rom, char *path);
+static int parse_options(options_t *p_options, int argc, char *argv[]);
+static cpu_t *cpu_open(const rom_t *p_rom, const options_t *p_options);
+static void run_headless(shared_data_t *data, uint64_t frames, script_t *p_script);
+static void run_late_sampling(shared_data_t *data);
+static void lock_shared(shared_data_t *data);
+static void delay_paced(shared_data_t *data, uint32_t ms);
+static void unlock_mutex(void *arg);
 static void *thread_cpu(void *arg);
-static void *thread_timers(void *arg);
 static void *thread_graphics(void *arg);
+static SDL_Renderer *window_open(SDL_Window **pp_window);
+static int poll_input(shared_data_t *data);
+static void input_keys_read(shared_data_t *data);
+static void audio_sync(shared_data_t *data, int active);
+static void render_frame(shared_data_t *data, SDL_Renderer *renderer);
+static cpu_status_t debugger_frame(shared_data_t *data, uint32_t cycles, int *p_quit);
+static cpu_status_t debugger_run(shared_data_t *data, uint32_t cycles, uint32_t *p_ran);
+static int debugger_prompt(shared_data_t *data);
+static int debugger_command(shared_data_t *data, char *line);
+static void debugger_list(debug_t *p_debug);
+static void debugger_registers(cpu_t *p_cpu);
+static void debugger_sigint(int signal);
 
 /* Public function definitions */
 
 int main(int argc, char *argv[])
 {
-	if (argc < 2)
+	options_t options;
+	if (parse_options(&options, argc, argv) != 0)
 	{
-		ERROR_PRINT("Missing argument.\n");
 		return -1;
 	}
 
 	rom_t rom;
-	if (load_rom(&rom, argv[1]) != 0)
+	if (rom_load(&rom, options.rom_path) != 0)
 	{
-		ERROR_PRINT("load_rom failed.\n");
+		ERROR_PRINT("rom_load failed.\n");
 		return -1;
 	}
 
-	if (SDL_Init(SDL_INIT_VIDEO) != 0)
+	unsigned int size_max = options.xo ? CPU_XO_PROGRAM_SIZE_MAX : CPU_PROGRAM_SIZE_MAX;
+	if (rom.size > size_max)
+	{
+		ERROR_PRINT_ARGS("ROM too large (%zu bytes, at most %u).\n", rom.size, size_max);
+		rom_free(&rom);
+		return -1;
+	}
+
+	if (options.xo)
+	{
+		cpu_frequency = XO_CYCLES_PER_FRAME * draw_frequency;
+	}
+
+	Uint32 sdl_flags = options.headless ? 0 : SDL_INIT_VIDEO;
+	if (options.audio_sink == AUDIO_SINK_SDL)
+	{
+		sdl_flags |= SDL_INIT_AUDIO;
+	}
+
+	if (SDL_Init(sdl_flags) != 0)
 	{
 		ERROR_PRINT("SDL_Init failed.\n");
 		return -1;
 	}
 
-	cpu_t *p_cpu = cpu_allocate();
+	audio_t *p_audio = audio_allocate(options.audio_sink, options.wav_path);
+	if (!p_audio)
+	{
+		ERROR_PRINT("audio_allocate failed, sound disabled.\n");
+		p_audio = audio_allocate(AUDIO_SINK_NULL, NULL);
+	}
+
+	record_t *p_record = NULL;
+	if (options.record_path)
+	{
+		p_record = record_open(options.record_path, &(options.record_config));
+		if (!p_record)
+		{
+			ERROR_PRINT("record_open failed.\n");
+			audio_free(p_audio);
+			SDL_Quit();
+			return -1;
+		}
+	}
+
+	metrics_t *p_metrics = NULL;
+	if (options.metrics_path)
+	{
+		metrics_config_t metrics_config;
+		metrics_config.interval_ms = options.metrics_interval;
+		metrics_config.cpu_frequency = cpu_frequency;
+		metrics_config.timer_frequency = timer_frequency;
+		metrics_config.draw_frequency = draw_frequency;
+
+		p_metrics = metrics_open(options.metrics_path, &metrics_config);
+		if (!p_metrics)
+		{
+			ERROR_PRINT("metrics_open failed, metrics disabled.\n");
+		}
+	}
+
+	script_t *p_script = NULL;
+	if (options.script_path)
+	{
+		p_script = script_load(options.script_path);
+		if (!p_script)
+		{
+			ERROR_PRINT_ARGS("script_load failed (%s), no input.\n", options.script_path);
+		}
+	}
+
+	native_t *p_native = NULL;
+	if (options.native_path)
+	{
+		p_native = native_load(options.native_path, rom.data, (uint16_t)rom.size);
+		if (!p_native)
+		{
+			ERROR_PRINT_ARGS("native_load failed (%s), interpreting.\n", options.native_path);
+		}
+	}
+
+	int result = 0;
+	cpu_t *p_cpu = cpu_open(&rom, &options);
 
 	if (p_cpu)
 	{
-		cpu_load(p_cpu, rom.data, rom.size);
+		native_attach(p_cpu, p_native);
 
 		shared_data_t shared_data;
 		shared_data.p_cpu = p_cpu;
+		shared_data.p_audio = p_audio;
+		shared_data.p_record = p_record;
+		shared_data.p_metrics = p_metrics;
+		shared_data.p_debugger = NULL;
+		shared_data.input_stage = INPUT_IDLE;
+		shared_data.input_event = 0;
+		shared_data.texture = NULL;
 		pthread_mutex_init(&(shared_data.mutex), NULL);
 		pthread_cond_init(&(shared_data.key_pressed), NULL);
 
-		pthread_t pth_cpu, pth_graphics, pth_timers;
+		cpu_set_timer_period(p_cpu, (uint32_t)(cpu_frequency / timer_frequency));
+
+		/* Stopped before the first instruction, Ctrl-C stops a running ROM. */
+		debugger_t debugger = {options.debug ? debug_allocate() : NULL, 0, 1};
+		if (options.debug && !debugger.p_debug)
+		{
+			ERROR_PRINT("debug_allocate failed, debugger disabled.\n");
+		}
+		else if (options.debug)
+		{
+			shared_data.p_debugger = &debugger;
+			p_interrupted = debugger.p_debug;
+			(void)signal(SIGINT, debugger_sigint);
+		}
+
+		if (options.headless)
+		{
+			run_headless(&shared_data, options.frames, p_script);
+		}
+		else if (options.late_sampling)
+		{
+			run_late_sampling(&shared_data);
+		}
+		else
+		{
+			pthread_t pth_cpu, pth_graphics;
+
+			(void)pthread_create(&pth_cpu, NULL, thread_cpu, &shared_data);
+			(void)pthread_create(&pth_graphics, NULL, thread_graphics, &shared_data);
 
-		(void)pthread_create(&pth_cpu, NULL, thread_cpu, &shared_data);
-		(void)pthread_create(&pth_timers, NULL, thread_timers, &shared_data);
-		(void)pthread_create(&pth_graphics, NULL, thread_graphics, &shared_data);
+			(void)pthread_join(pth_graphics, NULL);
 
-		(void)pthread_join(pth_graphics, NULL);
+			(void)pthread_cancel(pth_cpu);
 
-		(void)pthread_cancel(pth_cpu);
-		(void)pthread_cancel(pth_timers);
+			(void)pthread_join(pth_cpu, NULL);
+		}
+
+		if (shared_data.p_debugger)
+		{
+			(void)signal(SIGINT, SIG_DFL);
+			p_interrupted = NULL;
+		}
+
+		debug_free(debugger.p_debug);
+		cpu_free(p_cpu);
 	}
 	else
 	{
-		ERROR_PRINT("cpu_allocate failed.\n");
+		result = -1;
 	}
 
+	if (p_record && (record_close(p_record) != 0))
+	{
+		ERROR_PRINT("record_close failed.\n");
+	}
+
+	metrics_close(p_metrics);
+	audio_free(p_audio);
+	native_free(p_native);
+	script_free(p_script);
+	rom_free(&rom);
+
 	SDL_Quit();
 
-	return 0;
+	return result;
 }
 
 /* Private function definitions */
 
-static int load_rom(rom_t *p_rom, char *path)
+static int parse_options(options_t *p_options, int argc, char *argv[])
 {
-	if (!p_rom || !path)
-		return -1;
+	(void)memset(p_options, 0, sizeof(options_t));
+	p_options->audio_sink = AUDIO_SINK_SDL;
+	p_options->record_config.format = RECORD_FORMAT_Y4M;
+	p_options->record_config.fps = (uint32_t)draw_frequency;
+	p_options->record_config.scale = 1;
+	p_options->metrics_interval = METRICS_INTERVAL_DEFAULT;
 
-	FILE *file = fopen(path, "rb");
+	int audio_selected = 0;
 
-	if (!file)
+	int opt;
+	while ((opt = getopt(argc, argv, "a:w:HLn:s:o:f:z:kN:Fm:I:dx")) != -1)
 	{
-		ERROR_PRINT_ARGS("fopen failed (%s).\n", path);
-		return -1;
+		switch (opt)
+		{
+		case 'a':
+			if (strcmp(optarg, "sdl") == 0)
+			{
+				p_options->audio_sink = AUDIO_SINK_SDL;
+			}
+			else if (strcmp(optarg, "null") == 0)
+			{
+				p_options->audio_sink = AUDIO_SINK_NULL;
+			}
+			else
+			{
+				ERROR_PRINT_ARGS("Unknown audio sink (%s).\n", optarg);
+				return -1;
+			}
+			audio_selected = 1;
+			break;
+		case 'w':
+			p_options->audio_sink = AUDIO_SINK_WAV;
+			p_options->wav_path = optarg;
+			audio_selected = 1;
+			break;
+		case 'H':
+			p_options->headless = 1;
+			break;
+		case 'L':
+			p_options->late_sampling = 1;
+			break;
+		case 'n':
+			p_options->frames = strtoull(optarg, NULL, 0);
+			break;
+		case 's':
+			p_options->script_path = optarg;
+			break;
+		case 'o':
+			p_options->record_path = optarg;
+			break;
+		case 'f':
+			if (strcmp(optarg, "y4m") == 0)
+			{
+				p_options->record_config.format = RECORD_FORMAT_Y4M;
+			}
+			else if (strcmp(optarg, "rgb") == 0)
+			{
+				p_options->record_config.format = RECORD_FORMAT_RGB;
+			}
+			else
+			{
+				ERROR_PRINT_ARGS("Unknown record format (%s).\n", optarg);
+				return -1;
+			}
+			break;
+		case 'z':
+			p_options->record_config.scale = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'k':
+			p_options->record_config.keep_duplicates = 1;
+			break;
+		case 'N':
+			p_options->native_path = optarg;
+			break;
+		case 'F':
+			p_options->fuse = 1;
+			break;
+		case 'm':
+			p_options->metrics_path = optarg;
+			break;
+		case 'I':
+			p_options->metrics_interval = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			p_options->debug = 1;
+			break;
+		case 'x':
+			p_options->xo = 1;
+			break;
+		default:
+			ERROR_PRINT("Invalid argument.\n");
+			return -1;
+		}
 	}
 
-	/* Get ROM size. */
-	fseek(file, 0, SEEK_END);
-	p_rom->size = ftell(file);
-
-	/* Rewind. */
-	fseek(file, 0, SEEK_SET);
+	if (optind >= argc)
+	{
+		ERROR_PRINT("Missing argument.\n");
+		return -1;
+	}
 
-	p_rom->data = malloc(p_rom->size);
-	if (!p_rom->data)
+	if (p_options->xo && p_options->native_path)
 	{
-		fclose(file);
-		ERROR_PRINT("malloc failed.\n");
+		ERROR_PRINT("Native modules are CHIP-8 only.\n");
 		return -1;
 	}
 
-	(void)fread(p_rom->data, p_rom->size, 1, file);
+	/* An instruction per wakeup cannot keep up with XO-CHIP speeds, frames are run whole. */
+	if (p_options->xo)
+	{
+		p_options->late_sampling = 1;
+	}
+
+	/* No audio device unless explicitly requested when headless. */
+	if (p_options->headless && !audio_selected)
+	{
+		p_options->audio_sink = AUDIO_SINK_NULL;
+	}
 
-	fclose(file);
+	p_options->rom_path = argv[optind];
 
 	return 0;
 }
 
+static cpu_t *cpu_open(const rom_t *p_rom, const options_t *p_options)
+{
+	cpu_t *p_cpu = cpu_allocate();
+	if (!p_cpu)
+	{
+		ERROR_PRINT("cpu_allocate failed.\n");
+		return NULL;
+	}
+
+	cpu_image_t *p_image =
+		cpu_image_allocate_mode(p_rom->data, p_rom->size, p_options->xo ? CPU_MODE_XO : CPU_MODE_CHIP8);
+	if (!p_image)
+	{
+		ERROR_PRINT("cpu_image_allocate failed, ROM too large or out of memory.\n");
+		cpu_free(p_cpu);
+		return NULL;
+	}
+
+	if (p_options->fuse && (cpu_image_fuse(p_image) != CPU_OK))
+	{
+		ERROR_PRINT("cpu_image_fuse failed.\n");
+	}
+
+	cpu_status_t status = cpu_load_image(p_cpu, p_image);
+	cpu_image_free(p_image);
+
+	if (status != CPU_OK)
+	{
+		ERROR_PRINT_ARGS("cpu_load_image failed (%s).\n", cpu_status_string(status));
+		cpu_free(p_cpu);
+		return NULL;
+	}
+
+	return p_cpu;
+}
+
+static void run_headless(shared_data_t *data, uint64_t frames, script_t *p_script)
+{
+	/* Unthrottled, single threaded: timers derive from cycles so no pacing is needed. */
+	uint32_t cycles_per_frame = (uint32_t)(cpu_frequency / draw_frequency);
+	uint32_t frame_us = (uint32_t)(1000000.0 / draw_frequency);
+
+	for (uint64_t frame = 0; (frames == 0) || (frame < frames); frame++)
+	{
+		if (p_script)
+		{
+			cpu_set_keys(data->p_cpu, script_keys(p_script, frame));
+		}
+
+		int quit = 0;
+		uint64_t instructions = cpu_instructions(data->p_cpu);
+		uint64_t cycles = cpu_cycles(data->p_cpu);
+		cpu_status_t status = data->p_debugger ? debugger_frame(data, cycles_per_frame, &quit)
+											   : cpu_run_for(data->p_cpu, cycles_per_frame);
+		if (status != CPU_OK)
+		{
+			ERROR_PRINT_ARGS("cpu_run failed (%s).\n", cpu_status_string(status));
+			break;
+		}
+
+		if (quit)
+		{
+			break;
+		}
+
+		metrics_count(data->p_metrics, METRICS_INSTRUCTIONS, cpu_instructions(data->p_cpu) - instructions);
+		metrics_count(data->p_metrics, METRICS_CYCLES, cpu_cycles(data->p_cpu) - cycles);
+		metrics_count(data->p_metrics, METRICS_FRAMES, 1);
+
+		audio_sync(data, cpu_sound_active(data->p_cpu));
+		audio_update(data->p_audio, frame_us);
+
+		if (data->p_record)
+		{
+			/* Recording is the headless rendering. */
+			uint64_t render_start = metrics_now();
+
+			if (record_frame(data->p_record, cpu_graphics(data->p_cpu), frame) < 0)
+			{
+				ERROR_PRINT("record_frame failed.\n");
+				break;
+			}
+
+			metrics_record(data->p_metrics, METRICS_FRAME_RENDER, metrics_now() - render_start);
+		}
+	}
+}
+
+static void lock_shared(shared_data_t *data)
+{
+	uint64_t start = metrics_now();
+
+	(void)pthread_mutex_lock(&(data->mutex));
+
+	metrics_record(data->p_metrics, METRICS_LOCK_WAIT, metrics_now() - start);
+}
+
+static void delay_paced(shared_data_t *data, uint32_t ms)
+{
+	uint64_t start = metrics_now();
+
+	SDL_Delay(ms);
+
+	/* Oversleep accumulates as lag behind real time. */
+	uint64_t elapsed = metrics_now() - start;
+	uint64_t requested = (uint64_t)ms * 1000000u;
+	metrics_record(data->p_metrics, METRICS_PACING_DRIFT, (elapsed > requested) ? (elapsed - requested) : 0);
+}
+
+static void unlock_mutex(void *arg)
+{
+	(void)pthread_mutex_unlock((pthread_mutex_t *)arg);
+}
+
 static void *thread_cpu(void *arg)
 {
 	shared_data_t *data = (shared_data_t *)arg;
 
 	while (1)
 	{
-		(void)pthread_mutex_lock(&(data->mutex));
+		/* The debugger prompts without the lock, so the window keeps being drawn. */
+		if (data->p_debugger && data->p_debugger->prompt && debugger_prompt(data))
+		{
+			SDL_Event event = {.type = SDL_QUIT};
+			(void)SDL_PushEvent(&event);
+			break;
+		}
+
+		lock_shared(data);
+
+		uint32_t ran = 1;
+		uint64_t instructions = cpu_instructions(data->p_cpu);
+		uint64_t cycles = cpu_cycles(data->p_cpu);
+		cpu_status_t status = data->p_debugger ? debugger_run(data, 1, &ran) : cpu_run(data->p_cpu);
+		if (status != CPU_OK)
+		{
+			/* Leave the last frame on screen, the window stays open until closed. */
+			(void)pthread_mutex_unlock(&(data->mutex));
+			ERROR_PRINT_ARGS("cpu_run failed (%s).\n", cpu_status_string(status));
+			break;
+		}
 
-		cpu_run(data->p_cpu);
+		metrics_count(data->p_metrics, METRICS_INSTRUCTIONS, cpu_instructions(data->p_cpu) - instructions);
+		metrics_count(data->p_metrics, METRICS_CYCLES, cpu_cycles(data->p_cpu) - cycles);
 
-		if (cpu_halted(data->p_cpu))
+		if (cpu_keys_read(data->p_cpu))
 		{
-			/* If CPU is halted, wait for a key pressed. */
+			input_keys_read(data);
+		}
+
+		if (ran && cpu_halted(data->p_cpu))
+		{
+			/* If CPU is halted, wait for a key pressed. Release the lock if cancelled while waiting. */
+			Uint32 halted_ticks = SDL_GetTicks();
+
+			pthread_cleanup_push(unlock_mutex, &(data->mutex));
 			pthread_cond_wait(&(data->key_pressed), &(data->mutex));
+			pthread_cleanup_pop(0);
+
+			/* Timers keep running while halted. */
+			uint32_t idle = (uint32_t)((SDL_GetTicks() - halted_ticks) * cpu_frequency / 1000.0);
+			cpu_idle(data->p_cpu, idle);
+			metrics_count(data->p_metrics, METRICS_CYCLES, idle);
 		}
 
+		audio_sync(data, cpu_sound_active(data->p_cpu));
+
 		(void)pthread_mutex_unlock(&(data->mutex));
 
-		SDL_Delay((int)(1000.0 / cpu_frequency));
+		/* The generator runs outside the lock, the callback only sees the ring buffer. */
+		audio_update(data->p_audio, (uint32_t)(1000000.0 / cpu_frequency));
+
+		delay_paced(data, (uint32_t)(1000.0 / cpu_frequency));
 	}
+
+	audio_set_tone(data->p_audio, 0);
+
+	return NULL;
 }
 
-static void *thread_timers(void *arg)
+static void *thread_graphics(void *arg)
 {
 	shared_data_t *data = (shared_data_t *)arg;
 
-	while (1)
+	SDL_Window *window;
+	SDL_Renderer *renderer = window_open(&window);
+	if (!renderer)
 	{
-		(void)pthread_mutex_lock(&(data->mutex));
-		cpu_tick(data->p_cpu);
+		pthread_exit(NULL);
+	}
+
+	int quit = 0;
+	while (!quit)
+	{
+		lock_shared(data);
+		metrics_count(data->p_metrics, METRICS_FRAMES, 1);
+
+		render_frame(data, renderer);
+		quit = poll_input(data);
+
 		(void)pthread_mutex_unlock(&(data->mutex));
 
-		SDL_Delay((int)(1000.0 / timer_frequency));
+		delay_paced(data, (uint32_t)(1000.0 / draw_frequency));
 	}
+
+	if (data->texture)
+	{
+		SDL_DestroyTexture(data->texture);
+	}
+	SDL_DestroyRenderer(renderer);
+	SDL_DestroyWindow(window);
+
+	pthread_exit(NULL);
 }
 
-static void *thread_graphics(void *arg)
+static void run_late_sampling(shared_data_t *data)
 {
-	shared_data_t *data = (shared_data_t *)arg;
+	/* Single threaded: input is polled right before each frame is emulated, which is presented at once. */
+	SDL_Window *window;
+	SDL_Renderer *renderer = window_open(&window);
+	if (!renderer)
+	{
+		return;
+	}
+
+	uint32_t cycles_per_frame = (uint32_t)(cpu_frequency / draw_frequency);
+	uint32_t frame_us = (uint32_t)(1000000.0 / draw_frequency);
+	uint64_t frame_ns = (uint64_t)frame_us * 1000u;
+	uint64_t deadline = metrics_now();
 
-	SDL_Window *window = SDL_CreateWindow("CHIP8-EMULATOR",
-										  SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, 640, 320,
-										  SDL_WINDOW_SHOWN);
-	if (!window)
+	int running = 1;
+	int quit = 0;
+	while (!quit)
+	{
+		quit = poll_input(data);
+
+		if (running)
+		{
+			int debug_quit = 0;
+			uint64_t instructions = cpu_instructions(data->p_cpu);
+			uint64_t cycles = cpu_cycles(data->p_cpu);
+			cpu_status_t status = data->p_debugger ? debugger_frame(data, cycles_per_frame, &debug_quit)
+												   : cpu_run_for(data->p_cpu, cycles_per_frame);
+			quit |= debug_quit;
+			if (status != CPU_OK)
+			{
+				/* Leave the last frame on screen, the window stays open until closed. */
+				ERROR_PRINT_ARGS("cpu_run failed (%s).\n", cpu_status_string(status));
+				running = 0;
+			}
+			else
+			{
+				metrics_count(data->p_metrics, METRICS_INSTRUCTIONS, cpu_instructions(data->p_cpu) - instructions);
+				metrics_count(data->p_metrics, METRICS_CYCLES, cpu_cycles(data->p_cpu) - cycles);
+			}
+
+			if (cpu_keys_read(data->p_cpu))
+			{
+				input_keys_read(data);
+			}
+
+			audio_sync(data, running && cpu_sound_active(data->p_cpu));
+		}
+
+		audio_update(data->p_audio, frame_us);
+
+		metrics_count(data->p_metrics, METRICS_FRAMES, 1);
+		render_frame(data, renderer);
+
+		/* Fixed schedule, the backlog is dropped when more than a frame late. */
+		deadline += frame_ns;
+		uint64_t now = metrics_now();
+		if (deadline > now)
+		{
+			delay_paced(data, (uint32_t)((deadline - now + 999999u) / 1000000u));
+		}
+		else if ((now - deadline) > frame_ns)
+		{
+			deadline = now;
+		}
+	}
+
+	if (data->texture)
+	{
+		SDL_DestroyTexture(data->texture);
+	}
+	SDL_DestroyRenderer(renderer);
+	SDL_DestroyWindow(window);
+}
+
+static SDL_Renderer *window_open(SDL_Window **pp_window)
+{
+	*pp_window = SDL_CreateWindow("CHIP8-EMULATOR",
+								  SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, 640, 320,
+								  SDL_WINDOW_SHOWN);
+	if (!*pp_window)
 	{
 		ERROR_PRINT("SDL_CreateWindow failed.\n");
-		pthread_exit(NULL);
+		return NULL;
 	}
 
-	SDL_Renderer *renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_SOFTWARE);
+	SDL_Renderer *renderer = SDL_CreateRenderer(*pp_window, -1, SDL_RENDERER_SOFTWARE);
 	if (!renderer)
 	{
 		ERROR_PRINT("SDL_CreateRenderer failed.\n");
-		pthread_exit(NULL);
+		SDL_DestroyWindow(*pp_window);
+		return NULL;
 	}
 
 	/* Clear screen. */
@@ -209,69 +767,438 @@ static void *thread_graphics(void *arg)
 	SDL_RenderClear(renderer);
 	SDL_RenderPresent(renderer);
 
+	return renderer;
+}
+
+static int poll_input(shared_data_t *data)
+{
 	int quit = 0;
-	while (!quit)
+
+	SDL_Event event;
+	while (SDL_PollEvent(&event))
 	{
-		(void)pthread_mutex_lock(&(data->mutex));
+		uint64_t event_time = 0;
 
-		if (cpu_graphics_changed(data->p_cpu))
+		switch (event.type)
 		{
-			SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
-			SDL_RenderClear(renderer);
-
-			SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+		case SDL_QUIT:
+			quit = 1;
+			break;
+		case SDL_KEYDOWN:
+			if (!event.key.repeat)
+			{
+				/* Event timestamps are SDL ticks, in ms. */
+				uint64_t age = (uint64_t)(SDL_GetTicks() - event.key.timestamp) * 1000000u;
+				uint64_t now = metrics_now();
+				event_time = (age < now) ? (now - age) : now;
+			}
+			break;
+		}
 
-			uint8_t *graphics = cpu_graphics(data->p_cpu);
+		const Uint8 *keys = SDL_GetKeyboardState(NULL);
 
-			int line, column;
-			for (int line = 0; line < 32; line++)
+		for (int key = 0; key < 16; key++)
+		{
+			if (keys[mapped_keys[key]])
 			{
-				for (int column = 0; column < 64; column++)
+				pthread_cond_signal(&(data->key_pressed));
+				cpu_press_key(data->p_cpu, key);
+
+				if (event_time && (event.key.keysym.scancode == mapped_keys[key]))
 				{
-					if (graphics[column + (line * 64)])
-					{
-						SDL_Rect rect = {column * 10, line * 10, 10, 10};
-						SDL_RenderFillRect(renderer, &rect);
-					}
+					data->input_stage = INPUT_PRESSED;
+					data->input_event = event_time;
+					metrics_record(data->p_metrics, METRICS_INPUT_PRESS, metrics_now() - event_time);
 				}
 			}
+			else
+			{
+				cpu_release_key(data->p_cpu, key);
+			}
+		}
+	}
+
+	return quit;
+}
+
+static void input_keys_read(shared_data_t *data)
+{
+	if (data->input_stage == INPUT_PRESSED)
+	{
+		data->input_stage = INPUT_READ;
+		metrics_record(data->p_metrics, METRICS_INPUT_READ, metrics_now() - data->input_event);
+	}
+}
+
+static void audio_sync(shared_data_t *data, int active)
+{
+	uint8_t pattern[CPU_AUDIO_PATTERN_SIZE];
+	uint8_t pitch = 0;
+	int loaded = cpu_audio_pattern(data->p_cpu, pattern, &pitch);
+
+	audio_set_pattern(data->p_audio, loaded ? pattern : NULL, pitch);
+	audio_set_tone(data->p_audio, active);
+}
+
+static void render_frame(shared_data_t *data, SDL_Renderer *renderer)
+{
+	if (!cpu_graphics_changed(data->p_cpu))
+	{
+		return;
+	}
+
+	uint64_t render_start = metrics_now();
 
-			SDL_RenderPresent(renderer);
+	const uint8_t *graphics = cpu_graphics(data->p_cpu);
+
+	if (cpu_mode(data->p_cpu) == CPU_MODE_XO)
+	{
+		/* Planes are composed into a streaming texture, scaled on copy. */
+		if (!data->texture)
+		{
+			data->texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING,
+											  CPU_DISPLAY_COLS, CPU_DISPLAY_ROWS);
 		}
 
-		SDL_Event event;
-		while (SDL_PollEvent(&event))
+		uint32_t pixels[CPU_DISPLAY_COLS * CPU_DISPLAY_ROWS];
+		cpu_compose(data->p_cpu, palette, pixels);
+
+		if (data->texture)
 		{
-			switch (event.type)
-			{
-			case SDL_QUIT:
-				quit = 1;
-				break;
-			}
+			(void)SDL_UpdateTexture(data->texture, NULL, pixels, CPU_DISPLAY_COLS * sizeof(uint32_t));
+			(void)SDL_RenderCopy(renderer, data->texture, NULL, NULL);
+		}
+	}
+	else
+	{
+		SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+		SDL_RenderClear(renderer);
 
-			const Uint8 *keys = SDL_GetKeyboardState(NULL);
+		SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
 
-			for (int key = 0; key < 16; key++)
+		for (int line = 0; line < CPU_GRAPHICS_ROWS; line++)
+		{
+			for (int column = 0; column < CPU_GRAPHICS_COLS; column++)
 			{
-				if (keys[mapped_keys[key]])
-				{
-					pthread_cond_signal(&(data->key_pressed));
-					cpu_press_key(data->p_cpu, key);
-				}
-				else
+				if (cpu_graphics_pixel(graphics, column, line))
 				{
-					cpu_release_key(data->p_cpu, key);
+					SDL_Rect rect = {column * 10, line * 10, 10, 10};
+					SDL_RenderFillRect(renderer, &rect);
 				}
 			}
 		}
+	}
+
+	SDL_RenderPresent(renderer);
+
+	uint64_t now = metrics_now();
+	metrics_record(data->p_metrics, METRICS_FRAME_RENDER, now - render_start);
+	metrics_count(data->p_metrics, METRICS_PRESENTS, 1);
+
+	/* First present after the cpu read a key press shows its result. */
+	if (data->input_stage == INPUT_READ)
+	{
+		data->input_stage = INPUT_IDLE;
+		metrics_record(data->p_metrics, METRICS_INPUT_PRESENT, now - data->input_event);
+	}
+
+	if (data->p_record)
+	{
+		uint64_t frame = cpu_cycles(data->p_cpu) / (uint64_t)(cpu_frequency / draw_frequency);
+		(void)record_frame(data->p_record, graphics, frame);
+	}
+}
+
+static cpu_status_t debugger_frame(shared_data_t *data, uint32_t cycles, int *p_quit)
+{
+	cpu_status_t status = CPU_OK;
+
+	while (cycles)
+	{
+		if (data->p_debugger->prompt && debugger_prompt(data))
+		{
+			*p_quit = 1;
+			break;
+		}
+
+		uint32_t ran = 0;
+		status = debugger_run(data, cycles, &ran);
+		if (status != CPU_OK)
+		{
+			/* Faulted state can still be inspected. */
+			*p_quit = debugger_prompt(data);
+			break;
+		}
+
+		if (!ran && !data->p_debugger->prompt)
+		{
+			break;
+		}
+
+		cycles -= ran;
+	}
+
+	return status;
+}
+
+static cpu_status_t debugger_run(shared_data_t *data, uint32_t cycles, uint32_t *p_ran)
+{
+	static const char *const stop_names[] = {
+		"", "breakpoint", "condition", "read watchpoint", "write watchpoint", "interrupted", "fault"};
+
+	debugger_t *p_debugger = data->p_debugger;
+	if (p_debugger->steps && (p_debugger->steps < cycles))
+	{
+		cycles = (uint32_t)p_debugger->steps;
+	}
+
+	debug_event_t event;
+	cpu_status_t status = debug_run_for(p_debugger->p_debug, data->p_cpu, cycles, &event);
+	*p_ran = event.cycles;
+
+	if (p_debugger->steps)
+	{
+		p_debugger->steps -= event.cycles;
+		p_debugger->prompt = !p_debugger->steps;
+	}
+
+	if (event.stop != DEBUG_STOP_NONE)
+	{
+		cpu_registers_t registers;
+		cpu_registers(data->p_cpu, &registers);
 
+		char text[DEBUG_LINE_SIZE] = "";
+		(void)debug_describe(p_debugger->p_debug, event.id, text, sizeof(text));
+
+		printf("Stopped at 0x%03X: %s", registers.pc, stop_names[event.stop]);
+		if (event.id)
+		{
+			printf(" %d (%s)", event.id, text);
+		}
+		if ((event.stop == DEBUG_STOP_WATCH_READ) || (event.stop == DEBUG_STOP_WATCH_WRITE))
+		{
+			printf(" at 0x%03X", event.address);
+		}
+		if (event.stop == DEBUG_STOP_FAULT)
+		{
+			printf(", %s", cpu_status_string(status));
+		}
+		printf(".\n");
+
+		p_debugger->steps = 0;
+		p_debugger->prompt = 1;
+	}
+
+	return status;
+}
+
+/* Returns 1 to quit. */
+static int debugger_prompt(shared_data_t *data)
+{
+	debugger_t *p_debugger = data->p_debugger;
+	p_debugger->prompt = 1;
+
+	(void)pthread_mutex_lock(&(data->mutex));
+	cpu_registers_t registers;
+	cpu_registers(data->p_cpu, &registers);
+	printf("0x%03X: %02X%02X\n", registers.pc, cpu_peek(data->p_cpu, registers.pc),
+		   cpu_peek(data->p_cpu, (uint16_t)(registers.pc + 1)));
+	(void)pthread_mutex_unlock(&(data->mutex));
+
+	while (p_debugger->prompt)
+	{
+		printf("(chip8) ");
+		(void)fflush(stdout);
+
+		char line[DEBUG_LINE_SIZE];
+		if (!fgets(line, sizeof(line), stdin))
+		{
+			return 1;
+		}
+
+		(void)pthread_mutex_lock(&(data->mutex));
+		int quit = debugger_command(data, line);
 		(void)pthread_mutex_unlock(&(data->mutex));
 
-		SDL_Delay((int)(1000.0 / draw_frequency));
+		if (quit)
+		{
+			return 1;
+		}
 	}
 
-	SDL_DestroyRenderer(renderer);
-	SDL_DestroyWindow(window);
+	return 0;
+}
 
-	pthread_exit(NULL);
+/* Returns 1 to quit, called with the lock held. */
+static int debugger_command(shared_data_t *data, char *line)
+{
+	static const char *const compare_names[] = {"==", "!=", "<", "<=", ">", ">="};
+
+	debugger_t *p_debugger = data->p_debugger;
+	debug_t *p_debug = p_debugger->p_debug;
+
+	const char *command = strtok(line, " \t\n");
+	const char *arg1 = strtok(NULL, " \t\n");
+	const char *arg2 = strtok(NULL, " \t\n");
+	const char *arg3 = strtok(NULL, " \t\n");
+
+	if (!command)
+	{
+		return 0;
+	}
+
+	int id = 0;
+	if (strcmp(command, "s") == 0)
+	{
+		p_debugger->steps = arg1 ? strtoull(arg1, NULL, 0) : 1;
+		p_debugger->steps += !p_debugger->steps;
+		p_debugger->prompt = 0;
+	}
+	else if (strcmp(command, "c") == 0)
+	{
+		p_debugger->steps = 0;
+		p_debugger->prompt = 0;
+	}
+	else if ((strcmp(command, "b") == 0) && arg1)
+	{
+		id = debug_break(p_debug, (uint16_t)strtoul(arg1, NULL, 0));
+	}
+	else if ((strcmp(command, "w") == 0) && arg1)
+	{
+		/* w start [end] [r|w|rw], writes by default. */
+		const char *access_arg = arg3;
+		uint16_t start = (uint16_t)strtoul(arg1, NULL, 0);
+		uint16_t end = start;
+		if (arg2 && ((arg2[0] == 'r') || (arg2[0] == 'w')))
+		{
+			access_arg = arg2;
+		}
+		else if (arg2)
+		{
+			end = (uint16_t)strtoul(arg2, NULL, 0);
+		}
+
+		uint32_t access = DEBUG_WATCH_WRITE;
+		if (access_arg)
+		{
+			access = (strchr(access_arg, 'r') ? DEBUG_WATCH_READ : 0) | (strchr(access_arg, 'w') ? DEBUG_WATCH_WRITE : 0);
+		}
+
+		id = debug_watch(p_debug, start, end, access);
+	}
+	else if ((strcmp(command, "if") == 0) && arg1 && arg2 && arg3)
+	{
+		/* if vX|i op value */
+		uint8_t reg = DEBUG_REGISTER_I + 1;
+		if ((arg1[0] == 'i') || (arg1[0] == 'I'))
+		{
+			reg = DEBUG_REGISTER_I;
+		}
+		else if (((arg1[0] == 'v') || (arg1[0] == 'V')) && arg1[1])
+		{
+			reg = (uint8_t)strtoul(arg1 + 1, NULL, 16);
+		}
+
+		uint32_t compare = 0;
+		while ((compare < (sizeof(compare_names) / sizeof(compare_names[0]))) &&
+			   (strcmp(arg2, compare_names[compare]) != 0))
+		{
+			compare++;
+		}
+
+		id = debug_condition(p_debug, reg, (debug_compare_t)compare, (uint16_t)strtoul(arg3, NULL, 0));
+	}
+	else if ((strcmp(command, "d") == 0) && arg1)
+	{
+		if (debug_remove(p_debug, (int)strtol(arg1, NULL, 0)) != 0)
+		{
+			printf("No such point.\n");
+		}
+	}
+	else if (strcmp(command, "l") == 0)
+	{
+		debugger_list(p_debug);
+	}
+	else if (strcmp(command, "r") == 0)
+	{
+		debugger_registers(data->p_cpu);
+	}
+	else if ((strcmp(command, "x") == 0) && arg1)
+	{
+		uint32_t address = (uint32_t)strtoul(arg1, NULL, 0);
+		uint32_t length = arg2 ? (uint32_t)strtoul(arg2, NULL, 0) : DEBUG_DUMP_DEFAULT;
+		for (uint32_t offset = 0; offset < length; offset++)
+		{
+			if (!(offset % 16))
+			{
+				printf("%s0x%03X:", offset ? "\n" : "", (address + offset) & 0xFFF);
+			}
+			printf(" %02X", cpu_peek(data->p_cpu, (uint16_t)(address + offset)));
+		}
+		printf("\n");
+	}
+	else if (strcmp(command, "q") == 0)
+	{
+		return 1;
+	}
+	else
+	{
+		printf("s [n]                    Step n instructions (default 1).\n"
+			   "c                        Continue until a stop, or Ctrl-C.\n"
+			   "b address                Break before the instruction at address.\n"
+			   "w start [end] [r|w|rw]   Watch memory accesses (default w).\n"
+			   "if vX|i op value         Stop when a register comparison becomes true (== != < <= > >=).\n"
+			   "d id                     Delete a breakpoint, watchpoint or condition.\n"
+			   "l                        List breakpoints, watchpoints and conditions.\n"
+			   "r                        Show registers.\n"
+			   "x address [length]       Show memory.\n"
+			   "q                        Quit.\n"
+			   "Numbers are decimal, or hexadecimal with 0x.\n");
+	}
+
+	if (id < 0)
+	{
+		printf("Invalid or too many points.\n");
+	}
+	else if (id > 0)
+	{
+		char text[DEBUG_LINE_SIZE];
+		(void)debug_describe(p_debug, id, text, sizeof(text));
+		printf("%d: %s\n", id, text);
+	}
+
+	return 0;
+}
+
+static void debugger_list(debug_t *p_debug)
+{
+	for (int id = 1; id <= DEBUG_POINTS_MAX; id++)
+	{
+		char text[DEBUG_LINE_SIZE];
+		if (debug_describe(p_debug, id, text, sizeof(text)) == 0)
+		{
+			printf("%d: %s\n", id, text);
+		}
+	}
+}
+
+static void debugger_registers(cpu_t *p_cpu)
+{
+	cpu_registers_t registers;
+	cpu_registers(p_cpu, &registers);
+
+	printf("pc 0x%03X  i 0x%03X  sp 0x%03X  dt %u  st %u  cycles %llu\n", registers.pc, registers.i, registers.sp,
+		   registers.delay, registers.sound, (unsigned long long)cpu_cycles(p_cpu));
+	for (uint32_t reg = 0; reg < 16; reg++)
+	{
+		printf("V%X %02X%s", reg, registers.v[reg], (reg == 15) ? "\n" : "  ");
+	}
+}
+
+static void debugger_sigint(int signal)
+{
+	(void)signal;
+
+	/* Stops at the next check, the debugger prompts then. */
+	debug_interrupt(p_interrupted);
 }
@@ -0,0 +1,305 @@
+#include "metrics.h"
+
+#include "log.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Defines */
+
+#define METRICS_PREFIX "chip8."
+
+#define NS_PER_SECOND (1000000000ull)
+#define NS_PER_MS (1000000ull)
+
+/* Log-linear buckets: values below 2^(SUB_BITS + 1) are exact, above each power of two has 2^SUB_BITS buckets. */
+#define HISTOGRAM_SUB_BITS (4)
+#define HISTOGRAM_BUCKETS (((64 - HISTOGRAM_SUB_BITS - 1) << HISTOGRAM_SUB_BITS) + (2 << HISTOGRAM_SUB_BITS))
+
+/* Typedefs */
+
+typedef struct histogram_s
+{
+	atomic_uint_fast64_t counts[HISTOGRAM_BUCKETS];
+} histogram_t;
+
+struct metrics_s
+{
+	FILE *file;
+	metrics_config_t config;
+
+	atomic_uint_fast64_t counters[METRICS_COUNTER_COUNT];
+	histogram_t histograms[METRICS_HISTOGRAM_COUNT];
+
+	/* Exporter thread, stop is protected by mutex. */
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int stop;
+	uint64_t last_export;
+};
+
+/* Private variables */
+
+static const char *const histogram_names[METRICS_HISTOGRAM_COUNT] = {
+	"frame_render_us",
+	"lock_wait_us",
+	"pacing_drift_us",
+	"input_press_us",
+	"input_read_us",
+	"input_present_us"};
+
+/* Private function declarations */
+
+static void *metrics_thread(void *arg);
+static void metrics_export(metrics_t *p_metrics);
+static void histogram_export(metrics_t *p_metrics, histogram_t *p_histogram, const char *name, long timestamp);
+static uint32_t histogram_index(uint64_t value);
+static uint64_t histogram_lowest(uint32_t index);
+
+/* Public function definitions */
+
+metrics_t *metrics_open(const char *path, const metrics_config_t *p_config)
+{
+	if (!path || !p_config || !p_config->interval_ms)
+	{
+		return NULL;
+	}
+
+	metrics_t *p_metrics = calloc(1, sizeof(struct metrics_s));
+	if (!p_metrics)
+	{
+		return NULL;
+	}
+
+	p_metrics->config = *p_config;
+	p_metrics->file = (strcmp(path, "-") == 0) ? stdout : fopen(path, "w");
+	if (!p_metrics->file)
+	{
+		ERROR_PRINT_ARGS("fopen failed (%s).\n", path);
+		free(p_metrics);
+		return NULL;
+	}
+
+	pthread_condattr_t cond_attr;
+	(void)pthread_condattr_init(&cond_attr);
+	(void)pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+	(void)pthread_cond_init(&(p_metrics->cond), &cond_attr);
+	(void)pthread_condattr_destroy(&cond_attr);
+	(void)pthread_mutex_init(&(p_metrics->mutex), NULL);
+
+	p_metrics->last_export = metrics_now();
+
+	if (pthread_create(&(p_metrics->thread), NULL, metrics_thread, p_metrics) != 0)
+	{
+		ERROR_PRINT("pthread_create failed.\n");
+		p_metrics->stop = 1;
+		metrics_close(p_metrics);
+		return NULL;
+	}
+
+	return p_metrics;
+}
+
+void metrics_close(metrics_t *p_metrics)
+{
+	if (!p_metrics)
+	{
+		return;
+	}
+
+	(void)pthread_mutex_lock(&(p_metrics->mutex));
+	int running = !p_metrics->stop;
+	p_metrics->stop = 1;
+	(void)pthread_cond_signal(&(p_metrics->cond));
+	(void)pthread_mutex_unlock(&(p_metrics->mutex));
+
+	if (running)
+	{
+		(void)pthread_join(p_metrics->thread, NULL);
+	}
+
+	if (p_metrics->file != stdout)
+	{
+		(void)fclose(p_metrics->file);
+	}
+
+	(void)pthread_cond_destroy(&(p_metrics->cond));
+	(void)pthread_mutex_destroy(&(p_metrics->mutex));
+	free(p_metrics);
+}
+
+void metrics_count(metrics_t *p_metrics, metrics_counter_t counter, uint64_t value)
+{
+	if (p_metrics && (counter < METRICS_COUNTER_COUNT))
+	{
+		(void)atomic_fetch_add_explicit(&(p_metrics->counters[counter]), value, memory_order_relaxed);
+	}
+}
+
+void metrics_record(metrics_t *p_metrics, metrics_histogram_t histogram, uint64_t ns)
+{
+	if (p_metrics && (histogram < METRICS_HISTOGRAM_COUNT))
+	{
+		atomic_uint_fast64_t *p_count = &(p_metrics->histograms[histogram].counts[histogram_index(ns)]);
+		(void)atomic_fetch_add_explicit(p_count, 1, memory_order_relaxed);
+	}
+}
+
+uint64_t metrics_now(void)
+{
+	struct timespec now;
+	(void)clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return ((uint64_t)now.tv_sec * NS_PER_SECOND) + (uint64_t)now.tv_nsec;
+}
+
+/* Private function definitions */
+
+static void *metrics_thread(void *arg)
+{
+	metrics_t *p_metrics = (metrics_t *)arg;
+	uint64_t deadline = p_metrics->last_export;
+
+	(void)pthread_mutex_lock(&(p_metrics->mutex));
+
+	while (!p_metrics->stop)
+	{
+		/* Fixed schedule, a late export does not shift the following ones. */
+		deadline += p_metrics->config.interval_ms * NS_PER_MS;
+
+		struct timespec until;
+		until.tv_sec = (time_t)(deadline / NS_PER_SECOND);
+		until.tv_nsec = (long)(deadline % NS_PER_SECOND);
+
+		while (!p_metrics->stop && (metrics_now() < deadline))
+		{
+			(void)pthread_cond_timedwait(&(p_metrics->cond), &(p_metrics->mutex), &until);
+		}
+
+		if (!p_metrics->stop)
+		{
+			(void)pthread_mutex_unlock(&(p_metrics->mutex));
+			metrics_export(p_metrics);
+			(void)pthread_mutex_lock(&(p_metrics->mutex));
+		}
+	}
+
+	(void)pthread_mutex_unlock(&(p_metrics->mutex));
+
+	return NULL;
+}
+
+static void metrics_export(metrics_t *p_metrics)
+{
+	uint64_t now = metrics_now();
+	double seconds = (double)(now - p_metrics->last_export) / (double)NS_PER_SECOND;
+	p_metrics->last_export = now;
+
+	if (seconds <= 0.0)
+	{
+		return;
+	}
+
+	double rates[METRICS_COUNTER_COUNT];
+	for (uint32_t counter = 0; counter < METRICS_COUNTER_COUNT; counter++)
+	{
+		uint64_t value = atomic_exchange_explicit(&(p_metrics->counters[counter]), 0, memory_order_relaxed);
+		rates[counter] = (double)value / seconds;
+	}
+
+	const metrics_config_t *p_config = &(p_metrics->config);
+	FILE *file = p_metrics->file;
+	long timestamp = (long)time(NULL);
+
+	/* Timers tick every cpu_frequency / timer_frequency emulated cycles. */
+	double timer_hz = rates[METRICS_CYCLES] * p_config->timer_frequency / p_config->cpu_frequency;
+
+	fprintf(file, METRICS_PREFIX "instructions_per_second %.1f %ld\n", rates[METRICS_INSTRUCTIONS], timestamp);
+	fprintf(file, METRICS_PREFIX "cpu_hz %.1f %ld\n", rates[METRICS_CYCLES], timestamp);
+	fprintf(file, METRICS_PREFIX "cpu_hz_target %.1f %ld\n", p_config->cpu_frequency, timestamp);
+	fprintf(file, METRICS_PREFIX "realtime_ratio %.3f %ld\n", rates[METRICS_CYCLES] / p_config->cpu_frequency, timestamp);
+	fprintf(file, METRICS_PREFIX "timer_hz %.1f %ld\n", timer_hz, timestamp);
+	fprintf(file, METRICS_PREFIX "timer_hz_target %.1f %ld\n", p_config->timer_frequency, timestamp);
+	fprintf(file, METRICS_PREFIX "frame_hz %.1f %ld\n", rates[METRICS_FRAMES], timestamp);
+	fprintf(file, METRICS_PREFIX "frame_hz_target %.1f %ld\n", p_config->draw_frequency, timestamp);
+	fprintf(file, METRICS_PREFIX "present_hz %.1f %ld\n", rates[METRICS_PRESENTS], timestamp);
+
+	for (uint32_t histogram = 0; histogram < METRICS_HISTOGRAM_COUNT; histogram++)
+	{
+		histogram_export(p_metrics, &(p_metrics->histograms[histogram]), histogram_names[histogram], timestamp);
+	}
+
+	(void)fflush(file);
+}
+
+static void histogram_export(metrics_t *p_metrics, histogram_t *p_histogram, const char *name, long timestamp)
+{
+	static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+	static const char *const quantile_names[] = {"p50", "p90", "p99", "p999"};
+
+	uint64_t counts[HISTOGRAM_BUCKETS];
+	uint64_t total = 0;
+
+	for (uint32_t index = 0; index < HISTOGRAM_BUCKETS; index++)
+	{
+		counts[index] = atomic_exchange_explicit(&(p_histogram->counts[index]), 0, memory_order_relaxed);
+		total += counts[index];
+	}
+
+	FILE *file = p_metrics->file;
+	fprintf(file, METRICS_PREFIX "%s.count %llu %ld\n", name, (unsigned long long)total, timestamp);
+
+	/* Values are reported as the highest of their bucket, as HdrHistogram does. */
+	uint32_t index = 0;
+	uint64_t seen = 0;
+	for (uint32_t quantile = 0; quantile < (sizeof(quantiles) / sizeof(quantiles[0])); quantile++)
+	{
+		uint64_t rank = (uint64_t)((quantiles[quantile] * (double)total) + 0.999999);
+		while (total && (seen + counts[index]) < rank)
+		{
+			seen += counts[index];
+			index++;
+		}
+
+		double value = total ? ((double)(histogram_lowest(index + 1) - 1) / 1000.0) : 0.0;
+		fprintf(file, METRICS_PREFIX "%s.%s %.3f %ld\n", name, quantile_names[quantile], value, timestamp);
+	}
+
+	uint32_t highest = HISTOGRAM_BUCKETS;
+	while (highest && !counts[highest - 1])
+	{
+		highest--;
+	}
+
+	double max = highest ? ((double)(histogram_lowest(highest) - 1) / 1000.0) : 0.0;
+	fprintf(file, METRICS_PREFIX "%s.max %.3f %ld\n", name, max, timestamp);
+}
+
+static uint32_t histogram_index(uint64_t value)
+{
+	if (value < (2u << HISTOGRAM_SUB_BITS))
+	{
+		return (uint32_t)value;
+	}
+
+	/* The top HISTOGRAM_SUB_BITS + 1 bits select the bucket. */
+	uint32_t shift = (uint32_t)(63 - __builtin_clzll(value)) - HISTOGRAM_SUB_BITS;
+	return (shift << HISTOGRAM_SUB_BITS) + (uint32_t)(value >> shift);
+}
+
+static uint64_t histogram_lowest(uint32_t index)
+{
+	if (index < (2u << HISTOGRAM_SUB_BITS))
+	{
+		return index;
+	}
+
+	uint32_t shift = (index >> HISTOGRAM_SUB_BITS) - 1;
+	return (uint64_t)(index - (shift << HISTOGRAM_SUB_BITS)) << shift;
+}
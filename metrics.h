@@ -0,0 +1,94 @@
+#ifndef METRICS_H_
+#define METRICS_H_
+
+#include <stdint.h>
+
+/*
+ * Host performance telemetry.
+ *
+ * Counters and latency histograms are updated lock-free from any thread and
+ * exported by a background thread at a fixed interval, one metric per line in
+ * the Graphite plaintext format: "chip8.<name> <value> <unix time>".
+ * Histograms are log-linear (HDR style, within 1/16 of the recorded value) and
+ * cover one interval each.
+ */
+
+/* Typedefs */
+
+typedef struct metrics_s metrics_t;
+
+typedef enum metrics_counter_e
+{
+	METRICS_INSTRUCTIONS = 0, /* Instructions executed (cpu_instructions). */
+	METRICS_CYCLES,			  /* Emulated cycles, including the ones idled while halted. */
+	METRICS_FRAMES,			  /* Display refreshes. */
+	METRICS_PRESENTS,		  /* Refreshes that rendered changed graphics. */
+	METRICS_COUNTER_COUNT
+} metrics_counter_t;
+
+typedef enum metrics_histogram_e
+{
+	METRICS_FRAME_RENDER = 0, /* Time to render and present a frame. */
+	METRICS_LOCK_WAIT,		  /* Time spent waiting for the shared cpu mutex. */
+	METRICS_PACING_DRIFT,	  /* Time slept past the requested delay. */
+	METRICS_INPUT_PRESS,	  /* Key press event to cpu_press_key. */
+	METRICS_INPUT_READ,		  /* Key press event to the first instruction reading the keys. */
+	METRICS_INPUT_PRESENT,	  /* Key press event to the first present after that read. */
+	METRICS_HISTOGRAM_COUNT
+} metrics_histogram_t;
+
+typedef struct metrics_config_s
+{
+	uint32_t interval_ms; /* Export period. */
+
+	/* Targets the achieved rates are reported against. */
+	float cpu_frequency;
+	float timer_frequency;
+	float draw_frequency;
+} metrics_config_t;
+
+/* Public function declarations */
+
+/**
+ * @brief Open a metrics output and start exporting.
+ *
+ * @param[in]	path		Output file path, or "-" for stdout.
+ * @param[in]	p_config	Metrics configuration.
+ *
+ * @return Pointer to metrics, or NULL if the output could not be opened.
+ */
+metrics_t *metrics_open(const char *path, const metrics_config_t *p_config);
+
+/**
+ * @brief Stop exporting and close the output.
+ *
+ * @param[in]	p_metrics	Pointer to metrics, may be NULL.
+ */
+void metrics_close(metrics_t *p_metrics);
+
+/**
+ * @brief Add to a counter.
+ *
+ * @param[in]	p_metrics	Pointer to metrics, may be NULL.
+ * @param[in]	counter		Counter.
+ * @param[in]	value		Value to add.
+ */
+void metrics_count(metrics_t *p_metrics, metrics_counter_t counter, uint64_t value);
+
+/**
+ * @brief Record a duration in a histogram.
+ *
+ * @param[in]	p_metrics	Pointer to metrics, may be NULL.
+ * @param[in]	histogram	Histogram.
+ * @param[in]	ns			Duration, in nanoseconds.
+ */
+void metrics_record(metrics_t *p_metrics, metrics_histogram_t histogram, uint64_t ns);
+
+/**
+ * @brief Get the monotonic clock, the time base of recorded durations.
+ *
+ * @return Time, in nanoseconds.
+ */
+uint64_t metrics_now(void);
+
+#endif /* METRICS_H_ */
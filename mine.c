@@ -0,0 +1,333 @@
+#include "cpu.h"
+#include "log.h"
+#include "rom.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Defines */
+
+#define CYCLES_DEFAULT (1000000)
+#define TOP_DEFAULT (20)
+#define KEY_PERIOD (60) /* Cycles between random key changes. */
+
+#define LENGTH_MIN (2)
+#define LENGTH_MAX (3)
+
+#define TABLE_SIZE (1u << 16) /* Power of two, distinct sequences stay far below. */
+
+/* Typedefs */
+
+typedef struct options_s
+{
+	uint64_t cycles; /* Per ROM. */
+	uint32_t top;
+	uint32_t seed;
+	int rom_index; /* First ROM path in argv. */
+} options_t;
+
+/* Instruction shapes (opcode with operands masked) of a sequence, packed 16 bits each. */
+typedef struct sequence_s
+{
+	uint64_t key;
+	uint64_t count;
+} sequence_t;
+
+typedef struct table_s
+{
+	sequence_t entries[TABLE_SIZE];
+	uint32_t count;
+} table_t;
+
+/* Private function declarations */
+
+static int parse_options(options_t *p_options, int argc, char *argv[]);
+static int mine_rom(table_t *tables, const options_t *p_options, uint32_t *p_random_state, const char *name,
+					const uint8_t *program, size_t size, uint64_t *p_total);
+static uint16_t opcode_shape(uint16_t opcode);
+static void shape_name(uint16_t shape, char *name);
+static void table_add(table_t *p_table, uint64_t key);
+static int sequence_compare(const void *p_a, const void *p_b);
+static void print_top(table_t *p_table, uint32_t length, uint32_t top, uint64_t total);
+
+/* Public function definitions */
+
+int main(int argc, char *argv[])
+{
+	options_t options;
+	if (parse_options(&options, argc, argv) != 0)
+	{
+		return -1;
+	}
+
+	table_t *tables = calloc(LENGTH_MAX + 1, sizeof(table_t));
+	if (!tables)
+	{
+		ERROR_PRINT("calloc failed.\n");
+		return -1;
+	}
+
+	uint64_t total = 0;
+	uint32_t random_state = options.seed | 1u;
+
+	int result = 0;
+	for (int arg = options.rom_index; (arg < argc) && (result == 0); arg++)
+	{
+		/* Archives are mapped once, their ROMs run in place. */
+		if (rom_is_archive(argv[arg]))
+		{
+			rom_archive_t *p_archive = rom_archive_open(argv[arg]);
+			if (!p_archive)
+			{
+				ERROR_PRINT_ARGS("rom_archive_open failed (%s), skipped.\n", argv[arg]);
+				continue;
+			}
+
+			rom_entry_t entry;
+			for (uint32_t index = 0; (result == 0) && (rom_archive_entry(p_archive, index, &entry) == 0); index++)
+			{
+				result = mine_rom(tables, &options, &random_state, entry.name, entry.data, entry.size, &total);
+			}
+
+			rom_archive_close(p_archive);
+			continue;
+		}
+
+		rom_t rom;
+		if (rom_load(&rom, argv[arg]) != 0)
+		{
+			ERROR_PRINT_ARGS("rom_load failed (%s), skipped.\n", argv[arg]);
+			continue;
+		}
+
+		result = mine_rom(tables, &options, &random_state, argv[arg], rom.data, rom.size, &total);
+		rom_free(&rom);
+	}
+
+	if (result != 0)
+	{
+		free(tables);
+		return -1;
+	}
+
+	for (uint32_t length = LENGTH_MIN; length <= LENGTH_MAX; length++)
+	{
+		print_top(&(tables[length]), length, options.top, total);
+	}
+
+	free(tables);
+
+	return 0;
+}
+
+/* Private function definitions */
+
+static int parse_options(options_t *p_options, int argc, char *argv[])
+{
+	(void)memset(p_options, 0, sizeof(options_t));
+	p_options->cycles = CYCLES_DEFAULT;
+	p_options->top = TOP_DEFAULT;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "n:t:r:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'n':
+			p_options->cycles = strtoull(optarg, NULL, 0);
+			break;
+		case 't':
+			p_options->top = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			p_options->seed = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+		default:
+			ERROR_PRINT("Invalid argument.\n");
+			return -1;
+		}
+	}
+
+	if (optind >= argc)
+	{
+		ERROR_PRINT("Missing argument.\n");
+		return -1;
+	}
+
+	p_options->rom_index = optind;
+
+	return 0;
+}
+
+static int mine_rom(table_t *tables, const options_t *p_options, uint32_t *p_random_state, const char *name,
+					const uint8_t *program, size_t size, uint64_t *p_total)
+{
+	cpu_t *p_cpu = cpu_allocate();
+	if (!p_cpu)
+	{
+		ERROR_PRINT("cpu_allocate failed.\n");
+		return -1;
+	}
+
+	if (cpu_load(p_cpu, program, size) != CPU_OK)
+	{
+		ERROR_PRINT_ARGS("cpu_load failed (%s, %zu bytes), skipped.\n", name, size);
+		cpu_free(p_cpu);
+		return 0;
+	}
+	cpu_seed(p_cpu, p_options->seed);
+
+	/* Shapes of the last instructions, while each followed the previous one in memory. */
+	uint64_t history = 0;
+	uint32_t run = 0;
+	uint16_t next_pc = 0;
+	uint64_t cycle = 0;
+	cpu_status_t status = CPU_OK;
+
+	for (; (cycle < p_options->cycles) && (status == CPU_OK); cycle++)
+	{
+		/* Random key presses keep input driven ROMs going. */
+		if (((cycle % KEY_PERIOD) == 0) || cpu_halted(p_cpu))
+		{
+			*p_random_state ^= *p_random_state << 13;
+			*p_random_state ^= *p_random_state >> 17;
+			*p_random_state ^= *p_random_state << 5;
+			cpu_set_keys(p_cpu, (*p_random_state & 1) ? (uint16_t)(1u << ((*p_random_state >> 1) & 0x0F)) : 0);
+		}
+
+		cpu_registers_t registers;
+		cpu_registers(p_cpu, &registers);
+		uint16_t opcode = (uint16_t)((cpu_peek(p_cpu, registers.pc) << 8) | cpu_peek(p_cpu, registers.pc + 1));
+
+		if (registers.pc != next_pc)
+		{
+			run = 0;
+		}
+		history = (history << 16) | opcode_shape(opcode);
+		run++;
+
+		for (uint32_t length = LENGTH_MIN; (length <= LENGTH_MAX) && (length <= run); length++)
+		{
+			table_add(&(tables[length]), history & ((1ull << (16 * length)) - 1));
+		}
+
+		next_pc = registers.pc + 2;
+		status = cpu_run(p_cpu);
+	}
+
+	printf("%s: %llu instructions%s%s\n", name, (unsigned long long)cycle,
+		   (status == CPU_OK) ? "" : ", stopped: ", (status == CPU_OK) ? "" : cpu_status_string(status));
+	*p_total += cycle;
+
+	cpu_free(p_cpu);
+
+	return 0;
+}
+
+static uint16_t opcode_shape(uint16_t opcode)
+{
+	/* Keep what selects the operation, mask registers and immediates. */
+	switch (opcode >> 12)
+	{
+	case 0x0:
+		return ((opcode == 0x00E0) || (opcode == 0x00EE)) ? opcode : 0x0000;
+	case 0x8:
+		return opcode & (uint16_t)0xF00F;
+	case 0xE:
+	case 0xF:
+		return opcode & (uint16_t)0xF0FF;
+	default:
+		return opcode & (uint16_t)0xF000;
+	}
+}
+
+static void shape_name(uint16_t shape, char *name)
+{
+	static const char *const operands[16] = {
+		"NNN", "NNN", "NNN", "XNN", "XNN", "XY0", "XNN", "XNN",
+		"XY", "XY0", "NNN", "NNN", "XNN", "XYN", "X", "X"};
+
+	uint8_t op = (uint8_t)(shape >> 12);
+
+	if ((op == 0x0) && shape)
+	{
+		(void)sprintf(name, "%04X", shape);
+	}
+	else if (op == 0x8)
+	{
+		(void)sprintf(name, "8XY%X", shape & 0x0F);
+	}
+	else if ((op == 0xE) || (op == 0xF))
+	{
+		(void)sprintf(name, "%XX%02X", op, shape & 0xFF);
+	}
+	else
+	{
+		(void)sprintf(name, "%X%s", op, operands[op]);
+	}
+}
+
+static void table_add(table_t *p_table, uint64_t key)
+{
+	uint64_t hash = key * 0x9E3779B97F4A7C15ull;
+	uint32_t slot = (uint32_t)(hash >> 48) & (TABLE_SIZE - 1);
+
+	while (p_table->entries[slot].count && (p_table->entries[slot].key != key))
+	{
+		slot = (slot + 1) & (TABLE_SIZE - 1);
+	}
+
+	if (!p_table->entries[slot].count)
+	{
+		/* Drop new sequences once the table is nearly full. */
+		if ((p_table->count + 1) >= (TABLE_SIZE / 2))
+		{
+			return;
+		}
+
+		p_table->entries[slot].key = key;
+		p_table->count++;
+	}
+
+	p_table->entries[slot].count++;
+}
+
+static int sequence_compare(const void *p_a, const void *p_b)
+{
+	const sequence_t *p_sa = (const sequence_t *)p_a;
+	const sequence_t *p_sb = (const sequence_t *)p_b;
+
+	if (p_sa->count != p_sb->count)
+	{
+		return (p_sa->count < p_sb->count) ? 1 : -1;
+	}
+
+	return (p_sa->key > p_sb->key) - (p_sa->key < p_sb->key);
+}
+
+static void print_top(table_t *p_table, uint32_t length, uint32_t top, uint64_t total)
+{
+	qsort(p_table->entries, TABLE_SIZE, sizeof(sequence_t), sequence_compare);
+
+	/* Coverage: share of executed instructions a fused handler would have run. */
+	printf("\n%u instruction sequences:\n%12s %9s  %s\n", length, "count", "coverage", "sequence");
+
+	for (uint32_t index = 0; (index < top) && (index < TABLE_SIZE) && p_table->entries[index].count; index++)
+	{
+		const sequence_t *p_sequence = &(p_table->entries[index]);
+
+		printf("%12llu %8.2f%% ", (unsigned long long)p_sequence->count,
+			   total ? (100.0 * (double)(p_sequence->count * length) / (double)total) : 0.0);
+
+		for (uint32_t position = 0; position < length; position++)
+		{
+			char name[8];
+			shape_name((uint16_t)(p_sequence->key >> (16 * (length - 1 - position))), name);
+			printf(" %s", name);
+		}
+		printf("\n");
+	}
+}
@@ -0,0 +1,121 @@
+#include "native.h"
+
+#include "cpu.h"
+#include "cpu_internal.h"
+#include "hash.h"
+
+#include <dlfcn.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Typedefs */
+
+struct native_s
+{
+	void *handle;
+	const native_block_t *blocks;  /* Indexed by block start address. */
+	const uint16_t *block_cycles; /* Instructions in the longest path of each block. */
+};
+
+/* Public function definitions */
+
+native_t *native_load(const char *path, const uint8_t *program, uint16_t size)
+{
+	if (!path || !program)
+	{
+		return NULL;
+	}
+
+	void *handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+	if (!handle)
+	{
+		return NULL;
+	}
+
+	const uint32_t *p_abi = dlsym(handle, "chip8_native_abi");
+	const uint32_t *p_cpu_size = dlsym(handle, "chip8_native_cpu_size");
+	const uint64_t *p_rom_hash = dlsym(handle, "chip8_native_rom_hash");
+	const native_block_t *blocks = dlsym(handle, "chip8_native_blocks");
+	const uint16_t *block_cycles = dlsym(handle, "chip8_native_block_cycles");
+
+	/* Reject modules built for another layout or another ROM. */
+	if (!p_abi || !p_cpu_size || !p_rom_hash || !blocks || !block_cycles ||
+		(*p_abi != NATIVE_ABI_VERSION) ||
+		(*p_cpu_size != sizeof(struct cpu_s)) ||
+		(*p_rom_hash != hash_fnv1a(program, size, HASH_SEED)))
+	{
+		dlclose(handle);
+		return NULL;
+	}
+
+	native_t *p_native = calloc(1, sizeof(struct native_s));
+	if (!p_native)
+	{
+		dlclose(handle);
+		return NULL;
+	}
+
+	p_native->handle = handle;
+	p_native->blocks = blocks;
+	p_native->block_cycles = block_cycles;
+
+	return p_native;
+}
+
+void native_free(native_t *p_native)
+{
+	if (p_native)
+	{
+		dlclose(p_native->handle);
+		free(p_native);
+	}
+}
+
+void native_attach(cpu_t *p_cpu, const native_t *p_native)
+{
+	if (p_cpu)
+	{
+		p_cpu->native = p_native;
+	}
+}
+
+cpu_status_t native_run_for(const native_t *p_native, cpu_t *p_cpu, uint32_t cycles)
+{
+	if (!p_native || !p_cpu)
+	{
+		return CPU_ERROR_ARGUMENT;
+	}
+
+	while (cycles)
+	{
+		uint16_t pc = p_cpu->pc;
+
+		/* Only enter a block when the whole of it fits in the budget. */
+		if ((pc < MEM_SIZE) && p_native->blocks[pc] && (p_native->block_cycles[pc] <= cycles))
+		{
+			uint64_t start = p_cpu->cycles;
+
+			int result = p_native->blocks[pc](p_cpu, cpu_run);
+			if (result != NATIVE_BLOCK_MISS)
+			{
+				if (result != CPU_OK)
+				{
+					return (cpu_status_t)result;
+				}
+
+				cycles -= (uint32_t)(p_cpu->cycles - start);
+				continue;
+			}
+		}
+
+		cpu_status_t status = cpu_run(p_cpu);
+		if (status != CPU_OK)
+		{
+			return status;
+		}
+
+		cycles--;
+	}
+
+	return CPU_OK;
+}
@@ -0,0 +1,74 @@
+#ifndef NATIVE_H_
+#define NATIVE_H_
+
+#include "cpu.h"
+
+#include <stdint.h>
+
+/*
+ * Natively compiled ROMs, produced offline by chip8-aot.
+ *
+ * A module holds one C function per basic block of the ROM. Blocks operate on the
+ * cpu state directly (cpu_internal.h) and hand complex instructions back to the
+ * interpreter through the step function they receive.
+ */
+
+/* Defines */
+
+#define NATIVE_ABI_VERSION (5)
+
+#define NATIVE_BLOCK_MISS (-1) /* Memory no longer holds the compiled code, interpret instead. */
+
+/* Typedefs */
+
+typedef struct native_s native_t;
+
+typedef cpu_status_t (*native_step_t)(cpu_t *p_cpu);
+
+/* Returns a cpu_status_t, or NATIVE_BLOCK_MISS without having modified the cpu. */
+typedef int (*native_block_t)(cpu_t *p_cpu, native_step_t step);
+
+/* Public function declarations */
+
+/**
+ * @brief Load a natively compiled ROM.
+ * 
+ * @param[in]	path	Path of the shared object built by chip8-aot.
+ * @param[in]	program	ROM the module must have been compiled from.
+ * @param[in]	size	ROM size.
+ * 
+ * @return Pointer to module, or NULL if it could not be loaded or does not match the ROM.
+ */
+native_t *native_load(const char *path, const uint8_t *program, uint16_t size);
+
+/**
+ * @brief Unload a natively compiled ROM.
+ * 
+ * No cpu may still be attached to it.
+ * 
+ * @param[in]	p_native	Pointer to module.
+ */
+void native_free(native_t *p_native);
+
+/**
+ * @brief Run compiled blocks in place of the interpreter in cpu_run_for.
+ * 
+ * Code not covered by the module (computed jumps, self-modified code) is interpreted.
+ * 
+ * @param[in]	p_cpu		Pointer to cpu.
+ * @param[in]	p_native	Pointer to module, NULL to detach.
+ */
+void native_attach(cpu_t *p_cpu, const native_t *p_native);
+
+/**
+ * @brief Run cpu cycles using compiled blocks where available.
+ * 
+ * @param[in]	p_native	Pointer to module.
+ * @param[in]	p_cpu		Pointer to cpu.
+ * @param[in]	cycles		Number of cycles to run.
+ * 
+ * @return CPU_OK, or the fault that stopped the run.
+ */
+cpu_status_t native_run_for(const native_t *p_native, cpu_t *p_cpu, uint32_t cycles);
+
+#endif /* NATIVE_H_ */
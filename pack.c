@@ -0,0 +1,277 @@
+#include "cpu.h"
+#include "hash.h"
+#include "log.h"
+#include "rom.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * chip8-pack: pack ROMs in an archive, or list an archive and check its hashes.
+ * ROMs are named after their file name. Inputs may be archives, their ROMs are
+ * repacked with their quirk profiles, which merges archives.
+ */
+
+/* Defines */
+
+#define ARCHIVES_MAX (64)
+
+/* Typedefs */
+
+typedef struct options_s
+{
+	const char *output_path;
+	const char *list_path;
+	uint32_t quirks; /* Of the ROM files given. */
+	int input_index; /* First input path in argv. */
+} options_t;
+
+typedef struct pack_s
+{
+	rom_entry_t *entries;
+	rom_t *roms; /* ROM file data, per entry. */
+	uint32_t count;
+	uint32_t capacity;
+	rom_archive_t *archives[ARCHIVES_MAX]; /* Inputs, entries point into them. */
+	uint32_t archive_count;
+} pack_t;
+
+/* Private function declarations */
+
+static int parse_options(options_t *p_options, int argc, char *argv[]);
+static int pack_add(pack_t *p_pack, const rom_entry_t *p_entry, const rom_t *p_rom);
+static int pack_input(pack_t *p_pack, const char *path, uint32_t quirks);
+static void pack_free(pack_t *p_pack);
+static int list(const char *path);
+
+/* Public function definitions */
+
+int main(int argc, char *argv[])
+{
+	options_t options;
+	if (parse_options(&options, argc, argv) != 0)
+	{
+		return -1;
+	}
+
+	if (options.list_path)
+	{
+		return list(options.list_path);
+	}
+
+	pack_t pack;
+	(void)memset(&pack, 0, sizeof(pack));
+
+	int result = 0;
+	for (int arg = options.input_index; (arg < argc) && (result == 0); arg++)
+	{
+		result = pack_input(&pack, argv[arg], options.quirks);
+	}
+
+	if ((result == 0) && (rom_archive_write(options.output_path, pack.entries, pack.count) != 0))
+	{
+		ERROR_PRINT_ARGS("rom_archive_write failed (%s).\n", options.output_path);
+		result = -1;
+	}
+
+	if (result == 0)
+	{
+		printf("%s: %u ROMs\n", options.output_path, pack.count);
+	}
+
+	pack_free(&pack);
+
+	return result;
+}
+
+/* Private function definitions */
+
+static int parse_options(options_t *p_options, int argc, char *argv[])
+{
+	(void)memset(p_options, 0, sizeof(options_t));
+
+	int opt;
+	while ((opt = getopt(argc, argv, "o:q:l:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'o':
+			p_options->output_path = optarg;
+			break;
+		case 'q':
+			if (rom_quirks_parse(optarg, &(p_options->quirks)) != 0)
+			{
+				ERROR_PRINT_ARGS("Invalid quirks (%s).\n", optarg);
+				return -1;
+			}
+			break;
+		case 'l':
+			p_options->list_path = optarg;
+			break;
+		default:
+			ERROR_PRINT("Invalid argument.\n");
+			return -1;
+		}
+	}
+
+	if (!p_options->list_path && (!p_options->output_path || (optind >= argc)))
+	{
+		ERROR_PRINT("Missing argument.\n");
+		return -1;
+	}
+
+	p_options->input_index = optind;
+
+	return 0;
+}
+
+static int pack_add(pack_t *p_pack, const rom_entry_t *p_entry, const rom_t *p_rom)
+{
+	if (p_pack->count == p_pack->capacity)
+	{
+		uint32_t capacity = p_pack->capacity ? (2 * p_pack->capacity) : 1024;
+		rom_entry_t *entries = realloc(p_pack->entries, capacity * sizeof(rom_entry_t));
+		if (entries)
+		{
+			p_pack->entries = entries;
+		}
+
+		rom_t *roms = realloc(p_pack->roms, capacity * sizeof(rom_t));
+		if (roms)
+		{
+			p_pack->roms = roms;
+		}
+
+		if (!entries || !roms)
+		{
+			ERROR_PRINT("realloc failed.\n");
+			return -1;
+		}
+
+		p_pack->capacity = capacity;
+	}
+
+	p_pack->entries[p_pack->count] = *p_entry;
+	if (p_rom)
+	{
+		p_pack->roms[p_pack->count] = *p_rom;
+	}
+	else
+	{
+		(void)memset(&(p_pack->roms[p_pack->count]), 0, sizeof(rom_t));
+	}
+	p_pack->count++;
+
+	return 0;
+}
+
+static int pack_input(pack_t *p_pack, const char *path, uint32_t quirks)
+{
+	if (rom_is_archive(path))
+	{
+		if (p_pack->archive_count == ARCHIVES_MAX)
+		{
+			ERROR_PRINT_ARGS("Too many archives (%s).\n", path);
+			return -1;
+		}
+
+		rom_archive_t *p_archive = rom_archive_open(path);
+		if (!p_archive)
+		{
+			return -1;
+		}
+		p_pack->archives[p_pack->archive_count++] = p_archive;
+
+		rom_entry_t entry;
+		for (uint32_t index = 0; rom_archive_entry(p_archive, index, &entry) == 0; index++)
+		{
+			if (pack_add(p_pack, &entry, NULL) != 0)
+			{
+				return -1;
+			}
+		}
+
+		return 0;
+	}
+
+	rom_t rom;
+	if (rom_load(&rom, path) != 0)
+	{
+		return -1;
+	}
+
+	/* Would be rejected by cpu_load. */
+	if (!rom.size || (rom.size > CPU_PROGRAM_SIZE_MAX))
+	{
+		ERROR_PRINT_ARGS("ROM empty or too large (%s, %zu bytes), skipped.\n", path, rom.size);
+		rom_free(&rom);
+		return 0;
+	}
+
+	const char *name = strrchr(path, '/');
+	rom_entry_t entry;
+	(void)memset(&entry, 0, sizeof(entry));
+	entry.name = name ? (name + 1) : path;
+	entry.data = rom.data;
+	entry.size = rom.size;
+	entry.quirks = quirks;
+
+	if (pack_add(p_pack, &entry, &rom) != 0)
+	{
+		rom_free(&rom);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void pack_free(pack_t *p_pack)
+{
+	for (uint32_t index = 0; index < p_pack->count; index++)
+	{
+		rom_free(&(p_pack->roms[index]));
+	}
+
+	for (uint32_t index = 0; index < p_pack->archive_count; index++)
+	{
+		rom_archive_close(p_pack->archives[index]);
+	}
+
+	free(p_pack->entries);
+	free(p_pack->roms);
+}
+
+static int list(const char *path)
+{
+	rom_archive_t *p_archive = rom_archive_open(path);
+	if (!p_archive)
+	{
+		return -1;
+	}
+
+	int result = 0;
+	uint64_t bytes = 0;
+	rom_entry_t entry;
+
+	for (uint32_t index = 0; rom_archive_entry(p_archive, index, &entry) == 0; index++)
+	{
+		char quirks[64];
+		rom_quirks_string(entry.quirks, quirks, sizeof(quirks));
+
+		int intact = (hash_fnv1a(entry.data, entry.size, HASH_SEED) == entry.hash);
+		result |= intact ? 0 : -1;
+		bytes += entry.size;
+
+		printf("0x%016llx %5zu %-16s %s%s\n", (unsigned long long)entry.hash, entry.size, quirks, entry.name,
+			   intact ? "" : " (hash mismatch)");
+	}
+
+	printf("%u ROMs, %llu bytes\n", rom_archive_count(p_archive), (unsigned long long)bytes);
+
+	rom_archive_close(p_archive);
+
+	return result;
+}
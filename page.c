@@ -0,0 +1,56 @@
+#include "page.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Private variables */
+
+/* Starts with a reference of its own, so it always reads as shared and is never freed. */
+static page_t zero_page = {1, {0}};
+
+/* Public function definitions */
+
+page_t *page_allocate(void)
+{
+	page_t *p_page = malloc(sizeof(page_t));
+	if (p_page)
+	{
+		atomic_init(&(p_page->refs), 1);
+	}
+
+	return p_page;
+}
+
+page_t *page_zero(void)
+{
+	return page_retain(&zero_page);
+}
+
+void page_release(page_t *p_page)
+{
+	if (p_page && (atomic_fetch_sub_explicit(&(p_page->refs), 1, memory_order_acq_rel) == 1) &&
+		(p_page != &zero_page))
+	{
+		free(p_page);
+	}
+}
+
+page_t *page_unshare(page_t **pp_page)
+{
+	if (!page_shared(*pp_page))
+	{
+		return *pp_page;
+	}
+
+	page_t *p_copy = page_allocate();
+	if (!p_copy)
+	{
+		return NULL;
+	}
+
+	(void)memcpy(p_copy->data, (*pp_page)->data, PAGE_BYTES);
+	page_release(*pp_page);
+	*pp_page = p_copy;
+
+	return p_copy;
+}
@@ -0,0 +1,74 @@
+#ifndef PAGE_H_
+#define PAGE_H_
+
+/*
+ * Reference counted 256-byte pages backing cpu memory and graphics.
+ * A page referenced more than once is shared and read-only: writers take a
+ * private copy first (copy-on-write).
+ */
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+/* Defines */
+
+#define PAGE_SHIFT_BITS (8)
+#define PAGE_BYTES (1u << PAGE_SHIFT_BITS)
+
+/* Reference count bias of pages not owned by the allocator (e.g. mapped from a file), never freed. */
+#define PAGE_REFS_PINNED (1u << 30)
+
+/* Typedefs */
+
+typedef struct page_s
+{
+	atomic_uint refs;
+	uint8_t data[PAGE_BYTES];
+} page_t;
+
+/* Public function declarations */
+
+/**
+ * @brief Allocate a page holding one reference, with undefined content.
+ *
+ * @return Pointer to page, or NULL if allocation failed.
+ */
+page_t *page_allocate(void);
+
+/**
+ * @brief Get a reference to the shared all-zero page.
+ *
+ * @return Pointer to page, never NULL.
+ */
+page_t *page_zero(void);
+
+/**
+ * @brief Drop a reference, the page is freed with its last one.
+ *
+ * @param[in]	p_page	Pointer to page, may be NULL.
+ */
+void page_release(page_t *p_page);
+
+/**
+ * @brief Make a page private before writing to it, copying it if it is shared.
+ *
+ * @param[in,out]	pp_page	Page reference, replaced by the private copy.
+ *
+ * @return Pointer to the private page, or NULL if the copy could not be allocated.
+ */
+page_t *page_unshare(page_t **pp_page);
+
+/* Inlined function definitions */
+
+static inline page_t *page_retain(page_t *p_page)
+{
+	(void)atomic_fetch_add_explicit(&(p_page->refs), 1, memory_order_relaxed);
+	return p_page;
+}
+
+static inline int page_shared(const page_t *p_page)
+{
+	return atomic_load_explicit(&(p_page->refs), memory_order_acquire) != 1;
+}
+
+#endif /* PAGE_H_ */
@@ -0,0 +1,312 @@
+#include "record.h"
+
+#include "cpu.h"
+#include "log.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+/* Defines */
+
+#define QUEUE_FRAMES (16) /* Frames per writev. */
+#define FRAME_HEADER_SIZE (32)
+
+/* BT.601 studio range luma, neutral chroma. */
+#define Y4M_Y_ON (16)
+#define Y4M_Y_OFF (235)
+#define Y4M_CHROMA (128)
+
+/* Typedefs */
+
+struct record_s
+{
+	int fd;
+	int owns_fd;
+	int error;
+
+	record_config_t config;
+	uint32_t width;
+	uint32_t height;
+	size_t frame_size;
+
+	uint8_t last[CPU_GRAPHICS_SIZE];
+	int has_last;
+
+	/* Frame queue, one header and one payload iovec per frame. */
+	uint32_t queued;
+	char headers[QUEUE_FRAMES][FRAME_HEADER_SIZE];
+	uint8_t *payloads;
+	struct iovec iov[2 * QUEUE_FRAMES];
+	int iov_count;
+};
+
+/* Private function declarations */
+
+static int write_all(int fd, const void *data, size_t size);
+static int flush_queue(record_t *p_record);
+static void convert_y4m(const record_t *p_record, const uint8_t *graphics, uint8_t *out);
+static void convert_rgb(const record_t *p_record, const uint8_t *graphics, uint8_t *out);
+
+/* Public function definitions */
+
+record_t *record_open(const char *path, const record_config_t *p_config)
+{
+	if (!path || !p_config)
+	{
+		return NULL;
+	}
+
+	if (strcmp(path, "-") == 0)
+	{
+		return record_open_fd(STDOUT_FILENO, p_config);
+	}
+
+	/* Opening a named pipe blocks until a reader (e.g. an encoder) attaches. */
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+	{
+		ERROR_PRINT_ARGS("open failed (%s).\n", path);
+		return NULL;
+	}
+
+	record_t *p_record = record_open_fd(fd, p_config);
+	if (!p_record)
+	{
+		close(fd);
+		return NULL;
+	}
+
+	p_record->owns_fd = 1;
+	return p_record;
+}
+
+record_t *record_open_fd(int fd, const record_config_t *p_config)
+{
+	if ((fd < 0) || !p_config)
+	{
+		return NULL;
+	}
+
+	record_t *p_record = calloc(1, sizeof(struct record_s));
+	if (!p_record)
+	{
+		return NULL;
+	}
+
+	p_record->fd = fd;
+	p_record->config = *p_config;
+	if (!p_record->config.scale)
+	{
+		p_record->config.scale = 1;
+	}
+	if (!p_record->config.fps)
+	{
+		p_record->config.fps = 60;
+	}
+
+	p_record->width = CPU_GRAPHICS_COLS * p_record->config.scale;
+	p_record->height = CPU_GRAPHICS_ROWS * p_record->config.scale;
+	p_record->frame_size = (size_t)p_record->width * p_record->height * 3;
+
+	p_record->payloads = malloc(p_record->frame_size * QUEUE_FRAMES);
+	if (!p_record->payloads)
+	{
+		free(p_record);
+		return NULL;
+	}
+
+	if (p_record->config.format == RECORD_FORMAT_Y4M)
+	{
+		char header[64];
+		int length = snprintf(header, sizeof(header), "YUV4MPEG2 W%u H%u F%u:1 Ip A1:1 C444\n",
+							  p_record->width, p_record->height, p_record->config.fps);
+
+		if (write_all(fd, header, (size_t)length) != 0)
+		{
+			ERROR_PRINT("Y4M header write failed.\n");
+			p_record->error = 1;
+		}
+	}
+
+	return p_record;
+}
+
+int record_frame(record_t *p_record, const uint8_t *graphics, uint64_t timestamp)
+{
+	if (!p_record || !graphics || p_record->error)
+	{
+		return -1;
+	}
+
+	/* Raw RGB frames carry no timestamp, dropping one would shorten the recording. */
+	if ((p_record->config.format == RECORD_FORMAT_Y4M) && !p_record->config.keep_duplicates && p_record->has_last &&
+		(memcmp(p_record->last, graphics, CPU_GRAPHICS_SIZE) == 0))
+	{
+		return 0;
+	}
+
+	(void)memcpy(p_record->last, graphics, CPU_GRAPHICS_SIZE);
+	p_record->has_last = 1;
+
+	uint8_t *payload = p_record->payloads + (p_record->queued * p_record->frame_size);
+
+	if (p_record->config.format == RECORD_FORMAT_Y4M)
+	{
+		char *header = p_record->headers[p_record->queued];
+		int length = snprintf(header, FRAME_HEADER_SIZE, "FRAME Xpts=%llu\n", (unsigned long long)timestamp);
+
+		p_record->iov[p_record->iov_count].iov_base = header;
+		p_record->iov[p_record->iov_count].iov_len = (size_t)length;
+		p_record->iov_count++;
+
+		convert_y4m(p_record, graphics, payload);
+	}
+	else
+	{
+		convert_rgb(p_record, graphics, payload);
+	}
+
+	p_record->iov[p_record->iov_count].iov_base = payload;
+	p_record->iov[p_record->iov_count].iov_len = p_record->frame_size;
+	p_record->iov_count++;
+	p_record->queued++;
+
+	if (p_record->queued == QUEUE_FRAMES)
+	{
+		if (flush_queue(p_record) != 0)
+		{
+			return -1;
+		}
+	}
+
+	return 1;
+}
+
+int record_close(record_t *p_record)
+{
+	if (!p_record)
+	{
+		return -1;
+	}
+
+	int result = flush_queue(p_record);
+	if (p_record->error)
+	{
+		result = -1;
+	}
+
+	if (p_record->owns_fd)
+	{
+		close(p_record->fd);
+	}
+
+	free(p_record->payloads);
+	free(p_record);
+
+	return result;
+}
+
+/* Private function definitions */
+
+static int write_all(int fd, const void *data, size_t size)
+{
+	const uint8_t *p = data;
+
+	while (size)
+	{
+		ssize_t written = write(fd, p, size);
+		if (written < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			return -1;
+		}
+
+		p += written;
+		size -= (size_t)written;
+	}
+
+	return 0;
+}
+
+static int flush_queue(record_t *p_record)
+{
+	struct iovec *iov = p_record->iov;
+	int count = p_record->iov_count;
+
+	p_record->queued = 0;
+	p_record->iov_count = 0;
+
+	while ((count > 0) && !p_record->error)
+	{
+		ssize_t written = writev(p_record->fd, iov, count);
+		if (written < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+
+			ERROR_PRINT("writev failed.\n");
+			p_record->error = 1;
+			break;
+		}
+
+		/* Pipes may accept partial writes, skip what went out. */
+		while ((count > 0) && ((size_t)written >= iov->iov_len))
+		{
+			written -= (ssize_t)iov->iov_len;
+			iov++;
+			count--;
+		}
+
+		if (count > 0)
+		{
+			iov->iov_base = (uint8_t *)iov->iov_base + written;
+			iov->iov_len -= (size_t)written;
+		}
+	}
+
+	return p_record->error ? -1 : 0;
+}
+
+static void convert_y4m(const record_t *p_record, const uint8_t *graphics, uint8_t *out)
+{
+	uint32_t scale = p_record->config.scale;
+	size_t plane_size = (size_t)p_record->width * p_record->height;
+
+	uint8_t *luma = out;
+	for (uint32_t y = 0; y < p_record->height; y++)
+	{
+		for (uint32_t x = 0; x < p_record->width; x++)
+		{
+			*luma++ = cpu_graphics_pixel(graphics, x / scale, y / scale) ? Y4M_Y_ON : Y4M_Y_OFF;
+		}
+	}
+
+	(void)memset(out + plane_size, Y4M_CHROMA, 2 * plane_size);
+}
+
+static void convert_rgb(const record_t *p_record, const uint8_t *graphics, uint8_t *out)
+{
+	uint32_t scale = p_record->config.scale;
+
+	for (uint32_t y = 0; y < p_record->height; y++)
+	{
+		for (uint32_t x = 0; x < p_record->width; x++)
+		{
+			uint8_t value = cpu_graphics_pixel(graphics, x / scale, y / scale) ? 0 : 255;
+			*out++ = value;
+			*out++ = value;
+			*out++ = value;
+		}
+	}
+}
@@ -0,0 +1,68 @@
+#ifndef RECORD_H_
+#define RECORD_H_
+
+#include <stdint.h>
+
+/* Typedefs */
+
+typedef struct record_s record_t;
+
+typedef enum record_format_e
+{
+	RECORD_FORMAT_Y4M = 0, /* YUV4MPEG2 4:4:4 stream, frames carry an Xpts timestamp. */
+	RECORD_FORMAT_RGB	   /* Headerless packed RGB24 frames. */
+} record_format_t;
+
+typedef struct record_config_s
+{
+	record_format_t format;
+	uint32_t fps;	 /* Nominal frame rate written in the Y4M header. */
+	uint32_t scale;	 /* Integer upscaling factor, 1 for 64x32 output. */
+	int keep_duplicates; /* Write frames identical to the previous one, raw RGB always does. */
+} record_config_t;
+
+/* Public function declarations */
+
+/**
+ * @brief Open a frame recorder writing to a file or named pipe.
+ *
+ * @param[in]	path	Output path, "-" for stdout.
+ * @param[in]	p_config	Recorder configuration.
+ *
+ * @return Pointer to recorder, or NULL if opening failed.
+ */
+record_t *record_open(const char *path, const record_config_t *p_config);
+
+/**
+ * @brief Open a frame recorder writing to an already open file descriptor.
+ *
+ * The descriptor is not closed by record_close.
+ *
+ * @param[in]	fd			Output file descriptor.
+ * @param[in]	p_config	Recorder configuration.
+ *
+ * @return Pointer to recorder, or NULL if allocation failed.
+ */
+record_t *record_open_fd(int fd, const record_config_t *p_config);
+
+/**
+ * @brief Queue a frame, frames are written in batches.
+ *
+ * @param[in]	p_record	Pointer to recorder.
+ * @param[in]	graphics	Cpu graphics, as returned by cpu_graphics.
+ * @param[in]	timestamp	Frame timestamp, in frames since start.
+ *
+ * @return 1 if the frame was queued, 0 if skipped as duplicate (Y4M only), -1 on write error.
+ */
+int record_frame(record_t *p_record, const uint8_t *graphics, uint64_t timestamp);
+
+/**
+ * @brief Flush queued frames and close the recorder.
+ *
+ * @param[in]	p_record	Pointer to recorder.
+ *
+ * @return 0 on success, -1 if a write failed.
+ */
+int record_close(record_t *p_record);
+
+#endif /* RECORD_H_ */
@@ -0,0 +1,567 @@
+#include "rom.h"
+
+#include "hash.h"
+#include "log.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Defines */
+
+#define ARCHIVE_MAGIC (0x41523843u) /* "C8RA" */
+#define ARCHIVE_VERSION (1)
+
+/* Typedefs */
+
+/* File layout, host byte order: header, index ordered by name, then ROM data. */
+typedef struct archive_header_s
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t count;
+	uint32_t reserved0;
+	uint64_t size; /* File size. */
+	uint64_t reserved[5];
+} archive_header_t;
+
+typedef struct archive_index_s
+{
+	char name[ROM_NAME_MAX + 1]; /* NUL-terminated. */
+	uint64_t hash;
+	uint64_t offset; /* Aligned to ROM_ARCHIVE_ALIGN. */
+	uint32_t size;
+	uint32_t quirks;
+} archive_index_t;
+
+struct rom_archive_s
+{
+	const uint8_t *base;
+	size_t size;
+	const archive_index_t *index;
+	uint32_t count;
+};
+
+/* Private variables */
+
+static const char *quirk_names[ROM_QUIRK_COUNT] = {"shift-vy", "load-store-i", "jump-vx", "vf-reset", "display-wait"};
+
+/* Private function declarations */
+
+static void archive_entry_get(const rom_archive_t *p_archive, uint32_t index, rom_entry_t *p_entry);
+static int archive_name_compare(const void *p_a, const void *p_b);
+static int archive_data_compare(const void *p_a, const void *p_b);
+static int archive_write_data(FILE *file, const rom_entry_t **sorted, archive_index_t *index, uint32_t count,
+							  uint64_t offset);
+
+/* Public function definitions */
+
+int rom_load(rom_t *p_rom, const char *path)
+{
+	if (!p_rom || !path)
+	{
+		return -1;
+	}
+
+	FILE *file = fopen(path, "rb");
+
+	if (!file)
+	{
+		ERROR_PRINT_ARGS("fopen failed (%s).\n", path);
+		return -1;
+	}
+
+	/* Get ROM size, directories open but have none. */
+	struct stat st;
+	if ((fstat(fileno(file), &st) != 0) || !S_ISREG(st.st_mode))
+	{
+		fclose(file);
+		ERROR_PRINT_ARGS("Not a file (%s).\n", path);
+		return -1;
+	}
+	p_rom->size = (size_t)st.st_size;
+
+	/* One byte more, malloc(0) may return NULL. */
+	p_rom->data = malloc(p_rom->size + 1);
+	if (!p_rom->data)
+	{
+		fclose(file);
+		ERROR_PRINT("malloc failed.\n");
+		return -1;
+	}
+
+	if (p_rom->size && (fread(p_rom->data, p_rom->size, 1, file) != 1))
+	{
+		fclose(file);
+		rom_free(p_rom);
+		ERROR_PRINT_ARGS("fread failed (%s).\n", path);
+		return -1;
+	}
+
+	fclose(file);
+
+	return 0;
+}
+
+void rom_free(rom_t *p_rom)
+{
+	if (p_rom)
+	{
+		free(p_rom->data);
+		p_rom->data = NULL;
+		p_rom->size = 0;
+	}
+}
+
+int rom_is_archive(const char *path)
+{
+	FILE *file = path ? fopen(path, "rb") : NULL;
+	if (!file)
+	{
+		return 0;
+	}
+
+	uint32_t magic = 0;
+	int archive = (fread(&magic, sizeof(magic), 1, file) == 1) && (magic == ARCHIVE_MAGIC);
+	(void)fclose(file);
+
+	return archive;
+}
+
+rom_archive_t *rom_archive_open(const char *path)
+{
+	if (!path)
+	{
+		return NULL;
+	}
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		ERROR_PRINT_ARGS("open failed (%s).\n", path);
+		return NULL;
+	}
+
+	struct stat st;
+	if ((fstat(fd, &st) != 0) || ((size_t)st.st_size < sizeof(archive_header_t)))
+	{
+		ERROR_PRINT_ARGS("Not a ROM archive (%s).\n", path);
+		(void)close(fd);
+		return NULL;
+	}
+
+	/* The mapping outlives the descriptor. */
+	void *p_map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	(void)close(fd);
+	if (p_map == MAP_FAILED)
+	{
+		ERROR_PRINT_ARGS("mmap failed (%s).\n", path);
+		return NULL;
+	}
+
+	rom_archive_t *p_archive = calloc(1, sizeof(struct rom_archive_s));
+	if (!p_archive)
+	{
+		ERROR_PRINT("calloc failed.\n");
+		(void)munmap(p_map, (size_t)st.st_size);
+		return NULL;
+	}
+
+	p_archive->base = (const uint8_t *)p_map;
+	p_archive->size = (size_t)st.st_size;
+
+	const archive_header_t *p_header = (const archive_header_t *)p_map;
+	int valid = (p_header->magic == ARCHIVE_MAGIC) && (p_header->version == ARCHIVE_VERSION) &&
+				(p_header->size == p_archive->size) &&
+				(p_header->count <= ((p_archive->size - sizeof(archive_header_t)) / sizeof(archive_index_t)));
+
+	if (valid)
+	{
+		p_archive->index = (const archive_index_t *)(p_archive->base + sizeof(archive_header_t));
+		p_archive->count = p_header->count;
+	}
+
+	/* Checked once here, entries are then used without bounds checks. Names are strictly ordered for lookups. */
+	for (uint32_t index = 0; valid && (index < p_archive->count); index++)
+	{
+		const archive_index_t *p_index = &(p_archive->index[index]);
+
+		valid = (memchr(p_index->name, '\0', sizeof(p_index->name)) != NULL) &&
+				((p_index->offset % ROM_ARCHIVE_ALIGN) == 0) && (p_index->offset <= p_archive->size) &&
+				(p_index->size <= (p_archive->size - p_index->offset)) &&
+				(!index || (strcmp(p_archive->index[index - 1].name, p_index->name) < 0));
+	}
+
+	if (!valid)
+	{
+		ERROR_PRINT_ARGS("Not a ROM archive, or corrupted (%s).\n", path);
+		rom_archive_close(p_archive);
+		return NULL;
+	}
+
+	return p_archive;
+}
+
+void rom_archive_close(rom_archive_t *p_archive)
+{
+	if (p_archive)
+	{
+		(void)munmap((void *)p_archive->base, p_archive->size);
+		free(p_archive);
+	}
+}
+
+uint32_t rom_archive_count(const rom_archive_t *p_archive)
+{
+	return p_archive ? p_archive->count : 0;
+}
+
+int rom_archive_entry(const rom_archive_t *p_archive, uint32_t index, rom_entry_t *p_entry)
+{
+	if (!p_archive || !p_entry || (index >= p_archive->count))
+	{
+		return -1;
+	}
+
+	archive_entry_get(p_archive, index, p_entry);
+
+	return 0;
+}
+
+int rom_archive_find(const rom_archive_t *p_archive, const char *name, rom_entry_t *p_entry)
+{
+	if (!p_archive || !name || !p_entry)
+	{
+		return -1;
+	}
+
+	uint32_t low = 0;
+	uint32_t high = p_archive->count;
+	while (low < high)
+	{
+		uint32_t middle = low + ((high - low) / 2);
+		int compare = strcmp(name, p_archive->index[middle].name);
+
+		if (compare == 0)
+		{
+			archive_entry_get(p_archive, middle, p_entry);
+			return 0;
+		}
+
+		if (compare < 0)
+		{
+			high = middle;
+		}
+		else
+		{
+			low = middle + 1;
+		}
+	}
+
+	return -1;
+}
+
+rom_archive_t *rom_archive_open_entry(const char *path, rom_entry_t *p_entry)
+{
+	if (!path || !p_entry)
+	{
+		return NULL;
+	}
+
+	/* The archive path is the first prefix before a ':' that is an archive, names may hold ':'. */
+	char archive_path[4096];
+	for (const char *separator = strchr(path, ':'); separator; separator = strchr(separator + 1, ':'))
+	{
+		size_t length = (size_t)(separator - path);
+		if (length >= sizeof(archive_path))
+		{
+			break;
+		}
+
+		(void)memcpy(archive_path, path, length);
+		archive_path[length] = '\0';
+		if (!rom_is_archive(archive_path))
+		{
+			continue;
+		}
+
+		rom_archive_t *p_archive = rom_archive_open(archive_path);
+		if (!p_archive)
+		{
+			return NULL;
+		}
+
+		if (rom_archive_find(p_archive, separator + 1, p_entry) != 0)
+		{
+			ERROR_PRINT_ARGS("ROM not in archive (%s).\n", path);
+			rom_archive_close(p_archive);
+			return NULL;
+		}
+
+		return p_archive;
+	}
+
+	return NULL;
+}
+
+int rom_archive_write(const char *path, const rom_entry_t *entries, uint32_t count)
+{
+	if (!path || (!entries && count))
+	{
+		return -1;
+	}
+
+	const rom_entry_t **sorted = calloc((size_t)count + 1, sizeof(const rom_entry_t *));
+	archive_index_t *index = calloc((size_t)count + 1, sizeof(archive_index_t));
+	if (!sorted || !index)
+	{
+		ERROR_PRINT("calloc failed.\n");
+		free(sorted);
+		free(index);
+		return -1;
+	}
+
+	for (uint32_t entry = 0; entry < count; entry++)
+	{
+		sorted[entry] = &(entries[entry]);
+	}
+	qsort(sorted, count, sizeof(const rom_entry_t *), archive_name_compare);
+
+	int result = 0;
+	for (uint32_t entry = 0; (entry < count) && (result == 0); entry++)
+	{
+		const rom_entry_t *p_entry = sorted[entry];
+
+		if (!p_entry->name || !p_entry->name[0] || (strlen(p_entry->name) > ROM_NAME_MAX) || !p_entry->data ||
+			!p_entry->size || (p_entry->size > UINT32_MAX))
+		{
+			ERROR_PRINT_ARGS("Invalid ROM (%s).\n", p_entry->name ? p_entry->name : "no name");
+			result = -1;
+		}
+		else if (entry && (strcmp(sorted[entry - 1]->name, p_entry->name) == 0))
+		{
+			ERROR_PRINT_ARGS("Duplicate ROM name (%s).\n", p_entry->name);
+			result = -1;
+		}
+		else
+		{
+			(void)memcpy(index[entry].name, p_entry->name, strlen(p_entry->name) + 1);
+			index[entry].hash = hash_fnv1a(p_entry->data, p_entry->size, HASH_SEED);
+			index[entry].size = (uint32_t)p_entry->size;
+			index[entry].quirks = p_entry->quirks;
+		}
+	}
+
+	/* Written aside then renamed, a mapped archive is never seen partially written. */
+	char temporary[4096];
+	if ((result == 0) &&
+		(snprintf(temporary, sizeof(temporary), "%s.%ld.tmp", path, (long)getpid()) >= (int)sizeof(temporary)))
+	{
+		result = -1;
+	}
+
+	FILE *file = NULL;
+	if (result == 0)
+	{
+		file = fopen(temporary, "wb");
+		if (!file)
+		{
+			ERROR_PRINT_ARGS("fopen failed (%s).\n", temporary);
+			result = -1;
+		}
+	}
+
+	if (result == 0)
+	{
+		uint64_t data_offset = sizeof(archive_header_t) + ((uint64_t)count * sizeof(archive_index_t));
+		if (count)
+		{
+			data_offset = (data_offset + ROM_ARCHIVE_ALIGN - 1) & ~(uint64_t)(ROM_ARCHIVE_ALIGN - 1);
+		}
+
+		/* Data first: it sets the offsets of the index, then written over its placeholder. */
+		archive_header_t header;
+		(void)memset(&header, 0, sizeof(header));
+		header.magic = ARCHIVE_MAGIC;
+		header.version = ARCHIVE_VERSION;
+		header.count = count;
+
+		int failed = (fseek(file, (long)data_offset, SEEK_SET) != 0) ||
+					 (archive_write_data(file, sorted, index, count, data_offset) != 0);
+		long end = ftell(file);
+		header.size = (end > 0) ? (uint64_t)end : 0;
+
+		failed = failed || (end <= 0) || (fseek(file, 0, SEEK_SET) != 0) ||
+				 (fwrite(&header, sizeof(header), 1, file) != 1) ||
+				 (fwrite(index, sizeof(archive_index_t), count, file) != count);
+		failed |= (fclose(file) != 0);
+
+		if (failed || (rename(temporary, path) != 0))
+		{
+			ERROR_PRINT_ARGS("Writing failed (%s).\n", path);
+			(void)unlink(temporary);
+			result = -1;
+		}
+	}
+
+	free(sorted);
+	free(index);
+
+	return result;
+}
+
+int rom_quirks_parse(const char *text, uint32_t *p_quirks)
+{
+	if (!text || !p_quirks)
+	{
+		return -1;
+	}
+
+	*p_quirks = 0;
+	if (strcmp(text, "none") == 0)
+	{
+		return 0;
+	}
+
+	while (*text)
+	{
+		size_t length = strcspn(text, ",");
+		uint32_t quirk = 0;
+
+		for (uint32_t index = 0; index < ROM_QUIRK_COUNT; index++)
+		{
+			if ((strlen(quirk_names[index]) == length) && (strncmp(text, quirk_names[index], length) == 0))
+			{
+				quirk = 1u << index;
+			}
+		}
+
+		if (!quirk)
+		{
+			return -1;
+		}
+
+		*p_quirks |= quirk;
+		text += length + (text[length] == ',');
+	}
+
+	return 0;
+}
+
+void rom_quirks_string(uint32_t quirks, char *text, size_t size)
+{
+	if (!text || !size)
+	{
+		return;
+	}
+
+	(void)snprintf(text, size, "none");
+
+	size_t length = 0;
+	for (uint32_t index = 0; index < ROM_QUIRK_COUNT; index++)
+	{
+		if ((quirks & (1u << index)) && (length < size))
+		{
+			length += (size_t)snprintf(text + length, size - length, "%s%s", length ? "," : "", quirk_names[index]);
+		}
+	}
+}
+
+/* Private function definitions */
+
+static void archive_entry_get(const rom_archive_t *p_archive, uint32_t index, rom_entry_t *p_entry)
+{
+	const archive_index_t *p_index = &(p_archive->index[index]);
+
+	p_entry->name = p_index->name;
+	p_entry->data = p_archive->base + p_index->offset;
+	p_entry->size = p_index->size;
+	p_entry->hash = p_index->hash;
+	p_entry->quirks = p_index->quirks;
+}
+
+static int archive_name_compare(const void *p_a, const void *p_b)
+{
+	const rom_entry_t *p_entry_a = *(const rom_entry_t *const *)p_a;
+	const rom_entry_t *p_entry_b = *(const rom_entry_t *const *)p_b;
+
+	/* Unnamed entries first, they are rejected. */
+	if (!p_entry_a->name || !p_entry_b->name)
+	{
+		return (p_entry_a->name != NULL) - (p_entry_b->name != NULL);
+	}
+
+	return strcmp(p_entry_a->name, p_entry_b->name);
+}
+
+static int archive_data_compare(const void *p_a, const void *p_b)
+{
+	const archive_index_t *p_index_a = *(const archive_index_t *const *)p_a;
+	const archive_index_t *p_index_b = *(const archive_index_t *const *)p_b;
+
+	if (p_index_a->hash != p_index_b->hash)
+	{
+		return (p_index_a->hash < p_index_b->hash) ? -1 : 1;
+	}
+
+	if (p_index_a->size != p_index_b->size)
+	{
+		return (p_index_a->size < p_index_b->size) ? -1 : 1;
+	}
+
+	/* Same entry order within a group, the first one is written. */
+	return (p_index_a < p_index_b) ? -1 : (p_index_a > p_index_b);
+}
+
+static int archive_write_data(FILE *file, const rom_entry_t **sorted, archive_index_t *index, uint32_t count,
+							  uint64_t offset)
+{
+	/* Grouped by content, each distinct ROM is written once. */
+	archive_index_t **by_data = calloc((size_t)count + 1, sizeof(archive_index_t *));
+	if (!by_data)
+	{
+		ERROR_PRINT("calloc failed.\n");
+		return -1;
+	}
+
+	for (uint32_t entry = 0; entry < count; entry++)
+	{
+		by_data[entry] = &(index[entry]);
+	}
+	qsort(by_data, count, sizeof(archive_index_t *), archive_data_compare);
+
+	static const uint8_t padding[ROM_ARCHIVE_ALIGN];
+	int result = 0;
+
+	for (uint32_t entry = 0; (entry < count) && (result == 0); entry++)
+	{
+		archive_index_t *p_index = by_data[entry];
+		const uint8_t *data = sorted[p_index - index]->data;
+
+		/* Equal hashes are compared byte for byte before sharing data. */
+		archive_index_t *p_previous = entry ? by_data[entry - 1] : NULL;
+		if (p_previous && (p_previous->hash == p_index->hash) && (p_previous->size == p_index->size) &&
+			(memcmp(sorted[p_previous - index]->data, data, p_index->size) == 0))
+		{
+			p_index->offset = p_previous->offset;
+			continue;
+		}
+
+		size_t pad = (size_t)((ROM_ARCHIVE_ALIGN - (p_index->size % ROM_ARCHIVE_ALIGN)) % ROM_ARCHIVE_ALIGN);
+		p_index->offset = offset;
+		offset += p_index->size + pad;
+
+		if ((fwrite(data, p_index->size, 1, file) != 1) || (pad && (fwrite(padding, pad, 1, file) != 1)))
+		{
+			result = -1;
+		}
+	}
+
+	free(by_data);
+
+	return result;
+}
@@ -0,0 +1,166 @@
+#ifndef ROM_H_
+#define ROM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * ROM files, and ROM archives: many ROMs packed in one file with an index of
+ * their names, hashes, sizes and quirk profiles. An archive is mapped once and
+ * its ROMs are read in place from the mapping, so loading a batch costs no file
+ * operation per ROM. ROM data is aligned to ROM_ARCHIVE_ALIGN bytes and stored
+ * once per distinct content.
+ */
+
+/* Defines */
+
+#define ROM_NAME_MAX (55) /* Longest name in an archive. */
+#define ROM_ARCHIVE_ALIGN (256)
+
+/* Quirk profile: behaviors a ROM expects that differ from those of the cpu. */
+#define ROM_QUIRK_SHIFT_VY (1u << 0)	 /* 8XY6 and 8XYE shift VY into VX. */
+#define ROM_QUIRK_LOAD_STORE_I (1u << 1) /* FX55 and FX65 leave I past the last register. */
+#define ROM_QUIRK_JUMP_VX (1u << 2)		 /* BXNN jumps to XNN plus VX. */
+#define ROM_QUIRK_VF_RESET (1u << 3)	 /* 8XY1, 8XY2 and 8XY3 clear VF. */
+#define ROM_QUIRK_DISPLAY_WAIT (1u << 4) /* DXYN waits for the next frame. */
+#define ROM_QUIRK_COUNT (5)
+
+/* Typedefs */
+
+typedef struct rom_s
+{
+	uint8_t *data;
+	size_t size;
+} rom_t;
+
+typedef struct rom_archive_s rom_archive_t;
+
+typedef struct rom_entry_s
+{
+	const char *name;
+	const uint8_t *data; /* In the archive mapping, valid until rom_archive_close. */
+	size_t size;
+	uint64_t hash; /* hash_fnv1a of the data. */
+	uint32_t quirks;
+} rom_entry_t;
+
+/* Public function declarations */
+
+/**
+ * @brief Load a ROM file in memory.
+ * 
+ * @param[out]	p_rom	ROM, data must be released with rom_free.
+ * @param[in]	path	Path of the ROM file.
+ * 
+ * @return 0 on success, -1 on error.
+ */
+int rom_load(rom_t *p_rom, const char *path);
+
+/**
+ * @brief Release ROM data.
+ * 
+ * @param[in]	p_rom	ROM.
+ */
+void rom_free(rom_t *p_rom);
+
+/**
+ * @brief Check whether a file is a ROM archive.
+ * 
+ * @param[in]	path	Path of the file.
+ * 
+ * @return 1 if it is, else 0.
+ */
+int rom_is_archive(const char *path);
+
+/**
+ * @brief Map a ROM archive.
+ * 
+ * The index is checked, the ROM data is only read when used.
+ * 
+ * @param[in]	path	Path of the archive.
+ * 
+ * @return Pointer to archive, or NULL if missing or invalid.
+ */
+rom_archive_t *rom_archive_open(const char *path);
+
+/**
+ * @brief Unmap a ROM archive, its entries are no longer valid.
+ * 
+ * @param[in]	p_archive	Pointer to archive, may be NULL.
+ */
+void rom_archive_close(rom_archive_t *p_archive);
+
+/**
+ * @brief Get the number of ROMs in an archive.
+ * 
+ * @param[in]	p_archive	Pointer to archive.
+ * 
+ * @return Number of ROMs.
+ */
+uint32_t rom_archive_count(const rom_archive_t *p_archive);
+
+/**
+ * @brief Get a ROM of an archive, ROMs are ordered by name.
+ * 
+ * @param[in]	p_archive	Pointer to archive.
+ * @param[in]	index		ROM index.
+ * @param[out]	p_entry		ROM.
+ * 
+ * @return 0 on success, -1 if index is out of bound.
+ */
+int rom_archive_entry(const rom_archive_t *p_archive, uint32_t index, rom_entry_t *p_entry);
+
+/**
+ * @brief Find a ROM of an archive by name.
+ * 
+ * @param[in]	p_archive	Pointer to archive.
+ * @param[in]	name		ROM name.
+ * @param[out]	p_entry		ROM.
+ * 
+ * @return 0 on success, -1 if not found.
+ */
+int rom_archive_find(const rom_archive_t *p_archive, const char *name, rom_entry_t *p_entry);
+
+/**
+ * @brief Map the archive of a ROM named "archive.c8a:name" and find the ROM.
+ * 
+ * @param[in]	path	Archive path, ':' and ROM name.
+ * @param[out]	p_entry	ROM.
+ * 
+ * @return Pointer to archive, to close with rom_archive_close, or NULL if path names no ROM of an archive.
+ */
+rom_archive_t *rom_archive_open_entry(const char *path, rom_entry_t *p_entry);
+
+/**
+ * @brief Write a ROM archive.
+ * 
+ * Hashes are computed, the hash of the entries given is ignored.
+ * 
+ * @param[in]	path	Path of the archive, replaced atomically.
+ * @param[in]	entries	ROMs, not empty, with distinct names of at most ROM_NAME_MAX characters.
+ * @param[in]	count	Number of ROMs.
+ * 
+ * @return 0 on success, -1 on error.
+ */
+int rom_archive_write(const char *path, const rom_entry_t *entries, uint32_t count);
+
+/**
+ * @brief Parse a quirk profile.
+ * 
+ * @param[in]	text		Comma-separated quirk names (e.g. "shift-vy,jump-vx"), or "none".
+ * @param[out]	p_quirks	ROM_QUIRK_* flags.
+ * 
+ * @return 0 on success, -1 on unknown quirk.
+ */
+int rom_quirks_parse(const char *text, uint32_t *p_quirks);
+
+/**
+ * @brief Format a quirk profile, as rom_quirks_parse reads it.
+ * 
+ * @param[in]	quirks	ROM_QUIRK_* flags.
+ * @param[out]	text	Comma-separated quirk names, or "none".
+ * @param[in]	size	Size of text.
+ */
+void rom_quirks_string(uint32_t quirks, char *text, size_t size);
+
+#endif /* ROM_H_ */
@@ -0,0 +1,674 @@
+#include "sched.h"
+
+#include "cpu.h"
+#include "cpu_internal.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Defines */
+
+#define NS_PER_SECOND (1000000000ull)
+
+#define CHUNK_CYCLES (64) /* Cycles run between wait loop and halt checks. */
+#define LATE_SLICES (4)	  /* Slices further behind are dropped rather than caught up. */
+
+/* Typedefs */
+
+typedef struct worker_s worker_t;
+
+typedef struct task_s
+{
+	cpu_t *p_cpu;
+	sched_state_t state;
+	cpu_status_t status;
+
+	uint64_t deadline; /* Start of the next slice, in ns. */
+	uint64_t target;   /* Cycle count at the end of the current slice. */
+	uint64_t parked;   /* End of the slice the task parked on FX0A in, 0 if not parked. */
+
+	uint16_t keys;	  /* Held keys. */
+	uint16_t latched; /* Keys pressed since the last slice, so taps are not lost. */
+
+	size_t footprint;
+	int graphics_changed;
+	int graphics_listed; /* In its worker's changed list, until taken. */
+	uint8_t graphics[GRAPHICS_SIZE];
+} task_t;
+
+struct worker_s
+{
+	sched_t *p_sched;
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int running;
+
+	/* Timer min-heap on deadline, holds runnable and timer parked tasks. */
+	task_t **heap;
+	uint32_t heap_count;
+
+	/* Ids of tasks whose graphics changed since they were last taken. */
+	uint32_t *changed;
+	uint32_t changed_count;
+
+	sched_stats_t stats;
+};
+
+struct sched_s
+{
+	sched_config_t config;
+	uint64_t frame_ns;
+
+	worker_t *workers;
+	task_t *tasks;
+	uint32_t task_count;
+	pthread_mutex_t add_mutex;
+};
+
+/* Private function declarations */
+
+static uint64_t clock_ns(void);
+static worker_t *task_worker(sched_t *p_sched, uint32_t id);
+static void heap_push(worker_t *p_worker, task_t *p_task);
+static void list_changed(worker_t *p_worker, task_t *p_task, uint32_t id);
+static task_t *heap_pop(worker_t *p_worker);
+static void credit_cycles(cpu_t *p_cpu, uint64_t cycles);
+static sched_state_t run_slice(sched_t *p_sched, task_t *p_task, uint64_t now, cpu_status_t *p_status,
+							   sched_stats_t *p_stats);
+static void *worker_loop(void *arg);
+
+/* Public function definitions */
+
+sched_t *sched_allocate(const sched_config_t *p_config)
+{
+	if (!p_config || !p_config->capacity || !p_config->cycles_per_frame || !p_config->frame_frequency)
+	{
+		return NULL;
+	}
+
+	sched_t *p_sched = calloc(1, sizeof(struct sched_s));
+	if (!p_sched)
+	{
+		return NULL;
+	}
+
+	p_sched->config = *p_config;
+	if (!p_sched->config.workers)
+	{
+		long processors = sysconf(_SC_NPROCESSORS_ONLN);
+		p_sched->config.workers = (processors > 0) ? (uint32_t)processors : 1;
+	}
+
+	p_sched->frame_ns = NS_PER_SECOND / p_sched->config.frame_frequency;
+	(void)pthread_mutex_init(&(p_sched->add_mutex), NULL);
+
+	uint32_t workers = p_sched->config.workers;
+	uint32_t heap_size = (p_sched->config.capacity + workers - 1) / workers;
+
+	p_sched->tasks = calloc(p_sched->config.capacity, sizeof(task_t));
+	p_sched->workers = calloc(workers, sizeof(worker_t));
+	if (!p_sched->tasks || !p_sched->workers)
+	{
+		free(p_sched->tasks);
+		free(p_sched->workers);
+		free(p_sched);
+		return NULL;
+	}
+
+	pthread_condattr_t cond_attr;
+	(void)pthread_condattr_init(&cond_attr);
+	(void)pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+
+	int failed = 0;
+	for (uint32_t index = 0; index < workers; index++)
+	{
+		worker_t *p_worker = &(p_sched->workers[index]);
+
+		p_worker->p_sched = p_sched;
+		p_worker->heap = calloc(heap_size, sizeof(task_t *));
+		p_worker->changed = calloc(heap_size, sizeof(uint32_t));
+		(void)pthread_mutex_init(&(p_worker->mutex), NULL);
+		(void)pthread_cond_init(&(p_worker->cond), &cond_attr);
+
+		failed |= !p_worker->heap || !p_worker->changed;
+	}
+
+	(void)pthread_condattr_destroy(&cond_attr);
+
+	if (failed)
+	{
+		sched_free(p_sched);
+		return NULL;
+	}
+
+	return p_sched;
+}
+
+void sched_free(sched_t *p_sched)
+{
+	if (p_sched)
+	{
+		sched_stop(p_sched);
+
+		for (uint32_t index = 0; index < p_sched->config.workers; index++)
+		{
+			worker_t *p_worker = &(p_sched->workers[index]);
+
+			(void)pthread_mutex_destroy(&(p_worker->mutex));
+			(void)pthread_cond_destroy(&(p_worker->cond));
+			free(p_worker->heap);
+			free(p_worker->changed);
+		}
+
+		(void)pthread_mutex_destroy(&(p_sched->add_mutex));
+		free(p_sched->workers);
+		free(p_sched->tasks);
+		free(p_sched);
+	}
+}
+
+int sched_add(sched_t *p_sched, cpu_t *p_cpu)
+{
+	if (!p_sched || !p_cpu)
+	{
+		return -1;
+	}
+
+	(void)pthread_mutex_lock(&(p_sched->add_mutex));
+	if (p_sched->task_count >= p_sched->config.capacity)
+	{
+		(void)pthread_mutex_unlock(&(p_sched->add_mutex));
+		return -1;
+	}
+	uint32_t id = p_sched->task_count++;
+	(void)pthread_mutex_unlock(&(p_sched->add_mutex));
+
+	worker_t *p_worker = task_worker(p_sched, id);
+	task_t *p_task = &(p_sched->tasks[id]);
+
+	(void)pthread_mutex_lock(&(p_worker->mutex));
+
+	p_task->p_cpu = p_cpu;
+	p_task->state = SCHED_STATE_RUNNABLE;
+	p_task->status = CPU_OK;
+	p_task->deadline = clock_ns();
+	p_task->target = cpu_cycles(p_cpu);
+	p_task->footprint = cpu_footprint(p_cpu);
+	p_task->graphics_changed = 1;
+	(void)memcpy(p_task->graphics, cpu_graphics(p_cpu), GRAPHICS_SIZE);
+	list_changed(p_worker, p_task, id);
+
+	heap_push(p_worker, p_task);
+	(void)pthread_cond_signal(&(p_worker->cond));
+
+	(void)pthread_mutex_unlock(&(p_worker->mutex));
+
+	return (int)id;
+}
+
+int sched_start(sched_t *p_sched)
+{
+	if (!p_sched)
+	{
+		return -1;
+	}
+
+	for (uint32_t index = 0; index < p_sched->config.workers; index++)
+	{
+		worker_t *p_worker = &(p_sched->workers[index]);
+
+		if (p_worker->running)
+		{
+			continue;
+		}
+
+		p_worker->running = 1;
+		if (pthread_create(&(p_worker->thread), NULL, worker_loop, p_worker) != 0)
+		{
+			p_worker->running = 0;
+			sched_stop(p_sched);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+void sched_stop(sched_t *p_sched)
+{
+	if (!p_sched)
+	{
+		return;
+	}
+
+	for (uint32_t index = 0; index < p_sched->config.workers; index++)
+	{
+		worker_t *p_worker = &(p_sched->workers[index]);
+
+		(void)pthread_mutex_lock(&(p_worker->mutex));
+		int running = p_worker->running;
+		p_worker->running = 0;
+		(void)pthread_cond_signal(&(p_worker->cond));
+		(void)pthread_mutex_unlock(&(p_worker->mutex));
+
+		if (running)
+		{
+			(void)pthread_join(p_worker->thread, NULL);
+		}
+	}
+}
+
+void sched_press_key(sched_t *p_sched, uint32_t id, uint8_t key)
+{
+	worker_t *p_worker = task_worker(p_sched, id);
+	if (!p_worker || (key >= KEY_COUNT))
+	{
+		return;
+	}
+
+	task_t *p_task = &(p_sched->tasks[id]);
+
+	(void)pthread_mutex_lock(&(p_worker->mutex));
+
+	if (p_task->p_cpu)
+	{
+		p_task->keys |= (uint16_t)(1u << key);
+		p_task->latched |= (uint16_t)(1u << key);
+
+		/* Resume now, the parked time is credited by the next slice. */
+		if (p_task->state == SCHED_STATE_INPUT)
+		{
+			p_task->state = SCHED_STATE_RUNNABLE;
+			p_task->deadline = clock_ns();
+			heap_push(p_worker, p_task);
+			(void)pthread_cond_signal(&(p_worker->cond));
+		}
+	}
+
+	(void)pthread_mutex_unlock(&(p_worker->mutex));
+}
+
+void sched_release_key(sched_t *p_sched, uint32_t id, uint8_t key)
+{
+	worker_t *p_worker = task_worker(p_sched, id);
+	if (!p_worker || (key >= KEY_COUNT))
+	{
+		return;
+	}
+
+	(void)pthread_mutex_lock(&(p_worker->mutex));
+	p_sched->tasks[id].keys &= (uint16_t)~(1u << key);
+	(void)pthread_mutex_unlock(&(p_worker->mutex));
+}
+
+sched_state_t sched_state(sched_t *p_sched, uint32_t id, cpu_status_t *p_status)
+{
+	worker_t *p_worker = task_worker(p_sched, id);
+	if (!p_worker)
+	{
+		if (p_status)
+		{
+			*p_status = CPU_ERROR_ARGUMENT;
+		}
+		return SCHED_STATE_STOPPED;
+	}
+
+	task_t *p_task = &(p_sched->tasks[id]);
+
+	(void)pthread_mutex_lock(&(p_worker->mutex));
+	sched_state_t state = p_task->state;
+	if (p_status)
+	{
+		*p_status = p_task->status;
+	}
+	(void)pthread_mutex_unlock(&(p_worker->mutex));
+
+	return state;
+}
+
+int sched_copy_graphics(sched_t *p_sched, uint32_t id, uint8_t *graphics)
+{
+	worker_t *p_worker = task_worker(p_sched, id);
+	if (!p_worker || !graphics)
+	{
+		return -1;
+	}
+
+	task_t *p_task = &(p_sched->tasks[id]);
+
+	(void)pthread_mutex_lock(&(p_worker->mutex));
+	int changed = p_task->graphics_changed;
+	p_task->graphics_changed = 0;
+	(void)memcpy(graphics, p_task->graphics, GRAPHICS_SIZE);
+	(void)pthread_mutex_unlock(&(p_worker->mutex));
+
+	return changed;
+}
+
+uint32_t sched_take_changed(sched_t *p_sched, uint32_t *ids, uint32_t count)
+{
+	if (!p_sched || !ids)
+	{
+		return 0;
+	}
+
+	uint32_t taken = 0;
+
+	for (uint32_t index = 0; (index < p_sched->config.workers) && (taken < count); index++)
+	{
+		worker_t *p_worker = &(p_sched->workers[index]);
+
+		(void)pthread_mutex_lock(&(p_worker->mutex));
+
+		while (p_worker->changed_count && (taken < count))
+		{
+			uint32_t id = p_worker->changed[--p_worker->changed_count];
+			p_sched->tasks[id].graphics_listed = 0;
+			ids[taken++] = id;
+		}
+
+		(void)pthread_mutex_unlock(&(p_worker->mutex));
+	}
+
+	return taken;
+}
+
+void sched_stats(sched_t *p_sched, sched_stats_t *p_stats)
+{
+	if (!p_sched || !p_stats)
+	{
+		return;
+	}
+
+	(void)memset(p_stats, 0, sizeof(sched_stats_t));
+
+	(void)pthread_mutex_lock(&(p_sched->add_mutex));
+	uint32_t task_count = p_sched->task_count;
+	(void)pthread_mutex_unlock(&(p_sched->add_mutex));
+
+	for (uint32_t index = 0; index < p_sched->config.workers; index++)
+	{
+		worker_t *p_worker = &(p_sched->workers[index]);
+
+		(void)pthread_mutex_lock(&(p_worker->mutex));
+
+		p_stats->slices += p_worker->stats.slices;
+		p_stats->cycles += p_worker->stats.cycles;
+		p_stats->skipped_cycles += p_worker->stats.skipped_cycles;
+
+		for (uint32_t id = index; id < task_count; id += p_sched->config.workers)
+		{
+			p_stats->footprint += p_sched->tasks[id].footprint;
+
+			switch (p_sched->tasks[id].state)
+			{
+			case SCHED_STATE_RUNNABLE:
+				p_stats->runnable++;
+				break;
+			case SCHED_STATE_INPUT:
+				p_stats->input++;
+				break;
+			case SCHED_STATE_TIMER:
+				p_stats->timer++;
+				break;
+			default:
+				p_stats->stopped++;
+				break;
+			}
+		}
+
+		(void)pthread_mutex_unlock(&(p_worker->mutex));
+	}
+}
+
+/* Private function definitions */
+
+static uint64_t clock_ns(void)
+{
+	struct timespec now;
+	(void)clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return ((uint64_t)now.tv_sec * NS_PER_SECOND) + (uint64_t)now.tv_nsec;
+}
+
+static worker_t *task_worker(sched_t *p_sched, uint32_t id)
+{
+	if (!p_sched || (id >= p_sched->config.capacity))
+	{
+		return NULL;
+	}
+
+	return &(p_sched->workers[id % p_sched->config.workers]);
+}
+
+static void heap_push(worker_t *p_worker, task_t *p_task)
+{
+	uint32_t index = p_worker->heap_count++;
+
+	while (index > 0)
+	{
+		uint32_t parent = (index - 1) / 2;
+		if (p_worker->heap[parent]->deadline <= p_task->deadline)
+		{
+			break;
+		}
+
+		p_worker->heap[index] = p_worker->heap[parent];
+		index = parent;
+	}
+
+	p_worker->heap[index] = p_task;
+}
+
+static void list_changed(worker_t *p_worker, task_t *p_task, uint32_t id)
+{
+	/* Listed once until taken, a worker has at most its heap size of tasks. */
+	if (!p_task->graphics_listed)
+	{
+		p_task->graphics_listed = 1;
+		p_worker->changed[p_worker->changed_count++] = id;
+	}
+}
+
+static task_t *heap_pop(worker_t *p_worker)
+{
+	task_t *p_top = p_worker->heap[0];
+	task_t *p_last = p_worker->heap[--p_worker->heap_count];
+	uint32_t count = p_worker->heap_count;
+	uint32_t index = 0;
+
+	for (;;)
+	{
+		uint32_t child = (2 * index) + 1;
+		if (child >= count)
+		{
+			break;
+		}
+
+		if (((child + 1) < count) && (p_worker->heap[child + 1]->deadline < p_worker->heap[child]->deadline))
+		{
+			child++;
+		}
+
+		if (p_last->deadline <= p_worker->heap[child]->deadline)
+		{
+			break;
+		}
+
+		p_worker->heap[index] = p_worker->heap[child];
+		index = child;
+	}
+
+	if (count)
+	{
+		p_worker->heap[index] = p_last;
+	}
+
+	return p_top;
+}
+
+static void credit_cycles(cpu_t *p_cpu, uint64_t cycles)
+{
+	while (cycles)
+	{
+		uint32_t chunk = (cycles > UINT32_MAX) ? UINT32_MAX : (uint32_t)cycles;
+		cpu_idle(p_cpu, chunk);
+		cycles -= chunk;
+	}
+}
+
+static sched_state_t run_slice(sched_t *p_sched, task_t *p_task, uint64_t now, cpu_status_t *p_status,
+							   sched_stats_t *p_stats)
+{
+	cpu_t *p_cpu = p_task->p_cpu;
+	uint32_t cycles_per_frame = p_sched->config.cycles_per_frame;
+
+	if (p_task->parked)
+	{
+		/* FX0A would have spun for every slice missed while parked. */
+		uint64_t slices = (now > p_task->parked) ? ((now - p_task->parked) / p_sched->frame_ns) : 0;
+		credit_cycles(p_cpu, slices * cycles_per_frame);
+		p_stats->skipped_cycles += slices * cycles_per_frame;
+
+		p_task->target = cpu_cycles(p_cpu);
+		p_task->deadline = now;
+		p_task->parked = 0;
+	}
+
+	/* An overloaded worker slows instances down instead of bursting to catch up. */
+	if ((p_task->deadline + (LATE_SLICES * p_sched->frame_ns)) < now)
+	{
+		p_task->deadline = now;
+	}
+
+	p_task->target += cycles_per_frame;
+	p_task->deadline += p_sched->frame_ns;
+	p_stats->slices++;
+
+	uint64_t cycles;
+	while ((cycles = cpu_cycles(p_cpu)) < p_task->target)
+	{
+		uint32_t wait = cpu_wait_cycles(p_cpu);
+		if (wait)
+		{
+			if ((cycles + wait) <= p_task->target)
+			{
+				cpu_skip_wait(p_cpu, wait);
+				p_stats->skipped_cycles += wait;
+				continue;
+			}
+
+			/* Park until the slice in which the delay timer expires, it skips the loop then. */
+			uint64_t slices = (cycles + wait - p_task->target - 1) / cycles_per_frame;
+			p_task->target += slices * cycles_per_frame;
+			p_task->deadline += slices * p_sched->frame_ns;
+			return SCHED_STATE_TIMER;
+		}
+
+		uint64_t remaining = p_task->target - cycles;
+		cpu_status_t status = cpu_run_for(p_cpu, (remaining < CHUNK_CYCLES) ? (uint32_t)remaining : CHUNK_CYCLES);
+		p_stats->cycles += cpu_cycles(p_cpu) - cycles;
+
+		if (status != CPU_OK)
+		{
+			*p_status = status;
+			return SCHED_STATE_STOPPED;
+		}
+
+		/* Spinning on FX0A, park until a key is pressed. */
+		if (cpu_halted(p_cpu))
+		{
+			cycles = cpu_cycles(p_cpu);
+			credit_cycles(p_cpu, p_task->target - cycles);
+			p_stats->skipped_cycles += p_task->target - cycles;
+
+			p_task->parked = p_task->deadline;
+			return SCHED_STATE_INPUT;
+		}
+	}
+
+	return SCHED_STATE_RUNNABLE;
+}
+
+static void *worker_loop(void *arg)
+{
+	worker_t *p_worker = arg;
+	sched_t *p_sched = p_worker->p_sched;
+
+	(void)pthread_mutex_lock(&(p_worker->mutex));
+
+	while (p_worker->running)
+	{
+		if (!p_worker->heap_count)
+		{
+			(void)pthread_cond_wait(&(p_worker->cond), &(p_worker->mutex));
+			continue;
+		}
+
+		uint64_t now = clock_ns();
+		task_t *p_task = p_worker->heap[0];
+
+		if (p_task->deadline > now)
+		{
+			struct timespec until;
+			until.tv_sec = (time_t)(p_task->deadline / NS_PER_SECOND);
+			until.tv_nsec = (long)(p_task->deadline % NS_PER_SECOND);
+
+			(void)pthread_cond_timedwait(&(p_worker->cond), &(p_worker->mutex), &until);
+			continue;
+		}
+
+		(void)heap_pop(p_worker);
+		p_task->state = SCHED_STATE_RUNNABLE;
+		cpu_set_keys(p_task->p_cpu, p_task->keys | p_task->latched);
+		p_task->latched = 0;
+
+		/* The cpu is only touched by this worker, run it unlocked. */
+		sched_stats_t stats;
+		(void)memset(&stats, 0, sizeof(stats));
+		cpu_status_t status = CPU_OK;
+
+		(void)pthread_mutex_unlock(&(p_worker->mutex));
+		sched_state_t state = run_slice(p_sched, p_task, now, &status, &stats);
+		int changed = cpu_graphics_changed(p_task->p_cpu);
+		size_t footprint = cpu_footprint(p_task->p_cpu);
+		(void)pthread_mutex_lock(&(p_worker->mutex));
+
+		p_task->footprint = footprint;
+
+		if (changed)
+		{
+			(void)memcpy(p_task->graphics, cpu_graphics(p_task->p_cpu), GRAPHICS_SIZE);
+			p_task->graphics_changed = 1;
+			list_changed(p_worker, p_task, (uint32_t)(p_task - p_sched->tasks));
+		}
+
+		p_worker->stats.slices += stats.slices;
+		p_worker->stats.cycles += stats.cycles;
+		p_worker->stats.skipped_cycles += stats.skipped_cycles;
+
+		/* A key pressed while the slice ran resumes the task right away. */
+		if ((state == SCHED_STATE_INPUT) && p_task->latched)
+		{
+			state = SCHED_STATE_RUNNABLE;
+			p_task->deadline = now;
+		}
+
+		p_task->state = state;
+		p_task->status = status;
+
+		if ((p_task->state == SCHED_STATE_RUNNABLE) || (p_task->state == SCHED_STATE_TIMER))
+		{
+			heap_push(p_worker, p_task);
+		}
+	}
+
+	(void)pthread_mutex_unlock(&(p_worker->mutex));
+
+	return NULL;
+}
@@ -0,0 +1,156 @@
+#ifndef SCHED_H_
+#define SCHED_H_
+
+#include "cpu.h"
+
+#include <stdint.h>
+
+/*
+ * M:N scheduler running many cpus on a few worker threads.
+ *
+ * Each cpu is a stackless coroutine resumed for one frame slice at a time by the
+ * event loop of the worker it is assigned to. Instances halted on FX0A are parked
+ * until a key arrives, instances spinning in a delay timer wait loop are parked
+ * until the frame in which the timer expires. Parked instances cost no cpu time,
+ * the cycles they would have spun are credited when they resume.
+ */
+
+/* Typedefs */
+
+typedef struct sched_s sched_t;
+
+typedef struct sched_config_s
+{
+	uint32_t workers;		   /* Worker threads, 0 for one per online processor. */
+	uint32_t capacity;		   /* Maximum number of instances. */
+	uint32_t cycles_per_frame; /* Cycles run per slice. */
+	uint32_t frame_frequency;  /* Slices per second. */
+} sched_config_t;
+
+typedef enum sched_state_e
+{
+	SCHED_STATE_RUNNABLE = 0,
+	SCHED_STATE_INPUT,	 /* Parked on FX0A until a key is pressed. */
+	SCHED_STATE_TIMER,	 /* Parked in a delay timer wait loop. */
+	SCHED_STATE_STOPPED	 /* Stopped on a cpu error. */
+} sched_state_t;
+
+typedef struct sched_stats_s
+{
+	uint64_t slices;		 /* Slices run. */
+	uint64_t cycles;		 /* Cycles interpreted. */
+	uint64_t skipped_cycles; /* Cycles credited while parked or skipped in wait loops. */
+	uint64_t footprint;		 /* Bytes held by instances alone (cpu_footprint), as of their last slice. */
+	uint32_t runnable;
+	uint32_t input;
+	uint32_t timer;
+	uint32_t stopped;
+} sched_stats_t;
+
+/* Public function declarations */
+
+/**
+ * @brief Allocate a scheduler, workers are not started.
+ *
+ * @param[in]	p_config	Scheduler configuration.
+ *
+ * @return Pointer to scheduler, or NULL if allocation failed.
+ */
+sched_t *sched_allocate(const sched_config_t *p_config);
+
+/**
+ * @brief Stop the workers and free the scheduler, added cpus are not freed.
+ *
+ * @param[in]	p_sched	Pointer to scheduler.
+ */
+void sched_free(sched_t *p_sched);
+
+/**
+ * @brief Add a cpu, it is owned by the scheduler until sched_free.
+ *
+ * @param[in]	p_sched	Pointer to scheduler.
+ * @param[in]	p_cpu	Pointer to cpu, loaded with a ROM.
+ *
+ * @return Instance id, or -1 if the scheduler is full.
+ */
+int sched_add(sched_t *p_sched, cpu_t *p_cpu);
+
+/**
+ * @brief Start the worker threads.
+ *
+ * @param[in]	p_sched	Pointer to scheduler.
+ *
+ * @return 0 on success, -1 if a worker could not be started.
+ */
+int sched_start(sched_t *p_sched);
+
+/**
+ * @brief Stop and join the worker threads, instances keep their state.
+ *
+ * @param[in]	p_sched	Pointer to scheduler.
+ */
+void sched_stop(sched_t *p_sched);
+
+/**
+ * @brief Press a key on an instance, waking it if parked on FX0A.
+ *
+ * @param[in]	p_sched	Pointer to scheduler.
+ * @param[in]	id		Instance id.
+ * @param[in]	key		Key.
+ */
+void sched_press_key(sched_t *p_sched, uint32_t id, uint8_t key);
+
+/**
+ * @brief Release a key on an instance.
+ *
+ * @param[in]	p_sched	Pointer to scheduler.
+ * @param[in]	id		Instance id.
+ * @param[in]	key		Key.
+ */
+void sched_release_key(sched_t *p_sched, uint32_t id, uint8_t key);
+
+/**
+ * @brief Get the state of an instance.
+ *
+ * @param[in]	p_sched		Pointer to scheduler.
+ * @param[in]	id			Instance id.
+ * @param[out]	p_status	Status of the last slice, may be NULL.
+ *
+ * @return Instance state.
+ */
+sched_state_t sched_state(sched_t *p_sched, uint32_t id, cpu_status_t *p_status);
+
+/**
+ * @brief Copy the graphics of an instance as of its last slice.
+ *
+ * @param[in]	p_sched		Pointer to scheduler.
+ * @param[in]	id			Instance id.
+ * @param[out]	graphics	Output, in the cpu_graphics format.
+ *
+ * @return 1 if the graphics changed since the last copy, 0 if not, -1 on invalid id.
+ */
+int sched_copy_graphics(sched_t *p_sched, uint32_t id, uint8_t *graphics);
+
+/**
+ * @brief Take the ids of the instances whose graphics changed since they were last taken.
+ *
+ * Costs the number of ids taken plus the number of workers, not the number of
+ * instances. Ids beyond count stay pending for the next call.
+ *
+ * @param[in]	p_sched	Pointer to scheduler.
+ * @param[out]	ids		Output ids, each taken once.
+ * @param[in]	count	Size of ids.
+ *
+ * @return Number of ids taken.
+ */
+uint32_t sched_take_changed(sched_t *p_sched, uint32_t *ids, uint32_t count);
+
+/**
+ * @brief Sum the counters of all workers.
+ *
+ * @param[in]	p_sched		Pointer to scheduler.
+ * @param[out]	p_stats		Output statistics.
+ */
+void sched_stats(sched_t *p_sched, sched_stats_t *p_stats);
+
+#endif /* SCHED_H_ */
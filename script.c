@@ -0,0 +1,162 @@
+#include "script.h"
+
+#include "log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Defines */
+
+#define LINE_SIZE (256)
+
+/* Typedefs */
+
+typedef struct script_event_s
+{
+	uint64_t frame;
+	uint16_t keys;
+} script_event_t;
+
+struct script_s
+{
+	script_event_t *events;
+	uint32_t count;
+	uint64_t period; /* Frame of the last event, 0 if the script does not repeat. */
+	uint32_t next;	 /* Cursor, frames are usually asked in increasing order. */
+};
+
+/* Public function definitions */
+
+script_t *script_load(const char *path)
+{
+	if (!path)
+	{
+		return NULL;
+	}
+
+	FILE *file = fopen(path, "r");
+	if (!file)
+	{
+		ERROR_PRINT_ARGS("fopen failed (%s).\n", path);
+		return NULL;
+	}
+
+	script_t *p_script = calloc(1, sizeof(struct script_s));
+	if (!p_script)
+	{
+		ERROR_PRINT("calloc failed.\n");
+		(void)fclose(file);
+		return NULL;
+	}
+
+	uint32_t capacity = 0;
+	uint32_t line_number = 0;
+	char line[LINE_SIZE];
+
+	while (fgets(line, sizeof(line), file))
+	{
+		line_number++;
+
+		char *comment = strchr(line, '#');
+		if (comment)
+		{
+			*comment = '\0';
+		}
+
+		char *cursor = line;
+		char *end;
+
+		uint64_t frame = strtoull(cursor, &end, 0);
+		if (end == cursor)
+		{
+			/* Blank line. */
+			if (strspn(cursor, " \t\r\n") == strlen(cursor))
+			{
+				continue;
+			}
+
+			ERROR_PRINT_ARGS("Malformed script line (%s:%u).\n", path, line_number);
+			script_free(p_script);
+			(void)fclose(file);
+			return NULL;
+		}
+
+		cursor = end;
+		unsigned long keys = strtoul(cursor, &end, 0);
+		if ((end == cursor) || (keys > UINT16_MAX) || (p_script->count && (frame < p_script->events[p_script->count - 1].frame)))
+		{
+			ERROR_PRINT_ARGS("Malformed script line (%s:%u).\n", path, line_number);
+			script_free(p_script);
+			(void)fclose(file);
+			return NULL;
+		}
+
+		if (p_script->count == capacity)
+		{
+			capacity = capacity ? (capacity * 2) : 64;
+			script_event_t *events = realloc(p_script->events, capacity * sizeof(script_event_t));
+			if (!events)
+			{
+				ERROR_PRINT("realloc failed.\n");
+				script_free(p_script);
+				(void)fclose(file);
+				return NULL;
+			}
+			p_script->events = events;
+		}
+
+		p_script->events[p_script->count].frame = frame;
+		p_script->events[p_script->count].keys = (uint16_t)keys;
+		p_script->count++;
+	}
+
+	(void)fclose(file);
+
+	if (p_script->count)
+	{
+		p_script->period = p_script->events[p_script->count - 1].frame;
+	}
+
+	return p_script;
+}
+
+void script_free(script_t *p_script)
+{
+	if (p_script)
+	{
+		free(p_script->events);
+		free(p_script);
+	}
+}
+
+uint16_t script_keys(script_t *p_script, uint64_t frame)
+{
+	if (!p_script || !p_script->count)
+	{
+		return 0;
+	}
+
+	if (p_script->period)
+	{
+		frame %= p_script->period;
+	}
+
+	/* Keys before the first event are released. */
+	if (frame < p_script->events[0].frame)
+	{
+		return 0;
+	}
+
+	if ((p_script->next >= p_script->count) || (p_script->events[p_script->next].frame > frame))
+	{
+		p_script->next = 0;
+	}
+
+	while (((p_script->next + 1) < p_script->count) && (p_script->events[p_script->next + 1].frame <= frame))
+	{
+		p_script->next++;
+	}
+
+	return p_script->events[p_script->next].keys;
+}
@@ -0,0 +1,47 @@
+#ifndef SCRIPT_H_
+#define SCRIPT_H_
+
+#include <stdint.h>
+
+/*
+ * Scripted key input for headless runs.
+ *
+ * A script is a text file of "<frame> <keys>" lines, in increasing frame order:
+ * from that frame on the pressed keys are <keys>, a mask with bit n set for key n
+ * (decimal, or hexadecimal with a 0x prefix). Text after '#' is ignored. The
+ * script repeats with the period of its last frame.
+ */
+
+/* Typedefs */
+
+typedef struct script_s script_t;
+
+/* Public function declarations */
+
+/**
+ * @brief Load a key script.
+ *
+ * @param[in]	path	Path of the script file.
+ *
+ * @return Pointer to script, or NULL if the file could not be read or is malformed.
+ */
+script_t *script_load(const char *path);
+
+/**
+ * @brief Release a key script.
+ *
+ * @param[in]	p_script	Pointer to script, may be NULL.
+ */
+void script_free(script_t *p_script);
+
+/**
+ * @brief Get the keys pressed at a frame.
+ *
+ * @param[in]	p_script	Pointer to script.
+ * @param[in]	frame		Frame, in frames since start.
+ *
+ * @return Key mask, bit n set for key n.
+ */
+uint16_t script_keys(script_t *p_script, uint64_t frame);
+
+#endif /* SCRIPT_H_ */
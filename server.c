@@ -0,0 +1,474 @@
+#include "cpu.h"
+#include "log.h"
+#include "native.h"
+#include "rom.h"
+#include "server.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/* Defines */
+
+#define MAX_CLIENTS (16)
+
+#define CYCLES_PER_FRAME_DEFAULT (10) /* 600 Hz cpu, 60 Hz frames. */
+
+/* Typedefs */
+
+typedef struct options_s
+{
+	uint32_t instance_count;
+	uint32_t cycles_per_frame;
+	uint32_t seed;
+	uint32_t probe_count;
+	uint16_t probe_addresses[SERVER_MAX_PROBES];
+	const char *socket_path;
+	const char *shm_name;
+	const char *native_path;
+	const char *rom_path;
+} options_t;
+
+typedef struct server_s
+{
+	options_t options;
+	rom_t rom;
+	cpu_image_t *image; /* Shared by all instances. */
+	native_t *native;
+	cpu_t **cpus;
+	cpu_status_t *statuses;
+
+	server_shm_t *shm;
+	size_t shm_size;
+
+	uint64_t sequence;
+} server_t;
+
+/* Private variables */
+
+static volatile sig_atomic_t quit = 0;
+
+/* Private function declarations */
+
+static int parse_options(options_t *p_options, int argc, char *argv[]);
+static int parse_probes(options_t *p_options, char *list);
+static void on_signal(int signal);
+static int open_socket(const char *path);
+static int handle_request(server_t *p_server, int fd);
+static void reset_instance(server_t *p_server, uint32_t index);
+static void step_instance(server_t *p_server, uint32_t index, uint32_t frames);
+static void observe_instance(server_t *p_server, uint32_t index);
+
+/* Public function definitions */
+
+int main(int argc, char *argv[])
+{
+	server_t server;
+	(void)memset(&server, 0, sizeof(server));
+
+	if (parse_options(&(server.options), argc, argv) != 0)
+	{
+		return -1;
+	}
+
+	if (rom_load(&(server.rom), server.options.rom_path) != 0)
+	{
+		ERROR_PRINT("rom_load failed.\n");
+		return -1;
+	}
+
+	server.image = cpu_image_allocate(server.rom.data, server.rom.size);
+	if (!server.image)
+	{
+		ERROR_PRINT("cpu_image_allocate failed, ROM too large or out of memory.\n");
+		return -1;
+	}
+
+	if (server.options.native_path)
+	{
+		server.native = native_load(server.options.native_path, server.rom.data, (uint16_t)server.rom.size);
+		if (!server.native)
+		{
+			ERROR_PRINT_ARGS("native_load failed (%s), interpreting.\n", server.options.native_path);
+		}
+	}
+
+	/* Shared memory: header followed by one observation ring per instance. */
+	server.shm_size = sizeof(server_shm_t) + (server.options.instance_count * sizeof(server_instance_t));
+
+	int shm_fd = shm_open(server.options.shm_name, O_CREAT | O_RDWR | O_TRUNC, 0600);
+	if ((shm_fd < 0) || (ftruncate(shm_fd, (off_t)server.shm_size) != 0))
+	{
+		ERROR_PRINT_ARGS("shm_open failed (%s).\n", server.options.shm_name);
+		return -1;
+	}
+
+	server.shm = mmap(NULL, server.shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+	close(shm_fd);
+	if (server.shm == MAP_FAILED)
+	{
+		ERROR_PRINT("mmap failed.\n");
+		shm_unlink(server.options.shm_name);
+		return -1;
+	}
+
+	server.shm->version = SERVER_VERSION;
+	server.shm->instance_count = server.options.instance_count;
+	server.shm->ring_depth = SERVER_RING_DEPTH;
+	server.shm->probe_count = server.options.probe_count;
+	(void)memcpy(server.shm->probe_addresses, server.options.probe_addresses, sizeof(server.shm->probe_addresses));
+
+	server.cpus = calloc(server.options.instance_count, sizeof(cpu_t *));
+	server.statuses = calloc(server.options.instance_count, sizeof(cpu_status_t));
+	if (!server.cpus || !server.statuses)
+	{
+		ERROR_PRINT("calloc failed.\n");
+		return -1;
+	}
+
+	for (uint32_t index = 0; index < server.options.instance_count; index++)
+	{
+		server.cpus[index] = cpu_allocate();
+		if (!server.cpus[index])
+		{
+			ERROR_PRINT("cpu_allocate failed.\n");
+			return -1;
+		}
+
+		cpu_set_timer_period(server.cpus[index], server.options.cycles_per_frame);
+		native_attach(server.cpus[index], server.native);
+		reset_instance(&server, index);
+	}
+
+	/* Publish the segment only once it is fully initialized. */
+	atomic_thread_fence(memory_order_release);
+	server.shm->magic = SERVER_MAGIC;
+
+	int listen_fd = open_socket(server.options.socket_path);
+	if (listen_fd < 0)
+	{
+		shm_unlink(server.options.shm_name);
+		return -1;
+	}
+
+	struct sigaction action;
+	(void)memset(&action, 0, sizeof(action));
+	action.sa_handler = on_signal;
+	(void)sigaction(SIGINT, &action, NULL);
+	(void)sigaction(SIGTERM, &action, NULL);
+	(void)signal(SIGPIPE, SIG_IGN);
+
+	struct pollfd fds[1 + MAX_CLIENTS];
+	nfds_t nfds = 1;
+	fds[0].fd = listen_fd;
+	fds[0].events = POLLIN;
+
+	while (!quit)
+	{
+		if (poll(fds, nfds, -1) < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+
+			ERROR_PRINT("poll failed.\n");
+			break;
+		}
+
+		for (nfds_t n = 1; n < nfds; n++)
+		{
+			if (fds[n].revents && (handle_request(&server, fds[n].fd) != 0))
+			{
+				/* Client gone, compact the poll set. */
+				close(fds[n].fd);
+				fds[n] = fds[nfds - 1];
+				nfds--;
+				n--;
+			}
+		}
+
+		if (fds[0].revents & POLLIN)
+		{
+			int client_fd = accept(listen_fd, NULL, NULL);
+			if (client_fd >= 0)
+			{
+				if (nfds < (1 + MAX_CLIENTS))
+				{
+					fds[nfds].fd = client_fd;
+					fds[nfds].events = POLLIN;
+					fds[nfds].revents = 0;
+					nfds++;
+				}
+				else
+				{
+					close(client_fd);
+				}
+			}
+		}
+	}
+
+	for (nfds_t n = 0; n < nfds; n++)
+	{
+		close(fds[n].fd);
+	}
+
+	unlink(server.options.socket_path);
+	shm_unlink(server.options.shm_name);
+	munmap(server.shm, server.shm_size);
+
+	for (uint32_t index = 0; index < server.options.instance_count; index++)
+	{
+		cpu_free(server.cpus[index]);
+	}
+	free(server.cpus);
+	free(server.statuses);
+	native_free(server.native);
+	cpu_image_free(server.image);
+	rom_free(&(server.rom));
+
+	return 0;
+}
+
+/* Private function definitions */
+
+static int parse_options(options_t *p_options, int argc, char *argv[])
+{
+	(void)memset(p_options, 0, sizeof(options_t));
+	p_options->instance_count = 1;
+	p_options->cycles_per_frame = CYCLES_PER_FRAME_DEFAULT;
+	p_options->socket_path = "/tmp/chip8-server.sock";
+	p_options->shm_name = "/chip8-server";
+
+	int opt;
+	while ((opt = getopt(argc, argv, "n:c:r:p:s:m:N:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'n':
+			p_options->instance_count = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			p_options->cycles_per_frame = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			p_options->seed = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			if (parse_probes(p_options, optarg) != 0)
+			{
+				return -1;
+			}
+			break;
+		case 's':
+			p_options->socket_path = optarg;
+			break;
+		case 'm':
+			p_options->shm_name = optarg;
+			break;
+		case 'N':
+			p_options->native_path = optarg;
+			break;
+		default:
+			ERROR_PRINT("Invalid argument.\n");
+			return -1;
+		}
+	}
+
+	if (optind >= argc)
+	{
+		ERROR_PRINT("Missing argument.\n");
+		return -1;
+	}
+
+	if (!p_options->instance_count || !p_options->cycles_per_frame)
+	{
+		ERROR_PRINT("Invalid instance count or cycles per frame.\n");
+		return -1;
+	}
+
+	p_options->rom_path = argv[optind];
+
+	return 0;
+}
+
+static int parse_probes(options_t *p_options, char *list)
+{
+	for (char *token = strtok(list, ","); token; token = strtok(NULL, ","))
+	{
+		if (p_options->probe_count >= SERVER_MAX_PROBES)
+		{
+			ERROR_PRINT("Too many probes.\n");
+			return -1;
+		}
+
+		p_options->probe_addresses[p_options->probe_count++] = (uint16_t)strtoul(token, NULL, 0);
+	}
+
+	return 0;
+}
+
+static void on_signal(int signal)
+{
+	(void)signal;
+	quit = 1;
+}
+
+static int open_socket(const char *path)
+{
+	struct sockaddr_un address;
+	(void)memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+
+	if (strlen(path) >= sizeof(address.sun_path))
+	{
+		ERROR_PRINT_ARGS("Socket path too long (%s).\n", path);
+		return -1;
+	}
+	(void)strcpy(address.sun_path, path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+	{
+		ERROR_PRINT("socket failed.\n");
+		return -1;
+	}
+
+	unlink(path);
+	if ((bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0) || (listen(fd, MAX_CLIENTS) != 0))
+	{
+		ERROR_PRINT_ARGS("bind failed (%s).\n", path);
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static int handle_request(server_t *p_server, int fd)
+{
+	server_request_t request;
+	ssize_t received = recv(fd, &request, sizeof(request), MSG_WAITALL);
+	if (received != (ssize_t)sizeof(request))
+	{
+		return -1;
+	}
+
+	server_reply_t reply;
+	(void)memset(&reply, 0, sizeof(reply));
+
+	uint32_t count = p_server->options.instance_count;
+	int valid_range = (request.first < count) && (request.count <= (count - request.first));
+
+	switch (request.command)
+	{
+	case SERVER_COMMAND_HELLO:
+		reply.count = count;
+		break;
+	case SERVER_COMMAND_STEP:
+		if (!valid_range)
+		{
+			reply.status = -1;
+			break;
+		}
+
+		p_server->sequence++;
+		for (uint32_t index = request.first; index < (request.first + request.count); index++)
+		{
+			step_instance(p_server, index, request.frames);
+		}
+		reply.count = request.count;
+		break;
+	case SERVER_COMMAND_RESET:
+		if (!valid_range)
+		{
+			reply.status = -1;
+			break;
+		}
+
+		p_server->sequence++;
+		for (uint32_t index = request.first; index < (request.first + request.count); index++)
+		{
+			reset_instance(p_server, index);
+		}
+		reply.count = request.count;
+		break;
+	default:
+		reply.status = -1;
+		break;
+	}
+
+	reply.sequence = p_server->sequence;
+
+	return (send(fd, &reply, sizeof(reply), 0) == (ssize_t)sizeof(reply)) ? 0 : -1;
+}
+
+static void reset_instance(server_t *p_server, uint32_t index)
+{
+	cpu_t *p_cpu = p_server->cpus[index];
+
+	(void)cpu_load_image(p_cpu, p_server->image);
+	cpu_seed(p_cpu, p_server->options.seed + index);
+	p_server->statuses[index] = CPU_OK;
+
+	observe_instance(p_server, index);
+}
+
+static void step_instance(server_t *p_server, uint32_t index, uint32_t frames)
+{
+	cpu_t *p_cpu = p_server->cpus[index];
+	server_instance_t *p_instance = &(p_server->shm->instances[index]);
+
+	uint32_t keys = *(volatile uint32_t *)&(p_instance->action_keys);
+	cpu_set_keys(p_cpu, (uint16_t)keys);
+
+	/* A faulted instance stays stopped until reset. */
+	for (uint32_t frame = 0; (frame < frames) && (p_server->statuses[index] == CPU_OK); frame++)
+	{
+		p_server->statuses[index] = cpu_run_for(p_cpu, p_server->options.cycles_per_frame);
+	}
+
+	observe_instance(p_server, index);
+}
+
+static void observe_instance(server_t *p_server, uint32_t index)
+{
+	cpu_t *p_cpu = p_server->cpus[index];
+	server_instance_t *p_instance = &(p_server->shm->instances[index]);
+	server_observation_t *p_observation = &(p_instance->ring[p_instance->head % SERVER_RING_DEPTH]);
+
+	cpu_registers_t registers;
+	cpu_registers(p_cpu, &registers);
+
+	p_observation->sequence = p_server->sequence;
+	p_observation->cycles = cpu_cycles(p_cpu);
+	p_observation->status = (uint32_t)p_server->statuses[index];
+	p_observation->halted = (uint32_t)cpu_halted(p_cpu);
+	(void)memcpy(p_observation->v, registers.v, sizeof(p_observation->v));
+	p_observation->i = registers.i;
+	p_observation->pc = registers.pc;
+	p_observation->sp = registers.sp;
+	p_observation->delay = registers.delay;
+	p_observation->sound = registers.sound;
+
+	for (uint32_t probe = 0; probe < p_server->options.probe_count; probe++)
+	{
+		p_observation->probes[probe] = cpu_peek(p_cpu, p_server->options.probe_addresses[probe]);
+	}
+
+	(void)memcpy(p_observation->graphics, cpu_graphics(p_cpu), SERVER_GRAPHICS_SIZE);
+
+	/* Observation contents become visible before the new head. */
+	atomic_thread_fence(memory_order_release);
+	*(volatile uint64_t *)&(p_instance->head) = p_instance->head + 1;
+}
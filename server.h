@@ -0,0 +1,85 @@
+#ifndef SERVER_H_
+#define SERVER_H_
+
+#include <stdint.h>
+
+/*
+ * Step/observe protocol between chip8-server and external agents.
+ *
+ * Control goes through fixed size server_request_t / server_reply_t messages on a
+ * local Unix stream socket. Actions and observations never go through the socket:
+ * the agent writes key masks into the shared memory segment, sends a step request,
+ * and reads the observations the server wrote into the per-instance ring once the
+ * reply arrives.
+ */
+
+/* Defines */
+
+#define SERVER_MAGIC (0x43385350u) /* "C8SP" */
+#define SERVER_VERSION (2)
+
+#define SERVER_MAX_PROBES (16)
+#define SERVER_RING_DEPTH (4) /* Power of two. */
+
+#define SERVER_GRAPHICS_SIZE (64 * 32 / 8) /* Packed as cpu_graphics: 1 bit per pixel, MSB leftmost. */
+
+/* Typedefs */
+
+typedef enum server_command_e
+{
+	SERVER_COMMAND_HELLO = 0, /* Reply count holds the instance count. */
+	SERVER_COMMAND_STEP,	  /* Apply actions and run frames on a range of instances. */
+	SERVER_COMMAND_RESET	  /* Reload the ROM on a range of instances. */
+} server_command_t;
+
+typedef struct server_request_s
+{
+	uint32_t command; /* server_command_t */
+	uint32_t first;	  /* First instance. */
+	uint32_t count;	  /* Number of instances. */
+	uint32_t frames;  /* Frames to run per instance (STEP). */
+} server_request_t;
+
+typedef struct server_reply_s
+{
+	int32_t status; /* 0 on success, -1 on invalid request. */
+	uint32_t count;
+	uint64_t sequence; /* Sequence number of the step, observations carry it. */
+} server_reply_t;
+
+typedef struct server_observation_s
+{
+	uint64_t sequence;
+	uint64_t cycles;
+	uint32_t status; /* cpu_status_t of the last step. */
+	uint32_t halted;
+	uint8_t v[16];
+	uint16_t i;
+	uint16_t pc;
+	uint16_t sp;
+	uint8_t delay;
+	uint8_t sound;
+	uint8_t probes[SERVER_MAX_PROBES];
+	uint8_t graphics[SERVER_GRAPHICS_SIZE];
+} server_observation_t;
+
+typedef struct server_instance_s
+{
+	uint32_t action_keys; /* Written by the agent, bit n set if key n is pressed. */
+	uint32_t reserved;
+	uint64_t head; /* Number of observations written, the latest is ring[(head - 1) % depth]. */
+	server_observation_t ring[SERVER_RING_DEPTH];
+} server_instance_t;
+
+typedef struct server_shm_s
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t instance_count;
+	uint32_t ring_depth;
+	uint32_t probe_count;
+	uint16_t probe_addresses[SERVER_MAX_PROBES];
+	server_instance_t instances[];
+} server_shm_t;
+
+#endif /* SERVER_H_ */
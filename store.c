@@ -0,0 +1,726 @@
+#include "store.h"
+
+#include "cpu.h"
+#include "cpu_internal.h"
+#include "hash.h"
+#include "log.h"
+#include "page.h"
+
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Defines */
+
+#define STORE_MAGIC (0x53533843u) /* "C8SS" */
+#define STORE_VERSION (2)
+
+#define STORE_RESERVE (1ull << 36) /* Address space reserved so the mapping grows in place. */
+#define STORE_GROW (1ull << 20)
+
+#define RECORD_PAGE (1)
+#define RECORD_STATE (2)
+#define RECORD_ALIGN (8)
+
+#define INDEX_SIZE_MIN (1024) /* Power of two. */
+
+#define SNAPSHOT_PAGES (MEM_PAGE_COUNT + 1) /* Memory, then graphics. */
+#define SNAPSHOT_HASHED_SIZE (offsetof(store_snapshot_t, cycles)) /* The canonical state. */
+
+/* Typedefs */
+
+/* File layout, host byte order: header, then records appended up to header.end. */
+typedef struct store_header_s
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t end;
+	uint64_t reserved[6];
+} store_header_t;
+
+typedef struct store_record_s
+{
+	uint32_t type;
+	uint32_t size; /* Including this header and padding. */
+	uint64_t hash;
+} store_record_t;
+
+typedef struct store_page_record_s
+{
+	store_record_t record;
+	page_t page; /* Referenced in place by loaded cpus. */
+} store_page_record_t;
+
+typedef struct store_snapshot_s
+{
+	/* Canonical state, hashed and compared: the same game state reached at another cycle matches. */
+	uint64_t pages[SNAPSHOT_PAGES]; /* Page record offsets, page hashes while hashing. */
+	uint32_t rand_state;
+	uint16_t pc;
+	uint16_t sp;
+	uint16_t i;
+	uint8_t reg_v[REG_COUNT];
+	uint8_t timer_delay; /* Current values, as FX07 reads them. */
+	uint8_t timer_sound;
+	uint8_t halted_flag;
+
+	/* Bookkeeping, restored by store_load so the cpu resumes where it was put. */
+	uint64_t cycles;
+	uint64_t timer_delay_cycle;
+	uint64_t timer_sound_cycle;
+	uint32_t timer_period;
+	uint16_t opcode;
+	uint16_t keys;
+	uint8_t timer_delay_set; /* Values written at timer_*_cycle. */
+	uint8_t timer_sound_set;
+	uint8_t draw_flag;
+} store_snapshot_t;
+
+typedef struct store_state_record_s
+{
+	store_record_t record;
+	store_snapshot_t snapshot;
+} store_state_record_t;
+
+/* Open addressing hash table from record hash to record offset. */
+typedef struct index_s
+{
+	uint64_t *keys; /* 0 marks an empty slot. */
+	uint64_t *offsets;
+	uint64_t mask;
+	uint64_t count;
+} index_t;
+
+struct store_s
+{
+	int fd;
+	uint8_t *base;	 /* Start of the reserved address range, the file is mapped at its start. */
+	uint64_t mapped; /* Bytes of the file mapped. */
+	uint64_t tail;	 /* End of the records appended, published as header.end once complete. */
+	store_header_t *header;
+
+	index_t pages;
+	index_t states;
+	uint64_t page_refs;
+};
+
+/* Private function declarations */
+
+static uint64_t index_key(uint64_t hash);
+static int index_insert(index_t *p_index, uint64_t hash, uint64_t offset);
+static void index_free(index_t *p_index);
+static int store_map(store_t *p_store, uint64_t size);
+static void *store_append(store_t *p_store, uint32_t type, uint32_t size, uint64_t hash, uint64_t *p_offset);
+static int store_scan(store_t *p_store);
+static int store_page_valid(store_t *p_store, uint64_t offset, uint64_t end);
+static uint64_t page_lookup(store_t *p_store, const page_t *p_page, uint64_t *p_hash);
+static uint64_t page_add(store_t *p_store, const page_t *p_page, uint64_t hash);
+static uint64_t state_lookup(store_t *p_store, const store_snapshot_t *p_snapshot, uint64_t hash);
+static uint64_t snapshot_fill(store_t *p_store, cpu_t *p_cpu, store_snapshot_t *p_snapshot, uint64_t *hashes);
+
+/* Public function definitions */
+
+store_t *store_open(const char *path)
+{
+	if (!path)
+	{
+		return NULL;
+	}
+
+	store_t *p_store = calloc(1, sizeof(struct store_s));
+	if (!p_store)
+	{
+		return NULL;
+	}
+
+	p_store->fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (p_store->fd < 0)
+	{
+		ERROR_PRINT_ARGS("open failed (%s).\n", path);
+		free(p_store);
+		return NULL;
+	}
+
+	p_store->base = mmap(NULL, STORE_RESERVE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (p_store->base == MAP_FAILED)
+	{
+		ERROR_PRINT("mmap failed.\n");
+		close(p_store->fd);
+		free(p_store);
+		return NULL;
+	}
+
+	struct stat file_stat;
+	int created = (fstat(p_store->fd, &file_stat) == 0) && (file_stat.st_size == 0);
+	uint64_t size = created ? STORE_GROW : (uint64_t)file_stat.st_size;
+
+	if ((store_map(p_store, size) != 0) ||
+		(!created && (size < sizeof(store_header_t))))
+	{
+		ERROR_PRINT_ARGS("store_map failed (%s).\n", path);
+		(void)store_close(p_store);
+		return NULL;
+	}
+
+	p_store->header = (store_header_t *)p_store->base;
+	if (created)
+	{
+		p_store->header->magic = STORE_MAGIC;
+		p_store->header->version = STORE_VERSION;
+		p_store->header->end = sizeof(store_header_t);
+	}
+
+	if ((p_store->header->magic != STORE_MAGIC) || (p_store->header->version != STORE_VERSION) ||
+		(store_scan(p_store) != 0))
+	{
+		ERROR_PRINT_ARGS("Not a valid store (%s).\n", path);
+		p_store->header = NULL;
+		(void)store_close(p_store);
+		return NULL;
+	}
+
+	p_store->tail = p_store->header->end;
+
+	return p_store;
+}
+
+int store_close(store_t *p_store)
+{
+	if (!p_store)
+	{
+		return -1;
+	}
+
+	int result = 0;
+
+	if (p_store->header)
+	{
+		/* Drop the unused tail the mapping grew into. */
+		uint64_t end = p_store->header->end;
+		if ((msync(p_store->base, p_store->mapped, MS_SYNC) != 0) || (ftruncate(p_store->fd, (off_t)end) != 0))
+		{
+			result = -1;
+		}
+	}
+
+	(void)munmap(p_store->base, STORE_RESERVE);
+	close(p_store->fd);
+
+	index_free(&(p_store->pages));
+	index_free(&(p_store->states));
+	free(p_store);
+
+	return result;
+}
+
+uint64_t store_hash(store_t *p_store, cpu_t *p_cpu)
+{
+	if (!p_store || !p_cpu || p_cpu->xo)
+	{
+		return 0;
+	}
+
+	store_snapshot_t snapshot;
+	uint64_t hashes[SNAPSHOT_PAGES];
+
+	return snapshot_fill(p_store, p_cpu, &snapshot, hashes);
+}
+
+int store_put(store_t *p_store, cpu_t *p_cpu, uint64_t *p_hash)
+{
+	/* XO-CHIP state is not paged. */
+	if (!p_store || !p_cpu || p_cpu->xo)
+	{
+		return -1;
+	}
+
+	store_snapshot_t snapshot;
+	uint64_t hashes[SNAPSHOT_PAGES];
+	uint64_t hash = snapshot_fill(p_store, p_cpu, &snapshot, hashes);
+
+	if (p_hash)
+	{
+		*p_hash = hash;
+	}
+
+	if (state_lookup(p_store, &snapshot, hash))
+	{
+		return 0;
+	}
+
+	/* New state: store the pages not seen yet, then the state referencing them. */
+	const page_t *pages[SNAPSHOT_PAGES];
+	for (uint32_t page = 0; page < MEM_PAGE_COUNT; page++)
+	{
+		pages[page] = p_cpu->pages[page];
+	}
+	pages[MEM_PAGE_COUNT] = p_cpu->graphics;
+
+	for (uint32_t page = 0; page < SNAPSHOT_PAGES; page++)
+	{
+		/* Looked up again, the state may repeat a page added for it. */
+		if (!snapshot.pages[page])
+		{
+			snapshot.pages[page] = page_lookup(p_store, pages[page], &(hashes[page]));
+		}
+
+		if (!snapshot.pages[page])
+		{
+			snapshot.pages[page] = page_add(p_store, pages[page], hashes[page]);
+			if (!snapshot.pages[page])
+			{
+				return -1;
+			}
+		}
+	}
+
+	uint64_t offset;
+	store_state_record_t *p_record = store_append(p_store, RECORD_STATE, sizeof(store_state_record_t), hash, &offset);
+	if (!p_record)
+	{
+		return -1;
+	}
+
+	p_record->snapshot = snapshot;
+
+	/* The records become part of the file only once the end moves past them, after they are written. */
+	atomic_thread_fence(memory_order_release);
+	p_store->header->end = p_store->tail;
+
+	if (index_insert(&(p_store->states), hash, offset) != 0)
+	{
+		return -1;
+	}
+
+	p_store->page_refs += SNAPSHOT_PAGES;
+
+	return 1;
+}
+
+int store_contains(store_t *p_store, uint64_t hash)
+{
+	if (!p_store || !p_store->states.keys)
+	{
+		return 0;
+	}
+
+	uint64_t key = index_key(hash);
+	for (uint64_t slot = key & p_store->states.mask; p_store->states.keys[slot]; slot = (slot + 1) & p_store->states.mask)
+	{
+		if (p_store->states.keys[slot] == key)
+		{
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+int store_load(store_t *p_store, uint64_t hash, cpu_t *p_cpu)
+{
+	if (!p_store || !p_cpu || !p_store->states.keys)
+	{
+		return -1;
+	}
+
+	const store_state_record_t *p_record = NULL;
+
+	uint64_t key = index_key(hash);
+	for (uint64_t slot = key & p_store->states.mask; p_store->states.keys[slot]; slot = (slot + 1) & p_store->states.mask)
+	{
+		if (p_store->states.keys[slot] == key)
+		{
+			p_record = (const store_state_record_t *)(p_store->base + p_store->states.offsets[slot]);
+			break;
+		}
+	}
+
+	if (!p_record)
+	{
+		return -1;
+	}
+
+	const store_snapshot_t *p_snapshot = &(p_record->snapshot);
+
+	/* Stored states are CHIP-8 ones. */
+	free(p_cpu->xo);
+	p_cpu->xo = NULL;
+
+	/* Reference the mapped pages, pinned so they are never freed. */
+	for (uint32_t page = 0; page < SNAPSHOT_PAGES; page++)
+	{
+		store_page_record_t *p_page_record = (store_page_record_t *)(p_store->base + p_snapshot->pages[page]);
+		page_t *p_page = page_retain(&(p_page_record->page));
+
+		if (page < MEM_PAGE_COUNT)
+		{
+			page_release(p_cpu->pages[page]);
+			p_cpu->pages[page] = p_page;
+		}
+		else
+		{
+			page_release(p_cpu->graphics);
+			p_cpu->graphics = p_page;
+		}
+	}
+
+	p_cpu->timer_delay_cycle = p_snapshot->timer_delay_cycle;
+	p_cpu->timer_sound_cycle = p_snapshot->timer_sound_cycle;
+	p_cpu->cycles = p_snapshot->cycles;
+	p_cpu->idle_cycles = 0; /* Not stored, instructions are counted from the load on. */
+	p_cpu->timer_period = p_snapshot->timer_period;
+	p_cpu->rand_state = p_snapshot->rand_state;
+	p_cpu->pc = p_snapshot->pc;
+	p_cpu->sp = p_snapshot->sp;
+	p_cpu->i = p_snapshot->i;
+	p_cpu->opcode = p_snapshot->opcode;
+	p_cpu->keys = p_snapshot->keys;
+	(void)memcpy(p_cpu->reg_v, p_snapshot->reg_v, sizeof(p_cpu->reg_v));
+	p_cpu->timer_delay = p_snapshot->timer_delay_set;
+	p_cpu->timer_sound = p_snapshot->timer_sound_set;
+	p_cpu->draw_flag = p_snapshot->draw_flag;
+	p_cpu->halted_flag = p_snapshot->halted_flag;
+
+	return 0;
+}
+
+void store_stats(store_t *p_store, store_stats_t *p_stats)
+{
+	if (!p_store || !p_stats)
+	{
+		return;
+	}
+
+	p_stats->states = p_store->states.count;
+	p_stats->pages = p_store->pages.count;
+	p_stats->size = p_store->header->end;
+	p_stats->page_refs = p_store->page_refs;
+}
+
+/* Private function definitions */
+
+static uint64_t index_key(uint64_t hash)
+{
+	return hash ? hash : 1;
+}
+
+static int index_insert(index_t *p_index, uint64_t hash, uint64_t offset)
+{
+	/* Keep the load factor under one half. */
+	if (((p_index->count + 1) * 2) > (p_index->mask + 1) || !p_index->keys)
+	{
+		uint64_t size = p_index->keys ? ((p_index->mask + 1) * 2) : INDEX_SIZE_MIN;
+		index_t grown = {calloc(size, sizeof(uint64_t)), calloc(size, sizeof(uint64_t)), size - 1, 0};
+
+		if (!grown.keys || !grown.offsets)
+		{
+			index_free(&grown);
+			return -1;
+		}
+
+		for (uint64_t slot = 0; p_index->keys && (slot <= p_index->mask); slot++)
+		{
+			if (p_index->keys[slot])
+			{
+				uint64_t target = p_index->keys[slot] & grown.mask;
+				while (grown.keys[target])
+				{
+					target = (target + 1) & grown.mask;
+				}
+
+				grown.keys[target] = p_index->keys[slot];
+				grown.offsets[target] = p_index->offsets[slot];
+				grown.count++;
+			}
+		}
+
+		index_free(p_index);
+		*p_index = grown;
+	}
+
+	uint64_t key = index_key(hash);
+	uint64_t slot = key & p_index->mask;
+	while (p_index->keys[slot])
+	{
+		slot = (slot + 1) & p_index->mask;
+	}
+
+	p_index->keys[slot] = key;
+	p_index->offsets[slot] = offset;
+	p_index->count++;
+
+	return 0;
+}
+
+static void index_free(index_t *p_index)
+{
+	free(p_index->keys);
+	free(p_index->offsets);
+	(void)memset(p_index, 0, sizeof(index_t));
+}
+
+static int store_map(store_t *p_store, uint64_t size)
+{
+	/* Map whole growth steps, the file is extended sparse. */
+	size = (size + STORE_GROW - 1) & ~(STORE_GROW - 1);
+	if (size <= p_store->mapped)
+	{
+		return 0;
+	}
+
+	if ((size > STORE_RESERVE) || (ftruncate(p_store->fd, (off_t)size) != 0))
+	{
+		return -1;
+	}
+
+	void *p_map = mmap(p_store->base + p_store->mapped, size - p_store->mapped, PROT_READ | PROT_WRITE,
+					   MAP_SHARED | MAP_FIXED, p_store->fd, (off_t)p_store->mapped);
+	if (p_map == MAP_FAILED)
+	{
+		return -1;
+	}
+
+	p_store->mapped = size;
+
+	return 0;
+}
+
+static void *store_append(store_t *p_store, uint32_t type, uint32_t size, uint64_t hash, uint64_t *p_offset)
+{
+	size = (size + RECORD_ALIGN - 1) & ~(uint32_t)(RECORD_ALIGN - 1);
+
+	uint64_t offset = p_store->tail;
+	if (((offset + size) > p_store->mapped) && (store_map(p_store, 2 * (offset + size)) != 0))
+	{
+		ERROR_PRINT("store_map failed.\n");
+		return NULL;
+	}
+
+	store_record_t *p_record = (store_record_t *)(p_store->base + offset);
+	(void)memset(p_record, 0, size);
+	p_record->type = type;
+	p_record->size = size;
+	p_record->hash = hash;
+
+	/* Published by store_put once the records it appends are written. */
+	p_store->tail = offset + size;
+	*p_offset = offset;
+
+	return p_record;
+}
+
+static int store_scan(store_t *p_store)
+{
+	uint64_t end = p_store->header->end;
+	if ((end < sizeof(store_header_t)) || (end > p_store->mapped))
+	{
+		return -1;
+	}
+
+	uint64_t offset = sizeof(store_header_t);
+	while (offset < end)
+	{
+		const store_record_t *p_record = (const store_record_t *)(p_store->base + offset);
+
+		if ((p_record->size < sizeof(store_record_t)) || (p_record->size > (end - offset)) ||
+			(p_record->size % RECORD_ALIGN))
+		{
+			return -1;
+		}
+
+		index_t *p_index;
+		if ((p_record->type == RECORD_PAGE) && (p_record->size >= sizeof(store_page_record_t)))
+		{
+			p_index = &(p_store->pages);
+		}
+		else if ((p_record->type == RECORD_STATE) && (p_record->size >= sizeof(store_state_record_t)))
+		{
+			/* A state only references page records written before it. */
+			const store_snapshot_t *p_snapshot = &(((const store_state_record_t *)p_record)->snapshot);
+			for (uint32_t page = 0; page < SNAPSHOT_PAGES; page++)
+			{
+				if (!store_page_valid(p_store, p_snapshot->pages[page], offset))
+				{
+					return -1;
+				}
+			}
+
+			p_index = &(p_store->states);
+			p_store->page_refs += SNAPSHOT_PAGES;
+		}
+		else
+		{
+			return -1;
+		}
+
+		if (index_insert(p_index, p_record->hash, offset) != 0)
+		{
+			return -1;
+		}
+
+		offset += p_record->size;
+	}
+
+	return 0;
+}
+
+static int store_page_valid(store_t *p_store, uint64_t offset, uint64_t end)
+{
+	if ((offset < sizeof(store_header_t)) || (offset >= end) || ((end - offset) < sizeof(store_page_record_t)) ||
+		(offset % RECORD_ALIGN) || !p_store->pages.keys)
+	{
+		return 0;
+	}
+
+	/* Only offsets the scan indexed are record starts. */
+	const store_record_t *p_record = (const store_record_t *)(p_store->base + offset);
+	uint64_t key = index_key(p_record->hash);
+	for (uint64_t slot = key & p_store->pages.mask; p_store->pages.keys[slot]; slot = (slot + 1) & p_store->pages.mask)
+	{
+		if ((p_store->pages.keys[slot] == key) && (p_store->pages.offsets[slot] == offset))
+		{
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static uint64_t page_lookup(store_t *p_store, const page_t *p_page, uint64_t *p_hash)
+{
+	/* Pages loaded from the store carry their record. */
+	const uint8_t *p_bytes = (const uint8_t *)p_page;
+	if ((p_bytes >= p_store->base) && (p_bytes < (p_store->base + p_store->mapped)))
+	{
+		const store_page_record_t *p_record =
+			(const store_page_record_t *)(p_bytes - offsetof(store_page_record_t, page));
+
+		*p_hash = p_record->record.hash;
+		return (uint64_t)((const uint8_t *)p_record - p_store->base);
+	}
+
+	*p_hash = hash_fnv1a(p_page->data, PAGE_BYTES, HASH_SEED);
+
+	if (!p_store->pages.keys)
+	{
+		return 0;
+	}
+
+	uint64_t key = index_key(*p_hash);
+	for (uint64_t slot = key & p_store->pages.mask; p_store->pages.keys[slot]; slot = (slot + 1) & p_store->pages.mask)
+	{
+		if (p_store->pages.keys[slot] != key)
+		{
+			continue;
+		}
+
+		const store_page_record_t *p_record =
+			(const store_page_record_t *)(p_store->base + p_store->pages.offsets[slot]);
+		if (memcmp(p_record->page.data, p_page->data, PAGE_BYTES) == 0)
+		{
+			return p_store->pages.offsets[slot];
+		}
+	}
+
+	return 0;
+}
+
+static uint64_t page_add(store_t *p_store, const page_t *p_page, uint64_t hash)
+{
+	uint64_t offset;
+	store_page_record_t *p_record = store_append(p_store, RECORD_PAGE, sizeof(store_page_record_t), hash, &offset);
+	if (!p_record)
+	{
+		return 0;
+	}
+
+	atomic_init(&(p_record->page.refs), PAGE_REFS_PINNED);
+	(void)memcpy(p_record->page.data, p_page->data, PAGE_BYTES);
+
+	if (index_insert(&(p_store->pages), hash, offset) != 0)
+	{
+		return 0;
+	}
+
+	return offset;
+}
+
+static uint64_t state_lookup(store_t *p_store, const store_snapshot_t *p_snapshot, uint64_t hash)
+{
+	if (!p_store->states.keys)
+	{
+		return 0;
+	}
+
+	/* A page the store does not hold means a state it does not hold. */
+	for (uint32_t page = 0; page < SNAPSHOT_PAGES; page++)
+	{
+		if (!p_snapshot->pages[page])
+		{
+			return 0;
+		}
+	}
+
+	uint64_t key = index_key(hash);
+	for (uint64_t slot = key & p_store->states.mask; p_store->states.keys[slot]; slot = (slot + 1) & p_store->states.mask)
+	{
+		if (p_store->states.keys[slot] != key)
+		{
+			continue;
+		}
+
+		const store_state_record_t *p_record =
+			(const store_state_record_t *)(p_store->base + p_store->states.offsets[slot]);
+		if (memcmp(&(p_record->snapshot), p_snapshot, SNAPSHOT_HASHED_SIZE) == 0)
+		{
+			return p_store->states.offsets[slot];
+		}
+	}
+
+	return 0;
+}
+
+static uint64_t snapshot_fill(store_t *p_store, cpu_t *p_cpu, store_snapshot_t *p_snapshot, uint64_t *hashes)
+{
+	/* Zeroed padding keeps the snapshot bytes, and so the hash, deterministic. */
+	(void)memset(p_snapshot, 0, sizeof(store_snapshot_t));
+
+	p_snapshot->timer_delay_cycle = p_cpu->timer_delay_cycle;
+	p_snapshot->timer_sound_cycle = p_cpu->timer_sound_cycle;
+	p_snapshot->cycles = p_cpu->cycles;
+	p_snapshot->timer_period = p_cpu->timer_period;
+	p_snapshot->rand_state = p_cpu->rand_state;
+	p_snapshot->pc = p_cpu->pc;
+	p_snapshot->sp = p_cpu->sp;
+	p_snapshot->i = p_cpu->i;
+	p_snapshot->opcode = p_cpu->opcode;
+	p_snapshot->keys = p_cpu->keys;
+	(void)memcpy(p_snapshot->reg_v, p_cpu->reg_v, sizeof(p_snapshot->reg_v));
+	p_snapshot->timer_delay = cpu_timer_value(p_cpu, p_cpu->timer_delay, p_cpu->timer_delay_cycle);
+	p_snapshot->timer_sound = cpu_timer_value(p_cpu, p_cpu->timer_sound, p_cpu->timer_sound_cycle);
+	p_snapshot->timer_delay_set = p_cpu->timer_delay;
+	p_snapshot->timer_sound_set = p_cpu->timer_sound;
+	p_snapshot->draw_flag = p_cpu->draw_flag;
+	p_snapshot->halted_flag = p_cpu->halted_flag;
+
+	/* The state hash covers page contents through their hashes, not their offsets. */
+	uint64_t offsets[SNAPSHOT_PAGES];
+	for (uint32_t page = 0; page < SNAPSHOT_PAGES; page++)
+	{
+		const page_t *p_page = (page < MEM_PAGE_COUNT) ? p_cpu->pages[page] : p_cpu->graphics;
+		offsets[page] = page_lookup(p_store, p_page, &(hashes[page]));
+		p_snapshot->pages[page] = hashes[page];
+	}
+
+	uint64_t hash = hash_fnv1a(p_snapshot, SNAPSHOT_HASHED_SIZE, HASH_SEED);
+
+	(void)memcpy(p_snapshot->pages, offsets, sizeof(offsets));
+
+	return hash;
+}
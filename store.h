@@ -0,0 +1,110 @@
+#ifndef STORE_H_
+#define STORE_H_
+
+#include "cpu.h"
+
+#include <stdint.h>
+
+/*
+ * Content-addressed save-state store.
+ *
+ * States are appended to a single memory-mapped file. Memory and graphics pages
+ * are stored once per distinct content and shared by every state using them.
+ * Loading a state makes the cpu reference the mapped pages directly (they are
+ * copied on the cpu's first write, like any shared page), so the store must stay
+ * open while cpus loaded from it are in use.
+ *
+ * A store has a single writer. Indexes are kept in memory and rebuilt from the
+ * record headers when the file is opened.
+ */
+
+/* Typedefs */
+
+typedef struct store_s store_t;
+
+typedef struct store_stats_s
+{
+	uint64_t states;
+	uint64_t pages;	   /* Distinct pages. */
+	uint64_t size;	   /* Bytes of records in the file. */
+	uint64_t page_refs; /* Pages referenced by all states, deduplicated or not. */
+} store_stats_t;
+
+/* Public function declarations */
+
+/**
+ * @brief Open a store, creating the file if it does not exist.
+ *
+ * @param[in]	path	Store file path.
+ *
+ * @return Pointer to store, or NULL if the file could not be opened or is not a store.
+ */
+store_t *store_open(const char *path);
+
+/**
+ * @brief Flush and close a store.
+ *
+ * @param[in]	p_store	Pointer to store, may be NULL.
+ *
+ * @return 0 on success, -1 on write error.
+ */
+int store_close(store_t *p_store);
+
+/**
+ * @brief Compute the content hash of a cpu state, the key of stored states.
+ *
+ * Covers the canonical state: memory, display, V, I, pc, sp, the current timer
+ * values, the random state and the halt flag. The cycle count and other
+ * bookkeeping are not covered, so a state reached again later hashes the same.
+ *
+ * @param[in]	p_store	Pointer to store, used to skip hashing pages it holds.
+ * @param[in]	p_cpu	Pointer to cpu.
+ *
+ * @return State hash, 0 for a cpu in XO-CHIP mode.
+ */
+uint64_t store_hash(store_t *p_store, cpu_t *p_cpu);
+
+/**
+ * @brief Append a cpu state unless one with the same canonical state is stored.
+ *
+ * @param[in]	p_store	Pointer to store.
+ * @param[in]	p_cpu	Pointer to cpu.
+ * @param[out]	p_hash	State hash, may be NULL.
+ *
+ * @return 1 if the state was added, 0 if already stored, -1 on error or for a cpu in XO-CHIP mode.
+ */
+int store_put(store_t *p_store, cpu_t *p_cpu, uint64_t *p_hash);
+
+/**
+ * @brief Check whether a state is stored.
+ *
+ * @param[in]	p_store	Pointer to store.
+ * @param[in]	hash	State hash.
+ *
+ * @return 1 if stored, else 0.
+ */
+int store_contains(store_t *p_store, uint64_t hash);
+
+/**
+ * @brief Load a stored state on a cpu, referencing the mapped pages.
+ *
+ * The cycle count and timers are those of the first put of the state. The
+ * attached native module is kept, the cpu returns to CHIP-8 mode.
+ *
+ * @param[in]	p_store	Pointer to store.
+ * @param[in]	hash	State hash.
+ * @param[in]	p_cpu	Pointer to cpu.
+ *
+ * @return 0 on success, -1 if the state is not stored.
+ */
+int store_load(store_t *p_store, uint64_t hash, cpu_t *p_cpu);
+
+/**
+ * @brief Get store counters.
+ *
+ * @param[in]	p_store	Pointer to store.
+ * @param[out]	p_stats	Output statistics.
+ */
+void store_stats(store_t *p_store, store_stats_t *p_stats);
+
+#endif /* STORE_H_ */
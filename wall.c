@@ -0,0 +1,414 @@
+#include "wall.h"
+
+#include "cpu.h"
+#include "log.h"
+#include "sched.h"
+
+#include "SDL2/SDL.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Defines */
+
+#define TILE_WIDTH (CPU_GRAPHICS_COLS + 1)  /* Texels, with a gap column on the right. */
+#define TILE_HEIGHT (CPU_GRAPHICS_ROWS + 1) /* Texels, with a gap line below. */
+
+#define WINDOW_WIDTH_MAX (1280)
+#define WINDOW_HEIGHT_MAX (960)
+
+#define COLOR_OFF (0xFFFFFFFF)
+#define COLOR_ON (0xFF000000)
+#define COLOR_GAP (0xFF808080)
+
+/* Typedefs */
+
+struct wall_s
+{
+	sched_t *p_sched;
+	uint32_t count;
+	uint32_t columns;
+	uint32_t rows;
+
+	SDL_Window *window;
+	SDL_Renderer *renderer;
+	SDL_Texture *texture;
+
+	uint32_t *ids; /* Taken from the scheduler, count entries. */
+
+	int zoomed;
+	uint32_t zoom_id;
+	uint16_t keys; /* Held on the zoomed instance. */
+	int redraw;
+};
+
+/* Private variables */
+
+static const uint8_t mapped_keys[16] = {
+	SDL_SCANCODE_X, // 0
+	SDL_SCANCODE_1, // 1
+	SDL_SCANCODE_2, // 2
+	SDL_SCANCODE_3, // 3
+	SDL_SCANCODE_Q, // 4
+	SDL_SCANCODE_W, // 5
+	SDL_SCANCODE_E, // 6
+	SDL_SCANCODE_A, // 7
+	SDL_SCANCODE_S, // 8
+	SDL_SCANCODE_D, // 9
+	SDL_SCANCODE_Z, // 10
+	SDL_SCANCODE_C, // 11
+	SDL_SCANCODE_4, // 12
+	SDL_SCANCODE_R, // 13
+	SDL_SCANCODE_F, // 14
+	SDL_SCANCODE_V, // 15
+};
+
+/* Private function declarations */
+
+static void tile_rect(const wall_t *p_wall, uint32_t id, SDL_Rect *p_rect);
+static void tile_upload(wall_t *p_wall, uint32_t id);
+static void zoom(wall_t *p_wall, int zoomed, uint32_t id);
+static void key_event(wall_t *p_wall, int scancode, int pressed);
+static int poll_input(wall_t *p_wall);
+static void present(wall_t *p_wall);
+
+/* Public function definitions */
+
+wall_t *wall_open(sched_t *p_sched, uint32_t count)
+{
+	if (!p_sched || !count)
+	{
+		return NULL;
+	}
+
+	wall_t *p_wall = calloc(1, sizeof(struct wall_s));
+	if (!p_wall)
+	{
+		return NULL;
+	}
+
+	p_wall->p_sched = p_sched;
+	p_wall->count = count;
+
+	/* Tiles are twice as wide as high, a square grid of texels has half as many columns as rows. */
+	p_wall->columns = 1;
+	while ((2 * p_wall->columns * p_wall->columns) < count)
+	{
+		p_wall->columns++;
+	}
+	p_wall->rows = (count + p_wall->columns - 1) / p_wall->columns;
+
+	uint32_t texture_width = p_wall->columns * TILE_WIDTH;
+	uint32_t texture_height = p_wall->rows * TILE_HEIGHT;
+
+	/* Integer scale up to the window size limit, or scale down to fit it. */
+	uint32_t width = texture_width;
+	uint32_t height = texture_height;
+	uint32_t scale_x = WINDOW_WIDTH_MAX / texture_width;
+	uint32_t scale_y = WINDOW_HEIGHT_MAX / texture_height;
+	uint32_t scale = (scale_x < scale_y) ? scale_x : scale_y;
+	if (scale)
+	{
+		width *= scale;
+		height *= scale;
+	}
+	else if ((texture_width * WINDOW_HEIGHT_MAX) > (texture_height * WINDOW_WIDTH_MAX))
+	{
+		width = WINDOW_WIDTH_MAX;
+		height = (texture_height * WINDOW_WIDTH_MAX) / texture_width;
+	}
+	else
+	{
+		width = (texture_width * WINDOW_HEIGHT_MAX) / texture_height;
+		height = WINDOW_HEIGHT_MAX;
+	}
+
+	p_wall->ids = calloc(count, sizeof(uint32_t));
+	uint32_t *pixels = calloc((size_t)texture_width * texture_height, sizeof(uint32_t));
+	if (!p_wall->ids || !pixels)
+	{
+		ERROR_PRINT("calloc failed.\n");
+		free(pixels);
+		wall_close(p_wall);
+		return NULL;
+	}
+
+	if (SDL_Init(SDL_INIT_VIDEO) != 0)
+	{
+		ERROR_PRINT("SDL_Init failed.\n");
+		free(pixels);
+		wall_close(p_wall);
+		return NULL;
+	}
+
+	p_wall->window = SDL_CreateWindow("CHIP8-FLEET", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, (int)width,
+									  (int)height, SDL_WINDOW_SHOWN);
+	if (p_wall->window)
+	{
+		p_wall->renderer = SDL_CreateRenderer(p_wall->window, -1, SDL_RENDERER_SOFTWARE);
+	}
+	if (p_wall->renderer)
+	{
+		p_wall->texture = SDL_CreateTexture(p_wall->renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING,
+											(int)texture_width, (int)texture_height);
+	}
+	if (!p_wall->texture)
+	{
+		ERROR_PRINT_ARGS("Wall window or texture failed (%ux%u texels, %s).\n", texture_width, texture_height,
+						 SDL_GetError());
+		free(pixels);
+		wall_close(p_wall);
+		return NULL;
+	}
+
+	/* Gaps are uploaded once, tiles as their instances are taken from the scheduler. */
+	for (size_t index = 0; index < ((size_t)texture_width * texture_height); index++)
+	{
+		pixels[index] = COLOR_GAP;
+	}
+	(void)SDL_UpdateTexture(p_wall->texture, NULL, pixels, (int)(texture_width * sizeof(uint32_t)));
+	free(pixels);
+
+	p_wall->redraw = 1;
+
+	return p_wall;
+}
+
+void wall_close(wall_t *p_wall)
+{
+	if (p_wall)
+	{
+		if (p_wall->zoomed)
+		{
+			zoom(p_wall, 0, 0);
+		}
+
+		if (p_wall->texture)
+		{
+			SDL_DestroyTexture(p_wall->texture);
+		}
+		if (p_wall->renderer)
+		{
+			SDL_DestroyRenderer(p_wall->renderer);
+		}
+		if (p_wall->window)
+		{
+			SDL_DestroyWindow(p_wall->window);
+		}
+		SDL_Quit();
+
+		free(p_wall->ids);
+		free(p_wall);
+	}
+}
+
+int wall_frame(wall_t *p_wall)
+{
+	int quit = poll_input(p_wall);
+
+	uint32_t taken = sched_take_changed(p_wall->p_sched, p_wall->ids, p_wall->count);
+	for (uint32_t index = 0; index < taken; index++)
+	{
+		uint32_t id = p_wall->ids[index];
+		tile_upload(p_wall, id);
+
+		/* Tiles off screen are kept current for the way back to the grid. */
+		p_wall->redraw |= !p_wall->zoomed || (id == p_wall->zoom_id);
+	}
+
+	if (p_wall->redraw)
+	{
+		present(p_wall);
+		p_wall->redraw = 0;
+	}
+
+	return quit;
+}
+
+/* Private function definitions */
+
+static void tile_rect(const wall_t *p_wall, uint32_t id, SDL_Rect *p_rect)
+{
+	p_rect->x = (int)((id % p_wall->columns) * TILE_WIDTH);
+	p_rect->y = (int)((id / p_wall->columns) * TILE_HEIGHT);
+	p_rect->w = CPU_GRAPHICS_COLS;
+	p_rect->h = CPU_GRAPHICS_ROWS;
+}
+
+static void tile_upload(wall_t *p_wall, uint32_t id)
+{
+	uint8_t graphics[CPU_GRAPHICS_SIZE];
+	if (sched_copy_graphics(p_wall->p_sched, id, graphics) < 0)
+	{
+		return;
+	}
+
+	uint32_t pixels[CPU_GRAPHICS_COLS * CPU_GRAPHICS_ROWS];
+	uint32_t *p_pixel = pixels;
+	for (uint32_t index = 0; index < CPU_GRAPHICS_SIZE; index++)
+	{
+		for (int bit = 7; bit >= 0; bit--)
+		{
+			*p_pixel++ = ((graphics[index] >> bit) & 1) ? COLOR_ON : COLOR_OFF;
+		}
+	}
+
+	SDL_Rect rect;
+	tile_rect(p_wall, id, &rect);
+	(void)SDL_UpdateTexture(p_wall->texture, &rect, pixels, CPU_GRAPHICS_COLS * sizeof(uint32_t));
+}
+
+static void zoom(wall_t *p_wall, int zoomed, uint32_t id)
+{
+	/* Keys held on the instance left would stay held. */
+	for (uint8_t key = 0; key < 16; key++)
+	{
+		if (p_wall->keys & (1u << key))
+		{
+			sched_release_key(p_wall->p_sched, p_wall->zoom_id, key);
+		}
+	}
+	p_wall->keys = 0;
+
+	p_wall->zoomed = zoomed;
+	p_wall->zoom_id = id;
+	p_wall->redraw = 1;
+
+	if (p_wall->window)
+	{
+		char title[64];
+		if (zoomed)
+		{
+			(void)snprintf(title, sizeof(title), "CHIP8-FLEET instance %u", id);
+		}
+		else
+		{
+			(void)snprintf(title, sizeof(title), "CHIP8-FLEET");
+		}
+		SDL_SetWindowTitle(p_wall->window, title);
+	}
+}
+
+static void key_event(wall_t *p_wall, int scancode, int pressed)
+{
+	for (uint8_t key = 0; key < 16; key++)
+	{
+		if (mapped_keys[key] != scancode)
+		{
+			continue;
+		}
+
+		if (pressed)
+		{
+			p_wall->keys |= (uint16_t)(1u << key);
+			sched_press_key(p_wall->p_sched, p_wall->zoom_id, key);
+		}
+		else
+		{
+			p_wall->keys &= (uint16_t)~(1u << key);
+			sched_release_key(p_wall->p_sched, p_wall->zoom_id, key);
+		}
+	}
+}
+
+static int poll_input(wall_t *p_wall)
+{
+	int quit = 0;
+
+	SDL_Event event;
+	while (SDL_PollEvent(&event))
+	{
+		switch (event.type)
+		{
+		case SDL_QUIT:
+			quit = 1;
+			break;
+		case SDL_WINDOWEVENT:
+			/* Exposed or resized, the window content may be gone. */
+			p_wall->redraw = 1;
+			break;
+		case SDL_MOUSEBUTTONDOWN:
+			if (event.button.button != SDL_BUTTON_LEFT)
+			{
+				break;
+			}
+
+			if (p_wall->zoomed)
+			{
+				zoom(p_wall, 0, 0);
+			}
+			else
+			{
+				int width;
+				int height;
+				SDL_GetWindowSize(p_wall->window, &width, &height);
+
+				if ((width > 0) && (height > 0) && (event.button.x >= 0) && (event.button.y >= 0))
+				{
+					uint32_t column = (uint32_t)event.button.x * p_wall->columns / (uint32_t)width;
+					uint32_t row = (uint32_t)event.button.y * p_wall->rows / (uint32_t)height;
+					uint32_t id = (row * p_wall->columns) + column;
+
+					if ((column < p_wall->columns) && (id < p_wall->count))
+					{
+						zoom(p_wall, 1, id);
+					}
+				}
+			}
+			break;
+		case SDL_KEYDOWN:
+		case SDL_KEYUP:
+			if (!p_wall->zoomed || event.key.repeat)
+			{
+				break;
+			}
+
+			if (event.key.keysym.scancode == SDL_SCANCODE_ESCAPE)
+			{
+				if (event.type == SDL_KEYDOWN)
+				{
+					zoom(p_wall, 0, 0);
+				}
+			}
+			else
+			{
+				key_event(p_wall, event.key.keysym.scancode, event.type == SDL_KEYDOWN);
+			}
+			break;
+		}
+	}
+
+	return quit;
+}
+
+static void present(wall_t *p_wall)
+{
+	if (p_wall->zoomed)
+	{
+		SDL_Rect source;
+		tile_rect(p_wall, p_wall->zoom_id, &source);
+
+		/* Keeps the 2:1 aspect, centered. */
+		int width;
+		int height;
+		SDL_GetWindowSize(p_wall->window, &width, &height);
+
+		SDL_Rect destination;
+		destination.w = ((width / 2) < height) ? width : (height * 2);
+		destination.h = destination.w / 2;
+		destination.x = (width - destination.w) / 2;
+		destination.y = (height - destination.h) / 2;
+
+		SDL_SetRenderDrawColor(p_wall->renderer, 128, 128, 128, 255);
+		SDL_RenderClear(p_wall->renderer);
+		(void)SDL_RenderCopy(p_wall->renderer, p_wall->texture, &source, &destination);
+	}
+	else
+	{
+		(void)SDL_RenderCopy(p_wall->renderer, p_wall->texture, NULL, NULL);
+	}
+
+	SDL_RenderPresent(p_wall->renderer);
+}
@@ -0,0 +1,52 @@
+#ifndef WALL_H_
+#define WALL_H_
+
+#include "sched.h"
+
+#include <stdint.h>
+
+/*
+ * Video wall: the displays of a fleet's instances, tiled in one window.
+ *
+ * Tiles share one streaming texture, a 64x32 tile per instance in a grid about
+ * as wide as it is high. A frame uploads only the tiles of the instances that
+ * drew since the previous one (sched_take_changed) and presents only when one
+ * did, so it costs the changed tiles, not the fleet size.
+ *
+ * Clicking a tile zooms on its instance, which gets the keyboard; a click or
+ * Escape goes back to the grid.
+ */
+
+/* Typedefs */
+
+typedef struct wall_s wall_t;
+
+/* Public function declarations */
+
+/**
+ * @brief Open the wall window, SDL video must not be initialized yet.
+ *
+ * @param[in]	p_sched	Pointer to scheduler running the instances.
+ * @param[in]	count	Number of instances, ids 0 to count - 1.
+ *
+ * @return Pointer to wall, or NULL on error.
+ */
+wall_t *wall_open(sched_t *p_sched, uint32_t count);
+
+/**
+ * @brief Close the wall window, releasing the keys it holds.
+ *
+ * @param[in]	p_wall	Pointer to wall, may be NULL.
+ */
+void wall_close(wall_t *p_wall);
+
+/**
+ * @brief Handle input, upload the changed tiles and present if any.
+ *
+ * @param[in]	p_wall	Pointer to wall.
+ *
+ * @return 1 if the window was closed, else 0.
+ */
+int wall_frame(wall_t *p_wall);
+
+#endif /* WALL_H_ */
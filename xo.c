@@ -0,0 +1,822 @@
+#include "cpu.h"
+#include "cpu_internal.h"
+
+#include "log.h"
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * XO-CHIP interpreter, run by cpu_run and cpu_run_for for cpus loaded with an
+ * XO-CHIP image. Memory is flat and private to the cpu: 64 KB do not suit the
+ * copy-on-write pages, and XO-CHIP ROMs are run one at a time.
+ *
+ * Planes are packed bitmaps of 128x64 pixels whatever the resolution, a low
+ * resolution pixel is a 2x2 block, so drawing, scrolling and composing the
+ * planes work the same in both resolutions.
+ */
+
+/* Defines */
+
+#define PRINT_INSTR(str_) DEBUG_PRINT("%04x:%04x %s\n", p_cpu->pc, p_cpu->opcode, str_);
+
+#define SCROLL_HORIZONTAL (4) /* 00FB and 00FC, in pixels. */
+
+/* Private variables */
+
+static const uint8_t font_big[XO_FONT_BIG_SIZE] = {
+	0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, // 0
+	0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF, // 1
+	0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // 2
+	0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 3
+	0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03, // 4
+	0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 5
+	0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 6
+	0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18, // 7
+	0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 8
+	0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 9
+	0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+	0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+	0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+	0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+	0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+	0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  // F
+};
+
+/* Private function declarations */
+
+static cpu_status_t opcode00_handler(cpu_t *p_cpu);
+static cpu_status_t opcode05_handler(cpu_t *p_cpu);
+static cpu_status_t opcode08_handler(cpu_t *p_cpu);
+static cpu_status_t opcode13_handler(cpu_t *p_cpu);
+static cpu_status_t opcode15_handler(cpu_t *p_cpu);
+
+static void planes_clear(struct cpu_xo_s *p_xo, uint8_t mask);
+static void planes_scroll_vertical(struct cpu_xo_s *p_xo, int lines);
+static void planes_scroll_horizontal(struct cpu_xo_s *p_xo, int pixels);
+
+/* Inlined private function definitions */
+
+static inline uint16_t memory_word(const struct cpu_xo_s *p_xo, uint16_t address)
+{
+	return (uint16_t)((p_xo->memory[address] << 8) | p_xo->memory[(uint16_t)(address + 1)]);
+}
+
+/* Skips step over the whole next instruction, F000 NNNN is 4 bytes. */
+static inline void skip(cpu_t *p_cpu, int condition)
+{
+	p_cpu->pc += 2;
+	if (condition)
+	{
+		p_cpu->pc += (memory_word(p_cpu->xo, p_cpu->pc) == 0xF000) ? 4 : 2;
+	}
+}
+
+/* Stack depth is kept in sp as the CHIP-8 stack would be, for cpu_registers. */
+static inline uint32_t stack_depth(const cpu_t *p_cpu)
+{
+	return (uint32_t)(p_cpu->sp - STACK_ADDRESS) / sizeof(uint16_t);
+}
+
+/* Public function definitions */
+
+cpu_status_t xo_run(cpu_t *p_cpu)
+{
+	struct cpu_xo_s *p_xo = p_cpu->xo;
+
+	if (p_cpu->pc > (XO_MEM_SIZE - 2))
+	{
+		return CPU_ERROR_ADDRESS;
+	}
+
+	p_cpu->opcode = memory_word(p_xo, p_cpu->pc);
+
+	uint8_t x = (uint8_t)((p_cpu->opcode >> 8) & 0x0F);
+	uint8_t y = (uint8_t)((p_cpu->opcode >> 4) & 0x0F);
+	uint8_t nn = (uint8_t)p_cpu->opcode;
+	uint16_t nnn = p_cpu->opcode & (uint16_t)0x0FFF;
+
+	cpu_status_t status = CPU_OK;
+
+	switch (p_cpu->opcode >> 12)
+	{
+	case 0x0:
+		status = opcode00_handler(p_cpu);
+		break;
+	case 0x1:
+		PRINT_INSTR("JUMP");
+
+		p_cpu->pc = nnn;
+		break;
+	case 0x2:
+	{
+		PRINT_INSTR("CALL");
+
+		uint32_t depth = stack_depth(p_cpu);
+		if (depth >= STACK_DEPTH)
+		{
+			return CPU_ERROR_STACK;
+		}
+
+		p_xo->stack[depth] = p_cpu->pc;
+		p_cpu->sp += sizeof(uint16_t);
+		p_cpu->pc = nnn;
+	}
+	break;
+	case 0x3:
+		PRINT_INSTR("if(Vx==NN)");
+
+		skip(p_cpu, p_cpu->reg_v[x] == nn);
+		break;
+	case 0x4:
+		PRINT_INSTR("if(Vx!=NN)");
+
+		skip(p_cpu, p_cpu->reg_v[x] != nn);
+		break;
+	case 0x5:
+		status = opcode05_handler(p_cpu);
+		break;
+	case 0x6:
+		PRINT_INSTR("Vx=NN");
+
+		p_cpu->reg_v[x] = nn;
+		p_cpu->pc += 2;
+		break;
+	case 0x7:
+		PRINT_INSTR("Vx+=NN");
+
+		p_cpu->reg_v[x] += nn;
+		p_cpu->pc += 2;
+		break;
+	case 0x8:
+		status = opcode08_handler(p_cpu);
+		break;
+	case 0x9:
+		PRINT_INSTR("if(Vx==Vy)");
+
+		skip(p_cpu, p_cpu->reg_v[x] != p_cpu->reg_v[y]);
+		break;
+	case 0xA:
+		PRINT_INSTR("I=NNN");
+
+		p_cpu->i = nnn;
+		p_cpu->pc += 2;
+		break;
+	case 0xB:
+		PRINT_INSTR("PC=V0+NNN");
+
+		p_cpu->pc = (uint16_t)(p_cpu->reg_v[0] + nnn);
+		break;
+	case 0xC:
+		PRINT_INSTR("Vx=rand()&NN");
+
+		p_cpu->reg_v[x] = ((uint8_t)cpu_rand_next(p_cpu)) & nn;
+		p_cpu->pc += 2;
+		break;
+	case 0xD:
+		status = opcode13_handler(p_cpu);
+		break;
+	case 0xE:
+	{
+		uint8_t key = p_cpu->reg_v[x];
+		int pressed = (key < KEY_COUNT) && ((p_cpu->keys >> key) & 1);
+
+		if (nn == 0x9E)
+		{
+			PRINT_INSTR("if(key()==Vx)");
+
+			skip(p_cpu, pressed);
+		}
+		else if (nn == 0xA1)
+		{
+			PRINT_INSTR("if(key()!=Vx)");
+
+			skip(p_cpu, !pressed);
+		}
+		else
+		{
+			return CPU_ERROR_OPCODE;
+		}
+		p_cpu->keys_read_flag = 1;
+	}
+	break;
+	default:
+		status = opcode15_handler(p_cpu);
+		break;
+	}
+
+	if (status == CPU_OK)
+	{
+		p_cpu->cycles++;
+	}
+
+	return status;
+}
+
+void xo_reset(struct cpu_xo_s *p_xo, const uint8_t *memory)
+{
+	/* Flags persist, as they would on the calculator. */
+	uint8_t flags[XO_FLAG_COUNT];
+	(void)memcpy(flags, p_xo->flags, sizeof(flags));
+
+	(void)memset(p_xo, 0, sizeof(struct cpu_xo_s));
+	(void)memcpy(p_xo->memory, memory, XO_MEM_SIZE);
+	(void)memcpy(p_xo->flags, flags, sizeof(flags));
+
+	p_xo->plane_mask = 1;
+	p_xo->pitch = 64;
+}
+
+void xo_font(uint8_t *memory)
+{
+	(void)memcpy(memory + XO_FONT_BIG_ADDRESS, font_big, sizeof(font_big));
+}
+
+const uint8_t *xo_view(struct cpu_xo_s *p_xo)
+{
+	if (!p_xo->view_stale)
+	{
+		return p_xo->view;
+	}
+
+	/* Every other pixel of every other line, 16 pixels to a byte of the view. */
+	for (uint32_t row = 0; row < GRAPHICS_ROWS; row++)
+	{
+		uint32_t line = (2 * row) * XO_ROW_SIZE;
+
+		for (uint32_t column = 0; column < GRAPHICS_ROW_SIZE; column++)
+		{
+			uint32_t offset = line + (2 * column);
+			uint32_t bits = 0;
+			for (uint32_t plane = 0; plane < CPU_PLANE_COUNT; plane++)
+			{
+				bits |= (uint32_t)((p_xo->planes[plane][offset] << 8) | p_xo->planes[plane][offset + 1]);
+			}
+
+			p_xo->view[(row * GRAPHICS_ROW_SIZE) + column] = xo_pixels_halve(bits);
+		}
+	}
+
+	p_xo->view_stale = 0;
+
+	return p_xo->view;
+}
+
+void xo_compose(const uint8_t *const *planes, const uint32_t *palette, uint32_t *pixels)
+{
+	static const uint8_t zero[XO_PLANE_SIZE];
+	const uint8_t *p0 = planes[0] ? planes[0] : zero;
+	const uint8_t *p1 = planes[1] ? planes[1] : zero;
+	const uint8_t *p2 = planes[2] ? planes[2] : zero;
+	const uint8_t *p3 = planes[3] ? planes[3] : zero;
+
+	/*
+	 * Eight pixels at a time: each plane byte is spread to one bit per nibble,
+	 * the four planes stacked give the eight palette indices in a word.
+	 */
+	for (uint32_t offset = 0; offset < XO_PLANE_SIZE; offset++)
+	{
+		uint32_t *out = pixels + (8 * offset);
+
+		if (!(p0[offset] | p1[offset] | p2[offset] | p3[offset]))
+		{
+			for (uint32_t pixel = 0; pixel < 8; pixel++)
+			{
+				out[pixel] = palette[0];
+			}
+			continue;
+		}
+
+		uint32_t indices = xo_nibbles_spread(p0[offset]) | (xo_nibbles_spread(p1[offset]) << 1) |
+						   (xo_nibbles_spread(p2[offset]) << 2) | (xo_nibbles_spread(p3[offset]) << 3);
+
+		for (uint32_t pixel = 0; pixel < 8; pixel++)
+		{
+			out[pixel] = palette[(indices >> (28 - (4 * pixel))) & 0x0F];
+		}
+	}
+}
+
+/* Private function definitions */
+
+/* 00CN	Display	scroll down N lines. */
+/* 00DN	Display	scroll up N lines. */
+/* 00E0	Display	Clears the selected planes. */
+/* 00EE	Flow	Returns from a subroutine. */
+/* 00FB	Display	scroll right 4 pixels. */
+/* 00FC	Display	scroll left 4 pixels. */
+/* 00FD	Flow	exit, pc stays on it. */
+/* 00FE	Display	low resolution, clears the planes. */
+/* 00FF	Display	high resolution, clears the planes. */
+static cpu_status_t opcode00_handler(cpu_t *p_cpu)
+{
+	struct cpu_xo_s *p_xo = p_cpu->xo;
+	int scale = p_xo->hires ? 1 : 2;
+	uint8_t n = (uint8_t)(p_cpu->opcode & 0x0F);
+
+	if ((p_cpu->opcode & 0xFFF0) == 0x00C0)
+	{
+		PRINT_INSTR("scroll_down(N)");
+
+		planes_scroll_vertical(p_xo, n * scale);
+	}
+	else if ((p_cpu->opcode & 0xFFF0) == 0x00D0)
+	{
+		PRINT_INSTR("scroll_up(N)");
+
+		planes_scroll_vertical(p_xo, -(n * scale));
+	}
+	else
+	{
+		switch (p_cpu->opcode)
+		{
+		case 0x00E0:
+			PRINT_INSTR("CLR");
+
+			planes_clear(p_xo, p_xo->plane_mask);
+			break;
+		case 0x00EE:
+		{
+			PRINT_INSTR("RETURN");
+
+			uint32_t depth = stack_depth(p_cpu);
+			if (!depth)
+			{
+				return CPU_ERROR_STACK;
+			}
+
+			p_cpu->sp -= sizeof(uint16_t);
+			p_cpu->pc = p_xo->stack[depth - 1] + 2;
+			return CPU_OK;
+		}
+		case 0x00FB:
+			PRINT_INSTR("scroll_right()");
+
+			planes_scroll_horizontal(p_xo, SCROLL_HORIZONTAL * scale);
+			break;
+		case 0x00FC:
+			PRINT_INSTR("scroll_left()");
+
+			planes_scroll_horizontal(p_xo, -(SCROLL_HORIZONTAL * scale));
+			break;
+		case 0x00FD:
+			PRINT_INSTR("exit()");
+
+			return CPU_OK;
+		case 0x00FE:
+		case 0x00FF:
+			PRINT_INSTR("resolution()");
+
+			p_xo->hires = (p_cpu->opcode == 0x00FF);
+			planes_clear(p_xo, (1u << CPU_PLANE_COUNT) - 1);
+			break;
+		default:
+			PRINT_INSTR("UNHANDLED OPCODE");
+			return CPU_ERROR_OPCODE;
+		}
+	}
+
+	p_cpu->draw_flag = 1;
+	p_cpu->pc += 2;
+
+	return CPU_OK;
+}
+
+/* 5XY0	Cond	if(Vx!=Vy)	Skips the next instruction if VX equals VY. */
+/* 5XY2	MEM	save(Vx..Vy)	Stores VX to VY, in either order, from I. I is unchanged. */
+/* 5XY3	MEM	load(Vx..Vy)	Loads VX to VY, in either order, from I. I is unchanged. */
+static cpu_status_t opcode05_handler(cpu_t *p_cpu)
+{
+	struct cpu_xo_s *p_xo = p_cpu->xo;
+	uint8_t x = (uint8_t)((p_cpu->opcode >> 8) & 0x0F);
+	uint8_t y = (uint8_t)((p_cpu->opcode >> 4) & 0x0F);
+	int step = (x <= y) ? 1 : -1;
+	uint8_t count = (uint8_t)(((x <= y) ? (y - x) : (x - y)) + 1);
+
+	switch (p_cpu->opcode & 0x0F)
+	{
+	case 0x0:
+		PRINT_INSTR("if(Vx!=Vy)");
+
+		skip(p_cpu, p_cpu->reg_v[x] == p_cpu->reg_v[y]);
+		return CPU_OK;
+	case 0x2:
+		PRINT_INSTR("save(Vx..Vy)");
+
+		for (uint8_t offset = 0; offset < count; offset++)
+		{
+			p_xo->memory[(uint16_t)(p_cpu->i + offset)] = p_cpu->reg_v[x + (step * offset)];
+		}
+		break;
+	case 0x3:
+		PRINT_INSTR("load(Vx..Vy)");
+
+		for (uint8_t offset = 0; offset < count; offset++)
+		{
+			p_cpu->reg_v[x + (step * offset)] = p_xo->memory[(uint16_t)(p_cpu->i + offset)];
+		}
+		break;
+	default:
+		PRINT_INSTR("UNHANDLED OPCODE");
+		return CPU_ERROR_OPCODE;
+	}
+
+	p_cpu->pc += 2;
+
+	return CPU_OK;
+}
+
+/* 8XYN	as CHIP-8, but 8XY6 and 8XYE shift VY into VX, and VF is written after VX. */
+static cpu_status_t opcode08_handler(cpu_t *p_cpu)
+{
+	uint8_t x = (uint8_t)((p_cpu->opcode >> 8) & 0x0F);
+	uint8_t y = (uint8_t)((p_cpu->opcode >> 4) & 0x0F);
+	uint8_t vx = p_cpu->reg_v[x];
+	uint8_t vy = p_cpu->reg_v[y];
+	uint8_t flag;
+
+	switch (p_cpu->opcode & 0x0F)
+	{
+	case 0x0:
+		PRINT_INSTR("Vx=Vy");
+
+		p_cpu->reg_v[x] = vy;
+		break;
+	case 0x1:
+		PRINT_INSTR("Vx|=Vy");
+
+		p_cpu->reg_v[x] = vx | vy;
+		break;
+	case 0x2:
+		PRINT_INSTR("Vx&=Vy");
+
+		p_cpu->reg_v[x] = vx & vy;
+		break;
+	case 0x3:
+		PRINT_INSTR("Vx^=Vy");
+
+		p_cpu->reg_v[x] = vx ^ vy;
+		break;
+	case 0x4:
+		PRINT_INSTR("Vx+=Vy");
+
+		flag = (uint8_t)(((uint16_t)vx + vy) >> 8);
+		p_cpu->reg_v[x] = (uint8_t)(vx + vy);
+		p_cpu->reg_v[0xF] = flag;
+		break;
+	case 0x5:
+		PRINT_INSTR("Vx-=Vy");
+
+		flag = (uint8_t)(vx >= vy);
+		p_cpu->reg_v[x] = (uint8_t)(vx - vy);
+		p_cpu->reg_v[0xF] = flag;
+		break;
+	case 0x6:
+		PRINT_INSTR("Vx=Vy>>1");
+
+		flag = vy & (uint8_t)0x01;
+		p_cpu->reg_v[x] = vy >> 1;
+		p_cpu->reg_v[0xF] = flag;
+		break;
+	case 0x7:
+		PRINT_INSTR("Vx=Vy-Vx");
+
+		flag = (uint8_t)(vy >= vx);
+		p_cpu->reg_v[x] = (uint8_t)(vy - vx);
+		p_cpu->reg_v[0xF] = flag;
+		break;
+	case 0xE:
+		PRINT_INSTR("Vx=Vy<<1");
+
+		flag = vy >> 7;
+		p_cpu->reg_v[x] = (uint8_t)(vy << 1);
+		p_cpu->reg_v[0xF] = flag;
+		break;
+	default:
+		PRINT_INSTR("UNHANDLED OPCODE");
+		return CPU_ERROR_OPCODE;
+	}
+
+	p_cpu->pc += 2;
+
+	return CPU_OK;
+}
+
+/* DXYN	Disp	draw(Vx,Vy,N)	Draws an 8xN sprite, 16x16 for N = 0, on each selected plane.
+    Planes read their sprite data one after the other from I. Sprites wrap around the screen.
+    VF is set to 1 if any pixel of any plane is flipped from set to unset. */
+static cpu_status_t opcode13_handler(cpu_t *p_cpu)
+{
+	PRINT_INSTR("draw(Vx,Vy,N)");
+
+	struct cpu_xo_s *p_xo = p_cpu->xo;
+	uint8_t n = (uint8_t)(p_cpu->opcode & 0x0F);
+	uint32_t scale = p_xo->hires ? 1 : 2;
+	uint32_t height = n ? n : 16;
+	uint32_t width_bytes = n ? 1 : 2;
+
+	/* In plane pixels. */
+	uint32_t column = (p_cpu->reg_v[(p_cpu->opcode >> 8) & 0x0F] % (XO_COLS / scale)) * scale;
+	uint32_t row = (p_cpu->reg_v[(p_cpu->opcode >> 4) & 0x0F] % (XO_ROWS / scale)) * scale;
+	uint32_t shift = column % 8;
+	uint32_t first_byte = column / 8;
+
+	uint16_t address = p_cpu->i;
+	uint8_t collision = 0;
+
+	for (uint32_t plane = 0; plane < CPU_PLANE_COUNT; plane++)
+	{
+		if (!(p_xo->plane_mask & (1u << plane)))
+		{
+			continue;
+		}
+
+		for (uint32_t line = 0; line < height; line++)
+		{
+			uint16_t sprite = (uint16_t)(p_xo->memory[address] << 8);
+			if (width_bytes == 2)
+			{
+				sprite |= p_xo->memory[(uint16_t)(address + 1)];
+			}
+			address = (uint16_t)(address + width_bytes);
+
+			if (!sprite)
+			{
+				continue;
+			}
+
+			/* Left aligned in 32 bits, then in the 5 bytes of the row it may straddle. */
+			uint32_t bits = (scale == 2) ? xo_pixels_double(sprite) : ((uint32_t)sprite << 16);
+			uint64_t span = ((uint64_t)bits << 8) >> shift;
+
+			for (uint32_t repeat = 0; repeat < scale; repeat++)
+			{
+				uint32_t y = ((row + (line * scale) + repeat) % XO_ROWS) * XO_ROW_SIZE;
+				uint8_t *pixels = p_xo->planes[plane] + y;
+
+				for (uint32_t index = 0; index < 5; index++)
+				{
+					uint8_t byte = (uint8_t)(span >> (32 - (8 * index)));
+					uint8_t *p_pixels = &(pixels[(first_byte + index) % XO_ROW_SIZE]);
+
+					collision |= *p_pixels & byte;
+					*p_pixels ^= byte;
+				}
+			}
+		}
+	}
+
+	p_cpu->reg_v[0xF] = collision ? 1 : 0;
+	p_cpu->draw_flag = 1;
+	p_xo->view_stale = 1;
+	p_cpu->pc += 2;
+
+	return CPU_OK;
+}
+
+/*
+F000 NNNN	MEM	I=NNNN	Loads I from the next word, the instruction is 4 bytes.
+FN01	Display	planes(N)	Selects the planes 00E0, DXYN and scrolls apply to.
+F002	Sound	pattern(I)	Loads the 16-byte audio pattern from I.
+FX07, FX0A, FX15, FX18, FX1E, FX29, FX33	as CHIP-8.
+FX30	MEM	I=big_sprite_addr[Vx]	Sets I to the 8x10 character in VX.
+FX3A	Sound	pitch(Vx)	Sets the audio pattern pitch.
+FX55	MEM	reg_dump(Vx,&I)	Stores V0 to VX from I, then adds X + 1 to I.
+FX65	MEM	reg_load(Vx,&I)	Loads V0 to VX from I, then adds X + 1 to I.
+FX75	MEM	save_flags(Vx)	Stores V0 to VX in the flags.
+FX85	MEM	load_flags(Vx)	Loads V0 to VX from the flags.
+*/
+static cpu_status_t opcode15_handler(cpu_t *p_cpu)
+{
+	struct cpu_xo_s *p_xo = p_cpu->xo;
+	uint8_t x = (uint8_t)((p_cpu->opcode >> 8) & 0x0F);
+
+	switch ((uint8_t)p_cpu->opcode)
+	{
+	case 0x00:
+		if (x)
+		{
+			PRINT_INSTR("UNHANDLED OPCODE");
+			return CPU_ERROR_OPCODE;
+		}
+
+		PRINT_INSTR("I=NNNN");
+
+		p_cpu->i = memory_word(p_xo, (uint16_t)(p_cpu->pc + 2));
+		p_cpu->pc += 2;
+		break;
+	case 0x01:
+		PRINT_INSTR("planes(N)");
+
+		p_xo->plane_mask = x;
+		break;
+	case 0x02:
+		if (x)
+		{
+			PRINT_INSTR("UNHANDLED OPCODE");
+			return CPU_ERROR_OPCODE;
+		}
+
+		PRINT_INSTR("pattern(I)");
+
+		for (uint32_t offset = 0; offset < CPU_AUDIO_PATTERN_SIZE; offset++)
+		{
+			p_xo->pattern[offset] = p_xo->memory[(uint16_t)(p_cpu->i + offset)];
+		}
+		p_xo->pattern_loaded = 1;
+		break;
+	case 0x07:
+		PRINT_INSTR("Vx=get_delay()");
+
+		p_cpu->reg_v[x] = cpu_timer_value(p_cpu, p_cpu->timer_delay, p_cpu->timer_delay_cycle);
+		break;
+	case 0x0A:
+		PRINT_INSTR("Vx=get_key()");
+
+		p_cpu->keys_read_flag = 1;
+		p_cpu->halted_flag = 1;
+		for (uint8_t key = 0; key < KEY_COUNT; key++)
+		{
+			if ((p_cpu->keys >> key) & 1)
+			{
+				p_cpu->halted_flag = 0;
+				p_cpu->reg_v[x] = key;
+				break;
+			}
+		}
+
+		if (p_cpu->halted_flag)
+		{
+			p_cpu->idle_cycles++;
+			return CPU_OK;
+		}
+		break;
+	case 0x15:
+		PRINT_INSTR("delay_timer(Vx)");
+
+		p_cpu->timer_delay = p_cpu->reg_v[x];
+		p_cpu->timer_delay_cycle = p_cpu->cycles;
+		break;
+	case 0x18:
+		PRINT_INSTR("sound_timer(Vx)");
+
+		p_cpu->timer_sound = p_cpu->reg_v[x];
+		p_cpu->timer_sound_cycle = p_cpu->cycles;
+		break;
+	case 0x1E:
+		PRINT_INSTR("I+=Vx");
+
+		p_cpu->i += p_cpu->reg_v[x];
+		break;
+	case 0x29:
+		PRINT_INSTR("I=sprite_addr[Vx]");
+
+		p_cpu->i = FONT_ADDRESS + ((p_cpu->reg_v[x] & 0x0F) * FONT_CHAR_SIZE);
+		break;
+	case 0x30:
+		PRINT_INSTR("I=big_sprite_addr[Vx]");
+
+		p_cpu->i = XO_FONT_BIG_ADDRESS + ((p_cpu->reg_v[x] & 0x0F) * XO_FONT_BIG_CHAR_SIZE);
+		break;
+	case 0x33:
+	{
+		PRINT_INSTR("BCD(Vx)");
+
+		uint8_t vx = p_cpu->reg_v[x];
+		p_xo->memory[p_cpu->i] = vx / 100;
+		p_xo->memory[(uint16_t)(p_cpu->i + 1)] = (vx / 10) % 10;
+		p_xo->memory[(uint16_t)(p_cpu->i + 2)] = vx % 10;
+	}
+	break;
+	case 0x3A:
+		PRINT_INSTR("pitch(Vx)");
+
+		p_xo->pitch = p_cpu->reg_v[x];
+		break;
+	case 0x55:
+		PRINT_INSTR("reg_dump(Vx,&I)");
+
+		for (uint8_t reg = 0; reg <= x; reg++)
+		{
+			p_xo->memory[(uint16_t)(p_cpu->i + reg)] = p_cpu->reg_v[reg];
+		}
+		p_cpu->i += x + 1;
+		break;
+	case 0x65:
+		PRINT_INSTR("reg_load(Vx,&I)");
+
+		for (uint8_t reg = 0; reg <= x; reg++)
+		{
+			p_cpu->reg_v[reg] = p_xo->memory[(uint16_t)(p_cpu->i + reg)];
+		}
+		p_cpu->i += x + 1;
+		break;
+	case 0x75:
+		PRINT_INSTR("save_flags(Vx)");
+
+		(void)memcpy(p_xo->flags, p_cpu->reg_v, x + 1u);
+		break;
+	case 0x85:
+		PRINT_INSTR("load_flags(Vx)");
+
+		(void)memcpy(p_cpu->reg_v, p_xo->flags, x + 1u);
+		break;
+	default:
+		PRINT_INSTR("UNHANDLED OPCODE");
+		return CPU_ERROR_OPCODE;
+	}
+
+	p_cpu->pc += 2;
+
+	return CPU_OK;
+}
+
+static void planes_clear(struct cpu_xo_s *p_xo, uint8_t mask)
+{
+	for (uint32_t plane = 0; plane < CPU_PLANE_COUNT; plane++)
+	{
+		if (mask & (1u << plane))
+		{
+			(void)memset(p_xo->planes[plane], 0, XO_PLANE_SIZE);
+		}
+	}
+
+	p_xo->view_stale = 1;
+}
+
+/* Positive lines scroll down. Lines scrolled in are blank. */
+static void planes_scroll_vertical(struct cpu_xo_s *p_xo, int lines)
+{
+	uint32_t count = (uint32_t)((lines < 0) ? -lines : lines);
+	if (count > XO_ROWS)
+	{
+		count = XO_ROWS;
+	}
+	uint32_t bytes = count * XO_ROW_SIZE;
+
+	for (uint32_t plane = 0; plane < CPU_PLANE_COUNT; plane++)
+	{
+		if (!(p_xo->plane_mask & (1u << plane)))
+		{
+			continue;
+		}
+
+		uint8_t *pixels = p_xo->planes[plane];
+		if (lines > 0)
+		{
+			(void)memmove(pixels + bytes, pixels, XO_PLANE_SIZE - bytes);
+			(void)memset(pixels, 0, bytes);
+		}
+		else
+		{
+			(void)memmove(pixels, pixels + bytes, XO_PLANE_SIZE - bytes);
+			(void)memset(pixels + XO_PLANE_SIZE - bytes, 0, bytes);
+		}
+	}
+
+	p_xo->view_stale = 1;
+}
+
+/* Positive pixels scroll right, by 4 or 8. Pixels scrolled in are blank. */
+static void planes_scroll_horizontal(struct cpu_xo_s *p_xo, int pixels)
+{
+	uint32_t bytes = (uint32_t)((pixels < 0) ? -pixels : pixels) / 8;
+	uint32_t bits = (uint32_t)((pixels < 0) ? -pixels : pixels) % 8;
+
+	for (uint32_t plane = 0; plane < CPU_PLANE_COUNT; plane++)
+	{
+		if (!(p_xo->plane_mask & (1u << plane)))
+		{
+			continue;
+		}
+
+		for (uint32_t y = 0; y < XO_ROWS; y++)
+		{
+			uint8_t *row = p_xo->planes[plane] + (y * XO_ROW_SIZE);
+
+			/* Each byte takes the bits of the one or two bytes it scrolls from. */
+			if (pixels > 0)
+			{
+				for (int index = XO_ROW_SIZE - 1; index >= 0; index--)
+				{
+					int from = index - (int)bytes;
+					uint8_t high = (from >= 0) ? row[from] : 0;
+					uint8_t low = (from >= 1) ? row[from - 1] : 0;
+					row[index] = bits ? (uint8_t)((high >> bits) | (low << (8 - bits))) : high;
+				}
+			}
+			else
+			{
+				for (int index = 0; index < XO_ROW_SIZE; index++)
+				{
+					int from = index + (int)bytes;
+					uint8_t high = (from < XO_ROW_SIZE) ? row[from] : 0;
+					uint8_t low = ((from + 1) < XO_ROW_SIZE) ? row[from + 1] : 0;
+					row[index] = bits ? (uint8_t)((high << bits) | (low >> (8 - bits))) : high;
+				}
+			}
+		}
+	}
+
+	p_xo->view_stale = 1;
+}